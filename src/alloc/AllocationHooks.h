@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// C interface of the pkcs11_alloc_tracker interposer (src/alloc/AllocationInterposer.cpp), looked up with dlsym by
+// AllocationTracker so that pkcs11_hsm does not depend on it
+
+extern "C" {
+
+/**
+ * Allocations attributed to one PKCS#11 function, over all its calls and threads
+ */
+struct Pkcs11AllocSite {
+  // name given to pkcs11_alloc_enter, e.g. "C_Encrypt"
+  const char* function;
+  std::uint64_t calls;
+  // malloc, calloc, realloc and aligned allocations made during the calls, requested bytes
+  std::uint64_t allocations;
+  std::uint64_t allocatedBytes;
+  // blocks freed during the calls, whoever allocated them
+  std::uint64_t frees;
+  std::uint64_t freedBytes;
+  // blocks allocated during the calls and not freed yet, by any thread at any time
+  std::uint64_t outstandingBlocks;
+  std::uint64_t outstandingBytes;
+  // allocations left out of the outstanding counts because the pointer table was full
+  std::uint64_t untracked;
+};
+
+/**
+ * Attributes the allocations and frees of the calling thread to iFunction until the matching pkcs11_alloc_leave.
+ * Calls nest, the innermost one gets the allocations.
+ * @param iFunction - name kept by pointer, it must outlive the interposer (a string literal)
+ * @return 0 if the site table is full and the call is not attributed, 1 otherwise
+ */
+int pkcs11_alloc_enter(const char* iFunction);
+
+void pkcs11_alloc_leave(void);
+
+/**
+ * @param oSites - filled with up to iMax sites, in the order they were first entered
+ * @return the number of sites, possibly more than iMax
+ */
+std::size_t pkcs11_alloc_sites(Pkcs11AllocSite* oSites, std::size_t iMax);
+}
@@ -0,0 +1,372 @@
+#include "alloc/AllocationHooks.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+// malloc interposer attributing heap allocations to the PKCS#11 call running on the thread. Preloaded with
+// LD_PRELOAD=libpkcs11_alloc_tracker.so or linked into the executable, it replaces malloc, free, calloc, realloc,
+// memalign, posix_memalign and aligned_alloc by the glibc ones plus accounting:
+//
+//   - between pkcs11_alloc_enter and pkcs11_alloc_leave (AllocationTracker calls them around every observedCall)
+//     allocations and frees are counted for the function entered;
+//   - the blocks allocated there are kept in a pointer table with their size and function, so that freeing them
+//     later, from any thread, takes them off the outstanding bytes of that function.
+//
+// Outside of a call the cost is a thread-local read, plus a table lookup on free while blocks are tracked. Nothing
+// here allocates: the tables are static or mmap-ed.
+
+extern "C" {
+void* __libc_malloc(std::size_t iSize);
+void __libc_free(void* iPtr);
+void* __libc_calloc(std::size_t iCount, std::size_t iSize);
+void* __libc_realloc(void* iPtr, std::size_t iSize);
+void* __libc_memalign(std::size_t iAlignment, std::size_t iSize);
+}
+
+namespace {
+
+class SpinLock {
+ public:
+  void lock() {
+    for (unsigned aSpins = 0u; mFlag.test_and_set(std::memory_order_acquire); ++aSpins) {
+      // the holder may be descheduled, spinning longer only burns its time slice
+      if (aSpins >= 64u) {
+        sched_yield();
+      }
+    }
+  }
+  void unlock() { mFlag.clear(std::memory_order_release); }
+
+ private:
+  std::atomic_flag mFlag = ATOMIC_FLAG_INIT;
+};
+
+struct SpinGuard {
+  explicit SpinGuard(SpinLock& iLock) : lock(iLock) { lock.lock(); }
+  ~SpinGuard() { lock.unlock(); }
+  SpinLock& lock;
+};
+
+struct Site {
+  std::atomic<const char*> function{ nullptr };
+  std::atomic<std::uint64_t> calls{ 0u };
+  std::atomic<std::uint64_t> allocations{ 0u };
+  std::atomic<std::uint64_t> allocatedBytes{ 0u };
+  std::atomic<std::uint64_t> frees{ 0u };
+  std::atomic<std::uint64_t> freedBytes{ 0u };
+  std::atomic<std::int64_t> outstandingBlocks{ 0 };
+  std::atomic<std::int64_t> outstandingBytes{ 0 };
+  std::atomic<std::uint64_t> untracked{ 0u };
+};
+
+// site 0 is "no call", sites 1 .. K_MAX_SITES - 1 are functions
+constexpr std::size_t K_MAX_SITES = 256u;
+Site gSites[K_MAX_SITES];
+std::atomic<std::size_t> gSiteCount{ 1u };
+SpinLock gSitesLock;
+
+// innermost call of the thread; initial-exec so that reading it never calls into the loader (which may allocate)
+constexpr std::size_t K_MAX_DEPTH = 8u;
+struct Scope {
+  std::uint16_t sites[K_MAX_DEPTH];
+  std::size_t depth;
+};
+thread_local Scope tScope __attribute__((tls_model("initial-exec"))) = {};
+
+std::uint16_t currentSite() {
+  const auto aDepth = tScope.depth;
+  return aDepth == 0u ? 0u : tScope.sites[(aDepth < K_MAX_DEPTH ? aDepth : K_MAX_DEPTH) - 1u];
+}
+
+/**
+ * Pointers allocated during a call: open addressing with linear probing and backward shift deletion, split into
+ * shards with their own lock
+ */
+struct Entry {
+  std::uintptr_t ptr;
+  std::uint64_t size : 48;
+  std::uint64_t site : 16;
+};
+
+constexpr std::size_t K_SHARDS         = 64u;
+constexpr std::size_t K_SHARD_SLOTS    = std::size_t(1) << 14;
+constexpr std::size_t K_SHARD_CAPACITY = K_SHARD_SLOTS - K_SHARD_SLOTS / 8u;
+
+struct Shard {
+  SpinLock lock;
+  std::size_t count = 0u;
+  Entry* slots      = nullptr;
+};
+
+Shard gShards[K_SHARDS];
+std::atomic<std::size_t> gTracked{ 0u };
+std::atomic<Entry*> gTable{ nullptr };
+SpinLock gTableLock;
+
+std::uint64_t hash(std::uintptr_t iPtr) {
+  return (static_cast<std::uint64_t>(iPtr) >> 4) * 0x9E3779B97F4A7C15ull;
+}
+
+Shard& shardOf(std::uint64_t iHash) {
+  return gShards[iHash >> 58];
+}
+
+std::size_t homeOf(std::uint64_t iHash) {
+  return (iHash >> 24) & (K_SHARD_SLOTS - 1u);
+}
+
+/**
+ * Maps the pointer table on the first tracked allocation, untouched pages cost nothing
+ */
+bool mapTable() {
+  if (gTable.load(std::memory_order_acquire)) {
+    return true;
+  }
+  SpinGuard aGuard(gTableLock);
+  if (gTable.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  void* aMemory = mmap(nullptr, K_SHARDS * K_SHARD_SLOTS * sizeof(Entry), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (aMemory == MAP_FAILED) {
+    return false;
+  }
+  auto* aTable = static_cast<Entry*>(aMemory);
+  for (std::size_t s = 0u; s < K_SHARDS; ++s) {
+    gShards[s].slots = aTable + s * K_SHARD_SLOTS;
+  }
+  gTable.store(aTable, std::memory_order_release);
+  return true;
+}
+
+bool track(void* iPtr, std::size_t iSize, std::uint16_t iSite) {
+  if (not mapTable()) {
+    return false;
+  }
+  const auto aHash = hash(reinterpret_cast<std::uintptr_t>(iPtr));
+  auto& aShard     = shardOf(aHash);
+  SpinGuard aGuard(aShard.lock);
+  if (aShard.count >= K_SHARD_CAPACITY) {
+    return false;
+  }
+  auto i = homeOf(aHash);
+  while (aShard.slots[i].ptr != 0u) {
+    i = (i + 1u) & (K_SHARD_SLOTS - 1u);
+  }
+  aShard.slots[i].ptr  = reinterpret_cast<std::uintptr_t>(iPtr);
+  aShard.slots[i].size = iSize;
+  aShard.slots[i].site = iSite;
+  ++aShard.count;
+  gTracked.fetch_add(1u, std::memory_order_relaxed);
+  return true;
+}
+
+bool untrack(void* iPtr, std::size_t& oSize, std::uint16_t& oSite) {
+  if (gTracked.load(std::memory_order_relaxed) == 0u) {
+    return false;
+  }
+  const auto aPtr  = reinterpret_cast<std::uintptr_t>(iPtr);
+  const auto aHash = hash(aPtr);
+  auto& aShard     = shardOf(aHash);
+  SpinGuard aGuard(aShard.lock);
+  if (aShard.count == 0u) {
+    return false;
+  }
+  auto i = homeOf(aHash);
+  while (aShard.slots[i].ptr != aPtr) {
+    if (aShard.slots[i].ptr == 0u) {
+      return false;
+    }
+    i = (i + 1u) & (K_SHARD_SLOTS - 1u);
+  }
+  oSize = aShard.slots[i].size;
+  oSite = static_cast<std::uint16_t>(aShard.slots[i].site);
+  // shift back the following entries of the run that would no longer be reachable from their home slot
+  for (auto j = (i + 1u) & (K_SHARD_SLOTS - 1u);; j = (j + 1u) & (K_SHARD_SLOTS - 1u)) {
+    if (aShard.slots[j].ptr == 0u) {
+      break;
+    }
+    const auto aHome     = homeOf(hash(aShard.slots[j].ptr));
+    const bool aBetween  = i <= j ? (i < aHome and aHome <= j) : (i < aHome or aHome <= j);
+    if (not aBetween) {
+      aShard.slots[i] = aShard.slots[j];
+      i               = j;
+    }
+  }
+  aShard.slots[i] = Entry{};
+  --aShard.count;
+  gTracked.fetch_sub(1u, std::memory_order_relaxed);
+  return true;
+}
+
+void onAllocate(void* iPtr, std::size_t iSize) {
+  const auto aSite = currentSite();
+  if (not iPtr or aSite == 0u) {
+    return;
+  }
+  auto& aStats = gSites[aSite];
+  aStats.allocations.fetch_add(1u, std::memory_order_relaxed);
+  aStats.allocatedBytes.fetch_add(iSize, std::memory_order_relaxed);
+  if (track(iPtr, iSize, aSite)) {
+    aStats.outstandingBlocks.fetch_add(1, std::memory_order_relaxed);
+    aStats.outstandingBytes.fetch_add(static_cast<std::int64_t>(iSize), std::memory_order_relaxed);
+  } else {
+    aStats.untracked.fetch_add(1u, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * Called before the block is handed back to glibc, the address may be reused right after
+ */
+void onFree(void* iPtr) {
+  std::size_t aSize   = 0u;
+  std::uint16_t aOwner = 0u;
+  const bool aTracked = untrack(iPtr, aSize, aOwner);
+  if (aTracked) {
+    gSites[aOwner].outstandingBlocks.fetch_sub(1, std::memory_order_relaxed);
+    gSites[aOwner].outstandingBytes.fetch_sub(static_cast<std::int64_t>(aSize), std::memory_order_relaxed);
+  }
+  if (const auto aSite = currentSite()) {
+    gSites[aSite].frees.fetch_add(1u, std::memory_order_relaxed);
+    gSites[aSite].freedBytes.fetch_add(aTracked ? aSize : malloc_usable_size(iPtr), std::memory_order_relaxed);
+  }
+}
+
+}  // namespace
+
+extern "C" {
+
+void* malloc(std::size_t iSize) {
+  void* aPtr = __libc_malloc(iSize);
+  onAllocate(aPtr, iSize);
+  return aPtr;
+}
+
+void free(void* iPtr) {
+  if (iPtr) {
+    onFree(iPtr);
+  }
+  __libc_free(iPtr);
+}
+
+void* calloc(std::size_t iCount, std::size_t iSize) {
+  void* aPtr = __libc_calloc(iCount, iSize);
+  onAllocate(aPtr, iCount * iSize);
+  return aPtr;
+}
+
+void* realloc(void* iPtr, std::size_t iSize) {
+  if (not iPtr) {
+    return malloc(iSize);
+  }
+  if (iSize == 0u) {
+    free(iPtr);
+    return nullptr;
+  }
+  // taken off the table first: once glibc moved the block another thread may be handed the old address
+  std::size_t aSize   = 0u;
+  std::uint16_t aOwner = 0u;
+  const bool aTracked = untrack(iPtr, aSize, aOwner);
+  void* aPtr          = __libc_realloc(iPtr, iSize);
+  if (not aPtr) {
+    if (aTracked) {
+      track(iPtr, aSize, aOwner);
+    }
+    return nullptr;
+  }
+  if (aTracked) {
+    gSites[aOwner].outstandingBlocks.fetch_sub(1, std::memory_order_relaxed);
+    gSites[aOwner].outstandingBytes.fetch_sub(static_cast<std::int64_t>(aSize), std::memory_order_relaxed);
+  }
+  if (const auto aSite = currentSite()) {
+    gSites[aSite].frees.fetch_add(1u, std::memory_order_relaxed);
+    gSites[aSite].freedBytes.fetch_add(aSize, std::memory_order_relaxed);
+  }
+  onAllocate(aPtr, iSize);
+  return aPtr;
+}
+
+void* memalign(std::size_t iAlignment, std::size_t iSize) {
+  void* aPtr = __libc_memalign(iAlignment, iSize);
+  onAllocate(aPtr, iSize);
+  return aPtr;
+}
+
+void* aligned_alloc(std::size_t iAlignment, std::size_t iSize) {
+  return memalign(iAlignment, iSize);
+}
+
+int posix_memalign(void** oPtr, std::size_t iAlignment, std::size_t iSize) {
+  if (iAlignment % sizeof(void*) != 0u or (iAlignment & (iAlignment - 1u)) != 0u) {
+    return EINVAL;
+  }
+  void* aPtr = memalign(iAlignment, iSize);
+  if (not aPtr) {
+    return ENOMEM;
+  }
+  *oPtr = aPtr;
+  return 0;
+}
+
+int pkcs11_alloc_enter(const char* iFunction) {
+  std::uint16_t aSite = 0u;
+  const auto aCount   = gSiteCount.load(std::memory_order_acquire);
+  for (std::size_t s = 1u; s < aCount; ++s) {
+    const char* aName = gSites[s].function.load(std::memory_order_relaxed);
+    if (aName == iFunction or std::strcmp(aName, iFunction) == 0) {
+      aSite = static_cast<std::uint16_t>(s);
+      break;
+    }
+  }
+  if (aSite == 0u) {
+    SpinGuard aGuard(gSitesLock);
+    const auto aNow = gSiteCount.load(std::memory_order_relaxed);
+    for (std::size_t s = aCount; s < aNow and aSite == 0u; ++s) {
+      if (std::strcmp(gSites[s].function.load(std::memory_order_relaxed), iFunction) == 0) {
+        aSite = static_cast<std::uint16_t>(s);
+      }
+    }
+    if (aSite == 0u and aNow < K_MAX_SITES) {
+      gSites[aNow].function.store(iFunction, std::memory_order_relaxed);
+      gSiteCount.store(aNow + 1u, std::memory_order_release);
+      aSite = static_cast<std::uint16_t>(aNow);
+    }
+  }
+  // pushed even when not attributed, so that the matching leave pops it
+  if (tScope.depth < K_MAX_DEPTH) {
+    tScope.sites[tScope.depth] = aSite;
+  }
+  ++tScope.depth;
+  if (aSite == 0u) {
+    return 0;
+  }
+  gSites[aSite].calls.fetch_add(1u, std::memory_order_relaxed);
+  return 1;
+}
+
+void pkcs11_alloc_leave(void) {
+  if (tScope.depth > 0u) {
+    --tScope.depth;
+  }
+}
+
+std::size_t pkcs11_alloc_sites(Pkcs11AllocSite* oSites, std::size_t iMax) {
+  const auto aCount = gSiteCount.load(std::memory_order_acquire) - 1u;
+  for (std::size_t s = 0u; s < aCount and s < iMax; ++s) {
+    const auto& aSite = gSites[s + 1u];
+    oSites[s]         = Pkcs11AllocSite{ aSite.function.load(std::memory_order_relaxed),
+                                 aSite.calls.load(std::memory_order_relaxed),
+                                 aSite.allocations.load(std::memory_order_relaxed),
+                                 aSite.allocatedBytes.load(std::memory_order_relaxed),
+                                 aSite.frees.load(std::memory_order_relaxed),
+                                 aSite.freedBytes.load(std::memory_order_relaxed),
+                                 static_cast<std::uint64_t>(std::max<std::int64_t>(aSite.outstandingBlocks.load(std::memory_order_relaxed), 0)),
+                                 static_cast<std::uint64_t>(std::max<std::int64_t>(aSite.outstandingBytes.load(std::memory_order_relaxed), 0)),
+                                 aSite.untracked.load(std::memory_order_relaxed) };
+  }
+  return aCount;
+}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "bench/BenchSupport.h"
+
+/**
+ * Modes of pkcs11_bench; each returns the process exit code
+ */
+namespace bench {
+
+/**
+ * Latency of each HSMUtils operation on its own: openHSMDL, closeHSMDL, openSession, login,
+ * retrieveKeyHandle, generateKey, encrypt_aes and decrypt_aes
+ */
+int runOps(const Options& iOptions);
+
+/**
+ * Throughput of encrypt_aes against encrypt_aes_multipart over payload and chunk sizes, and the payload
+ * from which each chunk size beats the single-part call
+ */
+int runPayload(const Options& iOptions);
+
+/**
+ * Aggregate and per-thread throughput and latency of N threads sharing a SessionPool of M sessions, and the
+ * thread count from which the curve of every session count flattens
+ */
+int runScaling(const Options& iOptions);
+
+/**
+ * Requests sent on a fixed schedule at each target rate, latency measured from the intended send time into
+ * histograms so that a stalled call also counts against the requests queued behind it
+ */
+int runOpenLoop(const Options& iOptions);
+
+/**
+ * Millions of encrypt, decrypt, find and open/close calls at full speed, one phase per operation, with RSS,
+ * heap in use, open descriptors and threads sampled along the way and fitted into a growth per operation
+ */
+int runSoak(const Options& iOptions);
+
+/**
+ * openHSMDL / closeHSMDL (dlopen, C_Initialize, C_Finalize, dlclose) repeated thousands of times: time of each
+ * phase, cold against warm, and the mappings, descriptors and threads each cycle leaves behind
+ */
+int runCycle(const Options& iOptions);
+
+}  // namespace bench
@@ -0,0 +1,438 @@
+#include "bench/BenchSupport.h"
+#include "hsm/HSMUtils.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <limits.h>
+#include <malloc.h>
+#include <numeric>
+#include <sstream>
+#include <tuple>
+#include <unistd.h>
+
+namespace bench {
+
+Options::Options(int argc, char** argv, int iFirst) {
+  for (int i = iFirst; i < argc; ++i) {
+    std::string aArg(argv[i]);
+    if (aArg.rfind("--", 0) != 0) {
+      std::cerr << "ignoring argument " << aArg << ", options are --name=value" << std::endl;
+      continue;
+    }
+    auto aEqual = aArg.find('=');
+    if (aEqual == std::string::npos) {
+      // a flag
+      mValues[aArg.substr(2)] = "1";
+    } else {
+      mValues[aArg.substr(2, aEqual - 2)] = aArg.substr(aEqual + 1);
+    }
+  }
+}
+
+std::string Options::get(const std::string& iName, const std::string& iDefault) const {
+  mRead[iName] = true;
+  auto aIt     = mValues.find(iName);
+  return aIt == mValues.end() ? iDefault : aIt->second;
+}
+
+std::size_t Options::getSize(const std::string& iName, std::size_t iDefault) const {
+  auto aValue = get(iName, "");
+  return aValue.empty() ? iDefault : parseSize(aValue);
+}
+
+double Options::getDouble(const std::string& iName, double iDefault) const {
+  auto aValue = get(iName, "");
+  return aValue.empty() ? iDefault : std::stod(aValue);
+}
+
+std::vector<std::size_t> Options::getSizes(const std::string& iName, const std::vector<std::size_t>& iDefault) const {
+  auto aValue = get(iName, "");
+  if (aValue.empty()) {
+    return iDefault;
+  }
+  std::vector<std::size_t> aSizes;
+  std::istringstream aStream(aValue);
+  std::string aItem;
+  while (std::getline(aStream, aItem, ',')) {
+    if (not aItem.empty()) {
+      aSizes.push_back(parseSize(aItem));
+    }
+  }
+  return aSizes;
+}
+
+std::vector<std::string> Options::unused() const {
+  std::vector<std::string> aUnused;
+  for (const auto& aValue : mValues) {
+    if (mRead.count(aValue.first) == 0u) {
+      aUnused.push_back(aValue.first);
+    }
+  }
+  return aUnused;
+}
+
+std::size_t parseSize(const std::string& iValue) {
+  std::size_t aPos = 0u;
+  auto aNumber     = std::stoull(iValue, &aPos);
+  if (aPos < iValue.size()) {
+    switch (std::toupper(static_cast<unsigned char>(iValue[aPos]))) {
+      case 'K':
+        return aNumber << 10;
+      case 'M':
+        return aNumber << 20;
+      case 'G':
+        return aNumber << 30;
+      default:
+        break;
+    }
+  }
+  return aNumber;
+}
+
+std::string defaultLibPath() {
+  char aPath[PATH_MAX];
+  auto aLen = readlink("/proc/self/exe", aPath, sizeof(aPath) - 1u);
+  if (aLen <= 0) {
+    return "libpkcs11_mock.so";
+  }
+  std::string aExe(aPath, static_cast<std::size_t>(aLen));
+  return aExe.substr(0, aExe.rfind('/') + 1) + "libpkcs11_mock.so";
+}
+
+LatencySummary summarize(std::vector<std::uint64_t>& iSamplesNs, std::chrono::nanoseconds iElapsed) {
+  LatencySummary aSummary;
+  if (iSamplesNs.empty()) {
+    return aSummary;
+  }
+  std::sort(iSamplesNs.begin(), iSamplesNs.end());
+  // nearest rank
+  auto aPercentile = [&iSamplesNs](double iFraction) {
+    auto aRank = static_cast<std::size_t>(std::ceil(iFraction * static_cast<double>(iSamplesNs.size())));
+    return static_cast<double>(iSamplesNs[std::max<std::size_t>(aRank, 1u) - 1u]) / 1000.0;
+  };
+  aSummary.count    = iSamplesNs.size();
+  aSummary.meanUs   = std::accumulate(iSamplesNs.begin(), iSamplesNs.end(), 0.0) / static_cast<double>(iSamplesNs.size()) / 1000.0;
+  aSummary.medianUs = aPercentile(0.5);
+  aSummary.p99Us    = aPercentile(0.99);
+  aSummary.p999Us   = aPercentile(0.999);
+  aSummary.minUs    = static_cast<double>(iSamplesNs.front()) / 1000.0;
+  aSummary.maxUs    = static_cast<double>(iSamplesNs.back()) / 1000.0;
+  if (iElapsed.count() > 0) {
+    aSummary.opsPerSec = static_cast<double>(iSamplesNs.size()) * 1e9 / static_cast<double>(iElapsed.count());
+  }
+  return aSummary;
+}
+
+Histogram::Histogram(unsigned iPrecisionBits)
+    : mPrecisionBits(std::min(std::max(iPrecisionBits, 2u), 16u)),
+      mCounts(index(std::numeric_limits<std::uint64_t>::max()) + 1u, 0u) {}
+
+std::size_t Histogram::index(std::uint64_t iValue) const {
+  const std::uint64_t aSubBuckets = std::uint64_t(1) << mPrecisionBits;
+  if (iValue < aSubBuckets) {
+    return static_cast<std::size_t>(iValue);
+  }
+  // iValue >> aShift keeps the mPrecisionBits most significant bits
+  const unsigned aShift = static_cast<unsigned>(63 - __builtin_clzll(iValue)) - (mPrecisionBits - 1u);
+  return static_cast<std::size_t>(aShift * (aSubBuckets / 2u) + (iValue >> aShift));
+}
+
+std::uint64_t Histogram::highestEquivalent(std::size_t iIndex) const {
+  const std::uint64_t aSubBuckets = std::uint64_t(1) << mPrecisionBits;
+  if (iIndex < aSubBuckets) {
+    return iIndex;
+  }
+  const std::uint64_t aShift    = iIndex / (aSubBuckets / 2u) - 1u;
+  const std::uint64_t aMantissa = iIndex - aShift * (aSubBuckets / 2u);
+  return ((aMantissa + 1u) << aShift) - 1u;
+}
+
+void Histogram::record(std::uint64_t iValue) {
+  ++mCounts[index(iValue)];
+  mMin = mCount == 0u ? iValue : std::min(mMin, iValue);
+  mMax = std::max(mMax, iValue);
+  mSum += static_cast<double>(iValue);
+  ++mCount;
+}
+
+void Histogram::merge(const Histogram& iOther) {
+  if (iOther.mCount == 0u) {
+    return;
+  }
+  if (iOther.mPrecisionBits == mPrecisionBits) {
+    for (std::size_t i = 0u; i < mCounts.size(); ++i) {
+      mCounts[i] += iOther.mCounts[i];
+    }
+  } else {
+    for (std::size_t i = 0u; i < iOther.mCounts.size(); ++i) {
+      mCounts[index(iOther.highestEquivalent(i))] += iOther.mCounts[i];
+    }
+  }
+  mMin = mCount == 0u ? iOther.mMin : std::min(mMin, iOther.mMin);
+  mMax = std::max(mMax, iOther.mMax);
+  mSum += iOther.mSum;
+  mCount += iOther.mCount;
+}
+
+std::uint64_t Histogram::percentile(double iFraction) const {
+  if (mCount == 0u) {
+    return 0u;
+  }
+  auto aRank = static_cast<std::uint64_t>(std::ceil(std::min(std::max(iFraction, 0.0), 1.0) * static_cast<double>(mCount)));
+  aRank      = std::max<std::uint64_t>(aRank, 1u);
+  std::uint64_t aSeen = 0u;
+  for (std::size_t i = 0u; i < mCounts.size(); ++i) {
+    aSeen += mCounts[i];
+    if (aSeen >= aRank) {
+      return std::min(highestEquivalent(i), mMax);
+    }
+  }
+  return mMax;
+}
+
+ProcessSample sampleProcess() {
+  ProcessSample aSample;
+  std::ifstream aStatm("/proc/self/statm");
+  std::uint64_t aSize     = 0u;
+  std::uint64_t aResident = 0u;
+  if (aStatm >> aSize >> aResident) {
+    aSample.rssBytes = aResident * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+  }
+#if defined(__GLIBC__) and (__GLIBC__ > 2 or (__GLIBC__ == 2 and __GLIBC_MINOR__ >= 33))
+  auto aInfo        = mallinfo2();
+  aSample.heapBytes = aInfo.uordblks + aInfo.hblkhd;
+#elif defined(__GLIBC__)
+  // the int fields of mallinfo wrap above 2 GiB
+  auto aInfo        = mallinfo();
+  aSample.heapBytes = static_cast<unsigned>(aInfo.uordblks) + static_cast<unsigned>(aInfo.hblkhd);
+#endif
+  if (auto* aDir = opendir("/proc/self/fd")) {
+    while (auto* aEntry = readdir(aDir)) {
+      if (aEntry->d_name[0] != '.') {
+        ++aSample.fds;
+      }
+    }
+    closedir(aDir);
+    // the descriptor of the directory stream itself
+    --aSample.fds;
+  }
+  std::ifstream aStatus("/proc/self/status");
+  std::string aLine;
+  while (std::getline(aStatus, aLine)) {
+    if (aLine.rfind("Threads:", 0) == 0) {
+      aSample.threads = std::stoull(aLine.substr(8));
+      break;
+    }
+  }
+  return aSample;
+}
+
+LinearFit fitLine(const std::vector<double>& iX, const std::vector<double>& iY) {
+  LinearFit aFit;
+  const std::size_t aCount = std::min(iX.size(), iY.size());
+  if (aCount < 2u) {
+    return aFit;
+  }
+  const double aMeanX = std::accumulate(iX.begin(), iX.begin() + static_cast<std::ptrdiff_t>(aCount), 0.0) / static_cast<double>(aCount);
+  const double aMeanY = std::accumulate(iY.begin(), iY.begin() + static_cast<std::ptrdiff_t>(aCount), 0.0) / static_cast<double>(aCount);
+  double aSxx = 0.0;
+  double aSxy = 0.0;
+  double aSyy = 0.0;
+  for (std::size_t i = 0u; i < aCount; ++i) {
+    aSxx += (iX[i] - aMeanX) * (iX[i] - aMeanX);
+    aSxy += (iX[i] - aMeanX) * (iY[i] - aMeanY);
+    aSyy += (iY[i] - aMeanY) * (iY[i] - aMeanY);
+  }
+  if (aSxx == 0.0) {
+    return aFit;
+  }
+  aFit.slope     = aSxy / aSxx;
+  aFit.intercept = aMeanY - aFit.slope * aMeanX;
+  aFit.r2        = aSyy == 0.0 ? 0.0 : (aSxy * aSxy) / (aSxx * aSyy);
+  return aFit;
+}
+
+std::optional<Target> openTarget(const Options& iOptions) {
+  auto aLibPath = iOptions.get("lib", defaultLibPath());
+  auto aSlot    = iOptions.get("slot", "FKH");
+  auto aPin     = iOptions.get("pin", "1234");
+
+  Target aTarget;
+  std::tie(aTarget.lib, aTarget.functions) = HSMUtils::openHSMDL(aLibPath);
+  if (not aTarget.lib or not aTarget.functions) {
+    std::cerr << "Could not load " << aLibPath << std::endl;
+    return {};
+  }
+  auto aSlotId = HSMUtils::findSlot(aTarget.functions, aSlot);
+  auto aSession = aSlotId ? HSMUtils::openSession(aTarget.functions, aSlotId.value(), SessionAccess::ReadWrite) : std::nullopt;
+  if (not aSession) {
+    std::cerr << "Could not open a session on " << aSlot << std::endl;
+    HSMUtils::closeHSMDL(aTarget.lib, aTarget.functions);
+    return {};
+  }
+  aTarget.slot    = aSlotId.value();
+  aTarget.session = aSession.value();
+  if (not HSMUtils::login(aTarget.functions, aTarget.session, aPin) and HSMUtils::lastError() != CKR_USER_ALREADY_LOGGED_IN) {
+    std::cerr << "Could not login on " << aSlot << std::endl;
+    closeTarget(aTarget);
+    return {};
+  }
+  return aTarget;
+}
+
+void closeTarget(Target& ioTarget) {
+  if (ioTarget.session != CK_INVALID_HANDLE) {
+    ioTarget.functions->C_CloseSession(ioTarget.session);
+    ioTarget.session = CK_INVALID_HANDLE;
+  }
+  if (ioTarget.lib) {
+    HSMUtils::closeHSMDL(ioTarget.lib, ioTarget.functions);
+  }
+}
+
+namespace {
+
+std::string toText(const Value& iValue) {
+  std::ostringstream aOut;
+  if (auto aString = std::get_if<std::string>(&iValue)) {
+    aOut << *aString;
+  } else if (auto aDouble = std::get_if<double>(&iValue)) {
+    aOut << std::fixed << std::setprecision(2) << *aDouble;
+  } else {
+    aOut << std::get<std::uint64_t>(iValue);
+  }
+  return aOut.str();
+}
+
+std::string jsonString(const std::string& iText) {
+  std::ostringstream aOut;
+  aOut << '"';
+  for (char c : iText) {
+    switch (c) {
+      case '"':
+        aOut << "\\\"";
+        break;
+      case '\\':
+        aOut << "\\\\";
+        break;
+      case '\n':
+        aOut << "\\n";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20u) {
+          aOut << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        } else {
+          aOut << c;
+        }
+    }
+  }
+  aOut << '"';
+  return aOut.str();
+}
+
+std::string toJson(const Value& iValue) {
+  if (auto aString = std::get_if<std::string>(&iValue)) {
+    return jsonString(*aString);
+  }
+  std::ostringstream aOut;
+  if (auto aDouble = std::get_if<double>(&iValue)) {
+    if (not std::isfinite(*aDouble)) {
+      return "null";
+    }
+    aOut << std::setprecision(9) << *aDouble;
+  } else {
+    aOut << std::get<std::uint64_t>(iValue);
+  }
+  return aOut.str();
+}
+
+}  // namespace
+
+void Report::parameter(const std::string& iName, Value iValue) {
+  mParameters.emplace_back(iName, std::move(iValue));
+}
+
+Table& Report::table(const std::string& iName, std::vector<std::string> iColumns) {
+  mTables.push_back(Table{ iName, std::move(iColumns), {} });
+  return mTables.back();
+}
+
+void Report::print(std::ostream& oOut) const {
+  oOut << "mode: " << mMode << std::endl;
+  for (const auto& aParameter : mParameters) {
+    oOut << "  " << aParameter.first << ": " << toText(aParameter.second) << std::endl;
+  }
+  for (const auto& aTable : mTables) {
+    std::vector<std::size_t> aWidths;
+    for (const auto& aColumn : aTable.columns) {
+      aWidths.push_back(aColumn.size());
+    }
+    std::vector<std::vector<std::string>> aCells;
+    for (const auto& aRow : aTable.rows) {
+      aCells.emplace_back();
+      for (std::size_t c = 0u; c < aRow.size() and c < aWidths.size(); ++c) {
+        aCells.back().push_back(toText(aRow[c]));
+        aWidths[c] = std::max(aWidths[c], aCells.back().back().size());
+      }
+    }
+    oOut << std::endl << aTable.name << std::endl;
+    for (std::size_t c = 0u; c < aTable.columns.size(); ++c) {
+      oOut << std::setw(static_cast<int>(aWidths[c] + 2u)) << aTable.columns[c];
+    }
+    oOut << std::endl;
+    for (const auto& aRow : aCells) {
+      for (std::size_t c = 0u; c < aRow.size(); ++c) {
+        oOut << std::setw(static_cast<int>(aWidths[c] + 2u)) << aRow[c];
+      }
+      oOut << std::endl;
+    }
+  }
+}
+
+void Report::writeJson(std::ostream& oOut) const {
+  oOut << "{" << std::endl << "  \"mode\": " << jsonString(mMode) << "," << std::endl << "  \"parameters\": {";
+  for (std::size_t i = 0u; i < mParameters.size(); ++i) {
+    oOut << (i == 0u ? "" : ",") << std::endl << "    " << jsonString(mParameters[i].first) << ": " << toJson(mParameters[i].second);
+  }
+  oOut << std::endl << "  }," << std::endl << "  \"tables\": {";
+  for (std::size_t t = 0u; t < mTables.size(); ++t) {
+    const auto& aTable = mTables[t];
+    oOut << (t == 0u ? "" : ",") << std::endl << "    " << jsonString(aTable.name) << ": [";
+    for (std::size_t r = 0u; r < aTable.rows.size(); ++r) {
+      oOut << (r == 0u ? "" : ",") << std::endl << "      {";
+      for (std::size_t c = 0u; c < aTable.rows[r].size() and c < aTable.columns.size(); ++c) {
+        oOut << (c == 0u ? "" : ", ") << jsonString(aTable.columns[c]) << ": " << toJson(aTable.rows[r][c]);
+      }
+      oOut << "}";
+    }
+    oOut << std::endl << "    ]";
+  }
+  oOut << std::endl << "  }" << std::endl << "}" << std::endl;
+}
+
+bool Report::emit(const Options& iOptions) const {
+  print(std::cout);
+  auto aJson = iOptions.get("json", "");
+  if (aJson.empty()) {
+    return true;
+  }
+  if (aJson == "-") {
+    std::cout << std::endl;
+    writeJson(std::cout);
+    return true;
+  }
+  std::ofstream aFile(aJson);
+  writeJson(aFile);
+  if (not aFile) {
+    std::cerr << "Could not write " << aJson << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace bench
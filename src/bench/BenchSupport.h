@@ -0,0 +1,228 @@
+#pragma once
+
+#include "hsm/cryptoki.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <variant>
+#include <vector>
+
+/**
+ * Command line, statistics and report helpers shared by the pkcs11_bench modes
+ */
+namespace bench {
+
+/**
+ * --name=value options following the mode on the command line
+ */
+class Options {
+ public:
+  /**
+   * @param iFirst - index of the first option in argv
+   */
+  Options(int argc, char** argv, int iFirst);
+
+  bool has(const std::string& iName) const { return mValues.count(iName) > 0u; }
+  std::string get(const std::string& iName, const std::string& iDefault) const;
+  /**
+   * @return the value as a size, with an optional K, M or G (binary) suffix
+   */
+  std::size_t getSize(const std::string& iName, std::size_t iDefault) const;
+  double getDouble(const std::string& iName, double iDefault) const;
+  /**
+   * @return a comma separated list of sizes
+   */
+  std::vector<std::size_t> getSizes(const std::string& iName, const std::vector<std::size_t>& iDefault) const;
+
+  /**
+   * @return names given on the command line and never read, to report typos
+   */
+  std::vector<std::string> unused() const;
+
+ private:
+  std::map<std::string, std::string> mValues;
+  mutable std::map<std::string, bool> mRead;
+};
+
+std::size_t parseSize(const std::string& iValue);
+
+/**
+ * @return libpkcs11_mock.so next to the running executable, so that the benchmarks run without an HSM
+ */
+std::string defaultLibPath();
+
+struct LatencySummary {
+  std::size_t count = 0u;
+  double meanUs     = 0.0;
+  double medianUs   = 0.0;
+  double p99Us      = 0.0;
+  double p999Us     = 0.0;
+  double minUs      = 0.0;
+  double maxUs      = 0.0;
+  double opsPerSec  = 0.0;
+};
+
+/**
+ * @param iSamplesNs - latencies in nanoseconds, sorted in place
+ * @param iElapsed - time the operations took, for the rate
+ */
+LatencySummary summarize(std::vector<std::uint64_t>& iSamplesNs, std::chrono::nanoseconds iElapsed);
+
+/**
+ * Log-linear latency histogram in the manner of HdrHistogram: values below 2^iPrecisionBits are counted exactly,
+ * larger ones in buckets at most 2^(1 - iPrecisionBits) of their value wide (under 1% for the default 8 bits)
+ */
+class Histogram {
+ public:
+  explicit Histogram(unsigned iPrecisionBits = 8u);
+
+  void record(std::uint64_t iValue);
+  void merge(const Histogram& iOther);
+
+  std::uint64_t count() const { return mCount; }
+  std::uint64_t min() const { return mCount == 0u ? 0u : mMin; }
+  std::uint64_t max() const { return mMax; }
+  double mean() const { return mCount == 0u ? 0.0 : mSum / static_cast<double>(mCount); }
+  /**
+   * @param iFraction - 0.99 for p99
+   * @return highest value equivalent to the one at that rank (nearest rank), 0 if empty
+   */
+  std::uint64_t percentile(double iFraction) const;
+
+ private:
+  std::size_t index(std::uint64_t iValue) const;
+  std::uint64_t highestEquivalent(std::size_t iIndex) const;
+
+  unsigned mPrecisionBits;
+  std::vector<std::uint64_t> mCounts;
+  std::uint64_t mCount = 0u;
+  std::uint64_t mMin   = 0u;
+  std::uint64_t mMax   = 0u;
+  double mSum          = 0.0;
+};
+
+/**
+ * @return the duration of iCall in nanoseconds, empty optional if it returned false
+ */
+template <typename Call>
+std::optional<std::uint64_t> timed(Call&& iCall) {
+  auto aStart = std::chrono::steady_clock::now();
+  bool aOk    = iCall();
+  auto aEnd   = std::chrono::steady_clock::now();
+  if (not aOk) {
+    return {};
+  }
+  return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(aEnd - aStart).count());
+}
+
+/**
+ * Runs iIteration(i) iWarmup times without keeping the results, then iIterations times
+ * @param iIteration - returns the latency of iteration i (see timed), empty optional on failure
+ * @return the latencies, empty optional as soon as one iteration fails
+ */
+template <typename Iteration>
+std::optional<std::vector<std::uint64_t>> repeat(std::size_t iWarmup, std::size_t iIterations, Iteration&& iIteration) {
+  std::vector<std::uint64_t> aSamples;
+  aSamples.reserve(iIterations);
+  for (std::size_t i = 0u; i < iWarmup + iIterations; ++i) {
+    auto aSample = iIteration(i);
+    if (not aSample) {
+      return {};
+    }
+    if (i >= iWarmup) {
+      aSamples.push_back(aSample.value());
+    }
+  }
+  return aSamples;
+}
+
+/**
+ * Resource usage of the running process
+ */
+struct ProcessSample {
+  // resident set size, from /proc/self/statm
+  std::uint64_t rssBytes = 0u;
+  // bytes handed out by malloc and not freed yet (mallinfo2 uordblks + hblkhd)
+  std::uint64_t heapBytes = 0u;
+  // entries of /proc/self/fd
+  std::uint64_t fds = 0u;
+  // Threads: of /proc/self/status
+  std::uint64_t threads = 0u;
+};
+
+ProcessSample sampleProcess();
+
+/**
+ * Least squares line through the points
+ */
+struct LinearFit {
+  double slope     = 0.0;
+  double intercept = 0.0;
+  // coefficient of determination, 1 for points on a line, 0 when the line explains nothing
+  double r2 = 0.0;
+};
+
+LinearFit fitLine(const std::vector<double>& iX, const std::vector<double>& iY);
+
+/**
+ * A library loaded and a session logged in on one of its tokens
+ */
+struct Target {
+  void* lib                      = nullptr;
+  CK_FUNCTION_LIST_PTR functions = nullptr;
+  CK_SLOT_ID slot                = 0u;
+  CK_SESSION_HANDLE session      = CK_INVALID_HANDLE;
+};
+
+/**
+ * Loads --lib and opens a read-write session logged in on --slot with --pin
+ */
+std::optional<Target> openTarget(const Options& iOptions);
+
+/**
+ * Closes the session (C_CloseSession, without logout) and unloads the library
+ */
+void closeTarget(Target& ioTarget);
+
+using Value = std::variant<std::string, double, std::uint64_t>;
+
+struct Table {
+  std::string name;
+  std::vector<std::string> columns;
+  std::vector<std::vector<Value>> rows;
+};
+
+/**
+ * Results of a mode, printed as aligned tables and written as JSON
+ */
+class Report {
+ public:
+  explicit Report(std::string iMode) : mMode(std::move(iMode)) {}
+
+  void parameter(const std::string& iName, Value iValue);
+  /**
+   * @return a new table, filled by the caller
+   */
+  Table& table(const std::string& iName, std::vector<std::string> iColumns);
+
+  void print(std::ostream& oOut) const;
+  void writeJson(std::ostream& oOut) const;
+
+  /**
+   * Prints the report on stdout and writes the JSON to --json (a file, or - for stdout) when given
+   * @return false if the JSON file could not be written
+   */
+  bool emit(const Options& iOptions) const;
+
+ private:
+  std::string mMode;
+  std::vector<std::pair<std::string, Value>> mParameters;
+  std::deque<Table> mTables;
+};
+
+}  // namespace bench
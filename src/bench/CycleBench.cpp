@@ -0,0 +1,244 @@
+#include "bench/BenchModes.h"
+#include "hsm/HSMUtils.h"
+#include <algorithm>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fstream>
+#include <iostream>
+#include <limits.h>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+
+namespace bench {
+
+namespace {
+
+/**
+ * Mappings and open descriptors of the process, counted by what they point to so that two snapshots can be
+ * compared whatever the addresses and descriptor numbers
+ */
+struct Counts {
+  std::uint64_t mappings    = 0u;
+  std::uint64_t mappedBytes = 0u;
+  std::uint64_t fds         = 0u;
+  std::uint64_t threads     = 0u;
+};
+
+struct Resources {
+  // "<perms> <path>" of /proc/self/maps, [anon] for anonymous mappings
+  std::map<std::string, std::uint64_t> mappings;
+  // readlink of /proc/self/fd entries, socket:[inode] and alike reduced to socket
+  std::map<std::string, std::uint64_t> fds;
+  Counts counts;
+};
+
+Resources snapshot() {
+  Resources aResources;
+  std::ifstream aMaps("/proc/self/maps");
+  std::string aLine;
+  while (std::getline(aMaps, aLine)) {
+    std::istringstream aFields(aLine);
+    std::string aRange, aPerms, aOffset, aDevice, aInode, aPath;
+    aFields >> aRange >> aPerms >> aOffset >> aDevice >> aInode;
+    std::getline(aFields >> std::ws, aPath);
+    const auto aDash = aRange.find('-');
+    if (aDash != std::string::npos) {
+      aResources.counts.mappedBytes += std::stoull(aRange.substr(aDash + 1u), nullptr, 16) - std::stoull(aRange.substr(0u, aDash), nullptr, 16);
+    }
+    ++aResources.mappings[aPerms + " " + (aPath.empty() ? "[anon]" : aPath)];
+    ++aResources.counts.mappings;
+  }
+  if (auto* aDir = opendir("/proc/self/fd")) {
+    const std::string aOwn = std::to_string(dirfd(aDir));
+    while (auto* aEntry = readdir(aDir)) {
+      if (aEntry->d_name[0] == '.' or aOwn == aEntry->d_name) {
+        continue;
+      }
+      char aTarget[PATH_MAX];
+      const auto aLength = readlink((std::string("/proc/self/fd/") + aEntry->d_name).c_str(), aTarget, sizeof(aTarget) - 1u);
+      std::string aName = aLength > 0 ? std::string(aTarget, static_cast<std::size_t>(aLength)) : std::string("?");
+      const auto aBracket = aName.find(":[");
+      if (aBracket != std::string::npos and aName.find('/') == std::string::npos) {
+        aName = aName.substr(0u, aBracket);
+      }
+      ++aResources.fds[aName];
+      ++aResources.counts.fds;
+    }
+    closedir(aDir);
+  }
+  aResources.counts.threads = sampleProcess().threads;
+  return aResources;
+}
+
+struct Cycle {
+  LoadTimings timings;
+  // the module was still mapped after dlclose (STB_GNU_UNIQUE symbols, RTLD_NODELETE, a thread_local destructor
+  // pending...): the next dlopen only bumps a reference count
+  bool resident = false;
+  // only the counts are kept per cycle, the snapshots themselves would grow the heap under measure
+  Counts after;
+};
+
+double micros(std::chrono::nanoseconds iDuration) {
+  return static_cast<double>(iDuration.count()) / 1000.0;
+}
+
+/**
+ * Entries more numerous in iAfter than in iBefore
+ */
+void addLeftovers(Table& oTable, const std::string& iKind, const std::map<std::string, std::uint64_t>& iBefore,
+                  const std::map<std::string, std::uint64_t>& iAfter, std::uint64_t iCycles) {
+  for (const auto& aEntry : iAfter) {
+    auto aIt                 = iBefore.find(aEntry.first);
+    const std::uint64_t aWas = aIt == iBefore.end() ? 0u : aIt->second;
+    if (aEntry.second > aWas) {
+      const auto aExtra = aEntry.second - aWas;
+      oTable.rows.push_back({ iKind, aEntry.first, aExtra, static_cast<double>(aExtra) / static_cast<double>(iCycles) });
+    }
+  }
+}
+
+}  // namespace
+
+int runCycle(const Options& iOptions) {
+  const auto aCycles  = iOptions.getSize("cycles", 1000u);
+  const auto aLibPath = iOptions.get("lib", defaultLibPath());
+  // growth over the cycles after the first one is flagged when linear (see soak)
+  const auto aMinR2 = iOptions.getDouble("min-r2", 0.9);
+  if (aCycles == 0u) {
+    std::cerr << "--cycles cannot be 0" << std::endl;
+    return 1;
+  }
+
+  Report aReport("cycle");
+  aReport.parameter("library", aLibPath);
+  aReport.parameter("cycles", static_cast<std::uint64_t>(aCycles));
+  aReport.parameter("min_r2", aMinR2);
+
+  const auto aBaseline = snapshot();
+  Resources aLast;
+  std::vector<Cycle> aDone;
+  aDone.reserve(aCycles);
+  for (std::size_t c = 0u; c < aCycles; ++c) {
+    Cycle aCycle;
+    auto [aLib, aFunctions] = HSMUtils::openHSMDL(aLibPath, &aCycle.timings);
+    if (not aLib or not aFunctions or not HSMUtils::closeHSMDL(aLib, aFunctions, &aCycle.timings)) {
+      std::cerr << "cycle " << c + 1u << " failed, " << std::hex << HSMUtils::lastError() << std::dec << std::endl;
+      break;
+    }
+    if (auto* aStillLoaded = dlopen(aLibPath.c_str(), RTLD_NOW | RTLD_NOLOAD)) {
+      aCycle.resident = true;
+      dlclose(aStillLoaded);
+    }
+    aLast        = snapshot();
+    aCycle.after = aLast.counts;
+    aDone.push_back(aCycle);
+  }
+  if (aDone.empty()) {
+    return 1;
+  }
+  aReport.parameter("completed_cycles", static_cast<std::uint64_t>(aDone.size()));
+  const auto aResident = std::count_if(aDone.begin(), aDone.end(), [](const Cycle& iCycle) { return iCycle.resident; });
+  aReport.parameter("resident_after_close", static_cast<std::uint64_t>(aResident));
+  if (aResident > 0) {
+    std::cerr << "the module stayed loaded after " << aResident << " of " << aDone.size()
+              << " dlclose, the cycles after the first do not reload it" << std::endl;
+  }
+
+  // the first cycle pays for reading the module from disk, relocations and first touch of its pages; the
+  // following ones are what a process restarting the library in a loop sees
+  using Phase = std::chrono::nanoseconds LoadTimings::*;
+  const std::pair<const char*, Phase> aPhases[] = { { "dlopen", &LoadTimings::dlopen },         { "get_function_list", &LoadTimings::getFunctionList },
+                                                    { "initialize", &LoadTimings::initialize }, { "finalize", &LoadTimings::finalize },
+                                                    { "dlclose", &LoadTimings::dlclose } };
+  auto& aTimes = aReport.table("phases", { "phase", "first_us", "mean_us", "median_us", "p99_us", "max_us" });
+  for (const auto& aPhase : aPhases) {
+    std::vector<std::uint64_t> aSamples;
+    std::chrono::nanoseconds aSum(0);
+    for (std::size_t c = 1u; c < aDone.size(); ++c) {
+      const auto aTime = aDone[c].timings.*aPhase.second;
+      aSamples.push_back(static_cast<std::uint64_t>(aTime.count()));
+      aSum += aTime;
+    }
+    const auto aSummary = summarize(aSamples, aSum);
+    aTimes.rows.push_back({ std::string(aPhase.first), micros(aDone.front().timings.*aPhase.second), aSummary.meanUs, aSummary.medianUs,
+                            aSummary.p99Us, aSummary.maxUs });
+  }
+  {
+    std::vector<std::uint64_t> aSamples;
+    std::chrono::nanoseconds aSum(0);
+    auto aTotal = [&](const LoadTimings& iTimings) {
+      std::chrono::nanoseconds aTime(0);
+      for (const auto& aPhase : aPhases) {
+        aTime += iTimings.*aPhase.second;
+      }
+      return aTime;
+    };
+    for (std::size_t c = 1u; c < aDone.size(); ++c) {
+      aSamples.push_back(static_cast<std::uint64_t>(aTotal(aDone[c].timings).count()));
+      aSum += aTotal(aDone[c].timings);
+    }
+    const auto aSummary = summarize(aSamples, aSum);
+    aTimes.rows.push_back({ std::string("cycle"), micros(aTotal(aDone.front().timings)), aSummary.meanUs, aSummary.medianUs, aSummary.p99Us,
+                            aSummary.maxUs });
+  }
+
+  if (iOptions.has("samples")) {
+    auto& aSamples = aReport.table("samples", { "cycle", "dlopen_us", "initialize_us", "finalize_us", "dlclose_us", "mappings", "mapped_bytes",
+                                                "fds", "threads" });
+    for (std::size_t c = 0u; c < aDone.size(); ++c) {
+      const auto& aCycle = aDone[c];
+      aSamples.rows.push_back({ static_cast<std::uint64_t>(c + 1u), micros(aCycle.timings.dlopen), micros(aCycle.timings.initialize),
+                                micros(aCycle.timings.finalize), micros(aCycle.timings.dlclose), aCycle.after.mappings,
+                                aCycle.after.mappedBytes, aCycle.after.fds, aCycle.after.threads });
+    }
+  }
+
+  // what every cycle leaves behind: fit of each count against the cycle number, from the end of the first cycle
+  // on (a module kept loaded or a thread parked once is a constant, not a growth)
+  using Count = std::uint64_t Counts::*;
+  const std::pair<const char*, Count> aCounts[] = { { "mappings", &Counts::mappings },
+                                                    { "mapped_bytes", &Counts::mappedBytes },
+                                                    { "fds", &Counts::fds },
+                                                    { "threads", &Counts::threads } };
+  auto& aGrowth = aReport.table("growth", { "resource", "before", "after_first", "after_last", "per_cycle", "r2", "cycles_grown", "growing" });
+  for (const auto& aCount : aCounts) {
+    std::vector<double> aX;
+    std::vector<double> aY;
+    std::uint64_t aGrown = 0u;
+    for (std::size_t c = 0u; c < aDone.size(); ++c) {
+      aX.push_back(static_cast<double>(c + 1u));
+      aY.push_back(static_cast<double>(aDone[c].after.*aCount.second));
+      const auto aPrevious = c == 0u ? aBaseline.counts.*aCount.second : aDone[c - 1u].after.*aCount.second;
+      if (aDone[c].after.*aCount.second > aPrevious) {
+        ++aGrown;
+      }
+    }
+    aX.erase(aX.begin());
+    aY.erase(aY.begin());
+    const auto aFit    = fitLine(aX, aY);
+    const auto aFirst   = aDone.front().after.*aCount.second;
+    const auto aEnd     = aDone.back().after.*aCount.second;
+    const bool aGrowing = aEnd > aFirst and aFit.r2 >= aMinR2 and aFit.slope > 0.0;
+    aGrowth.rows.push_back({ std::string(aCount.first), aBaseline.counts.*aCount.second, aFirst, aEnd, aFit.slope, aFit.r2, aGrown,
+                             std::string(aGrowing ? "yes" : "no") });
+  }
+
+  // mappings and descriptors present after the last cycle and not before the first one, e.g. the module itself
+  // when it cannot be unloaded, or an eventfd per cycle
+  auto& aLeftovers = aReport.table("leftovers", { "kind", "what", "count", "per_cycle" });
+  addLeftovers(aLeftovers, "mapping", aBaseline.mappings, aLast.mappings, aDone.size());
+  addLeftovers(aLeftovers, "fd", aBaseline.fds, aLast.fds, aDone.size());
+  if (aLast.counts.threads > aBaseline.counts.threads) {
+    const auto aExtra = aLast.counts.threads - aBaseline.counts.threads;
+    aLeftovers.rows.push_back({ std::string("threads"), std::string("-"), aExtra, static_cast<double>(aExtra) / static_cast<double>(aDone.size()) });
+  }
+
+  if (not aReport.emit(iOptions)) {
+    return 4;
+  }
+  return aDone.size() == aCycles ? 0 : 1;
+}
+
+}  // namespace bench
@@ -0,0 +1,181 @@
+#include "bench/BenchModes.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/SessionPool.h"
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Step {
+  double targetRate   = 0.0;
+  double achievedRate = 0.0;
+  std::uint64_t errors = 0u;
+  // from the intended send time, coordinated omission corrected
+  Histogram latency;
+  // from the actual send time, what a closed-loop client would report
+  Histogram service;
+  std::uint64_t lateSends = 0u;
+};
+
+struct WorkerResult {
+  Histogram latency;
+  Histogram service;
+  std::uint64_t errors    = 0u;
+  std::uint64_t lateSends = 0u;
+};
+
+std::uint64_t nanos(Clock::duration iDuration) {
+  return static_cast<std::uint64_t>(std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(iDuration).count(), 0));
+}
+
+/**
+ * Request k is due at start + k / iRate whatever happened to the previous ones. Workers take the requests in
+ * order and wait for their due time; when all of them are busy the following requests go out late and their
+ * latency keeps counting from the due time
+ */
+Step runRate(SessionPool& iPool, CK_FUNCTION_LIST_PTR iFunctions, CK_OBJECT_HANDLE iKey, const std::string& iOperation,
+             const std::vector<unsigned char>& iPayload, const std::vector<unsigned char>& iCipherText, double iRate, std::size_t iWorkers,
+             Clock::duration iDuration) {
+  Step aStep;
+  aStep.targetRate     = iRate;
+  const auto aInterval = std::chrono::duration<double>(1.0 / iRate);
+  const auto aCount    = static_cast<std::uint64_t>(std::chrono::duration<double>(iDuration).count() * iRate);
+  const auto aLateness = std::chrono::microseconds(100);
+  std::atomic<std::uint64_t> aNext{ 0u };
+  std::vector<WorkerResult> aResults(iWorkers);
+  std::vector<std::thread> aThreads;
+  const auto aStart = Clock::now() + std::chrono::milliseconds(10);
+  for (std::size_t w = 0u; w < iWorkers; ++w) {
+    aThreads.emplace_back([&, w] {
+      auto& aResult = aResults[w];
+      for (auto k = aNext.fetch_add(1u); k < aCount; k = aNext.fetch_add(1u)) {
+        const auto aDue = aStart + std::chrono::duration_cast<Clock::duration>(aInterval * static_cast<double>(k));
+        std::this_thread::sleep_until(aDue);
+        const auto aSent = Clock::now();
+        if (aSent - aDue > aLateness) {
+          ++aResult.lateSends;
+        }
+        bool aOk;
+        {
+          auto aLease         = iPool.acquire();
+          const bool aEncrypt = iOperation == "encrypt" or (iOperation == "mixed" and k % 2u == 0u);
+          aOk = aLease and (aEncrypt ? HSMUtils::encrypt_aes(iFunctions, aLease->session(), iKey, iPayload)
+                                     : HSMUtils::decrypt_aes(iFunctions, aLease->session(), iKey, iCipherText))
+                               .has_value();
+        }
+        const auto aDone = Clock::now();
+        if (not aOk) {
+          ++aResult.errors;
+          continue;
+        }
+        aResult.latency.record(nanos(aDone - aDue));
+        aResult.service.record(nanos(aDone - aSent));
+      }
+    });
+  }
+  for (auto& aThread : aThreads) {
+    aThread.join();
+  }
+  const auto aElapsed = Clock::now() - aStart;
+  for (const auto& aResult : aResults) {
+    aStep.latency.merge(aResult.latency);
+    aStep.service.merge(aResult.service);
+    aStep.errors += aResult.errors;
+    aStep.lateSends += aResult.lateSends;
+  }
+  aStep.achievedRate = static_cast<double>(aStep.latency.count()) / std::chrono::duration<double>(aElapsed).count();
+  return aStep;
+}
+
+double micros(std::uint64_t iNanos) {
+  return static_cast<double>(iNanos) / 1000.0;
+}
+
+}  // namespace
+
+int runOpenLoop(const Options& iOptions) {
+  std::vector<double> aRates;
+  for (auto aRate : iOptions.getSizes("rates", { 100u, 500u, 1000u, 2000u, 5000u, 10000u, 20000u })) {
+    aRates.push_back(static_cast<double>(aRate));
+  }
+  const auto aWorkers   = iOptions.getSize("workers", 64u);
+  const auto aSessions  = iOptions.getSize("sessions", 8u);
+  const auto aPayload   = std::vector<unsigned char>(iOptions.getSize("payload", 32u), 0xA5);
+  const auto aOperation = iOptions.get("op", "mixed");
+  const auto aDuration  = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(iOptions.getDouble("duration", 5.0)));
+  // the knee is the first rate not sustained, or whose p99 exceeds this many times the one at the lowest rate
+  const auto aKneeFactor = iOptions.getDouble("knee-factor", 10.0);
+  if (aOperation != "encrypt" and aOperation != "decrypt" and aOperation != "mixed") {
+    std::cerr << "--op is encrypt, decrypt or mixed" << std::endl;
+    return 1;
+  }
+  if (aWorkers == 0u or aSessions == 0u or aRates.empty()) {
+    std::cerr << "--workers, --sessions and --rates cannot be empty" << std::endl;
+    return 1;
+  }
+
+  Report aReport("openloop");
+  aReport.parameter("library", iOptions.get("lib", defaultLibPath()));
+  aReport.parameter("operation", aOperation);
+  aReport.parameter("payload_bytes", static_cast<std::uint64_t>(aPayload.size()));
+  aReport.parameter("workers", static_cast<std::uint64_t>(aWorkers));
+  aReport.parameter("sessions", static_cast<std::uint64_t>(aSessions));
+  aReport.parameter("duration_s", std::chrono::duration<double>(aDuration).count());
+  aReport.parameter("knee_factor", aKneeFactor);
+
+  auto aTarget = openTarget(iOptions);
+  if (not aTarget) {
+    return 1;
+  }
+  auto* aFunctions            = aTarget->functions;
+  const std::string aKeyLabel = iOptions.get("key", "PKCS11_BENCH_KEY");
+  auto aKey                   = HSMUtils::getOrCreateKey(aFunctions, aTarget->session, aKeyLabel);
+  auto aCipherText            = aKey ? HSMUtils::encrypt_aes(aFunctions, aTarget->session, aKey.value(), aPayload) : std::nullopt;
+  if (not aCipherText) {
+    std::cerr << "Could not find nor generate " << aKeyLabel << std::endl;
+    closeTarget(aTarget.value());
+    return 3;
+  }
+  SessionPool aPool(aFunctions, iOptions.get("slot", "FKH"), iOptions.get("pin", "1234"));
+  if (not aPool.open(aSessions)) {
+    closeTarget(aTarget.value());
+    return 1;
+  }
+
+  std::vector<Step> aSteps;
+  for (auto aRate : aRates) {
+    aSteps.push_back(runRate(aPool, aFunctions, aKey.value(), aOperation, aPayload, aCipherText.value(), aRate, aWorkers, aDuration));
+  }
+  aPool.close();
+  closeTarget(aTarget.value());
+
+  auto& aTable = aReport.table("latency", { "target_rate", "achieved_rate", "count", "errors", "late_pct", "p50_us", "p90_us", "p99_us",
+                                            "p99.9_us", "p99.99_us", "max_us", "uncorrected_p99_us" });
+  std::optional<double> aKnee;
+  const double aBaseP99 = micros(aSteps.front().latency.percentile(0.99));
+  for (const auto& aStep : aSteps) {
+    const auto& aLatency = aStep.latency;
+    const double aP99    = micros(aLatency.percentile(0.99));
+    const auto aSent     = aLatency.count() + aStep.errors;
+    const double aLate   = aSent > 0u ? 100.0 * static_cast<double>(aStep.lateSends) / static_cast<double>(aSent) : 0.0;
+    aTable.rows.push_back({ aStep.targetRate, aStep.achievedRate, aLatency.count(), aStep.errors, aLate, micros(aLatency.percentile(0.5)),
+                            micros(aLatency.percentile(0.9)), aP99, micros(aLatency.percentile(0.999)), micros(aLatency.percentile(0.9999)),
+                            micros(aLatency.max()), micros(aStep.service.percentile(0.99)) });
+    if (not aKnee and (aStep.achievedRate < 0.95 * aStep.targetRate or aP99 > aKneeFactor * aBaseP99)) {
+      aKnee = aStep.targetRate;
+    }
+  }
+  aReport.parameter("knee_rate", aKnee ? Value(aKnee.value()) : Value(std::string("not reached")));
+
+  if (not aReport.emit(iOptions)) {
+    return 4;
+  }
+  return 0;
+}
+
+}  // namespace bench
@@ -0,0 +1,177 @@
+#include "bench/BenchModes.h"
+#include "hsm/HSMUtils.h"
+#include <iostream>
+#include <set>
+#include <sstream>
+
+namespace bench {
+
+namespace {
+
+const char* const K_OPERATIONS[] = { "openHSMDL", "closeHSMDL", "openSession", "login", "retrieveKeyHandle", "generateKey", "encrypt_aes", "decrypt_aes" };
+
+std::set<std::string> selectedOperations(const Options& iOptions) {
+  std::set<std::string> aSelected;
+  std::istringstream aStream(iOptions.get("ops", ""));
+  std::string aName;
+  while (std::getline(aStream, aName, ',')) {
+    if (not aName.empty()) {
+      aSelected.insert(aName);
+    }
+  }
+  if (aSelected.empty()) {
+    aSelected.insert(std::begin(K_OPERATIONS), std::end(K_OPERATIONS));
+  }
+  return aSelected;
+}
+
+}  // namespace
+
+int runOps(const Options& iOptions) {
+  const auto aLibPath        = iOptions.get("lib", defaultLibPath());
+  const auto aSlot           = iOptions.get("slot", "FKH");
+  const auto aPin            = iOptions.get("pin", "1234");
+  const auto aWarmup         = iOptions.getSize("warmup", 100u);
+  const auto aIterations     = iOptions.getSize("iterations", 10000u);
+  const auto aLoadIterations = iOptions.getSize("load-iterations", 100u);
+  const auto aKeyIterations  = iOptions.getSize("keygen-iterations", 1000u);
+  const auto aPayloadSize    = iOptions.getSize("payload", 32u);
+  const auto aSelected       = selectedOperations(iOptions);
+  auto aWanted               = [&aSelected](const std::string& iName) { return aSelected.count(iName) > 0u; };
+
+  Report aReport("ops");
+  aReport.parameter("library", aLibPath);
+  aReport.parameter("slot", aSlot);
+  aReport.parameter("warmup", static_cast<std::uint64_t>(aWarmup));
+  aReport.parameter("iterations", static_cast<std::uint64_t>(aIterations));
+  aReport.parameter("load_iterations", static_cast<std::uint64_t>(aLoadIterations));
+  aReport.parameter("keygen_iterations", static_cast<std::uint64_t>(aKeyIterations));
+  aReport.parameter("payload_bytes", static_cast<std::uint64_t>(aPayloadSize));
+  auto& aTable = aReport.table("latency", { "operation", "count", "mean_us", "median_us", "p99_us", "p99.9_us", "max_us", "ops_per_sec" });
+  int aResult  = 0;
+  auto aRecord = [&](const std::string& iName, std::optional<std::vector<std::uint64_t>> iSamples) {
+    if (not iSamples) {
+      std::cerr << iName << " failed" << std::endl;
+      aResult = 2;
+      return;
+    }
+    std::uint64_t aTotal = 0u;
+    for (auto aSample : iSamples.value()) {
+      aTotal += aSample;
+    }
+    // rate of the timed calls alone, without the untimed setup some iterations need
+    auto aSummary = summarize(iSamples.value(), std::chrono::nanoseconds(aTotal));
+    aTable.rows.push_back({ iName, static_cast<std::uint64_t>(aSummary.count), aSummary.meanUs, aSummary.medianUs, aSummary.p99Us,
+                            aSummary.p999Us, aSummary.maxUs, aSummary.opsPerSec });
+  };
+
+  // load / unload first, while no other handle keeps the library loaded and initialized
+  if (aWanted("openHSMDL") or aWanted("closeHSMDL")) {
+    const auto aLoadWarmup = std::min<std::size_t>(aWarmup, 5u);
+    std::vector<std::uint64_t> aCloseSamples;
+    auto aOpenSamples = repeat(aLoadWarmup, aLoadIterations, [&](std::size_t i) -> std::optional<std::uint64_t> {
+      std::pair<void*, CK_FUNCTION_LIST_PTR> aLoaded;
+      auto aOpen = timed([&] {
+        aLoaded = HSMUtils::openHSMDL(aLibPath);
+        return aLoaded.first != nullptr;
+      });
+      if (not aOpen) {
+        return {};
+      }
+      auto aClose = timed([&] { return HSMUtils::closeHSMDL(aLoaded.first, aLoaded.second); });
+      if (not aClose) {
+        return {};
+      }
+      if (i >= aLoadWarmup) {
+        aCloseSamples.push_back(aClose.value());
+      }
+      return aOpen;
+    });
+    if (aWanted("openHSMDL")) {
+      aRecord("openHSMDL", aOpenSamples);
+    }
+    if (aWanted("closeHSMDL")) {
+      aRecord("closeHSMDL", aOpenSamples ? std::make_optional(aCloseSamples) : std::nullopt);
+    }
+  }
+
+  auto aTarget = openTarget(iOptions);
+  if (not aTarget) {
+    return 1;
+  }
+  auto* aFunctions = aTarget->functions;
+  auto aSession    = aTarget->session;
+
+  if (aWanted("openSession")) {
+    aRecord("openSession", repeat(aWarmup, aIterations, [&](std::size_t) -> std::optional<std::uint64_t> {
+              std::optional<CK_SESSION_HANDLE> aOpened;
+              auto aSample = timed([&] {
+                aOpened = HSMUtils::openSession(aFunctions, aSlot, SessionAccess::ReadOnly);
+                return aOpened.has_value();
+              });
+              if (aOpened) {
+                // no C_Logout, the benchmark session stays logged in
+                aFunctions->C_CloseSession(aOpened.value());
+              }
+              return aSample;
+            }));
+  }
+
+  if (aWanted("login")) {
+    aRecord("login", repeat(aWarmup, aIterations, [&](std::size_t) {
+              aFunctions->C_Logout(aSession);
+              return timed([&] { return HSMUtils::login(aFunctions, aSession, aPin); });
+            }));
+  }
+
+  const std::string aKeyLabel = iOptions.get("key", "PKCS11_BENCH_KEY");
+  auto aKey                   = HSMUtils::getOrCreateKey(aFunctions, aSession, aKeyLabel);
+  if (not aKey) {
+    std::cerr << "Could not find nor generate " << aKeyLabel << std::endl;
+    closeTarget(aTarget.value());
+    return 3;
+  }
+
+  if (aWanted("retrieveKeyHandle")) {
+    aRecord("retrieveKeyHandle", repeat(aWarmup, aIterations, [&](std::size_t) {
+              return timed([&] { return HSMUtils::retrieveKeyHandle(aFunctions, aSession, aKeyLabel).has_value(); });
+            }));
+  }
+
+  if (aWanted("generateKey")) {
+    aRecord("generateKey", repeat(std::min(aWarmup, aKeyIterations), aKeyIterations, [&](std::size_t i) -> std::optional<std::uint64_t> {
+              std::optional<CK_OBJECT_HANDLE> aGenerated;
+              auto aSample = timed([&] {
+                aGenerated = HSMUtils::generateKey(aFunctions, aSession, "PKCS11_BENCH_GENERATED_" + std::to_string(i));
+                return aGenerated.has_value();
+              });
+              // leave the token as it was
+              if (aGenerated) {
+                HSMUtils::destroyObject(aFunctions, aSession, aGenerated.value());
+              }
+              return aSample;
+            }));
+  }
+
+  const std::vector<unsigned char> aPayload(aPayloadSize, 0xA5);
+  if (aWanted("encrypt_aes")) {
+    aRecord("encrypt_aes", repeat(aWarmup, aIterations, [&](std::size_t) {
+              return timed([&] { return HSMUtils::encrypt_aes(aFunctions, aSession, aKey.value(), aPayload).has_value(); });
+            }));
+  }
+
+  if (aWanted("decrypt_aes")) {
+    auto aCipherText = HSMUtils::encrypt_aes(aFunctions, aSession, aKey.value(), aPayload);
+    aRecord("decrypt_aes", aCipherText ? repeat(aWarmup, aIterations, [&](std::size_t) {
+      return timed([&] { return HSMUtils::decrypt_aes(aFunctions, aSession, aKey.value(), aCipherText.value()).has_value(); });
+    }) : std::nullopt);
+  }
+
+  closeTarget(aTarget.value());
+  if (not aReport.emit(iOptions)) {
+    return 4;
+  }
+  return aResult;
+}
+
+}  // namespace bench
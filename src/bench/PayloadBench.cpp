@@ -0,0 +1,189 @@
+#include "bench/BenchModes.h"
+#include "hsm/HSMUtils.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+namespace bench {
+
+namespace {
+
+struct Measure {
+  std::size_t payload;
+  // 0 for single-part encrypt_aes
+  std::size_t chunk;
+  std::optional<LatencySummary> summary;
+  double mbPerSec = 0.0;
+};
+
+std::string sizeText(std::size_t iSize) {
+  if (iSize >= (1u << 30) and iSize % (1u << 30) == 0u) {
+    return std::to_string(iSize >> 30) + "G";
+  }
+  if (iSize >= (1u << 20) and iSize % (1u << 20) == 0u) {
+    return std::to_string(iSize >> 20) + "M";
+  }
+  if (iSize >= (1u << 10) and iSize % (1u << 10) == 0u) {
+    return std::to_string(iSize >> 10) + "K";
+  }
+  return std::to_string(iSize);
+}
+
+std::string methodText(std::size_t iChunk) {
+  return iChunk == 0u ? "single" : "multipart:" + sizeText(iChunk);
+}
+
+/**
+ * Calls iEncrypt until both iMinIterations and iMinTime are reached, or iMaxIterations
+ */
+template <typename Encrypt>
+std::optional<LatencySummary> measure(std::size_t iMinIterations, std::size_t iMaxIterations, std::chrono::nanoseconds iMinTime, Encrypt&& iEncrypt) {
+  // warm-up, also faults in the output buffers of the module
+  if (not iEncrypt()) {
+    return {};
+  }
+  std::vector<std::uint64_t> aSamples;
+  std::chrono::nanoseconds aElapsed(0);
+  while (aSamples.size() < iMaxIterations and (aSamples.size() < iMinIterations or aElapsed < iMinTime)) {
+    auto aSample = timed(iEncrypt);
+    if (not aSample) {
+      return {};
+    }
+    aSamples.push_back(aSample.value());
+    aElapsed += std::chrono::nanoseconds(aSample.value());
+  }
+  return summarize(aSamples, aElapsed);
+}
+
+}  // namespace
+
+int runPayload(const Options& iOptions) {
+  const auto aMaxPayload    = iOptions.getSize("max-payload", std::size_t(1) << 30);
+  const auto aMinIterations = iOptions.getSize("min-iterations", 3u);
+  const auto aMaxIterations = iOptions.getSize("iterations", 1000u);
+  const auto aMinTime       = std::chrono::nanoseconds(static_cast<std::int64_t>(iOptions.getDouble("min-time", 0.2) * 1e9));
+  // multi-part within this fraction of single-part counts as not slower, so that noise does not hide the crossover
+  const auto aTolerance = iOptions.getDouble("tolerance", 0.02);
+  std::vector<std::size_t> aDefaultPayloads;
+  for (std::size_t aSize = 16u; aSize <= aMaxPayload; aSize *= 4u) {
+    aDefaultPayloads.push_back(aSize);
+  }
+  if (aDefaultPayloads.empty() or aDefaultPayloads.back() != aMaxPayload) {
+    aDefaultPayloads.push_back(aMaxPayload);
+  }
+  const auto aPayloads = iOptions.getSizes("payloads", aDefaultPayloads);
+  const auto aChunks   = iOptions.getSizes("chunks", { 1u << 10, 4u << 10, 16u << 10, 64u << 10, 256u << 10, 1u << 20 });
+
+  Report aReport("payload");
+  aReport.parameter("payloads", std::to_string(aPayloads.size()) + " sizes from " + sizeText(aPayloads.front()) + " to " + sizeText(aPayloads.back()));
+  aReport.parameter("min_iterations", static_cast<std::uint64_t>(aMinIterations));
+  aReport.parameter("max_iterations", static_cast<std::uint64_t>(aMaxIterations));
+  aReport.parameter("min_time_s", static_cast<double>(aMinTime.count()) / 1e9);
+  aReport.parameter("tolerance", aTolerance);
+
+  auto aTarget = openTarget(iOptions);
+  if (not aTarget) {
+    return 1;
+  }
+  aReport.parameter("library", iOptions.get("lib", defaultLibPath()));
+  auto* aFunctions            = aTarget->functions;
+  auto aSession               = aTarget->session;
+  const std::string aKeyLabel = iOptions.get("key", "PKCS11_BENCH_KEY");
+  auto aKey                   = HSMUtils::getOrCreateKey(aFunctions, aSession, aKeyLabel);
+  if (not aKey) {
+    std::cerr << "Could not find nor generate " << aKeyLabel << std::endl;
+    closeTarget(aTarget.value());
+    return 3;
+  }
+
+  std::vector<Measure> aMeasures;
+  for (auto aPayloadSize : aPayloads) {
+    std::vector<unsigned char> aPayload(aPayloadSize, 0xA5);
+    std::vector<std::size_t> aMethods{ 0u };
+    for (auto aChunk : aChunks) {
+      // chunks as large as the payload are all a single C_EncryptUpdate, measured once
+      aMethods.push_back(std::min(aChunk, aPayloadSize));
+    }
+    std::sort(aMethods.begin(), aMethods.end());
+    aMethods.erase(std::unique(aMethods.begin(), aMethods.end()), aMethods.end());
+    for (auto aChunk : aMethods) {
+      Measure aMeasure{ aPayloadSize, aChunk, {} };
+      aMeasure.summary = measure(aMinIterations, aMaxIterations, aMinTime, [&] {
+        return (aChunk == 0u ? HSMUtils::encrypt_aes(aFunctions, aSession, aKey.value(), aPayload)
+                             : HSMUtils::encrypt_aes_multipart(aFunctions, aSession, aKey.value(), aPayload, aChunk))
+            .has_value();
+      });
+      if (aMeasure.summary and aMeasure.summary->medianUs > 0.0) {
+        aMeasure.mbPerSec = static_cast<double>(aPayloadSize) / aMeasure.summary->medianUs;
+      } else if (not aMeasure.summary) {
+        std::cerr << methodText(aChunk) << " failed for " << sizeText(aPayloadSize) << " bytes, " << std::hex << HSMUtils::lastError() << std::dec
+                  << std::endl;
+      }
+      aMeasures.push_back(aMeasure);
+    }
+  }
+  closeTarget(aTarget.value());
+
+  // curves: one row per payload and method, MB/s from the median latency
+  auto& aCurves = aReport.table("throughput", { "payload", "method", "iterations", "median_us", "p99_us", "mb_per_s" });
+  for (const auto& aMeasure : aMeasures) {
+    if (aMeasure.summary) {
+      aCurves.rows.push_back({ sizeText(aMeasure.payload), methodText(aMeasure.chunk), static_cast<std::uint64_t>(aMeasure.summary->count),
+                               aMeasure.summary->medianUs, aMeasure.summary->p99Us, aMeasure.mbPerSec });
+    } else {
+      aCurves.rows.push_back({ sizeText(aMeasure.payload), methodText(aMeasure.chunk), std::uint64_t(0), std::string("failed"),
+                               std::string("failed"), 0.0 });
+    }
+  }
+
+  // best multi-part chunk against single-part for every payload
+  auto& aBest = aReport.table("best", { "payload", "single_mb_per_s", "best_chunk", "multipart_mb_per_s", "faster" });
+  std::map<std::size_t, double> aSingle;
+  for (const auto& aMeasure : aMeasures) {
+    if (aMeasure.chunk == 0u) {
+      aSingle[aMeasure.payload] = aMeasure.mbPerSec;
+    }
+  }
+  for (auto aPayloadSize : aPayloads) {
+    const Measure* aTop = nullptr;
+    for (const auto& aMeasure : aMeasures) {
+      if (aMeasure.payload == aPayloadSize and aMeasure.chunk != 0u and (not aTop or aMeasure.mbPerSec > aTop->mbPerSec)) {
+        aTop = &aMeasure;
+      }
+    }
+    const double aMultipart = aTop ? aTop->mbPerSec : 0.0;
+    aBest.rows.push_back({ sizeText(aPayloadSize), aSingle[aPayloadSize], aTop ? sizeText(aTop->chunk) : std::string("-"), aMultipart,
+                           std::string(aMultipart > aSingle[aPayloadSize] ? "multipart" : "single") });
+  }
+
+  // crossover of each chunk size: smallest payload from which multi-part stays as fast as single-part (within aTolerance)
+  auto& aCrossover = aReport.table("crossover", { "chunk", "multipart_from_payload", "mb_per_s_at_largest" });
+  for (auto aChunk : aChunks) {
+    std::optional<std::size_t> aFrom;
+    double aLargest = 0.0;
+    for (auto aPayloadSize : aPayloads) {
+      auto aIt = std::find_if(aMeasures.begin(), aMeasures.end(), [&](const Measure& iMeasure) {
+        return iMeasure.payload == aPayloadSize and iMeasure.chunk == std::min(aChunk, aPayloadSize);
+      });
+      if (aIt == aMeasures.end()) {
+        continue;
+      }
+      aLargest = aIt->mbPerSec;
+      if (aIt->summary and aIt->mbPerSec >= aSingle[aPayloadSize] * (1.0 - aTolerance)) {
+        if (not aFrom) {
+          aFrom = aPayloadSize;
+        }
+      } else {
+        aFrom.reset();
+      }
+    }
+    aCrossover.rows.push_back({ sizeText(aChunk), aFrom ? sizeText(aFrom.value()) : std::string("never"), aLargest });
+  }
+
+  if (not aReport.emit(iOptions)) {
+    return 4;
+  }
+  return 0;
+}
+
+}  // namespace bench
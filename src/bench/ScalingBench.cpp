@@ -0,0 +1,266 @@
+#include "bench/BenchModes.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/SessionPool.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <numeric>
+#include <thread>
+
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Run {
+  std::size_t payload  = 0u;
+  std::size_t threads  = 0u;
+  std::size_t sessions = 0u;
+  bool opened          = false;
+  std::uint64_t ops    = 0u;
+  std::uint64_t errors = 0u;
+  LatencySummary latency;
+  double perThreadOpsPerSec = 0.0;
+  // share of the request latency spent waiting for a free session
+  double waitPct = 0.0;
+};
+
+struct ThreadResult {
+  std::vector<std::uint64_t> latencies;
+  std::uint64_t waitNs = 0u;
+  std::uint64_t errors = 0u;
+};
+
+/**
+ * iThreads threads encrypting (iOperation "encrypt"), decrypting ("decrypt") or alternating both ("mixed")
+ * through one SessionPool of iSessions sessions
+ */
+Run runOne(const Target& iTarget, const Options& iOptions, CK_OBJECT_HANDLE iKey, const std::string& iOperation, std::size_t iPayload,
+           std::size_t iThreads, std::size_t iSessions, Clock::duration iWarmup, Clock::duration iDuration) {
+  Run aRun;
+  aRun.payload  = iPayload;
+  aRun.threads  = iThreads;
+  aRun.sessions = iSessions;
+  SessionPool aPool(iTarget.functions, iOptions.get("slot", "FKH"), iOptions.get("pin", "1234"));
+  if (not aPool.open(iSessions)) {
+    return aRun;
+  }
+  aRun.opened = true;
+
+  const std::vector<unsigned char> aPayload(iPayload, 0xA5);
+  std::optional<std::vector<unsigned char>> aCipherText;
+  if (auto aLease = aPool.acquire()) {
+    aCipherText = HSMUtils::encrypt_aes(iTarget.functions, aLease->session(), iKey, aPayload);
+  }
+  if (not aCipherText) {
+    aPool.close();
+    aRun.opened = false;
+    return aRun;
+  }
+
+  std::vector<ThreadResult> aResults(iThreads);
+  std::vector<std::thread> aThreads;
+  std::atomic<bool> aGo{ false };
+  Clock::time_point aMeasureFrom;
+  Clock::time_point aEnd;
+  for (std::size_t t = 0u; t < iThreads; ++t) {
+    aThreads.emplace_back([&, t] {
+      auto& aResult = aResults[t];
+      while (not aGo.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      for (std::size_t i = t;; ++i) {
+        auto aStart = Clock::now();
+        if (aStart >= aEnd) {
+          break;
+        }
+        bool aOk;
+        Clock::time_point aLeased;
+        {
+          auto aLease = aPool.acquire();
+          aLeased     = Clock::now();
+          const bool aEncrypt = iOperation == "encrypt" or (iOperation == "mixed" and i % 2u == 0u);
+          aOk = aLease and (aEncrypt ? HSMUtils::encrypt_aes(iTarget.functions, aLease->session(), iKey, aPayload)
+                                     : HSMUtils::decrypt_aes(iTarget.functions, aLease->session(), iKey, aCipherText.value()))
+                               .has_value();
+        }
+        auto aDone = Clock::now();
+        if (aStart < aMeasureFrom) {
+          continue;
+        }
+        if (not aOk) {
+          ++aResult.errors;
+          continue;
+        }
+        aResult.latencies.push_back(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(aDone - aStart).count()));
+        aResult.waitNs += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(aLeased - aStart).count());
+      }
+    });
+  }
+  aMeasureFrom = Clock::now() + iWarmup;
+  aEnd         = aMeasureFrom + iDuration;
+  aGo.store(true, std::memory_order_release);
+  for (auto& aThread : aThreads) {
+    aThread.join();
+  }
+  aPool.close();
+
+  std::vector<std::uint64_t> aLatencies;
+  std::uint64_t aWaitNs = 0u;
+  for (auto& aResult : aResults) {
+    aLatencies.insert(aLatencies.end(), aResult.latencies.begin(), aResult.latencies.end());
+    aWaitNs += aResult.waitNs;
+    aRun.errors += aResult.errors;
+  }
+  const double aBusyNs = std::accumulate(aLatencies.begin(), aLatencies.end(), 0.0);
+  aRun.ops             = aLatencies.size();
+  aRun.latency         = summarize(aLatencies, iDuration);
+  aRun.perThreadOpsPerSec = aRun.latency.opsPerSec / static_cast<double>(iThreads);
+  aRun.waitPct            = aBusyNs > 0.0 ? 100.0 * static_cast<double>(aWaitNs) / aBusyNs : 0.0;
+  return aRun;
+}
+
+}  // namespace
+
+int runScaling(const Options& iOptions) {
+  const auto aThreadCounts  = iOptions.getSizes("threads", { 1u, 2u, 4u, 8u, 16u, 32u, 64u, 128u, 256u });
+  const auto aSessionCounts = iOptions.getSizes("sessions", { 1u, 2u, 4u, 8u, 16u, 32u, 64u });
+  const auto aPayloads      = iOptions.getSizes("payloads", { 32u });
+  const auto aOperation     = iOptions.get("op", "mixed");
+  const auto aDuration      = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(iOptions.getDouble("duration", 1.0)));
+  const auto aWarmup        = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(iOptions.getDouble("warmup-time", 0.1)));
+  // doubling the threads has to add this fraction of throughput, below it the curve is flat
+  const auto aFlatGain = iOptions.getDouble("flat-gain", 0.1);
+  if (aOperation != "encrypt" and aOperation != "decrypt" and aOperation != "mixed") {
+    std::cerr << "--op is encrypt, decrypt or mixed" << std::endl;
+    return 1;
+  }
+
+  Report aReport("scaling");
+  aReport.parameter("library", iOptions.get("lib", defaultLibPath()));
+  aReport.parameter("operation", aOperation);
+  aReport.parameter("duration_s", std::chrono::duration<double>(aDuration).count());
+  aReport.parameter("warmup_s", std::chrono::duration<double>(aWarmup).count());
+  aReport.parameter("flat_gain", aFlatGain);
+
+  auto aTarget = openTarget(iOptions);
+  if (not aTarget) {
+    return 1;
+  }
+  const std::string aKeyLabel = iOptions.get("key", "PKCS11_BENCH_KEY");
+  auto aKey                   = HSMUtils::getOrCreateKey(aTarget->functions, aTarget->session, aKeyLabel);
+  if (not aKey) {
+    std::cerr << "Could not find nor generate " << aKeyLabel << std::endl;
+    closeTarget(aTarget.value());
+    return 3;
+  }
+
+  std::vector<Run> aRuns;
+  for (auto aPayload : aPayloads) {
+    for (auto aSessions : aSessionCounts) {
+      for (auto aThreads : aThreadCounts) {
+        // sessions beyond the thread count stay idle
+        if (aSessions > aThreads) {
+          continue;
+        }
+        aRuns.push_back(runOne(aTarget.value(), iOptions, aKey.value(), aOperation, aPayload, aThreads, aSessions, aWarmup, aDuration));
+        if (not aRuns.back().opened) {
+          std::cerr << "Could not run " << aThreads << " threads over " << aSessions << " sessions" << std::endl;
+        }
+      }
+    }
+  }
+  closeTarget(aTarget.value());
+
+  auto& aTable = aReport.table("scaling", { "payload", "sessions", "threads", "ops", "ops_per_sec", "per_thread_ops_per_sec", "p50_us", "p99_us",
+                                            "wait_pct", "errors" });
+  for (const auto& aRun : aRuns) {
+    if (aRun.opened) {
+      aTable.rows.push_back({ static_cast<std::uint64_t>(aRun.payload), static_cast<std::uint64_t>(aRun.sessions),
+                              static_cast<std::uint64_t>(aRun.threads), aRun.ops, aRun.latency.opsPerSec, aRun.perThreadOpsPerSec,
+                              aRun.latency.medianUs, aRun.latency.p99Us, aRun.waitPct, aRun.errors });
+    } else {
+      aTable.rows.push_back({ static_cast<std::uint64_t>(aRun.payload), static_cast<std::uint64_t>(aRun.sessions),
+                              static_cast<std::uint64_t>(aRun.threads), std::uint64_t(0), std::string("no sessions"), 0.0, 0.0, 0.0, 0.0,
+                              std::uint64_t(0) });
+    }
+  }
+
+  // per payload and session count: first thread count after which more threads stop paying off. When more
+  // sessions reach a higher peak the session count is the limit, when they do not the calls serialize inside
+  // the module, when they could not be opened the token's session limit is reached
+  auto& aPlateau = aReport.table("plateau", { "payload", "sessions", "peak_ops_per_sec", "peak_threads", "flat_from_threads", "limited_by" });
+  for (auto aPayload : aPayloads) {
+    std::vector<std::pair<std::size_t, double>> aPeaks;
+    for (auto aSessions : aSessionCounts) {
+      double aPeak = 0.0;
+      for (const auto& aRun : aRuns) {
+        if (aRun.payload == aPayload and aRun.sessions == aSessions and aRun.opened) {
+          aPeak = std::max(aPeak, aRun.latency.opsPerSec);
+        }
+      }
+      aPeaks.emplace_back(aSessions, aPeak);
+    }
+    for (auto aSessions : aSessionCounts) {
+      std::vector<const Run*> aCurve;
+      bool aAttempted = false;
+      for (const auto& aRun : aRuns) {
+        if (aRun.payload == aPayload and aRun.sessions == aSessions) {
+          aAttempted = true;
+          if (aRun.opened) {
+            aCurve.push_back(&aRun);
+          }
+        }
+      }
+      if (aCurve.empty()) {
+        if (aAttempted) {
+          aPlateau.rows.push_back({ static_cast<std::uint64_t>(aPayload), static_cast<std::uint64_t>(aSessions), 0.0, std::string("-"),
+                                    std::string("-"), std::string("session limit") });
+        }
+        continue;
+      }
+      const Run* aPeak = *std::max_element(aCurve.begin(), aCurve.end(), [](const Run* iLeft, const Run* iRight) {
+        return iLeft->latency.opsPerSec < iRight->latency.opsPerSec;
+      });
+      const Run* aFlat = nullptr;
+      for (std::size_t i = 0u; i + 1u < aCurve.size(); ++i) {
+        const double aGain = aCurve[i]->latency.opsPerSec > 0.0 ? aCurve[i + 1u]->latency.opsPerSec / aCurve[i]->latency.opsPerSec - 1.0 : 0.0;
+        const double aScale = static_cast<double>(aCurve[i + 1u]->threads) / static_cast<double>(aCurve[i]->threads) - 1.0;
+        // gain relative to a doubling of the threads
+        if (aScale > 0.0 and aGain < aFlatGain * aScale) {
+          aFlat = aCurve[i];
+          break;
+        }
+      }
+      std::string aLimit = "-";
+      if (aFlat) {
+        aLimit = "untested";
+        for (const auto& aOther : aPeaks) {
+          if (aOther.first <= aSessions or aLimit == "sessions") {
+            continue;
+          }
+          if (aOther.second > aPeak->latency.opsPerSec * (1.0 + aFlatGain)) {
+            aLimit = "sessions";
+          } else if (aOther.second > 0.0) {
+            aLimit = "module";
+          } else if (aLimit == "untested" and std::any_of(aRuns.begin(), aRuns.end(), [&](const Run& iRun) {
+                       return iRun.payload == aPayload and iRun.sessions == aOther.first;
+                     })) {
+            aLimit = "session limit";
+          }
+        }
+      }
+      aPlateau.rows.push_back({ static_cast<std::uint64_t>(aPayload), static_cast<std::uint64_t>(aSessions), aPeak->latency.opsPerSec,
+                                static_cast<std::uint64_t>(aPeak->threads),
+                                aFlat ? Value(static_cast<std::uint64_t>(aFlat->threads)) : Value(std::string("not reached")), aLimit });
+    }
+  }
+
+  if (not aReport.emit(iOptions)) {
+    return 4;
+  }
+  return 0;
+}
+
+}  // namespace bench
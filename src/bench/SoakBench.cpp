@@ -0,0 +1,202 @@
+#include "bench/BenchModes.h"
+#include "hsm/AllocationTracker.h"
+#include "hsm/HSMUtils.h"
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <sstream>
+
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* const K_OPERATIONS[] = { "encrypt", "decrypt", "find", "open_close" };
+
+struct Sample {
+  std::uint64_t ops = 0u;
+  ProcessSample process;
+};
+
+struct Phase {
+  std::string operation;
+  std::uint64_t ops    = 0u;
+  std::uint64_t errors = 0u;
+  double opsPerSec     = 0.0;
+  std::vector<Sample> samples;
+};
+
+/**
+ * Calls iCall iIterations times, sampling the process before the first call and every iSampleEvery calls
+ */
+Phase soak(const std::string& iOperation, std::size_t iIterations, std::size_t iSampleEvery, const std::function<bool()>& iCall) {
+  Phase aPhase;
+  aPhase.operation = iOperation;
+  // reserved up front, a growing vector would show up in the heap samples
+  aPhase.samples.reserve(iIterations / iSampleEvery + 2u);
+  aPhase.samples.push_back({ 0u, sampleProcess() });
+  const auto aStart = Clock::now();
+  for (std::size_t i = 1u; i <= iIterations; ++i) {
+    if (not iCall()) {
+      ++aPhase.errors;
+    }
+    if (i % iSampleEvery == 0u or i == iIterations) {
+      aPhase.samples.push_back({ i, sampleProcess() });
+    }
+  }
+  const auto aElapsed = std::chrono::duration<double>(Clock::now() - aStart).count();
+  aPhase.ops          = iIterations;
+  aPhase.opsPerSec    = aElapsed > 0.0 ? static_cast<double>(iIterations) / aElapsed : 0.0;
+  return aPhase;
+}
+
+/**
+ * Fit of one resource against the operation count, on the samples left after the settling ones
+ */
+LinearFit fitResource(const std::vector<Sample>& iSamples, std::size_t iFrom, std::uint64_t ProcessSample::*iResource) {
+  std::vector<double> aOps;
+  std::vector<double> aValues;
+  for (std::size_t i = iFrom; i < iSamples.size(); ++i) {
+    aOps.push_back(static_cast<double>(iSamples[i].ops));
+    aValues.push_back(static_cast<double>(iSamples[i].process.*iResource));
+  }
+  return fitLine(aOps, aValues);
+}
+
+}  // namespace
+
+int runSoak(const Options& iOptions) {
+  const auto aIterations  = iOptions.getSize("iterations", 1000000u);
+  const auto aSampleEvery = iOptions.getSize("sample-every", 10000u);
+  const auto aPayload     = std::vector<unsigned char>(iOptions.getSize("payload", 32u), 0xA5);
+  // first samples left out of the fits: caches, arenas and pools of the module fill up there
+  const auto aSettle = iOptions.getDouble("settle", 0.1);
+  // a resource grows when the fit explains at least this share of its variance and adds up to at least min-growth
+  // bytes (one descriptor or thread) over the phase
+  const auto aMinR2     = iOptions.getDouble("min-r2", 0.9);
+  const auto aMinGrowth = iOptions.getSize("min-growth", 64u << 10);
+  std::vector<std::string> aOperations;
+  {
+    std::istringstream aList(iOptions.get("ops", "encrypt,decrypt,find,open_close"));
+    std::string aName;
+    while (std::getline(aList, aName, ',')) {
+      if (std::find(std::begin(K_OPERATIONS), std::end(K_OPERATIONS), aName) == std::end(K_OPERATIONS)) {
+        std::cerr << "unknown operation " << aName << ", --ops takes encrypt, decrypt, find and open_close" << std::endl;
+        return 1;
+      }
+      aOperations.push_back(aName);
+    }
+  }
+  if (aIterations == 0u or aSampleEvery == 0u) {
+    std::cerr << "--iterations and --sample-every cannot be 0" << std::endl;
+    return 1;
+  }
+
+  Report aReport("soak");
+  aReport.parameter("library", iOptions.get("lib", defaultLibPath()));
+  aReport.parameter("iterations", static_cast<std::uint64_t>(aIterations));
+  aReport.parameter("sample_every", static_cast<std::uint64_t>(aSampleEvery));
+  aReport.parameter("payload_bytes", static_cast<std::uint64_t>(aPayload.size()));
+  aReport.parameter("settle", aSettle);
+  aReport.parameter("min_r2", aMinR2);
+  aReport.parameter("min_growth_bytes", static_cast<std::uint64_t>(aMinGrowth));
+
+  auto aTarget = openTarget(iOptions);
+  if (not aTarget) {
+    return 1;
+  }
+  auto* aFunctions            = aTarget->functions;
+  auto aSession               = aTarget->session;
+  const std::string aKeyLabel = iOptions.get("key", "PKCS11_BENCH_KEY");
+  auto aKey                   = HSMUtils::getOrCreateKey(aFunctions, aSession, aKeyLabel);
+  auto aCipherText            = aKey ? HSMUtils::encrypt_aes(aFunctions, aSession, aKey.value(), aPayload) : std::nullopt;
+  if (not aCipherText) {
+    std::cerr << "Could not find nor generate " << aKeyLabel << std::endl;
+    closeTarget(aTarget.value());
+    return 3;
+  }
+
+  // allocations per PKCS#11 function when the pkcs11_alloc_tracker interposer is preloaded
+  auto aAllocations = AllocationTracker::create();
+  aReport.parameter("allocation_tracker", std::string(aAllocations ? "loaded" : "not loaded"));
+  if (aAllocations) {
+    CallObservers::add(aAllocations);
+  }
+
+  std::vector<Phase> aPhases;
+  for (const auto& aOperation : aOperations) {
+    std::cerr << "soak " << aOperation << ": " << aIterations << " iterations" << std::endl;
+    std::function<bool()> aCall;
+    if (aOperation == "encrypt") {
+      aCall = [&] { return HSMUtils::encrypt_aes(aFunctions, aSession, aKey.value(), aPayload).has_value(); };
+    } else if (aOperation == "decrypt") {
+      aCall = [&] { return HSMUtils::decrypt_aes(aFunctions, aSession, aKey.value(), aCipherText.value()).has_value(); };
+    } else if (aOperation == "find") {
+      aCall = [&] { return HSMUtils::retrieveKeyHandle(aFunctions, aSession, aKeyLabel).has_value(); };
+    } else {
+      // plain C_CloseSession: closeSession would also log the token out under the other phases
+      aCall = [&] {
+        auto aOpened = HSMUtils::openSession(aFunctions, aTarget->slot, SessionAccess::ReadOnly);
+        return aOpened and aFunctions->C_CloseSession(aOpened.value()) == CKR_OK;
+      };
+    }
+    aPhases.push_back(soak(aOperation, aIterations, aSampleEvery, aCall));
+  }
+  closeTarget(aTarget.value());
+  if (aAllocations) {
+    CallObservers::remove(aAllocations);
+    auto& aTable = aReport.table("allocations", { "function", "calls", "allocations", "allocated_bytes", "frees", "freed_bytes",
+                                                  "outstanding_blocks", "outstanding_bytes", "outstanding_bytes_per_call" });
+    for (const auto& aSite : aAllocations->sites()) {
+      aTable.rows.push_back({ std::string(aSite.function), aSite.calls, aSite.allocations, aSite.allocatedBytes, aSite.frees, aSite.freedBytes,
+                              aSite.outstandingBlocks, aSite.outstandingBytes,
+                              aSite.calls > 0u ? static_cast<double>(aSite.outstandingBytes) / static_cast<double>(aSite.calls) : 0.0 });
+    }
+  }
+
+  if (iOptions.has("samples")) {
+    auto& aSamples = aReport.table("samples", { "operation", "ops", "rss_bytes", "heap_bytes", "fds", "threads" });
+    for (const auto& aPhase : aPhases) {
+      for (const auto& aSample : aPhase.samples) {
+        aSamples.rows.push_back({ aPhase.operation, aSample.ops, aSample.process.rssBytes, aSample.process.heapBytes, aSample.process.fds,
+                                  aSample.process.threads });
+      }
+    }
+  }
+
+  // bytes per operation are the slopes of heap in use and RSS against the operation count. A slope the fit does
+  // not explain (low r2) is allocator noise, one that adds up to less than min-growth over the phase is a cache
+  auto& aGrowth = aReport.table("growth", { "operation", "ops", "ops_per_sec", "errors", "heap_bytes_per_op", "heap_r2", "rss_bytes_per_op",
+                                            "rss_r2", "fd_growth", "thread_growth", "growing" });
+  for (const auto& aPhase : aPhases) {
+    const auto aFrom  = std::min(static_cast<std::size_t>(aSettle * static_cast<double>(aPhase.samples.size())), aPhase.samples.size() - 2u);
+    const auto& aFirst = aPhase.samples[aFrom].process;
+    const auto& aLast  = aPhase.samples.back().process;
+    const double aSpan = static_cast<double>(aPhase.samples.back().ops - aPhase.samples[aFrom].ops);
+    const auto aHeap   = fitResource(aPhase.samples, aFrom, &ProcessSample::heapBytes);
+    const auto aRss    = fitResource(aPhase.samples, aFrom, &ProcessSample::rssBytes);
+    const auto aFds    = fitResource(aPhase.samples, aFrom, &ProcessSample::fds);
+    const auto aThreads = fitResource(aPhase.samples, aFrom, &ProcessSample::threads);
+    const auto aGrows   = [&](const LinearFit& iFit, double iMinGrowth) { return iFit.r2 >= aMinR2 and iFit.slope * aSpan >= iMinGrowth; };
+    std::string aGrowing;
+    for (const auto& aCheck : { std::make_pair("heap", aGrows(aHeap, static_cast<double>(aMinGrowth))),
+                                std::make_pair("rss", aGrows(aRss, static_cast<double>(aMinGrowth))), std::make_pair("fds", aGrows(aFds, 1.0)),
+                                std::make_pair("threads", aGrows(aThreads, 1.0)) }) {
+      if (aCheck.second) {
+        aGrowing += (aGrowing.empty() ? "" : ",") + std::string(aCheck.first);
+      }
+    }
+    aGrowth.rows.push_back({ aPhase.operation, aPhase.ops, aPhase.opsPerSec, aPhase.errors, aHeap.slope, aHeap.r2, aRss.slope, aRss.r2,
+                             static_cast<double>(aLast.fds) - static_cast<double>(aFirst.fds),
+                             static_cast<double>(aLast.threads) - static_cast<double>(aFirst.threads),
+                             aGrowing.empty() ? std::string("no") : aGrowing });
+  }
+
+  if (not aReport.emit(iOptions)) {
+    return 4;
+  }
+  return 0;
+}
+
+}  // namespace bench
@@ -0,0 +1,99 @@
+#include <hsm/HSMUtils.h>
+#include <hsm/KeyReplicaSet.h>
+#include <hsm/SessionPool.h>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::string_literals;
+
+// Measures AES-GCM encryption throughput with the operations spread over K session-object copies of the key,
+// to tell whether the module serializes the operations on a single key object.
+int main(int argc, char** argv) {
+  std::string aLibPath   = argc > 1 ? argv[1] : "/usr/local/lib/softhsm/libsofthsm2.so";
+  std::string aSlotLabel = argc > 2 ? argv[2] : "FKH";
+  std::string aSlotPwd   = argc > 3 ? argv[3] : "1234";
+  std::size_t aThreads   = argc > 4 ? std::stoul(argv[4]) : 8u;
+  std::size_t aSeconds   = argc > 5 ? std::stoul(argv[5]) : 5u;
+  std::size_t aMaxCopies = argc > 6 ? std::stoul(argv[6]) : 16u;
+
+  auto [lib, libFunc] = HSMUtils::openHSMDL(aLibPath);
+  if (not lib or not libFunc) {
+    std::cout << "Lib not loaded!" << std::endl;
+    return 1;
+  }
+
+  int aResult = 0;
+  {
+    SessionPool aPool(libFunc, aSlotLabel, aSlotPwd);
+    if (not aPool.open(aThreads + 1u)) {
+      std::cout << "Could not open session pool." << std::endl;
+      HSMUtils::closeHSMDL(lib, libFunc);
+      return 2;
+    }
+
+    static std::string aMasterKey = "MASTER_KEY"s;
+    if (not aPool.findKey(aMasterKey)) {
+      auto aLease = aPool.acquire(SessionAccess::ReadWrite);
+      if (not aLease or not HSMUtils::generateKey(libFunc, aLease->session(), aMasterKey)) {
+        std::cout << "Could not generate missing key." << std::endl;
+        aResult = 3;
+      }
+    }
+
+    const std::vector<unsigned char> aPayload(32u, 0xA3);
+    double aBaseline = 0.0;
+    std::cout << "threads: " << aThreads << ", " << aSeconds << "s per run" << std::endl;
+    std::cout << std::setw(8) << "copies" << std::setw(14) << "ops/s" << std::setw(10) << "speedup" << std::endl;
+
+    for (std::size_t aCopies = 0u; aResult == 0 and aCopies <= aMaxCopies; aCopies = (aCopies == 0u) ? 1u : aCopies * 2u) {
+      auto aSet = KeyReplicaSet::create(aPool, aMasterKey, aCopies);
+      if (not aSet) {
+        std::cout << "Could not create " << aCopies << " copies of the key." << std::endl;
+        aResult = 4;
+        break;
+      }
+
+      std::atomic<bool> aStop{ false };
+      std::atomic<std::uint64_t> aOps{ 0u };
+      std::atomic<std::uint64_t> aErrors{ 0u };
+      std::vector<std::thread> aWorkers;
+      auto aStart = std::chrono::steady_clock::now();
+      for (std::size_t i = 0u; i < aThreads; ++i) {
+        aWorkers.emplace_back([&]() {
+          while (not aStop.load(std::memory_order_relaxed)) {
+            if (aSet->encrypt_aes(aPayload)) {
+              aOps.fetch_add(1u, std::memory_order_relaxed);
+            } else {
+              aErrors.fetch_add(1u, std::memory_order_relaxed);
+            }
+          }
+        });
+      }
+      std::this_thread::sleep_for(std::chrono::seconds(aSeconds));
+      aStop = true;
+      for (auto& aWorker : aWorkers) {
+        aWorker.join();
+      }
+      std::chrono::duration<double> aElapsed = std::chrono::steady_clock::now() - aStart;
+
+      double aThroughput = static_cast<double>(aOps.load()) / aElapsed.count();
+      if (aCopies == 0u) {
+        aBaseline = aThroughput;
+      }
+      std::cout << std::setw(8) << aCopies << std::setw(14) << std::fixed << std::setprecision(0) << aThroughput
+                << std::setw(10) << std::setprecision(2) << (aBaseline > 0.0 ? aThroughput / aBaseline : 0.0);
+      if (aErrors.load() > 0u) {
+        std::cout << "  (" << aErrors.load() << " errors)";
+      }
+      std::cout << std::endl;
+    }
+  }
+
+  HSMUtils::closeHSMDL(lib, libFunc);
+  return aResult;
+}
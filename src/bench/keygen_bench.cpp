@@ -0,0 +1,124 @@
+#include <hsm/HSMUtils.h>
+#include <hsm/ObjectReaper.h>
+#include <hsm/SessionPool.h>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum class KeyMode {
+  Token,
+  Session,
+  SessionReaped,
+};
+
+const char* toString(KeyMode iMode) {
+  switch (iMode) {
+    case KeyMode::Token:
+      return "token";
+    case KeyMode::Session:
+      return "session";
+    case KeyMode::SessionReaped:
+      return "session+reaper";
+  }
+  return "unknown";
+}
+
+}  // namespace
+
+// Compares AES key generation throughput for token objects (NV storage write) and ephemeral session objects,
+// destroyed on lease release or in the background by an ObjectReaper. Token keys are destroyed after the run.
+int main(int argc, char** argv) {
+  std::string aLibPath   = argc > 1 ? argv[1] : "/usr/local/lib/softhsm/libsofthsm2.so";
+  std::string aSlotLabel = argc > 2 ? argv[2] : "FKH";
+  std::string aSlotPwd   = argc > 3 ? argv[3] : "1234";
+  std::size_t aThreads   = argc > 4 ? std::stoul(argv[4]) : 8u;
+  std::size_t aSeconds   = argc > 5 ? std::stoul(argv[5]) : 5u;
+
+  auto [lib, libFunc] = HSMUtils::openHSMDL(aLibPath);
+  if (not lib or not libFunc) {
+    std::cout << "Lib not loaded!" << std::endl;
+    return 1;
+  }
+
+  int aResult = 0;
+  {
+    SessionPool aPool(libFunc, aSlotLabel, aSlotPwd);
+    if (not aPool.open(aThreads + 1u)) {
+      std::cout << "Could not open session pool." << std::endl;
+      aResult = 2;
+    }
+
+    std::cout << "threads: " << aThreads << ", " << aSeconds << "s per run" << std::endl;
+    std::cout << std::setw(16) << "mode" << std::setw(14) << "keys/s" << std::setw(10) << "errors" << std::endl;
+    for (auto aMode : { KeyMode::Token, KeyMode::Session, KeyMode::SessionReaped }) {
+      if (aResult != 0) {
+        break;
+      }
+      std::unique_ptr<ObjectReaper> aReaper;
+      if (aMode == KeyMode::SessionReaped) {
+        aReaper = std::make_unique<ObjectReaper>(aPool);
+      }
+
+      std::atomic<bool> aStop{ false };
+      std::atomic<std::uint64_t> aKeys{ 0u };
+      std::atomic<std::uint64_t> aErrors{ 0u };
+      std::mutex aTokenKeysMutex;
+      std::vector<CK_OBJECT_HANDLE> aTokenKeys;
+      std::vector<std::thread> aWorkers;
+      auto aStart = std::chrono::steady_clock::now();
+      for (std::size_t t = 0u; t < aThreads; ++t) {
+        aWorkers.emplace_back([&, t]() {
+          std::vector<CK_OBJECT_HANDLE> aCreated;
+          for (std::size_t n = 0u; not aStop.load(std::memory_order_relaxed); ++n) {
+            auto aLabel = "BENCH_KEY_" + std::to_string(t) + "_" + std::to_string(n);
+            auto aLease = aPool.acquire(aMode == KeyMode::Token ? SessionAccess::ReadWrite : SessionAccess::ReadOnly);
+            if (not aLease) {
+              aErrors.fetch_add(1u, std::memory_order_relaxed);
+              continue;
+            }
+            std::optional<CK_OBJECT_HANDLE> aKey;
+            if (aMode == KeyMode::Token) {
+              aKey = HSMUtils::generateKey(aLease->libInterface(), aLease->session(), aLabel);
+              if (aKey) {
+                aCreated.push_back(aKey.value());
+              }
+            } else {
+              aKey = aLease->generateEphemeralKey(aLabel);
+            }
+            (aKey ? aKeys : aErrors).fetch_add(1u, std::memory_order_relaxed);
+          }
+          std::lock_guard<std::mutex> aLock(aTokenKeysMutex);
+          aTokenKeys.insert(aTokenKeys.end(), aCreated.begin(), aCreated.end());
+        });
+      }
+      std::this_thread::sleep_for(std::chrono::seconds(aSeconds));
+      aStop = true;
+      for (auto& aWorker : aWorkers) {
+        aWorker.join();
+      }
+      std::chrono::duration<double> aElapsed = std::chrono::steady_clock::now() - aStart;
+
+      std::cout << std::setw(16) << toString(aMode) << std::setw(14) << std::fixed << std::setprecision(0)
+                << static_cast<double>(aKeys.load()) / aElapsed.count() << std::setw(10) << aErrors.load() << std::endl;
+
+      // leave the token as it was
+      if (auto aLease = aPool.acquire(SessionAccess::ReadWrite)) {
+        for (auto aKey : aTokenKeys) {
+          HSMUtils::destroyObject(aLease->libInterface(), aLease->session(), aKey);
+        }
+      }
+    }
+  }
+
+  HSMUtils::closeHSMDL(lib, libFunc);
+  return aResult;
+}
@@ -0,0 +1,74 @@
+#include "bench/BenchModes.h"
+#include <iostream>
+#include <string>
+
+namespace {
+
+void usage() {
+  std::cout << "usage: pkcs11_bench [mode] [--name=value ...]" << std::endl
+            << std::endl
+            << "common options:" << std::endl
+            << "  --lib=<path>     PKCS#11 module (default: libpkcs11_mock.so next to this executable)" << std::endl
+            << "  --slot=<label>   token label (default FKH)" << std::endl
+            << "  --pin=<pin>      user pin (default 1234)" << std::endl
+            << "  --json=<file>    also write the results as JSON, - for stdout" << std::endl
+            << std::endl
+            << "modes:" << std::endl
+            << "  ops (default)    latency of every HSMUtils operation on its own" << std::endl
+            << "                   --warmup=100 --iterations=10000 --load-iterations=100 --keygen-iterations=1000" << std::endl
+            << "                   --payload=32 --key=PKCS11_BENCH_KEY --ops=<comma separated operations>" << std::endl
+            << "  payload          single-part against multi-part encryption throughput" << std::endl
+            << "                   --max-payload=1G --payloads=<sizes> --chunks=1K,4K,16K,64K,256K,1M" << std::endl
+            << "                   --min-iterations=3 --iterations=1000 --min-time=0.2 --tolerance=0.02 --key=PKCS11_BENCH_KEY" << std::endl
+            << "  scaling          throughput against threads and sessions of a SessionPool" << std::endl
+            << "                   --threads=1,2,4,...,256 --sessions=1,2,4,...,64 --payloads=32 --op=mixed|encrypt|decrypt" << std::endl
+            << "                   --duration=1 --warmup-time=0.1 --flat-gain=0.1 --key=PKCS11_BENCH_KEY" << std::endl
+            << "  openloop         latency at fixed request rates, from the intended send time" << std::endl
+            << "                   --rates=100,500,...,20000 --workers=64 --sessions=8 --payload=32 --op=mixed|encrypt|decrypt" << std::endl
+            << "                   --duration=5 --knee-factor=10 --key=PKCS11_BENCH_KEY" << std::endl
+            << "  soak             heap, RSS, descriptor and thread growth per operation over long runs" << std::endl
+            << "                   --iterations=1000000 --sample-every=10000 --ops=encrypt,decrypt,find,open_close --payload=32" << std::endl
+            << "                   --settle=0.1 --min-r2=0.9 --min-growth=64K --samples --key=PKCS11_BENCH_KEY" << std::endl
+            << "  cycle            dlopen/C_Initialize/C_Finalize/dlclose time and resources left behind per cycle" << std::endl
+            << "                   --cycles=1000 --min-r2=0.9 --samples" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string aMode = "ops";
+  int aFirstOption  = 1;
+  if (argc > 1 and std::string(argv[1]).rfind("--", 0) != 0) {
+    aMode        = argv[1];
+    aFirstOption = 2;
+  }
+  bench::Options aOptions(argc, argv, aFirstOption);
+  if (aMode == "help" or aOptions.has("help")) {
+    usage();
+    return 0;
+  }
+
+  int aResult = 0;
+  if (aMode == "ops") {
+    aResult = bench::runOps(aOptions);
+  } else if (aMode == "payload") {
+    aResult = bench::runPayload(aOptions);
+  } else if (aMode == "scaling") {
+    aResult = bench::runScaling(aOptions);
+  } else if (aMode == "openloop") {
+    aResult = bench::runOpenLoop(aOptions);
+  } else if (aMode == "soak") {
+    aResult = bench::runSoak(aOptions);
+  } else if (aMode == "cycle") {
+    aResult = bench::runCycle(aOptions);
+  } else {
+    std::cerr << "unknown mode " << aMode << std::endl;
+    usage();
+    return 1;
+  }
+
+  for (const auto& aName : aOptions.unused()) {
+    std::cerr << "warning: option --" << aName << " is not used by mode " << aMode << std::endl;
+  }
+  return aResult;
+}
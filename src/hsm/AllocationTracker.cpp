@@ -0,0 +1,57 @@
+#include "hsm/AllocationTracker.h"
+#include <algorithm>
+#include <dlfcn.h>
+#include <iomanip>
+
+std::shared_ptr<AllocationTracker> AllocationTracker::create() {
+  // resolved at run time: a weak reference would be bound to nullptr at link time in a non-PIE executable
+  auto aEnter = reinterpret_cast<Enter>(dlsym(RTLD_DEFAULT, "pkcs11_alloc_enter"));
+  auto aLeave = reinterpret_cast<Leave>(dlsym(RTLD_DEFAULT, "pkcs11_alloc_leave"));
+  auto aSites = reinterpret_cast<Sites>(dlsym(RTLD_DEFAULT, "pkcs11_alloc_sites"));
+  if (not aEnter or not aLeave or not aSites) {
+    return nullptr;
+  }
+  return std::shared_ptr<AllocationTracker>(new AllocationTracker(aEnter, aLeave, aSites));
+}
+
+AllocationTracker::AllocationTracker(Enter iEnter, Leave iLeave, Sites iSites) : mEnter(iEnter), mLeave(iLeave), mSites(iSites) {}
+
+std::vector<Pkcs11AllocSite> AllocationTracker::sites() const {
+  std::vector<Pkcs11AllocSite> aSites(64u);
+  for (;;) {
+    const auto aCount = mSites(aSites.data(), aSites.size());
+    if (aCount <= aSites.size()) {
+      aSites.resize(aCount);
+      break;
+    }
+    aSites.resize(aCount);
+  }
+  std::stable_sort(aSites.begin(), aSites.end(), [](const Pkcs11AllocSite& iLeft, const Pkcs11AllocSite& iRight) {
+    return iLeft.outstandingBytes > iRight.outstandingBytes;
+  });
+  return aSites;
+}
+
+void AllocationTracker::print(std::ostream& oOut) const {
+  oOut << std::left << std::setw(24) << "function" << std::right << std::setw(10) << "calls" << std::setw(12) << "allocs" << std::setw(14)
+       << "alloc_bytes" << std::setw(12) << "frees" << std::setw(14) << "freed_bytes" << std::setw(14) << "outstanding" << std::setw(16)
+       << "outst_bytes" << std::setw(14) << "bytes/call" << std::endl;
+  for (const auto& aSite : sites()) {
+    const double aPerCall = aSite.calls > 0u ? static_cast<double>(aSite.outstandingBytes) / static_cast<double>(aSite.calls) : 0.0;
+    oOut << std::left << std::setw(24) << aSite.function << std::right << std::setw(10) << aSite.calls << std::setw(12) << aSite.allocations
+         << std::setw(14) << aSite.allocatedBytes << std::setw(12) << aSite.frees << std::setw(14) << aSite.freedBytes << std::setw(14)
+         << aSite.outstandingBlocks << std::setw(16) << aSite.outstandingBytes << std::setw(14) << std::fixed << std::setprecision(2) << aPerCall;
+    if (aSite.untracked > 0u) {
+      oOut << "  (" << aSite.untracked << " allocations not tracked)";
+    }
+    oOut << std::endl;
+  }
+}
+
+void AllocationTracker::onCallBegin(CK_FUNCTION_LIST_PTR, const char* iFunction, CK_SESSION_HANDLE) {
+  mEnter(iFunction);
+}
+
+void AllocationTracker::onCallEnd(CK_FUNCTION_LIST_PTR, const char*, CK_SESSION_HANDLE, CK_RV) {
+  mLeave();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "alloc/AllocationHooks.h"
+#include "hsm/CallObserver.h"
+#include <memory>
+#include <ostream>
+#include <vector>
+
+/**
+ * Attributes the heap allocations made during each PKCS#11 call (as a CallObserver) to its function name, through
+ * the pkcs11_alloc_tracker malloc interposer: allocations and frees per function, and the bytes allocated by a
+ * function that nothing freed since. The interposer is preloaded (LD_PRELOAD=libpkcs11_alloc_tracker.so) or linked
+ * into the executable; without it create() returns nullptr and nothing is tracked.
+ *
+ * Only the thread making the call is accounted, not the threads the module runs on its own. Register it with
+ * CallObservers::add after the other observers, so that their bookkeeping is not counted against the module.
+ */
+class AllocationTracker : public CallObserver {
+ public:
+  /**
+   * @return the tracker, nullptr if the interposer hooks are not loaded in the process
+   */
+  static std::shared_ptr<AllocationTracker> create();
+
+  AllocationTracker(const AllocationTracker&) = delete;
+  AllocationTracker& operator=(const AllocationTracker&) = delete;
+
+  /**
+   * @return the functions called so far, largest outstanding bytes first. The counts are process-wide, they
+   * include the calls observed by any tracker
+   */
+  std::vector<Pkcs11AllocSite> sites() const;
+
+  void print(std::ostream& oOut) const;
+
+  void onCallBegin(CK_FUNCTION_LIST_PTR iLibInterface, const char* iFunction, CK_SESSION_HANDLE iSession) override;
+  void onCallEnd(CK_FUNCTION_LIST_PTR iLibInterface, const char* iFunction, CK_SESSION_HANDLE iSession, CK_RV iStatus) override;
+
+ private:
+  using Enter = int (*)(const char*);
+  using Leave = void (*)();
+  using Sites = std::size_t (*)(Pkcs11AllocSite*, std::size_t);
+
+  AllocationTracker(Enter iEnter, Leave iLeave, Sites iSites);
+
+  const Enter mEnter;
+  const Leave mLeave;
+  const Sites mSites;
+};
@@ -0,0 +1,37 @@
+#include "hsm/CallObserver.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace {
+
+// copy-on-write list, readers only load the pointer
+std::shared_ptr<const CallObservers::List> gObservers;
+std::mutex gObserversMutex;
+
+}  // namespace
+
+std::atomic<bool> CallObservers::gAny{ false };
+
+void CallObservers::add(std::shared_ptr<CallObserver> iObserver) {
+  std::lock_guard<std::mutex> aLock(gObserversMutex);
+  auto aList = gObservers ? std::make_shared<List>(*gObservers) : std::make_shared<List>();
+  aList->push_back(std::move(iObserver));
+  std::atomic_store(&gObservers, std::shared_ptr<const List>(std::move(aList)));
+  gAny.store(true, std::memory_order_relaxed);
+}
+
+void CallObservers::remove(const std::shared_ptr<CallObserver>& iObserver) {
+  std::lock_guard<std::mutex> aLock(gObserversMutex);
+  if (not gObservers) {
+    return;
+  }
+  auto aList = std::make_shared<List>(*gObservers);
+  aList->erase(std::remove(aList->begin(), aList->end(), iObserver), aList->end());
+  gAny.store(not aList->empty(), std::memory_order_relaxed);
+  std::atomic_store(&gObservers, aList->empty() ? std::shared_ptr<const List>() : std::shared_ptr<const List>(std::move(aList)));
+}
+
+std::shared_ptr<const CallObservers::List> CallObservers::current() {
+  return std::atomic_load(&gObservers);
+}
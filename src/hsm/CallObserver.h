@@ -0,0 +1,74 @@
+#pragma once
+
+#include "hsm/cryptoki.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+ * Receives every PKCS#11 call made through observedCall, before and after it reaches the module.
+ * Both callbacks run on the calling thread and should be cheap.
+ */
+class CallObserver {
+ public:
+  virtual ~CallObserver() = default;
+
+  /**
+   * @param iLibInterface - the function list the call goes to
+   * @param iFunction - name of the PKCS#11 function, e.g. "C_Encrypt"
+   * @param iSession - session the call runs on, CK_INVALID_HANDLE for calls not bound to a session
+   */
+  virtual void onCallBegin(CK_FUNCTION_LIST_PTR iLibInterface, const char* iFunction, CK_SESSION_HANDLE iSession) = 0;
+
+  virtual void onCallEnd(CK_FUNCTION_LIST_PTR iLibInterface, const char* iFunction, CK_SESSION_HANDLE iSession, CK_RV iStatus) = 0;
+};
+
+/**
+ * Process-wide registry of call observers
+ */
+class CallObservers {
+ public:
+  using List = std::vector<std::shared_ptr<CallObserver>>;
+
+  static void add(std::shared_ptr<CallObserver> iObserver);
+
+  static void remove(const std::shared_ptr<CallObserver>& iObserver);
+
+  /**
+   * @return the observers registered at the time of the call, nullptr if there are none
+   */
+  static std::shared_ptr<const List> current();
+
+  /**
+   * @return false when no observer is registered. A relaxed load: an observer added concurrently may miss the
+   *  calls already under way
+   */
+  static bool any() { return gAny.load(std::memory_order_relaxed); }
+
+ private:
+  static std::atomic<bool> gAny;
+};
+
+/**
+ * Calls iFunction(iArgs...) and reports it to the registered observers.
+ * Without observers this is a single relaxed load on top of the call; the shared list (and its reference count)
+ * is only touched while some observer is registered.
+ */
+template <typename Function, typename... Args>
+CK_RV observedCall(CK_FUNCTION_LIST_PTR iLibInterface, const char* iName, CK_SESSION_HANDLE iSession, Function iFunction, Args... iArgs) {
+  if (not CallObservers::any()) {
+    return iFunction(iArgs...);
+  }
+  auto aObservers = CallObservers::current();
+  if (not aObservers) {
+    return iFunction(iArgs...);
+  }
+  for (const auto& aObserver : *aObservers) {
+    aObserver->onCallBegin(iLibInterface, iName, iSession);
+  }
+  CK_RV aStatus = iFunction(iArgs...);
+  for (auto aIt = aObservers->rbegin(); aIt != aObservers->rend(); ++aIt) {
+    (*aIt)->onCallEnd(iLibInterface, iName, iSession, aStatus);
+  }
+  return aStatus;
+}
@@ -0,0 +1,185 @@
+#include "hsm/CallWatchdog.h"
+#include "hsm/SessionPool.h"
+#include "hsm/Trace.h"
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+namespace {
+
+std::atomic<std::uint64_t> gNextWatchdogId{ 1u };
+
+}  // namespace
+
+thread_local CallWatchdog::ThreadSlots CallWatchdog::tSlots;
+
+CallWatchdog::ThreadSlots::~ThreadSlots() {
+  for (auto& aSlot : slots) {
+    aSlot.second->inUse.store(false, std::memory_order_release);
+  }
+}
+
+std::shared_ptr<CallWatchdog> CallWatchdog::create() {
+  return create(Config{});
+}
+
+std::shared_ptr<CallWatchdog> CallWatchdog::create(Config iConfig) {
+  return std::shared_ptr<CallWatchdog>(new CallWatchdog(std::move(iConfig)));
+}
+
+CallWatchdog::CallWatchdog(Config iConfig)
+    : mConfig(std::move(iConfig)), mId(gNextWatchdogId.fetch_add(1u)), mSlots(makeSlots(std::max<std::size_t>(mConfig.threads, 1u))) {
+  mScanner = std::thread([this] { scanLoop(); });
+}
+
+CallWatchdog::~CallWatchdog() {
+  stop();
+}
+
+void CallWatchdog::attach(SessionPool& iPool) {
+  std::lock_guard<std::mutex> aLock(mPoolsMutex);
+  mPools.push_back(&iPool);
+}
+
+void CallWatchdog::detach(SessionPool& iPool) {
+  std::lock_guard<std::mutex> aLock(mPoolsMutex);
+  mPools.erase(std::remove(mPools.begin(), mPools.end(), &iPool), mPools.end());
+}
+
+void CallWatchdog::stop() {
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    if (mStopped) {
+      return;
+    }
+    mStopped = true;
+  }
+  mStopCv.notify_all();
+  mScanner.join();
+}
+
+CallWatchdog::Counters CallWatchdog::counters() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  auto aCounters      = mCounters;
+  aCounters.untracked = mUntracked.load(std::memory_order_relaxed);
+  return aCounters;
+}
+
+std::vector<std::shared_ptr<CallWatchdog::Slot>> CallWatchdog::makeSlots(std::size_t iCount) {
+  std::vector<std::shared_ptr<Slot>> aSlots;
+  aSlots.reserve(iCount);
+  for (std::size_t i = 0; i < iCount; ++i) {
+    aSlots.push_back(std::make_shared<Slot>());
+  }
+  return aSlots;
+}
+
+CallWatchdog::Slot* CallWatchdog::threadSlot() {
+  auto& aSlots = tSlots.slots;
+  for (auto& aSlot : aSlots) {
+    if (aSlot.first == mId) {
+      return aSlot.second.get();
+    }
+  }
+  // the slots of the watchdogs destroyed since are only referenced from here
+  aSlots.erase(std::remove_if(aSlots.begin(), aSlots.end(), [](const auto& iSlot) { return iSlot.second.use_count() == 1; }), aSlots.end());
+  for (const auto& aSlot : mSlots) {
+    bool aFree = false;
+    if (aSlot->inUse.compare_exchange_strong(aFree, true, std::memory_order_acquire)) {
+      aSlots.emplace_back(mId, aSlot);
+      return aSlot.get();
+    }
+  }
+  return nullptr;
+}
+
+void CallWatchdog::onCallBegin(CK_FUNCTION_LIST_PTR iLibInterface, const char* iFunction, CK_SESSION_HANDLE iSession) {
+  auto* aSlot = threadSlot();
+  if (not aSlot) {
+    mUntracked.fetch_add(1u, std::memory_order_relaxed);
+    return;
+  }
+
+  auto aTimeout = mConfig.defaultTimeout;
+  auto aIt      = mConfig.timeouts.find(iFunction);
+  if (aIt != mConfig.timeouts.end()) {
+    aTimeout = aIt->second;
+  }
+
+  std::lock_guard<std::mutex> aLock(aSlot->mutex);
+  if (aSlot->depth < Slot::K_DEPTH) {
+    aSlot->calls[aSlot->depth] = InFlight{ iLibInterface, iFunction, iSession, Clock::now() + aTimeout, false };
+  }
+  else {
+    mUntracked.fetch_add(1u, std::memory_order_relaxed);
+  }
+  ++aSlot->depth;
+}
+
+void CallWatchdog::onCallEnd(CK_FUNCTION_LIST_PTR, const char*, CK_SESSION_HANDLE, CK_RV) {
+  auto* aSlot = threadSlot();
+  if (not aSlot) {
+    return;
+  }
+  std::lock_guard<std::mutex> aLock(aSlot->mutex);
+  if (aSlot->depth > 0u) {
+    --aSlot->depth;
+  }
+}
+
+void CallWatchdog::scanLoop() {
+  std::unique_lock<std::mutex> aLock(mMutex);
+  while (not mStopCv.wait_for(aLock, mConfig.scanPeriod, [this] { return mStopped; })) {
+    auto aNow = Clock::now();
+    std::vector<InFlight> aOverruns;
+    for (const auto& aSlot : mSlots) {
+      if (not aSlot->inUse.load(std::memory_order_acquire)) {
+        continue;
+      }
+      std::lock_guard<std::mutex> aSlotLock(aSlot->mutex);
+      for (std::size_t i = 0; i < std::min(aSlot->depth, Slot::K_DEPTH); ++i) {
+        auto& aCall = aSlot->calls[i];
+        if (not aCall.overrun and aCall.deadline <= aNow) {
+          aCall.overrun = true;
+          ++mCounters.overruns[aCall.function];
+          aOverruns.push_back(aCall);
+        }
+      }
+    }
+    if (aOverruns.empty()) {
+      continue;
+    }
+    aLock.unlock();
+    for (const auto& aCall : aOverruns) {
+      handleOverrun(aCall);
+    }
+    aLock.lock();
+  }
+}
+
+void CallWatchdog::handleOverrun(const InFlight& iCall) {
+  std::ostringstream descr;
+  descr << iCall.function << " on session " << iCall.session << " overran its deadline";
+  TRC_WARN(255, descr.str());
+
+  if (iCall.session == CK_INVALID_HANDLE) {
+    return;
+  }
+
+  // legacy function, most modules answer CKR_FUNCTION_NOT_PARALLEL
+  bool aCancelled = iCall.libInterface->C_CancelFunction(iCall.session) == CKR_OK;
+
+  if (aCancelled) {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    ++mCounters.cancelled;
+  }
+  // under the lock detach() takes: a pool cannot be detached, then destroyed, while it is quarantining
+  std::lock_guard<std::mutex> aPoolsLock(mPoolsMutex);
+  for (auto* aPool : mPools) {
+    if (aPool->libInterface() == iCall.libInterface and aPool->quarantine(iCall.session)) {
+      std::lock_guard<std::mutex> aLock(mMutex);
+      ++mCounters.quarantined;
+      break;
+    }
+  }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "hsm/CallObserver.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class SessionPool;
+
+/**
+ * Tracks the in-flight PKCS#11 calls (as a CallObserver) and flags the ones running past their deadline.
+ * On an overrun the watchdog tries C_CancelFunction on the session, and quarantines the session in the
+ * attached pool owning it: the pool stops handing it out and opens a replacement right away, so a hung
+ * vendor call costs one blocked thread instead of one pool slot for good.
+ *
+ * Each calling thread records its calls on a slot of its own, allocated once when the watchdog is created: a call
+ * costs an uncontended lock and no allocation. The scanner visits the slots.
+ *
+ * Register it with CallObservers::add once created with create().
+ */
+class CallWatchdog : public CallObserver {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Config {
+    std::chrono::milliseconds defaultTimeout{ 5000 };
+    // overrides of the timeout for given function names, e.g. { "C_GenerateKey", 30s }
+    std::map<std::string, std::chrono::milliseconds, std::less<>> timeouts;
+    // how often the in-flight calls are scanned
+    std::chrono::milliseconds scanPeriod{ 50 };
+    // threads calling concurrently that can be watched; the calls of the threads beyond are not tracked
+    std::size_t threads = 256u;
+  };
+
+  struct Counters {
+    // overruns per PKCS#11 function name
+    std::map<std::string, std::uint64_t> overruns;
+    std::uint64_t cancelled   = 0u;
+    std::uint64_t quarantined = 0u;
+    // calls not watched, for want of a free slot or nested too deep
+    std::uint64_t untracked = 0u;
+  };
+
+  static std::shared_ptr<CallWatchdog> create();
+  static std::shared_ptr<CallWatchdog> create(Config iConfig);
+  ~CallWatchdog() override;
+
+  CallWatchdog(const CallWatchdog&) = delete;
+  CallWatchdog& operator=(const CallWatchdog&) = delete;
+
+  /**
+   * @param iPool - pool whose sessions are quarantined on overrun; must be detached before being destroyed
+   */
+  void attach(SessionPool& iPool);
+
+  /**
+   * Returns once no overrun handler uses the attached pools any more, iPool can then be destroyed
+   */
+  void detach(SessionPool& iPool);
+
+  /**
+   * Stops the scanning thread; called by the destructor
+   */
+  void stop();
+
+  Counters counters() const;
+
+  void onCallBegin(CK_FUNCTION_LIST_PTR iLibInterface, const char* iFunction, CK_SESSION_HANDLE iSession) override;
+  void onCallEnd(CK_FUNCTION_LIST_PTR iLibInterface, const char* iFunction, CK_SESSION_HANDLE iSession, CK_RV iStatus) override;
+
+ private:
+  struct InFlight {
+    CK_FUNCTION_LIST_PTR libInterface;
+    const char* function;
+    CK_SESSION_HANDLE session;
+    Clock::time_point deadline;
+    bool overrun;
+  };
+
+  // calls in flight of the thread owning the slot, innermost last
+  struct Slot {
+    static constexpr std::size_t K_DEPTH = 4u;
+    // taken by the owning thread and the scanner only
+    std::mutex mutex;
+    std::array<InFlight, K_DEPTH> calls;
+    // nesting of the calls, the ones beyond K_DEPTH are not recorded
+    std::size_t depth = 0u;
+    std::atomic<bool> inUse{ false };
+  };
+
+  // slots held by the current thread, released when it exits
+  struct ThreadSlots {
+    ~ThreadSlots();
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<Slot>>> slots;
+  };
+
+  explicit CallWatchdog(Config iConfig);
+  static std::vector<std::shared_ptr<Slot>> makeSlots(std::size_t iCount);
+  // slot of the current thread, nullptr if all of them are taken
+  Slot* threadSlot();
+  void scanLoop();
+  void handleOverrun(const InFlight& iCall);
+
+  static thread_local ThreadSlots tSlots;
+
+  const Config mConfig;
+  // identifies the watchdog in tSlots, an address may be reused by a later watchdog
+  const std::uint64_t mId;
+  // allocated up front, never resized
+  const std::vector<std::shared_ptr<Slot>> mSlots;
+  std::atomic<std::uint64_t> mUntracked{ 0u };
+
+  // held by the overrun handler while it uses the pools, so that detach() waits for it; taken before mMutex
+  std::mutex mPoolsMutex;
+  std::vector<SessionPool*> mPools;
+
+  mutable std::mutex mMutex;
+  Counters mCounters;
+
+  std::condition_variable mStopCv;
+  bool mStopped = false;
+  std::thread mScanner;
+};
@@ -0,0 +1,170 @@
+#include "hsm/CircuitBreaker.h"
+#include <algorithm>
+#include <utility>
+
+CircuitBreaker::CircuitBreaker(std::string iName) : CircuitBreaker(std::move(iName), Config{}) {}
+
+CircuitBreaker::CircuitBreaker(std::string iName, Config iConfig)
+    : mName(std::move(iName)), mConfig(iConfig), mOutcomes(std::max<std::size_t>(iConfig.window, 1u)) {}
+
+CircuitBreaker::Permit CircuitBreaker::allow() {
+  std::unique_lock<std::mutex> aLock(mMutex);
+  const auto aNow = Clock::now();
+  switch (mState) {
+    case BreakerState::Closed:
+      return Permit{ true, mEpoch };
+    case BreakerState::HalfOpen:
+      if (mProbeInFlight and aNow - mProbeGrantedAt < mConfig.openDuration) {
+        ++mCounters.rejected;
+        return Permit{ false, mEpoch };
+      }
+      if (mProbeInFlight) {
+        // the probe was never reported: this call replaces it, a late result of the old one is ignored
+        ++mEpoch;
+      }
+      mProbeInFlight  = true;
+      mProbeGrantedAt = aNow;
+      return Permit{ true, mEpoch };
+    case BreakerState::Open: {
+      if (aNow - mOpenedAt < mConfig.openDuration) {
+        ++mCounters.rejected;
+        return Permit{ false, mEpoch };
+      }
+      transitionLocked(BreakerState::HalfOpen);
+      mProbeInFlight  = true;
+      mProbeGrantedAt = aNow;
+      const Permit aPermit{ true, mEpoch };
+      aLock.unlock();
+      notify(BreakerState::Open, BreakerState::HalfOpen);
+      return aPermit;
+    }
+  }
+  return Permit{ false, mEpoch };
+}
+
+void CircuitBreaker::onResult(const Permit& iPermit, bool iSuccess, Clock::duration iLatency) {
+  bool aSlow = iLatency >= mConfig.slowCallDuration;
+  BreakerState aFrom;
+  BreakerState aTo;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    if (not iPermit.granted or iPermit.epoch != mEpoch) {
+      // late result of a call granted before the last transition: it says nothing about the current state, and
+      // taken in half-open it would pass for the probe
+      return;
+    }
+    if (iSuccess) {
+      ++mCounters.successes;
+    }
+    else {
+      ++mCounters.failures;
+    }
+    if (aSlow) {
+      ++mCounters.slowCalls;
+    }
+
+    if (mState == BreakerState::HalfOpen) {
+      mProbeInFlight = false;
+      aTo            = (iSuccess and not aSlow) ? BreakerState::Closed : BreakerState::Open;
+    }
+    else if (mState == BreakerState::Closed) {
+      mOutcomes[mNext] = Outcome{ not iSuccess, aSlow };
+      mNext            = (mNext + 1u) % mOutcomes.size();
+      mCount           = std::min(mCount + 1u, mOutcomes.size());
+
+      aTo = BreakerState::Closed;
+      if (mCount >= mConfig.minCalls) {
+        std::size_t aFailures = 0u;
+        std::size_t aSlowCalls = 0u;
+        for (std::size_t i = 0; i < mCount; ++i) {
+          aFailures += mOutcomes[i].failure ? 1u : 0u;
+          aSlowCalls += mOutcomes[i].slow ? 1u : 0u;
+        }
+        auto aCount = static_cast<double>(mCount);
+        if (static_cast<double>(aFailures) / aCount >= mConfig.failureRateThreshold
+            or static_cast<double>(aSlowCalls) / aCount >= mConfig.slowCallRateThreshold) {
+          aTo = BreakerState::Open;
+        }
+      }
+    }
+    else {
+      // no permit is granted while open
+      return;
+    }
+    aFrom = transitionLocked(aTo);
+  }
+  if (aFrom != aTo) {
+    notify(aFrom, aTo);
+  }
+}
+
+void CircuitBreaker::setListener(Listener iListener) {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  mListener = std::move(iListener);
+}
+
+BreakerState CircuitBreaker::state() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mState;
+}
+
+CircuitBreaker::Counters CircuitBreaker::counters() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mCounters;
+}
+
+bool CircuitBreaker::isSlotFailure(CK_RV iStatus) {
+  switch (iStatus) {
+    case CKR_GENERAL_ERROR:
+    case CKR_HOST_MEMORY:
+    case CKR_FUNCTION_FAILED:
+    case CKR_DEVICE_ERROR:
+    case CKR_DEVICE_MEMORY:
+    case CKR_DEVICE_REMOVED:
+    case CKR_TOKEN_NOT_PRESENT:
+    case CKR_TOKEN_NOT_RECOGNIZED:
+    case CKR_SESSION_HANDLE_INVALID:
+    case CKR_SESSION_CLOSED:
+    case CKR_SESSION_COUNT:
+    case CKR_CRYPTOKI_NOT_INITIALIZED:
+      return true;
+    default:
+      return false;
+  }
+}
+
+BreakerState CircuitBreaker::transitionLocked(BreakerState iTo) {
+  auto aFrom = mState;
+  if (aFrom == iTo) {
+    return aFrom;
+  }
+  mState = iTo;
+  ++mEpoch;
+  switch (iTo) {
+    case BreakerState::Open:
+      ++mCounters.opened;
+      mOpenedAt = Clock::now();
+      break;
+    case BreakerState::HalfOpen:
+      ++mCounters.halfOpened;
+      break;
+    case BreakerState::Closed:
+      ++mCounters.closed;
+      // start over with a clean window
+      mNext  = 0u;
+      mCount = 0u;
+      break;
+  }
+  return aFrom;
+}
+
+void CircuitBreaker::notify(BreakerState iFrom, BreakerState iTo) {
+  Listener aListener;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    aListener = mListener;
+  }
+  if (aListener) {
+    aListener(mName, iFrom, iTo);
+  }
+}
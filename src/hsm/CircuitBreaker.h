@@ -0,0 +1,137 @@
+#pragma once
+
+#include "hsm/cryptoki.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class BreakerState {
+  Closed,
+  Open,
+  HalfOpen,
+};
+
+/**
+ * @return printable name of the state
+ */
+inline const char* toString(BreakerState iState) {
+  switch (iState) {
+    case BreakerState::Closed: return "closed";
+    case BreakerState::Open: return "open";
+    case BreakerState::HalfOpen: return "half-open";
+  }
+  return "unknown";
+}
+
+/**
+ * Per-slot circuit breaker.
+ *
+ * Closed: calls flow, outcomes are kept over a window of the most recent calls. When the window holds at least
+ * minCalls and the failure rate or the slow call rate reaches its threshold, the breaker opens.
+ * Open: calls are refused without touching the slot, for openDuration.
+ * Half-open: a single probe call is let through; its success closes the breaker, its failure opens it again. A
+ * probe whose outcome is not reported within openDuration (its caller threw or dropped the permit) is given up
+ * and the next call becomes the probe.
+ *
+ * Callers ask allow() before the call and, when granted, must report the outcome through onResult() with the
+ * permit they were given. A permit belongs to the state it was granted in: the late result of a call allowed
+ * before a transition is ignored, so that it cannot be taken for the half-open probe.
+ */
+class CircuitBreaker {
+ public:
+  using Clock    = std::chrono::steady_clock;
+  using Listener = std::function<void(const std::string& iName, BreakerState iFrom, BreakerState iTo)>;
+
+  struct Config {
+    std::size_t window      = 50u;
+    std::size_t minCalls    = 10u;
+    double failureRateThreshold = 0.5;
+    // calls slower than slowCallDuration count against slowCallRateThreshold
+    std::chrono::milliseconds slowCallDuration{ 2000 };
+    double slowCallRateThreshold = 0.5;
+    std::chrono::milliseconds openDuration{ 5000 };
+  };
+
+  /**
+   * Granted (or refused) call, to hand back to onResult
+   */
+  struct Permit {
+    bool granted = false;
+    // number of transitions and given up probes the breaker had gone through when the permit was granted
+    std::uint64_t epoch = 0u;
+
+    explicit operator bool() const { return granted; }
+  };
+
+  struct Counters {
+    std::uint64_t successes = 0u;
+    std::uint64_t failures  = 0u;
+    std::uint64_t slowCalls = 0u;
+    std::uint64_t rejected  = 0u;
+    std::uint64_t opened    = 0u;
+    std::uint64_t halfOpened = 0u;
+    std::uint64_t closed    = 0u;
+  };
+
+  /**
+   * @param iName - name reported in the transition events, typically the slot label
+   */
+  explicit CircuitBreaker(std::string iName);
+  CircuitBreaker(std::string iName, Config iConfig);
+
+  /**
+   * @return a granted permit if the call may proceed; refused while open, or half-open with a probe in flight for
+   *  less than openDuration
+   */
+  Permit allow();
+
+  /**
+   * @param iPermit - the permit the call was granted with; ignored when the breaker changed state since
+   * @param iSuccess - false if the call failed because of the slot (see isSlotFailure)
+   * @param iLatency - duration of the call
+   */
+  void onResult(const Permit& iPermit, bool iSuccess, Clock::duration iLatency);
+
+  /**
+   * @param iListener - invoked on every state transition, outside of the breaker lock
+   */
+  void setListener(Listener iListener);
+
+  BreakerState state() const;
+  Counters counters() const;
+  const std::string& name() const { return mName; }
+
+  /**
+   * @return true if iStatus points at the slot or module rather than at the request (bad data, wrong key, ...)
+   */
+  static bool isSlotFailure(CK_RV iStatus);
+
+ private:
+  struct Outcome {
+    bool failure;
+    bool slow;
+  };
+
+  // returns the state transitioned from, or iTo itself when no transition occurs
+  BreakerState transitionLocked(BreakerState iTo);
+  void notify(BreakerState iFrom, BreakerState iTo);
+
+  const std::string mName;
+  const Config mConfig;
+
+  mutable std::mutex mMutex;
+  BreakerState mState = BreakerState::Closed;
+  std::uint64_t mEpoch = 0u;
+  Clock::time_point mOpenedAt;
+  bool mProbeInFlight = false;
+  Clock::time_point mProbeGrantedAt;
+  std::vector<Outcome> mOutcomes;
+  std::size_t mNext = 0u;
+  std::size_t mCount = 0u;
+  Counters mCounters;
+  Listener mListener;
+};
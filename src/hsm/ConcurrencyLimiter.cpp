@@ -0,0 +1,135 @@
+#include "hsm/ConcurrencyLimiter.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+ConcurrencyLimiter::Permit::Permit(ConcurrencyLimiter* iLimiter, Clock::time_point iStart) : mLimiter(iLimiter), mStart(iStart) {}
+
+ConcurrencyLimiter::Permit::Permit(Permit&& iOther) noexcept : mLimiter(iOther.mLimiter), mStart(iOther.mStart) {
+  iOther.mLimiter = nullptr;
+}
+
+ConcurrencyLimiter::Permit& ConcurrencyLimiter::Permit::operator=(Permit&& iOther) noexcept {
+  if (this != &iOther) {
+    if (mLimiter) {
+      mLimiter->onComplete(Clock::now() - mStart, true, false);
+    }
+    mLimiter        = iOther.mLimiter;
+    mStart          = iOther.mStart;
+    iOther.mLimiter = nullptr;
+  }
+  return *this;
+}
+
+ConcurrencyLimiter::Permit::~Permit() {
+  if (mLimiter) {
+    mLimiter->onComplete(Clock::now() - mStart, true, false);
+  }
+}
+
+void ConcurrencyLimiter::Permit::record(bool iSuccess) {
+  if (mLimiter) {
+    mLimiter->onComplete(Clock::now() - mStart, iSuccess, true);
+    mLimiter = nullptr;
+  }
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter() : ConcurrencyLimiter(Config{}) {}
+
+ConcurrencyLimiter::ConcurrencyLimiter(Config iConfig)
+    : mConfig(iConfig),
+      mLimit(static_cast<double>(std::clamp(iConfig.initialLimit, iConfig.minLimit, iConfig.maxLimit))) {}
+
+ConcurrencyLimiter::Permit ConcurrencyLimiter::acquire() {
+  std::unique_lock<std::mutex> aLock(mMutex);
+  ++mWaiting;
+  mSlotCv.wait(aLock, [this] { return static_cast<double>(mInFlight) < std::floor(mLimit); });
+  --mWaiting;
+  ++mInFlight;
+  return Permit(this, Clock::now());
+}
+
+std::optional<ConcurrencyLimiter::Permit> ConcurrencyLimiter::acquireUntil(Clock::time_point iDeadline) {
+  std::unique_lock<std::mutex> aLock(mMutex);
+  ++mWaiting;
+  bool aGranted = mSlotCv.wait_until(aLock, iDeadline, [this] { return static_cast<double>(mInFlight) < std::floor(mLimit); });
+  --mWaiting;
+  if (not aGranted) {
+    return {};
+  }
+  ++mInFlight;
+  return Permit(this, Clock::now());
+}
+
+ConcurrencyLimiter::Snapshot ConcurrencyLimiter::snapshot() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  Snapshot aSnapshot;
+  aSnapshot.limit          = static_cast<std::size_t>(std::floor(mLimit));
+  aSnapshot.inFlight       = mInFlight;
+  aSnapshot.waiting        = mWaiting;
+  aSnapshot.shortLatencyUs = mShortLatencyUs;
+  aSnapshot.longLatencyUs  = mLongLatencyUs;
+  aSnapshot.gradient       = mGradient;
+  aSnapshot.samples        = mSamples;
+  aSnapshot.failures       = mFailures;
+  return aSnapshot;
+}
+
+void ConcurrencyLimiter::onComplete(Clock::duration iLatency, bool iSuccess, bool iRecorded) {
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    --mInFlight;
+    if (iRecorded) {
+      if (iSuccess) {
+        updateLimitLocked(std::chrono::duration<double, std::micro>(iLatency).count());
+      }
+      else {
+        ++mFailures;
+        mLimit = std::max(static_cast<double>(mConfig.minLimit), mLimit * mConfig.backoffRatio);
+      }
+    }
+  }
+  mSlotCv.notify_all();
+}
+
+void ConcurrencyLimiter::updateLimitLocked(double iLatencyUs) {
+  ++mSamples;
+  if (mSamples == 1u) {
+    mShortLatencyUs = iLatencyUs;
+    mLongLatencyUs  = iLatencyUs;
+    mWindowMinUs    = iLatencyUs;
+    return;
+  }
+
+  // short term: exponential moving average over roughly shortWindow samples
+  double aShortFactor = 2.0 / (static_cast<double>(mConfig.shortWindow) + 1.0);
+  mShortLatencyUs     = mShortLatencyUs + aShortFactor * (iLatencyUs - mShortLatencyUs);
+
+  // long term: the minimum latency seen, re-based every longWindow samples so that a module that
+  // became slower for good is not mistaken for a queueing one forever
+  mWindowMinUs   = std::min(mWindowMinUs, iLatencyUs);
+  mLongLatencyUs = std::min(mLongLatencyUs, iLatencyUs);
+  if (++mWindowCount >= mConfig.longWindow) {
+    mLongLatencyUs = mWindowMinUs;
+    mWindowMinUs   = mShortLatencyUs;
+    mWindowCount   = 0u;
+  }
+
+  mGradient = std::clamp(mConfig.tolerance * mLongLatencyUs / mShortLatencyUs, 0.5, 1.0);
+
+  // one limit update per short window, so that the samples of the calls admitted under the previous
+  // limit have reached the short average before it moves again
+  if (mSamples % mConfig.shortWindow != 0u) {
+    return;
+  }
+
+  // do not grow a limit the callers are not using
+  if (static_cast<double>(mInFlight + 1u) < mLimit / 2.0 and mGradient >= 1.0) {
+    return;
+  }
+
+  double aQueueAllowance = std::sqrt(mLimit);
+  double aNewLimit       = mLimit * mGradient + aQueueAllowance;
+  aNewLimit              = mLimit * (1.0 - mConfig.smoothing) + aNewLimit * mConfig.smoothing;
+  mLimit                 = std::clamp(aNewLimit, static_cast<double>(mConfig.minLimit), static_cast<double>(mConfig.maxLimit));
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+/**
+ * Adaptive bound on the number of in-flight HSM calls.
+ *
+ * The limit follows a latency gradient: the minimum observed call latency is used as the no-queueing
+ * baseline, and the limit grows while the recent average latency stays within tolerance of it and shrinks
+ * as soon as it inflates. Failed calls cut the limit multiplicatively.
+ */
+class ConcurrencyLimiter {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Config {
+    std::size_t initialLimit = 4u;
+    std::size_t minLimit     = 1u;
+    std::size_t maxLimit     = 256u;
+    // ratio of short over long latency accepted before the limit is reduced
+    double tolerance = 1.5;
+    // weight of a new limit estimate against the current one
+    double smoothing = 0.2;
+    // samples averaged into the short latency (and between two limit updates), and after which the baseline is re-based
+    std::size_t shortWindow = 10u;
+    std::size_t longWindow  = 600u;
+    // multiplicative decrease applied on a failed call
+    double backoffRatio = 0.9;
+  };
+
+  /**
+   * Observable state of the limiter
+   */
+  struct Snapshot {
+    std::size_t limit    = 0u;
+    std::size_t inFlight = 0u;
+    std::size_t waiting  = 0u;
+    double shortLatencyUs = 0.0;
+    double longLatencyUs  = 0.0;
+    double gradient       = 1.0;
+    std::uint64_t samples = 0u;
+    std::uint64_t failures = 0u;
+  };
+
+  /**
+   * Slot granted by the limiter; the caller reports the outcome of the call through record(),
+   * a permit destroyed without a record only frees its slot.
+   */
+  class Permit {
+   public:
+    Permit(Permit&& iOther) noexcept;
+    Permit& operator=(Permit&& iOther) noexcept;
+    Permit(const Permit&) = delete;
+    Permit& operator=(const Permit&) = delete;
+    ~Permit();
+
+    /**
+     * @param iSuccess - false if the HSM call failed
+     */
+    void record(bool iSuccess);
+
+   private:
+    friend class ConcurrencyLimiter;
+    Permit(ConcurrencyLimiter* iLimiter, Clock::time_point iStart);
+
+    ConcurrencyLimiter* mLimiter;
+    Clock::time_point mStart;
+  };
+
+  ConcurrencyLimiter();
+  explicit ConcurrencyLimiter(Config iConfig);
+
+  /**
+   * @return a permit, blocking until the number of in-flight calls drops below the limit
+   */
+  Permit acquire();
+
+  /**
+   * @param iDeadline - point in time after which the caller gives up waiting
+   * @return a permit, or empty optional if none became available before iDeadline
+   */
+  std::optional<Permit> acquireUntil(Clock::time_point iDeadline);
+
+  Snapshot snapshot() const;
+
+ private:
+  void onComplete(Clock::duration iLatency, bool iSuccess, bool iRecorded);
+  void updateLimitLocked(double iLatencyUs);
+
+  const Config mConfig;
+  mutable std::mutex mMutex;
+  std::condition_variable mSlotCv;
+  double mLimit;
+  std::size_t mInFlight = 0u;
+  std::size_t mWaiting  = 0u;
+  double mShortLatencyUs = 0.0;
+  double mLongLatencyUs  = 0.0;
+  double mWindowMinUs    = 0.0;
+  std::size_t mWindowCount = 0u;
+  double mGradient       = 1.0;
+  std::uint64_t mSamples  = 0u;
+  std::uint64_t mFailures = 0u;
+};
@@ -0,0 +1,128 @@
+#include "hsm/HSMModule.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/Trace.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+// setenv is not thread-safe and the variables have to stay in place until C_Initialize returned
+std::mutex gEnvironmentMutex;
+
+std::string tokenLabel(const CK_TOKEN_INFO& iTokenInfo) {
+  std::string aLabel(reinterpret_cast<const char*>(iTokenInfo.label), sizeof(iTokenInfo.label));
+  aLabel.erase(std::remove_if(aLabel.begin(), aLabel.end(), [](unsigned char x) { return std::isspace(x); }), aLabel.end());
+  return aLabel;
+}
+
+}  // namespace
+
+std::unique_ptr<HSMModule> HSMModule::load(std::string iName,
+                                           const std::string& iLibPath,
+                                           const std::map<std::string, std::string>& iEnvironment) {
+  std::pair<void*, CK_FUNCTION_LIST_PTR> aLoaded;
+  {
+    std::lock_guard<std::mutex> aLock(gEnvironmentMutex);
+    std::map<std::string, std::optional<std::string>> aPrevious;
+    for (const auto& [aVariable, aValue] : iEnvironment) {
+      const char* aOld      = std::getenv(aVariable.c_str());
+      aPrevious[aVariable] = aOld ? std::optional<std::string>(aOld) : std::nullopt;
+      setenv(aVariable.c_str(), aValue.c_str(), 1);
+    }
+    aLoaded = HSMUtils::openHSMDL(iLibPath);
+    for (const auto& [aVariable, aValue] : aPrevious) {
+      if (aValue) {
+        setenv(aVariable.c_str(), aValue->c_str(), 1);
+      } else {
+        unsetenv(aVariable.c_str());
+      }
+    }
+  }
+  if (not aLoaded.first or not aLoaded.second) {
+    std::ostringstream descr;
+    descr << "Module " << iName << " could not be loaded from " << iLibPath;
+    TRC_ERROR(255, descr.str());
+    return nullptr;
+  }
+
+  std::unique_ptr<HSMModule> aModule(new HSMModule(std::move(iName), iLibPath, aLoaded.first, aLoaded.second));
+  if (not aModule->refreshSlots()) {
+    return nullptr;
+  }
+  return aModule;
+}
+
+HSMModule::HSMModule(std::string iName, std::string iLibPath, void* iLib, CK_FUNCTION_LIST_PTR iLibInterface)
+    : mName(std::move(iName)), mLibPath(std::move(iLibPath)), mLib(iLib), mLibInterface(iLibInterface) {}
+
+HSMModule::~HSMModule() {
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    mPools.clear();
+  }
+  HSMUtils::closeHSMDL(mLib, mLibInterface);
+}
+
+bool HSMModule::refreshSlots() {
+  auto aTokens = HSMUtils::listTokens(mLibInterface);
+  if (not aTokens) {
+    return false;
+  }
+  std::vector<Slot> aSlots;
+  aSlots.reserve(aTokens->size());
+  for (const auto& [aSlotId, aTokenInfo] : aTokens.value()) {
+    aSlots.push_back(Slot{ aSlotId, tokenLabel(aTokenInfo), aTokenInfo });
+  }
+  std::lock_guard<std::mutex> aLock(mMutex);
+  mSlots = std::move(aSlots);
+  return true;
+}
+
+std::optional<HSMModule::Slot> HSMModule::slot(const std::string& iSlotLabel) const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  for (const auto& aSlot : mSlots) {
+    if (aSlot.label == iSlotLabel) {
+      return aSlot;
+    }
+  }
+  return {};
+}
+
+SessionPool* HSMModule::openPool(const std::string& iSlotLabel, const std::string& iSlotPwd, std::size_t iSize) {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  auto aIt = mPools.find(iSlotLabel);
+  if (aIt != mPools.end()) {
+    return aIt->second.get();
+  }
+  auto aPool = std::make_unique<SessionPool>(mLibInterface, iSlotLabel, iSlotPwd);
+  if (not aPool->open(iSize)) {
+    std::ostringstream descr;
+    descr << "Module " << mName << " could not open a pool on slot " << iSlotLabel;
+    TRC_ERROR(255, descr.str());
+    return nullptr;
+  }
+  return mPools.emplace(iSlotLabel, std::move(aPool)).first->second.get();
+}
+
+SessionPool* HSMModule::pool(const std::string& iSlotLabel) const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  auto aIt = mPools.find(iSlotLabel);
+  return aIt == mPools.end() ? nullptr : aIt->second.get();
+}
+
+std::vector<SessionPool*> HSMModule::pools() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  std::vector<SessionPool*> aPools;
+  aPools.reserve(mPools.size());
+  for (const auto& aEntry : mPools) {
+    aPools.push_back(aEntry.second.get());
+  }
+  return aPools;
+}
+
+std::vector<HSMModule::Slot> HSMModule::slots() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mSlots;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "hsm/SessionPool.h"
+#include "hsm/cryptoki.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * One loaded PKCS#11 library: its dlopen handle, its function list, the directory of its slots and the
+ * session pools opened on them. Several modules can be loaded side by side (e.g. one vendor library per
+ * appliance), each one is initialized and finalized independently.
+ */
+class HSMModule {
+ public:
+  /**
+   * A slot with a token present, as found by refreshSlots()
+   */
+  struct Slot {
+    CK_SLOT_ID id;
+    std::string label;
+    CK_TOKEN_INFO tokenInfo;
+  };
+
+  /**
+   * @param iName - name of the module, used in traces and statistics
+   * @param iLibPath - path to the DL lib to be opened
+   * @param iEnvironment - environment variables set while the library is initialized, e.g. SOFTHSM2_CONF
+   *  to give each SoftHSM instance its own token directory; previous values are restored afterwards
+   * @return the loaded module with its slot directory filled, nullptr if the library could not be loaded
+   */
+  static std::unique_ptr<HSMModule> load(std::string iName,
+                                         const std::string& iLibPath,
+                                         const std::map<std::string, std::string>& iEnvironment = {});
+
+  /**
+   * Closes the pools, then finalizes and closes the library
+   */
+  ~HSMModule();
+
+  HSMModule(const HSMModule&) = delete;
+  HSMModule& operator=(const HSMModule&) = delete;
+
+  /**
+   * Reads the slots and token labels of the module again
+   * @return false if the slot list could not be read (the previous directory is kept)
+   */
+  bool refreshSlots();
+
+  /**
+   * @param iSlotLabel - label of the token
+   * @return the slot holding the token, empty optional if the module has no such token
+   */
+  std::optional<Slot> slot(const std::string& iSlotLabel) const;
+
+  /**
+   * @param iSlotLabel - label of the token the sessions are opened on
+   * @param iSlotPwd - pwd for the slot
+   * @param iSize - number of sessions
+   * @return the pool (owned by the module), the existing one if already opened; nullptr on error
+   */
+  SessionPool* openPool(const std::string& iSlotLabel, const std::string& iSlotPwd, std::size_t iSize);
+
+  /**
+   * @return the pool opened on iSlotLabel, nullptr if there is none
+   */
+  SessionPool* pool(const std::string& iSlotLabel) const;
+
+  std::vector<SessionPool*> pools() const;
+  std::vector<Slot> slots() const;
+
+  const std::string& name() const { return mName; }
+  const std::string& libPath() const { return mLibPath; }
+  CK_FUNCTION_LIST_PTR libInterface() const { return mLibInterface; }
+
+ private:
+  HSMModule(std::string iName, std::string iLibPath, void* iLib, CK_FUNCTION_LIST_PTR iLibInterface);
+
+  const std::string mName;
+  const std::string mLibPath;
+  void* mLib;
+  CK_FUNCTION_LIST_PTR mLibInterface;
+
+  mutable std::mutex mMutex;
+  std::vector<Slot> mSlots;
+  std::map<std::string, std::unique_ptr<SessionPool>> mPools;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+/**
+ * Outcome of an HSM operation dispatched through the scheduling layers
+ */
+enum class HSMStatus {
+  Ok,
+  Failed,
+  DeadlineExceeded,
+  Cancelled,
+  // refused without calling the HSM, e.g. every candidate slot has its circuit breaker open
+  Unavailable,
+};
+
+/**
+ * @return printable name of the status
+ */
+inline const char* toString(HSMStatus iStatus) {
+  switch (iStatus) {
+    case HSMStatus::Ok: return "ok";
+    case HSMStatus::Failed: return "failed";
+    case HSMStatus::DeadlineExceeded: return "deadline exceeded";
+    case HSMStatus::Cancelled: return "cancelled";
+    case HSMStatus::Unavailable: return "unavailable";
+  }
+  return "unknown";
+}
+
+struct HSMResult {
+  HSMStatus status = HSMStatus::Failed;
+  // output of the operation, only set when status is HSMStatus::Ok
+  std::optional<std::vector<unsigned char>> value;
+};
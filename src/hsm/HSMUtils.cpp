@@ -3,11 +3,17 @@
 //
 
 #include "hsm/HSMUtils.h"
+#include "hsm/CallObserver.h"
+#include "hsm/Trace.h"
 #include <algorithm>
 #include <dlfcn.h>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <tuple>
 #include <vector>
 #include <random>
 
@@ -20,6 +26,17 @@ constexpr const std::size_t K_TAG_SIZE = 16u;
 std::vector<unsigned char> gcmAAD = { 0xFE, 0xED, 0xFA, 0xCE, 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED,
                                       0xFA, 0xCE, 0xDE, 0xAD, 0xBE, 0xEF, 0xAB, 0xAD, 0xDA, 0xD2 };
 
+// status of the last PKCS#11 call that failed in the current thread, see HSMUtils::lastError
+thread_local CK_RV gLastError = CKR_OK;
+
+// getOrCreateKey calls in flight, per library, slot and label
+using KeyFlightId = std::tuple<CK_FUNCTION_LIST_PTR, CK_SLOT_ID, std::string>;
+std::mutex gKeyFlightsMutex;
+std::map<KeyFlightId, std::shared_future<std::optional<CK_OBJECT_HANDLE>>> gKeyFlights;
+
+// number of times getOrCreateKey generates again after dropping a duplicate
+constexpr const int K_GET_OR_CREATE_ATTEMPTS = 3;
+
 void TRC_ERROR(int error, const std::string& err) {
   std::cout << error << err;
 }
@@ -28,9 +45,23 @@ void TRC_WARN(int error, const std::string& err) {
   std::cout << error << err;
 }
 
-std::pair<void*, CK_FUNCTION_LIST_PTR> HSMUtils::openHSMDL(const std::string& iLibPath) {
+CK_RV HSMUtils::lastError() {
+  return gLastError;
+}
+
+void HSMUtils::clearLastError() {
+  gLastError = CKR_OK;
+}
+
+std::pair<void*, CK_FUNCTION_LIST_PTR> HSMUtils::openHSMDL(const std::string& iLibPath, LoadTimings* oTimings) {
+  gLastError = CKR_OK;
 
-  void* aLib = dlopen(iLibPath.c_str(), RTLD_LAZY);
+  auto aStart = std::chrono::steady_clock::now();
+  void* aLib  = dlopen(iLibPath.c_str(), RTLD_LAZY);
+  if (oTimings) {
+    oTimings->dlopen = std::chrono::steady_clock::now() - aStart;
+    aStart           = std::chrono::steady_clock::now();
+  }
   if (not aLib) {
     std::ostringstream descr;
     descr << "HSM lib: " << iLibPath << " could not be opened, with error: " << std::string(dlerror());
@@ -55,12 +86,20 @@ std::pair<void*, CK_FUNCTION_LIST_PTR> HSMUtils::openHSMDL(const std::string& iL
     TRC_ERROR(255,  "Could not get function list"s);
     return { nullptr, nullptr };
   }
+  if (oTimings) {
+    oTimings->getFunctionList = std::chrono::steady_clock::now() - aStart;
+    aStart                    = std::chrono::steady_clock::now();
+  }
 
-  CK_RV result = aFunctionList->C_Initialize(nullptr);
+  CK_RV result = observedCall(aFunctionList, "C_Initialize", CK_INVALID_HANDLE, aFunctionList->C_Initialize, nullptr);
+  if (oTimings) {
+    oTimings->initialize = std::chrono::steady_clock::now() - aStart;
+  }
   if (result == CKR_CRYPTOKI_ALREADY_INITIALIZED) {
     TRC_WARN(255,  "HSM lib already initialized"s);
   }
   else if (result != CKR_OK) {
+    gLastError = result;
     dlclose(aLib);
     std::ostringstream desc;
     desc << "Could not initialize HSM library " << std::hex << std::setw(2 * sizeof(CK_RV)) << std::setfill('0')
@@ -72,33 +111,45 @@ std::pair<void*, CK_FUNCTION_LIST_PTR> HSMUtils::openHSMDL(const std::string& iL
   return { aLib, aFunctionList };
   }
 
-bool HSMUtils::closeHSMDL(void*& iLib, CK_FUNCTION_LIST_PTR iFunctionList) {
+bool HSMUtils::closeHSMDL(void*& iLib, CK_FUNCTION_LIST_PTR iFunctionList, LoadTimings* oTimings) {
+  gLastError = CKR_OK;
   if ((iLib == nullptr) or (iFunctionList == nullptr)) {
     TRC_WARN(255,  "HSM lib already finalized.");
     return true;
   }
 
-  CK_RV result = iFunctionList->C_Finalize(nullptr);
+  auto aStart  = std::chrono::steady_clock::now();
+  CK_RV result = observedCall(iFunctionList, "C_Finalize", CK_INVALID_HANDLE, iFunctionList->C_Finalize, nullptr);
+  if (oTimings) {
+    oTimings->finalize = std::chrono::steady_clock::now() - aStart;
+  }
   if (result == CKR_CRYPTOKI_NOT_INITIALIZED) {
     TRC_WARN(255,  "HSM lib already finalized.");
   }
   else if (result != CKR_OK) {
+    gLastError = result;
     TRC_ERROR(255,  "HSM lib already finalized.");
     return false;
   }
+  aStart = std::chrono::steady_clock::now();
   dlclose(iLib);
+  if (oTimings) {
+    oTimings->dlclose = std::chrono::steady_clock::now() - aStart;
+  }
   iLib = nullptr;
   return true;
 }
 std::optional<CK_OBJECT_HANDLE> HSMUtils::retrieveKeyHandle(CK_FUNCTION_LIST_PTR iLibInterface,
                                                             CK_SESSION_HANDLE iSession,
                                                             const std::string& iKeyLabel) {
+  gLastError = CKR_OK;
 
   CK_ATTRIBUTE aKeyTemplate[] = { { CKA_LABEL, const_cast<char*>(iKeyLabel.c_str()), iKeyLabel.length() } };
 
   // Initialize the search
-  CK_RV aStatus = iLibInterface->C_FindObjectsInit(iSession, aKeyTemplate, 1);
+  CK_RV aStatus = observedCall(iLibInterface, "C_FindObjectsInit", iSession, iLibInterface->C_FindObjectsInit, iSession, aKeyTemplate, 1);
   if (aStatus != CKR_OK) {
+    gLastError = aStatus;
     std::stringstream aErrorMsg;
     aErrorMsg << "Error: C_FindObjectsInit returned 0x" << std::hex << aStatus;
     return {};
@@ -106,8 +157,9 @@ std::optional<CK_OBJECT_HANDLE> HSMUtils::retrieveKeyHandle(CK_FUNCTION_LIST_PTR
 
   CK_ULONG aCount = 0u;
   CK_OBJECT_HANDLE aHandle;
-  CK_RV aCKFindStatus = iLibInterface->C_FindObjects(iSession, &aHandle, 1, &aCount);
+  CK_RV aCKFindStatus = observedCall(iLibInterface, "C_FindObjects", iSession, iLibInterface->C_FindObjects, iSession, &aHandle, 1, &aCount);
   if (aCKFindStatus != CKR_OK) {
+    gLastError = aCKFindStatus;
     std::stringstream aErrorMsg;
     aErrorMsg << "Unable to find the Key: " << iKeyLabel << " - C_FindObjects returned 0x" << std::hex << aCKFindStatus;
     TRC_ERROR(255,  aErrorMsg.str());
@@ -121,8 +173,9 @@ std::optional<CK_OBJECT_HANDLE> HSMUtils::retrieveKeyHandle(CK_FUNCTION_LIST_PTR
   }
 
   // Close search
-  CK_RV aCKCloseStatus = iLibInterface->C_FindObjectsFinal(iSession);
+  CK_RV aCKCloseStatus = observedCall(iLibInterface, "C_FindObjectsFinal", iSession, iLibInterface->C_FindObjectsFinal, iSession);
   if (aCKCloseStatus != CKR_OK) {
+    gLastError = aCKCloseStatus;
     std::stringstream aErrorMsg;
     aErrorMsg << "Error in C_FindObjectsFinal" << std::hex << aCKCloseStatus;
     TRC_ERROR(255,  aErrorMsg.str());
@@ -138,12 +191,14 @@ std::optional<CK_OBJECT_HANDLE> HSMUtils::retrieveKeyHandle(CK_FUNCTION_LIST_PTR
 bool HSMUtils::login(CK_FUNCTION_LIST_PTR iLibInterface,
 CK_SESSION_HANDLE iSession,
 const std::string& iSlotPwd) {
+  gLastError = CKR_OK;
 /*
  * Log in
  */
 const CK_USER_TYPE aUserType = CKU_USER;
-CK_RV aStatus = iLibInterface->C_Login(iSession, aUserType, (CK_CHAR_PTR)iSlotPwd.c_str(), iSlotPwd.size());
+CK_RV aStatus = observedCall(iLibInterface, "C_Login", iSession, iLibInterface->C_Login, iSession, aUserType, (CK_CHAR_PTR)iSlotPwd.c_str(), iSlotPwd.size());
 if (aStatus != CKR_OK) {
+    gLastError = aStatus;
     std::stringstream aErrorMsg;
     aErrorMsg << "Login to HSM failed - C_Login returned 0x" << std::hex << aStatus;
     TRC_ERROR(255,  aErrorMsg.str());
@@ -152,8 +207,10 @@ if (aStatus != CKR_OK) {
   return true;
 }
 
-std::optional<CK_SESSION_HANDLE> HSMUtils::openSession(CK_FUNCTION_LIST_PTR iLibInterface,
-                                                       const std::string& iSlotLabel) {
+std::optional<CK_SLOT_ID> HSMUtils::findSlot(CK_FUNCTION_LIST_PTR iLibInterface,
+                                             const std::string& iSlotLabel,
+                                             CK_TOKEN_INFO* oTokenInfo) {
+  gLastError = CKR_OK;
 
   if (iLibInterface == nullptr) {
     TRC_ERROR(255,  "Empty lib interface functions.");
@@ -161,8 +218,9 @@ std::optional<CK_SESSION_HANDLE> HSMUtils::openSession(CK_FUNCTION_LIST_PTR iLib
   }
 
   CK_ULONG aSlotCount = 0u;
-  CK_RV aStatus       = iLibInterface->C_GetSlotList((CK_BBOOL)TRUE, nullptr, &aSlotCount);
+  CK_RV aStatus       = observedCall(iLibInterface, "C_GetSlotList", CK_INVALID_HANDLE, iLibInterface->C_GetSlotList, (CK_BBOOL)TRUE, nullptr, &aSlotCount);
   if (aStatus != CKR_OK) {
+    gLastError = aStatus;
     std::ostringstream descr;
     descr << "Error in C_GetSlotList: " << std::hex << aStatus;
     TRC_ERROR(255,  descr.str());
@@ -176,8 +234,9 @@ std::optional<CK_SESSION_HANDLE> HSMUtils::openSession(CK_FUNCTION_LIST_PTR iLib
   }
 
   std::vector<CK_SLOT_ID> aSlotList(aSlotCount, 0);
-  aStatus = iLibInterface->C_GetSlotList((CK_BBOOL)TRUE, &aSlotList[0], &aSlotCount);
+  aStatus = observedCall(iLibInterface, "C_GetSlotList", CK_INVALID_HANDLE, iLibInterface->C_GetSlotList, (CK_BBOOL)TRUE, &aSlotList[0], &aSlotCount);
   if (aStatus != CKR_OK) {
+    gLastError = aStatus;
     std::ostringstream descr;
     descr << "Error while retrieving slot list in C_GetSlotList: " << std::hex << aStatus;
     TRC_ERROR(255,  descr.str());
@@ -188,8 +247,9 @@ std::optional<CK_SESSION_HANDLE> HSMUtils::openSession(CK_FUNCTION_LIST_PTR iLib
 
     CK_SLOT_ID aSlotId = aSlotList[i];
     CK_TOKEN_INFO aTokenInfo;
-    aStatus = iLibInterface->C_GetTokenInfo(aSlotId, &aTokenInfo);
+    aStatus = observedCall(iLibInterface, "C_GetTokenInfo", CK_INVALID_HANDLE, iLibInterface->C_GetTokenInfo, aSlotId, &aTokenInfo);
     if (aStatus != CKR_OK) {
+      gLastError = aStatus;
       std::ostringstream aErrorMsg;
       aErrorMsg << "Unable to read HSM token in slot " << aSlotId << " while looking for slot " << iSlotLabel
                 << " - C_GetTokenInfo returned 0x" << std::hex << aStatus;
@@ -202,23 +262,11 @@ std::optional<CK_SESSION_HANDLE> HSMUtils::openSession(CK_FUNCTION_LIST_PTR iLib
                                     aSlotLabel.end(),
                                     [](unsigned char x) { return std::isspace(x); }),
                      aSlotLabel.end());
-    /*
-     * Open session on the slot
-     */
     if (aSlotLabel == iSlotLabel) {
-
-      const CK_FLAGS aSessionFlags = CKF_SERIAL_SESSION | CKF_RW_SESSION;
-      CK_SESSION_HANDLE aSession;
-      aStatus = iLibInterface->C_OpenSession(aSlotId, aSessionFlags, 0, 0, &aSession);
-      if (aStatus != CKR_OK) {
-        std::ostringstream aErrorMsg;
-        aErrorMsg << "Unable to open HSM session " << iSlotLabel << " - C_OpenSession returned 0x" << std::hex
-                  << aStatus;
-        TRC_ERROR(255,  aErrorMsg.str());
-        return {};
+      if (oTokenInfo) {
+        *oTokenInfo = aTokenInfo;
       }
-      // return found session
-      return { aSession };
+      return { aSlotId };
     }
   }
 
@@ -228,22 +276,113 @@ std::optional<CK_SESSION_HANDLE> HSMUtils::openSession(CK_FUNCTION_LIST_PTR iLib
   return {};
 }
 
+std::optional<std::vector<std::pair<CK_SLOT_ID, CK_TOKEN_INFO>>> HSMUtils::listTokens(CK_FUNCTION_LIST_PTR iLibInterface) {
+  gLastError = CKR_OK;
+
+  if (iLibInterface == nullptr) {
+    TRC_ERROR(255,  "Empty lib interface functions.");
+    return {};
+  }
+
+  CK_ULONG aSlotCount = 0u;
+  CK_RV aStatus       = observedCall(iLibInterface, "C_GetSlotList", CK_INVALID_HANDLE, iLibInterface->C_GetSlotList, (CK_BBOOL)TRUE, nullptr, &aSlotCount);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream descr;
+    descr << "Error in C_GetSlotList: " << std::hex << aStatus;
+    TRC_ERROR(255,  descr.str());
+    return {};
+  }
+
+  std::vector<CK_SLOT_ID> aSlotList(aSlotCount, 0);
+  if (aSlotCount > 0u) {
+    aStatus = observedCall(iLibInterface, "C_GetSlotList", CK_INVALID_HANDLE, iLibInterface->C_GetSlotList, (CK_BBOOL)TRUE, &aSlotList[0], &aSlotCount);
+    if (aStatus != CKR_OK) {
+      gLastError = aStatus;
+      std::ostringstream descr;
+      descr << "Error while retrieving slot list in C_GetSlotList: " << std::hex << aStatus;
+      TRC_ERROR(255,  descr.str());
+      return {};
+    }
+    aSlotList.resize(aSlotCount);
+  }
+
+  std::vector<std::pair<CK_SLOT_ID, CK_TOKEN_INFO>> aTokens;
+  aTokens.reserve(aSlotList.size());
+  for (CK_SLOT_ID aSlotId : aSlotList) {
+    CK_TOKEN_INFO aTokenInfo;
+    aStatus = observedCall(iLibInterface, "C_GetTokenInfo", CK_INVALID_HANDLE, iLibInterface->C_GetTokenInfo, aSlotId, &aTokenInfo);
+    if (aStatus != CKR_OK) {
+      gLastError = aStatus;
+      std::ostringstream aErrorMsg;
+      aErrorMsg << "Unable to read HSM token in slot " << aSlotId << " - C_GetTokenInfo returned 0x" << std::hex << aStatus;
+      TRC_ERROR(255,  aErrorMsg.str());
+      return {};
+    }
+    aTokens.emplace_back(aSlotId, aTokenInfo);
+  }
+  return aTokens;
+}
+
+std::optional<CK_SESSION_HANDLE> HSMUtils::openSession(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                       const std::string& iSlotLabel,
+                                                       SessionAccess iAccess) {
+  gLastError = CKR_OK;
+
+  auto aSlotId = findSlot(iLibInterface, iSlotLabel);
+  if (not aSlotId) {
+    return {};
+  }
+  return openSession(iLibInterface, aSlotId.value(), iAccess);
+}
+
+std::optional<CK_SESSION_HANDLE> HSMUtils::openSession(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                       CK_SLOT_ID iSlotId,
+                                                       SessionAccess iAccess) {
+  gLastError = CKR_OK;
+
+  if (iLibInterface == nullptr) {
+    TRC_ERROR(255,  "Empty lib interface functions.");
+    return {};
+  }
+
+  /*
+   * Open session on the slot
+   */
+  const CK_FLAGS aSessionFlags = (iAccess == SessionAccess::ReadWrite) ? (CKF_SERIAL_SESSION | CKF_RW_SESSION) : CKF_SERIAL_SESSION;
+  CK_SESSION_HANDLE aSession;
+  CK_RV aStatus = observedCall(iLibInterface, "C_OpenSession", CK_INVALID_HANDLE, iLibInterface->C_OpenSession, iSlotId, aSessionFlags, nullptr, nullptr, &aSession);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Unable to open HSM session on slot " << iSlotId << " - C_OpenSession returned 0x" << std::hex
+              << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  // return found session
+  return { aSession };
+}
+
 bool HSMUtils::closeSession(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE& iSession) {
+  gLastError = CKR_OK;
   if (iLibInterface == nullptr) {
     TRC_ERROR(255,  "Empty lib interface functions.");
     return false;
   }
 
   if (iSession) {
-    auto aStatus = iLibInterface -> C_Logout(iSession);
+    auto aStatus = observedCall(iLibInterface, "C_Logout", iSession, iLibInterface->C_Logout, iSession);
     if (aStatus != CKR_OK) {
+      gLastError = aStatus;
       std::ostringstream aErrorMsg;
       aErrorMsg << "Error while calling C_Logout: 0x" << std::hex << aStatus;
       TRC_WARN(255,  aErrorMsg.str());
     }
 
-    aStatus = iLibInterface -> C_CloseSession(iSession);
+    aStatus = observedCall(iLibInterface, "C_CloseSession", iSession, iLibInterface->C_CloseSession, iSession);
     if (aStatus != CKR_OK) {
+      gLastError = aStatus;
       std::ostringstream aErrorMsg;
       aErrorMsg << "Error while calling C_CloseSession: 0x" << std::hex << aStatus;
       TRC_ERROR(255,  aErrorMsg.str());
@@ -254,25 +393,33 @@ bool HSMUtils::closeSession(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDL
   return true;
 }
 
-std::optional<CK_OBJECT_HANDLE> HSMUtils::generateKey(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::string& iKeyLabel) {
+std::optional<CK_OBJECT_HANDLE> HSMUtils::generateKey(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                      CK_SESSION_HANDLE iSession,
+                                                      const std::string& iKeyLabel,
+                                                      bool iTokenObject,
+                                                      bool iModifiable,
+                                                      const std::vector<unsigned char>& iKeyId) {
+  gLastError = CKR_OK;
   CK_MECHANISM mechanism = {
       CKM_AES_KEY_GEN, nullptr, 0};
 
   std::vector<CK_BYTE> keyLabel(iKeyLabel.begin(), iKeyLabel.end());
+  std::vector<CK_BYTE> keyId = iKeyId.empty() ? keyLabel : iKeyId;
 
   static CK_OBJECT_CLASS KeyClass = CKO_SECRET_KEY;
   static CK_KEY_TYPE KeyType = CKK_AES;
   static CK_ULONG KeyLen = 32;
   static CK_BBOOL bTrue = true;
-  static CK_BBOOL bFalse = true;
+  CK_BBOOL bModifiable = iModifiable ? CK_TRUE : CK_FALSE;
+  CK_BBOOL bToken = iTokenObject ? CK_TRUE : CK_FALSE;
 
   std::vector<CK_ATTRIBUTE> attrs = {
       {CKA_CLASS, &KeyClass, sizeof(KeyClass)},
-      {CKA_TOKEN, &bTrue, sizeof(bTrue)},
+      {CKA_TOKEN, &bToken, sizeof(bToken)},
       {CKA_PRIVATE, &bTrue, sizeof(bTrue)},
       {CKA_LABEL, keyLabel.data(), keyLabel.size()},
-      {CKA_ID, keyLabel.data(), keyLabel.size()},
-      {CKA_MODIFIABLE, &bFalse, sizeof(bFalse)},
+      {CKA_ID, keyId.data(), keyId.size()},
+      {CKA_MODIFIABLE, &bModifiable, sizeof(bModifiable)},
       {CKA_KEY_TYPE, &KeyType, sizeof(KeyType)},
       {CKA_ENCRYPT, &bTrue, sizeof(bTrue)},
       {CKA_DECRYPT, &bTrue, sizeof(bTrue)},
@@ -280,8 +427,9 @@ std::optional<CK_OBJECT_HANDLE> HSMUtils::generateKey(CK_FUNCTION_LIST_PTR iLibI
   };
 
   CK_OBJECT_HANDLE aKey;
-  CK_RV aStatus = iLibInterface->C_GenerateKey(iSession, &mechanism, attrs.data(), attrs.size(), &aKey);
+  CK_RV aStatus = observedCall(iLibInterface, "C_GenerateKey", iSession, iLibInterface->C_GenerateKey, iSession, &mechanism, attrs.data(), attrs.size(), &aKey);
   if (aStatus != CKR_OK) {
+    gLastError = aStatus;
     std::ostringstream aErrorMsg;
     aErrorMsg << "Error while calling C_GenerateKey: 0x" << std::hex << aStatus;
     TRC_ERROR(255,  aErrorMsg.str());
@@ -290,7 +438,486 @@ std::optional<CK_OBJECT_HANDLE> HSMUtils::generateKey(CK_FUNCTION_LIST_PTR iLibI
   return {aKey};
 }
 
+std::optional<CK_OBJECT_HANDLE> HSMUtils::generateMacKey(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::string& iKeyLabel, bool iTokenObject) {
+  gLastError = CKR_OK;
+  CK_MECHANISM mechanism = {
+      CKM_AES_KEY_GEN, nullptr, 0};
+
+  std::vector<CK_BYTE> keyLabel(iKeyLabel.begin(), iKeyLabel.end());
+
+  static CK_OBJECT_CLASS KeyClass = CKO_SECRET_KEY;
+  static CK_KEY_TYPE KeyType = CKK_AES;
+  static CK_ULONG KeyLen = 32;
+  static CK_BBOOL bTrue = true;
+  static CK_BBOOL bFalse = false;
+  CK_BBOOL bToken = iTokenObject ? CK_TRUE : CK_FALSE;
+
+  std::vector<CK_ATTRIBUTE> attrs = {
+      {CKA_CLASS, &KeyClass, sizeof(KeyClass)},
+      {CKA_TOKEN, &bToken, sizeof(bToken)},
+      {CKA_PRIVATE, &bTrue, sizeof(bTrue)},
+      {CKA_LABEL, keyLabel.data(), keyLabel.size()},
+      {CKA_ID, keyLabel.data(), keyLabel.size()},
+      {CKA_MODIFIABLE, &bFalse, sizeof(bFalse)},
+      {CKA_KEY_TYPE, &KeyType, sizeof(KeyType)},
+      {CKA_SIGN, &bTrue, sizeof(bTrue)},
+      {CKA_VERIFY, &bTrue, sizeof(bTrue)},
+      {CKA_VALUE_LEN, &KeyLen, sizeof(KeyLen)}
+  };
+
+  CK_OBJECT_HANDLE aKey;
+  CK_RV aStatus = observedCall(iLibInterface, "C_GenerateKey", iSession, iLibInterface->C_GenerateKey, iSession, &mechanism, attrs.data(), attrs.size(), &aKey);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_GenerateKey: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  return {aKey};
+}
+
+std::optional<std::vector<CK_OBJECT_HANDLE>> HSMUtils::findObjects(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                                    CK_SESSION_HANDLE iSession,
+                                                                    const std::vector<CK_ATTRIBUTE>& iTemplate,
+                                                                    std::size_t iBatchSize) {
+  gLastError = CKR_OK;
+
+  std::vector<CK_ATTRIBUTE> aTemplate(iTemplate);
+  CK_RV aStatus = observedCall(iLibInterface, "C_FindObjectsInit", iSession, iLibInterface->C_FindObjectsInit, iSession, aTemplate.data(), (CK_ULONG)aTemplate.size());
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error: C_FindObjectsInit returned 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+
+  std::vector<CK_OBJECT_HANDLE> aHandles;
+  std::vector<CK_OBJECT_HANDLE> aBatch(std::max<std::size_t>(iBatchSize, 1u));
+  CK_ULONG aCount = 0u;
+  do {
+    aStatus = observedCall(iLibInterface, "C_FindObjects", iSession, iLibInterface->C_FindObjects, iSession, aBatch.data(), (CK_ULONG)aBatch.size(), &aCount);
+    if (aStatus != CKR_OK) {
+      break;
+    }
+    aHandles.insert(aHandles.end(), aBatch.begin(), aBatch.begin() + aCount);
+  } while (aCount == aBatch.size());
+
+  CK_RV aFinalStatus = observedCall(iLibInterface, "C_FindObjectsFinal", iSession, iLibInterface->C_FindObjectsFinal, iSession);
+  if (aStatus == CKR_OK) {
+    aStatus = aFinalStatus;
+  }
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while searching objects: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  return aHandles;
+}
+
+std::optional<std::pair<std::string, std::vector<unsigned char>>> HSMUtils::getLabelAndId(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                                                          CK_SESSION_HANDLE iSession,
+                                                                                          CK_OBJECT_HANDLE iObject) {
+  gLastError = CKR_OK;
+
+  // first call for the lengths, second one for the values
+  CK_ATTRIBUTE aTemplate[] = { { CKA_LABEL, nullptr, 0u }, { CKA_ID, nullptr, 0u } };
+  CK_RV aStatus = observedCall(iLibInterface, "C_GetAttributeValue", iSession, iLibInterface->C_GetAttributeValue, iSession, iObject, aTemplate, 2);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_GetAttributeValue: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+
+  std::string aLabel(aTemplate[0].ulValueLen, '\0');
+  std::vector<unsigned char> aId(aTemplate[1].ulValueLen);
+  aTemplate[0].pValue = aLabel.empty() ? nullptr : &aLabel[0];
+  aTemplate[1].pValue = aId.empty() ? nullptr : aId.data();
+  aStatus = observedCall(iLibInterface, "C_GetAttributeValue", iSession, iLibInterface->C_GetAttributeValue, iSession, iObject, aTemplate, 2);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_GetAttributeValue: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  return std::make_pair(std::move(aLabel), std::move(aId));
+}
+
+std::optional<KeyAttributes> HSMUtils::getKeyAttributes(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                       CK_SESSION_HANDLE iSession,
+                                                       CK_OBJECT_HANDLE iKey) {
+  gLastError = CKR_OK;
+
+  // large enough for the usual labels and ids, saves the length query
+  constexpr const std::size_t K_INLINE_SIZE = 128u;
+  KeyAttributes aAttributes;
+  aAttributes.label.resize(K_INLINE_SIZE);
+  aAttributes.id.resize(K_INLINE_SIZE);
+  aAttributes.keyType  = CKK_GENERIC_SECRET;
+  aAttributes.valueLen = 0u;
+
+  CK_ATTRIBUTE aTemplate[] = {
+      { CKA_LABEL, &aAttributes.label[0], aAttributes.label.size() },
+      { CKA_ID, aAttributes.id.data(), aAttributes.id.size() },
+      { CKA_KEY_TYPE, &aAttributes.keyType, sizeof(aAttributes.keyType) },
+      { CKA_VALUE_LEN, &aAttributes.valueLen, sizeof(aAttributes.valueLen) },
+  };
+  CK_RV aStatus = observedCall(iLibInterface, "C_GetAttributeValue", iSession, iLibInterface->C_GetAttributeValue, iSession, iKey, aTemplate, 4);
+  if (aStatus == CKR_BUFFER_TOO_SMALL) {
+    // query the lengths of label and id, then ask again with buffers of that size
+    aTemplate[0].pValue = nullptr;
+    aTemplate[1].pValue = nullptr;
+    aStatus = observedCall(iLibInterface, "C_GetAttributeValue", iSession, iLibInterface->C_GetAttributeValue, iSession, iKey, aTemplate, 2);
+    if (aStatus == CKR_OK) {
+      aAttributes.label.resize(aTemplate[0].ulValueLen);
+      aAttributes.id.resize(aTemplate[1].ulValueLen);
+      aTemplate[0].pValue = aAttributes.label.empty() ? nullptr : &aAttributes.label[0];
+      aTemplate[1].pValue = aAttributes.id.empty() ? nullptr : aAttributes.id.data();
+      aStatus = observedCall(iLibInterface, "C_GetAttributeValue", iSession, iLibInterface->C_GetAttributeValue, iSession, iKey, aTemplate, 4);
+    }
+  }
+  if (aStatus == CKR_ATTRIBUTE_TYPE_INVALID and aTemplate[3].ulValueLen == CK_UNAVAILABLE_INFORMATION) {
+    // secret keys of a fixed size (e.g. DES) have no CKA_VALUE_LEN
+    aAttributes.valueLen = 0u;
+    aStatus              = observedCall(iLibInterface, "C_GetAttributeValue", iSession, iLibInterface->C_GetAttributeValue, iSession, iKey, aTemplate, 3);
+  }
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_GetAttributeValue: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  aAttributes.label.resize(aTemplate[0].ulValueLen);
+  aAttributes.id.resize(aTemplate[1].ulValueLen);
+  return aAttributes;
+}
+
+std::optional<std::vector<unsigned char>> HSMUtils::wrapKey(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                            CK_SESSION_HANDLE iSession,
+                                                            CK_OBJECT_HANDLE iWrappingKey,
+                                                            CK_OBJECT_HANDLE iKey) {
+  gLastError = CKR_OK;
+
+  CK_MECHANISM aMech = { CKM_AES_KEY_WRAP_PAD, nullptr, 0 };
+  CK_ULONG aWrappedLen = 0u;
+  CK_RV aStatus = observedCall(iLibInterface, "C_WrapKey", iSession, iLibInterface->C_WrapKey, iSession, &aMech, iWrappingKey, iKey, nullptr, &aWrappedLen);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_WrapKey: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+
+  std::vector<unsigned char> aWrapped(aWrappedLen);
+  aStatus = observedCall(iLibInterface, "C_WrapKey", iSession, iLibInterface->C_WrapKey, iSession, &aMech, iWrappingKey, iKey, aWrapped.data(), &aWrappedLen);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_WrapKey: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  aWrapped.resize(aWrappedLen);
+  return aWrapped;
+}
+
+std::optional<CK_OBJECT_HANDLE> HSMUtils::unwrapKey(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                    CK_SESSION_HANDLE iSession,
+                                                    CK_OBJECT_HANDLE iUnwrappingKey,
+                                                    const std::vector<unsigned char>& iWrappedKey,
+                                                    const std::string& iKeyLabel,
+                                                    const std::vector<unsigned char>& iKeyId) {
+  gLastError = CKR_OK;
+
+  CK_MECHANISM aMech = { CKM_AES_KEY_WRAP_PAD, nullptr, 0 };
+  std::vector<CK_BYTE> aLabel(iKeyLabel.begin(), iKeyLabel.end());
+  std::vector<CK_BYTE> aId(iKeyId.begin(), iKeyId.end());
+  std::vector<CK_BYTE> aWrapped(iWrappedKey.begin(), iWrappedKey.end());
+
+  static CK_OBJECT_CLASS KeyClass = CKO_SECRET_KEY;
+  static CK_KEY_TYPE KeyType      = CKK_AES;
+  static CK_BBOOL bTrue           = true;
+
+  // extractable again, so that the replica can itself be replicated
+  std::vector<CK_ATTRIBUTE> attrs = {
+      {CKA_CLASS, &KeyClass, sizeof(KeyClass)},
+      {CKA_KEY_TYPE, &KeyType, sizeof(KeyType)},
+      {CKA_TOKEN, &bTrue, sizeof(bTrue)},
+      {CKA_PRIVATE, &bTrue, sizeof(bTrue)},
+      {CKA_SENSITIVE, &bTrue, sizeof(bTrue)},
+      {CKA_EXTRACTABLE, &bTrue, sizeof(bTrue)},
+      {CKA_LABEL, aLabel.data(), aLabel.size()},
+      {CKA_ID, aId.data(), aId.size()},
+      {CKA_ENCRYPT, &bTrue, sizeof(bTrue)},
+      {CKA_DECRYPT, &bTrue, sizeof(bTrue)},
+  };
+
+  CK_OBJECT_HANDLE aKey;
+  CK_RV aStatus = observedCall(iLibInterface, "C_UnwrapKey", iSession, iLibInterface->C_UnwrapKey, iSession, &aMech, iUnwrappingKey, aWrapped.data(), (CK_ULONG)aWrapped.size(), attrs.data(), (CK_ULONG)attrs.size(), &aKey);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_UnwrapKey: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  return {aKey};
+}
+
+// completes a getOrCreateKey flight on every way out of its leader, exceptions included: the followers get no key
+// instead of waiting forever and the next call starts a new flight
+class KeyFlightGuard {
+ public:
+  KeyFlightGuard(std::promise<std::optional<CK_OBJECT_HANDLE>>& iPromise, KeyFlightId iId)
+      : mPromise(iPromise), mId(std::move(iId)) {}
+  KeyFlightGuard(const KeyFlightGuard&) = delete;
+  KeyFlightGuard& operator=(const KeyFlightGuard&) = delete;
+
+  ~KeyFlightGuard() {
+    if (not mSettled) {
+      mPromise.set_value(std::nullopt);
+    }
+    std::lock_guard<std::mutex> aLock(gKeyFlightsMutex);
+    gKeyFlights.erase(mId);
+  }
+
+  void settle(const std::optional<CK_OBJECT_HANDLE>& iKey) {
+    mPromise.set_value(iKey);
+    mSettled = true;
+  }
+
+ private:
+  std::promise<std::optional<CK_OBJECT_HANDLE>>& mPromise;
+  const KeyFlightId mId;
+  bool mSettled = false;
+};
+
+// CKA_ID of a key generated by getOrCreateKey: the label, then the creation time in nanoseconds and random bytes,
+// both big-endian so that the earliest key has the smallest id
+std::vector<unsigned char> creationId(const std::string& iKeyLabel) {
+  thread_local std::mt19937_64 tRandom{ std::random_device{}() };
+  std::vector<unsigned char> aId(iKeyLabel.begin(), iKeyLabel.end());
+  const auto aTime   = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+  const auto aRandom = tRandom();
+  for (const auto aValue : { aTime, aRandom }) {
+    for (int aShift = 56; aShift >= 0; aShift -= 8) {
+      aId.push_back(static_cast<unsigned char>(aValue >> aShift));
+    }
+  }
+  return aId;
+}
+
+// the key every application keeps among iKeys, all labeled alike: the smallest CKA_ID, which only token contents
+// decide (a key with the bare label as id, generated by generateKey, comes first); handles, private to each
+// application, only break ties between identical ids
+std::optional<CK_OBJECT_HANDLE> survivingKey(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::vector<CK_OBJECT_HANDLE>& iKeys) {
+  std::optional<std::pair<std::vector<unsigned char>, CK_OBJECT_HANDLE>> aBest;
+  for (const auto aKey : iKeys) {
+    auto aLabelAndId = HSMUtils::getLabelAndId(iLibInterface, iSession, aKey);
+    if (not aLabelAndId) {
+      return {};
+    }
+    std::pair<std::vector<unsigned char>, CK_OBJECT_HANDLE> aCandidate(std::move(aLabelAndId->second), aKey);
+    if (not aBest or aCandidate < *aBest) {
+      aBest = std::move(aCandidate);
+    }
+  }
+  if (not aBest) {
+    return {};
+  }
+  return aBest->second;
+}
+
+std::optional<CK_OBJECT_HANDLE> HSMUtils::getOrCreateKey(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                         CK_SESSION_HANDLE iSession,
+                                                         const std::string& iKeyLabel) {
+  gLastError = CKR_OK;
+  // the same label names a different key on each token
+  CK_SESSION_INFO aSessionInfo;
+  CK_RV aStatus = observedCall(iLibInterface, "C_GetSessionInfo", iSession, iLibInterface->C_GetSessionInfo, iSession, &aSessionInfo);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_GetSessionInfo: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  KeyFlightId aFlightId(iLibInterface, aSessionInfo.slotID, iKeyLabel);
+
+  std::promise<std::optional<CK_OBJECT_HANDLE>> aPromise;
+  std::shared_future<std::optional<CK_OBJECT_HANDLE>> aFlight;
+  bool aLeader = false;
+  {
+    std::lock_guard<std::mutex> aLock(gKeyFlightsMutex);
+    auto aIt = gKeyFlights.find(aFlightId);
+    if (aIt != gKeyFlights.end()) {
+      aFlight = aIt->second;
+    } else {
+      aFlight = aPromise.get_future().share();
+      gKeyFlights.emplace(aFlightId, aFlight);
+      aLeader = true;
+    }
+  }
+  if (not aLeader) {
+    return aFlight.get();
+  }
+  KeyFlightGuard aGuard(aPromise, std::move(aFlightId));
+
+  std::vector<CK_BYTE> keyLabel(iKeyLabel.begin(), iKeyLabel.end());
+  static CK_OBJECT_CLASS KeyClass = CKO_SECRET_KEY;
+  static CK_KEY_TYPE KeyType = CKK_AES;
+  static CK_BBOOL bTrue = true;
+  const std::vector<CK_ATTRIBUTE> aTemplate = {
+      {CKA_CLASS, &KeyClass, sizeof(KeyClass)},
+      {CKA_KEY_TYPE, &KeyType, sizeof(KeyType)},
+      {CKA_TOKEN, &bTrue, sizeof(bTrue)},
+      {CKA_LABEL, keyLabel.data(), keyLabel.size()},
+  };
+
+  std::optional<CK_OBJECT_HANDLE> aKey;
+  for (int aAttempt = 0; aAttempt < K_GET_OR_CREATE_ATTEMPTS and not aKey; ++aAttempt) {
+    auto aExisting = findObjects(iLibInterface, iSession, aTemplate);
+    if (not aExisting) {
+      break;
+    }
+    if (not aExisting->empty()) {
+      aKey = aExisting->size() == 1u ? aExisting->front() : survivingKey(iLibInterface, iSession, *aExisting);
+      break;
+    }
+
+    auto aGenerated = generateKey(iLibInterface, iSession, iKeyLabel, true, false, creationId(iKeyLabel));
+    if (not aGenerated) {
+      break;
+    }
+    // another application may have generated the key at the same time
+    auto aAll = findObjects(iLibInterface, iSession, aTemplate);
+    if (not aAll or aAll->size() <= 1u) {
+      aKey = aGenerated;
+      break;
+    }
+    auto aKeep = survivingKey(iLibInterface, iSession, *aAll);
+    if (not aKeep or aKeep.value() == aGenerated.value()) {
+      aKey = aGenerated;
+      break;
+    }
+    std::ostringstream descr;
+    descr << "Key " << iKeyLabel << " was created concurrently, dropping the duplicate";
+    TRC_WARN(255,  descr.str());
+    destroyObject(iLibInterface, iSession, aGenerated.value());
+    // the surviving copy is looked up again, in case it was destroyed meanwhile
+  }
+
+  aGuard.settle(aKey);
+  return aKey;
+}
+
+std::optional<std::pair<CK_OBJECT_HANDLE, CK_OBJECT_HANDLE>> HSMUtils::generateKeyPair(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                                                        CK_SESSION_HANDLE iSession,
+                                                                                        const std::string& iKeyLabel,
+                                                                                        bool iTokenObject) {
+  gLastError = CKR_OK;
+  CK_MECHANISM mechanism = {
+      CKM_EC_KEY_PAIR_GEN, nullptr, 0};
+
+  std::vector<CK_BYTE> keyLabel(iKeyLabel.begin(), iKeyLabel.end());
+
+  // DER encoded OID of prime256v1 (1.2.840.10045.3.1.7)
+  static CK_BYTE P256Params[] = { 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07 };
+  static CK_BBOOL bTrue = true;
+  CK_BBOOL bToken = iTokenObject ? CK_TRUE : CK_FALSE;
+
+  std::vector<CK_ATTRIBUTE> publicAttrs = {
+      {CKA_TOKEN, &bToken, sizeof(bToken)},
+      {CKA_LABEL, keyLabel.data(), keyLabel.size()},
+      {CKA_ID, keyLabel.data(), keyLabel.size()},
+      {CKA_EC_PARAMS, P256Params, sizeof(P256Params)},
+      {CKA_VERIFY, &bTrue, sizeof(bTrue)},
+  };
+  std::vector<CK_ATTRIBUTE> privateAttrs = {
+      {CKA_TOKEN, &bToken, sizeof(bToken)},
+      {CKA_PRIVATE, &bTrue, sizeof(bTrue)},
+      {CKA_SENSITIVE, &bTrue, sizeof(bTrue)},
+      {CKA_LABEL, keyLabel.data(), keyLabel.size()},
+      {CKA_ID, keyLabel.data(), keyLabel.size()},
+      {CKA_SIGN, &bTrue, sizeof(bTrue)},
+  };
+
+  CK_OBJECT_HANDLE aPublicKey;
+  CK_OBJECT_HANDLE aPrivateKey;
+  CK_RV aStatus = observedCall(iLibInterface, "C_GenerateKeyPair", iSession, iLibInterface->C_GenerateKeyPair, iSession, &mechanism,
+                               publicAttrs.data(), (CK_ULONG)publicAttrs.size(), privateAttrs.data(), (CK_ULONG)privateAttrs.size(),
+                               &aPublicKey, &aPrivateKey);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_GenerateKeyPair: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  return std::make_pair(aPublicKey, aPrivateKey);
+}
+
+bool HSMUtils::setKeyLabel(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iObject, const std::string& iKeyLabel) {
+  gLastError = CKR_OK;
+
+  std::vector<CK_BYTE> keyLabel(iKeyLabel.begin(), iKeyLabel.end());
+  CK_ATTRIBUTE aTemplate[] = { { CKA_LABEL, keyLabel.data(), keyLabel.size() }, { CKA_ID, keyLabel.data(), keyLabel.size() } };
+  CK_RV aStatus = observedCall(iLibInterface, "C_SetAttributeValue", iSession, iLibInterface->C_SetAttributeValue, iSession, iObject, aTemplate, 2);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_SetAttributeValue: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return false;
+  }
+  return true;
+}
+
+std::optional<CK_OBJECT_HANDLE> HSMUtils::copyObject(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                     CK_SESSION_HANDLE iSession,
+                                                     CK_OBJECT_HANDLE iObject,
+                                                     bool iTokenObject) {
+  gLastError = CKR_OK;
+
+  CK_BBOOL aToken = iTokenObject ? CK_TRUE : CK_FALSE;
+  CK_ATTRIBUTE aTemplate[] = { { CKA_TOKEN, &aToken, sizeof(aToken) } };
+
+  CK_OBJECT_HANDLE aCopy;
+  CK_RV aStatus = observedCall(iLibInterface, "C_CopyObject", iSession, iLibInterface->C_CopyObject, iSession, iObject, aTemplate, 1, &aCopy);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_CopyObject: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return {};
+  }
+  return {aCopy};
+}
+
+bool HSMUtils::destroyObject(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iObject) {
+  gLastError = CKR_OK;
+
+  CK_RV aStatus = observedCall(iLibInterface, "C_DestroyObject", iSession, iLibInterface->C_DestroyObject, iSession, iObject);
+  if (aStatus != CKR_OK) {
+    gLastError = aStatus;
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Error while calling C_DestroyObject: 0x" << std::hex << aStatus;
+    TRC_ERROR(255,  aErrorMsg.str());
+    return false;
+  }
+  return true;
+}
+
 std::optional<std::vector<unsigned char>> HSMUtils::encrypt_aes(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iKeyHandle, const std::vector<unsigned char> &iPlainText) {
+  gLastError = CKR_OK;
 
   if (not iLibInterface) {
     TRC_ERROR(255, "Cannot encrypt due to empty lib iLibInterface interface");
@@ -311,8 +938,9 @@ std::optional<std::vector<unsigned char>> HSMUtils::encrypt_aes(CK_FUNCTION_LIST
 
   CK_MECHANISM aMech = { CKM_AES_GCM, &gcmParams, sizeof(CK_AES_GCM_PARAMS) };
 
-  CK_RV rv = iLibInterface->C_EncryptInit(iSession, &aMech, iKeyHandle);
+  CK_RV rv = observedCall(iLibInterface, "C_EncryptInit", iSession, iLibInterface->C_EncryptInit, iSession, &aMech, iKeyHandle);
   if (rv != CKR_OK) {
+    gLastError = rv;
     std::stringstream descr;
     descr << "Failed in C_EncryptInit, return value: " << std::hex << rv;
     TRC_ERROR(255, descr.str());
@@ -322,8 +950,9 @@ std::optional<std::vector<unsigned char>> HSMUtils::encrypt_aes(CK_FUNCTION_LIST
   // Determine how much memory is required to store the ciphertext.
   CK_ULONG aCipherTextLength = 0;
   rv =
-      iLibInterface->C_Encrypt(iSession, (CK_BYTE_PTR)&iPlainText.front(), iPlainText.size(), nullptr, &aCipherTextLength);
+      observedCall(iLibInterface, "C_Encrypt", iSession, iLibInterface->C_Encrypt, iSession, (CK_BYTE_PTR)iPlainText.data(), iPlainText.size(), nullptr, &aCipherTextLength);
   if (rv != CKR_OK) {
+    gLastError = rv;
     std::stringstream descr;
     descr << "Failed in C_Encrypt size, return value: " << std::hex << rv;
     TRC_ERROR(255, descr.str());
@@ -334,12 +963,13 @@ std::optional<std::vector<unsigned char>> HSMUtils::encrypt_aes(CK_FUNCTION_LIST
   std::vector<unsigned char> aCipherText(gcmIV);
   aCipherText.resize(gcmIV.size() + aCipherTextLength);
   // Start to write ciphertext to iv lenght in order to have IV prepended
-  rv = iLibInterface->C_Encrypt(iSession,
-                             (CK_BYTE_PTR)&iPlainText.front(),
+  rv = observedCall(iLibInterface, "C_Encrypt", iSession, iLibInterface->C_Encrypt, iSession,
+                             (CK_BYTE_PTR)iPlainText.data(),
                              iPlainText.size(),
                              &aCipherText[gcmIV.size()],
                              &aCipherTextLength);
   if (rv != CKR_OK) {
+    gLastError = rv;
     std::ostringstream descr;
     descr << "Failed in C_Encrypt, return value: " << std::hex << rv;
     TRC_ERROR(255, descr.str());
@@ -350,7 +980,75 @@ std::optional<std::vector<unsigned char>> HSMUtils::encrypt_aes(CK_FUNCTION_LIST
 
   return {  aCipherText };
 }
+std::optional<std::vector<unsigned char>> HSMUtils::encrypt_aes_multipart(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iKeyHandle, const std::vector<unsigned char> &iPlainText, std::size_t iChunkSize) {
+  gLastError = CKR_OK;
+
+  if (not iLibInterface) {
+    TRC_ERROR(255, "Cannot encrypt due to empty lib iLibInterface interface");
+    return {};
+  }
+  if (iChunkSize == 0u) {
+    TRC_ERROR(255, "Cannot encrypt in chunks of 0 bytes");
+    return {};
+  }
+
+  std::vector<unsigned char> gcmIV(K_IV_SIZE, 0x00);
+  std::random_device rd;
+  std::uniform_int_distribution<unsigned char> dist(0x00,0xFF);
+  std::for_each(gcmIV.begin(), gcmIV.end(), [& dist = dist, &gen = rd](auto& el) { el = dist(gen); });
+
+  CK_AES_GCM_PARAMS gcmParams = {
+      &gcmIV.front(), gcmIV.size(), gcmIV.size() * 8u, &gcmAAD.front(), gcmAAD.size(), K_TAG_SIZE * 8u
+  };
+
+  CK_MECHANISM aMech = { CKM_AES_GCM, &gcmParams, sizeof(CK_AES_GCM_PARAMS) };
+
+  CK_RV rv = observedCall(iLibInterface, "C_EncryptInit", iSession, iLibInterface->C_EncryptInit, iSession, &aMech, iKeyHandle);
+  if (rv != CKR_OK) {
+    gLastError = rv;
+    std::stringstream descr;
+    descr << "Failed in C_EncryptInit, return value: " << std::hex << rv;
+    TRC_ERROR(255, descr.str());
+    return {};
+  }
+
+  // GCM ciphertext is as long as the plaintext; one extra block in case the module holds back a partial block
+  std::vector<unsigned char> aCipherText(gcmIV);
+  aCipherText.resize(gcmIV.size() + iPlainText.size() + K_TAG_SIZE + 16u);
+  std::size_t aWritten = gcmIV.size();
+  for (std::size_t aOffset = 0u; aOffset < iPlainText.size(); aOffset += iChunkSize) {
+    CK_ULONG aPartLength = aCipherText.size() - aWritten;
+    rv = observedCall(iLibInterface, "C_EncryptUpdate", iSession, iLibInterface->C_EncryptUpdate, iSession,
+                      (CK_BYTE_PTR)&iPlainText[aOffset],
+                      std::min(iChunkSize, iPlainText.size() - aOffset),
+                      &aCipherText[aWritten],
+                      &aPartLength);
+    if (rv != CKR_OK) {
+      gLastError = rv;
+      std::ostringstream descr;
+      descr << "Failed in C_EncryptUpdate, return value: " << std::hex << rv;
+      TRC_ERROR(255, descr.str());
+      return {};
+    }
+    aWritten += aPartLength;
+  }
+
+  CK_ULONG aLastPartLength = aCipherText.size() - aWritten;
+  rv = observedCall(iLibInterface, "C_EncryptFinal", iSession, iLibInterface->C_EncryptFinal, iSession, &aCipherText[aWritten], &aLastPartLength);
+  if (rv != CKR_OK) {
+    gLastError = rv;
+    std::ostringstream descr;
+    descr << "Failed in C_EncryptFinal, return value: " << std::hex << rv;
+    TRC_ERROR(255, descr.str());
+    return {};
+  }
+  aCipherText.resize(aWritten + aLastPartLength);
+
+  return { aCipherText };
+}
+
 std::optional<std::vector<unsigned char>> HSMUtils::decrypt_aes(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iKeyHandle, const std::vector<unsigned char> &iCipherText) {
+  gLastError = CKR_OK;
 
   if (iLibInterface == nullptr) {
     TRC_ERROR(255, "Cannot decrypt due to empty lib iLibInterface interface");
@@ -378,8 +1076,9 @@ std::optional<std::vector<unsigned char>> HSMUtils::decrypt_aes(CK_FUNCTION_LIST
 
   CK_MECHANISM aMech = { CKM_AES_GCM, &gcmParams, sizeof(CK_AES_GCM_PARAMS) };
 
-  CK_RV rv = iLibInterface->C_DecryptInit(iSession, &aMech, iKeyHandle);
+  CK_RV rv = observedCall(iLibInterface, "C_DecryptInit", iSession, iLibInterface->C_DecryptInit, iSession, &aMech, iKeyHandle);
   if (rv != CKR_OK) {
+    gLastError = rv;
     std::stringstream descr;
     descr << "Failed in C_DecryptInit, return value: " << std::hex << rv;
     TRC_ERROR(255, descr.str());
@@ -388,8 +1087,9 @@ std::optional<std::vector<unsigned char>> HSMUtils::decrypt_aes(CK_FUNCTION_LIST
 
   // Determine how much memory is required to store the plaintext.
   CK_ULONG aPlainTextLength = 0;
-  rv = iLibInterface->C_Decrypt(iSession, (CK_BYTE_PTR)&iCipherText[K_IV_SIZE], iCipherText.size() - K_IV_SIZE, nullptr, &aPlainTextLength);
+  rv = observedCall(iLibInterface, "C_Decrypt", iSession, iLibInterface->C_Decrypt, iSession, (CK_BYTE_PTR)&iCipherText[K_IV_SIZE], iCipherText.size() - K_IV_SIZE, nullptr, &aPlainTextLength);
   if (rv != CKR_OK) {
+    gLastError = rv;
     std::stringstream descr;
     descr << "Failed in C_Decrypt size, return value: " << std::hex << rv;
     TRC_ERROR(255, descr.str());
@@ -398,14 +1098,17 @@ std::optional<std::vector<unsigned char>> HSMUtils::decrypt_aes(CK_FUNCTION_LIST
 
   // reserve size on plaintext to contain enough space to prepended IV + cipheredtext
   std::vector<unsigned char> aPlainText;
-  aPlainText.resize(aPlainTextLength);
+  // never a null buffer, even for an empty plaintext: C_Decrypt would take it for another length query and leave
+  // the operation active
+  aPlainText.resize(std::max<CK_ULONG>(aPlainTextLength, 1u));
   // Start to write ciphertext to iv lenght in order to have IV prepended
-  rv = iLibInterface->C_Decrypt(iSession,
+  rv = observedCall(iLibInterface, "C_Decrypt", iSession, iLibInterface->C_Decrypt, iSession,
                              (CK_BYTE_PTR)&iCipherText[K_IV_SIZE],
                              iCipherText.size() - K_IV_SIZE,
-                             &aPlainText.front(),
+                             aPlainText.data(),
                              &aPlainTextLength);
   if (rv != CKR_OK) {
+    gLastError = rv;
     std::ostringstream descr;
     descr << "Failed in C_Decrypt, return value: " << std::hex << rv;
     TRC_ERROR(255, descr.str());
@@ -417,3 +1120,78 @@ std::optional<std::vector<unsigned char>> HSMUtils::decrypt_aes(CK_FUNCTION_LIST
 
   return { aPlainText };
 }
+
+std::optional<std::vector<unsigned char>> HSMUtils::sign_cmac(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iKeyHandle, const std::vector<unsigned char> &iData) {
+  gLastError = CKR_OK;
+
+  if (not iLibInterface) {
+    TRC_ERROR(255, "Cannot sign due to empty lib iLibInterface interface");
+    return {};
+  }
+
+  CK_MECHANISM aMech = { CKM_AES_CMAC, nullptr, 0 };
+  CK_RV rv = observedCall(iLibInterface, "C_SignInit", iSession, iLibInterface->C_SignInit, iSession, &aMech, iKeyHandle);
+  if (rv != CKR_OK) {
+    gLastError = rv;
+    std::ostringstream descr;
+    descr << "Failed in C_SignInit, return value: " << std::hex << rv;
+    TRC_ERROR(255, descr.str());
+    return {};
+  }
+
+  // a CMAC is one block long, no size query needed
+  std::vector<unsigned char> aSignature(16u);
+  CK_ULONG aSignatureLength = aSignature.size();
+  rv = observedCall(iLibInterface, "C_Sign", iSession, iLibInterface->C_Sign, iSession,
+                    (CK_BYTE_PTR)iData.data(),
+                    iData.size(),
+                    aSignature.data(),
+                    &aSignatureLength);
+  if (rv != CKR_OK) {
+    gLastError = rv;
+    std::ostringstream descr;
+    descr << "Failed in C_Sign, return value: " << std::hex << rv;
+    TRC_ERROR(255, descr.str());
+    return {};
+  }
+  aSignature.resize(aSignatureLength);
+
+  return { aSignature };
+}
+
+std::optional<std::vector<unsigned char>> HSMUtils::digest_sha256(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::vector<unsigned char> &iData) {
+  gLastError = CKR_OK;
+
+  if (not iLibInterface) {
+    TRC_ERROR(255, "Cannot digest due to empty lib iLibInterface interface");
+    return {};
+  }
+
+  CK_MECHANISM aMech = { CKM_SHA256, nullptr, 0 };
+  CK_RV rv = observedCall(iLibInterface, "C_DigestInit", iSession, iLibInterface->C_DigestInit, iSession, &aMech);
+  if (rv != CKR_OK) {
+    gLastError = rv;
+    std::ostringstream descr;
+    descr << "Failed in C_DigestInit, return value: " << std::hex << rv;
+    TRC_ERROR(255, descr.str());
+    return {};
+  }
+
+  std::vector<unsigned char> aDigest(32u);
+  CK_ULONG aDigestLength = aDigest.size();
+  rv = observedCall(iLibInterface, "C_Digest", iSession, iLibInterface->C_Digest, iSession,
+                    (CK_BYTE_PTR)iData.data(),
+                    iData.size(),
+                    aDigest.data(),
+                    &aDigestLength);
+  if (rv != CKR_OK) {
+    gLastError = rv;
+    std::ostringstream descr;
+    descr << "Failed in C_Digest, return value: " << std::hex << rv;
+    TRC_ERROR(255, descr.str());
+    return {};
+  }
+  aDigest.resize(aDigestLength);
+
+  return { aDigest };
+}
@@ -5,40 +5,113 @@
 #pragma once
 
 #include "hsm/cryptoki.h"
+#include <chrono>
 #include <optional>
+#include <string>
 #include <tuple>
 #include <vector>
 
+/**
+ * Access a session is opened with. Read-only sessions can encrypt, decrypt, sign, verify and find objects
+ * but not create or modify token objects; tokens usually allow far more of them than read-write ones.
+ */
+enum class SessionAccess {
+  ReadOnly,
+  ReadWrite,
+};
+
+/**
+ * Attributes identifying a secret key, see HSMUtils::getKeyAttributes
+ */
+struct KeyAttributes {
+  std::string label;
+  std::vector<unsigned char> id;
+  CK_KEY_TYPE keyType;
+  CK_ULONG valueLen;
+};
+
+/**
+ * Time spent in each step of HSMUtils::openHSMDL and closeHSMDL
+ */
+struct LoadTimings {
+  std::chrono::nanoseconds dlopen{ 0 };
+  // dlsym of C_GetFunctionList and the call
+  std::chrono::nanoseconds getFunctionList{ 0 };
+  std::chrono::nanoseconds initialize{ 0 };
+  std::chrono::nanoseconds finalize{ 0 };
+  std::chrono::nanoseconds dlclose{ 0 };
+};
+
 /**
  * Utils used for interface with HSM
  * Favor using nox::fkk::hsm::HSMInterface for better resources allocation/cleaning
  */
 class HSMUtils {
  public:
+  /**
+   * @return
+   *  the return value of the PKCS#11 call that made the last HSMUtils call of the current thread fail,
+   *  CKR_OK if it succeeded (or failed without reaching the module, e.g. key not found)
+   */
+  static CK_RV lastError();
+
+  /**
+   * Resets lastError to CKR_OK, before running code that may fail without an HSMUtils call
+   */
+  static void clearLastError();
+
   /**
    * @param iLibPath - path to the DL lib to be opened
+   * @param oTimings - if not null, receives the time of dlopen, C_GetFunctionList and C_Initialize
    * @return tuple where:
    *  1. is a pointer to void to the lib (output of dlopen method) - nullptr if error occurs
    *  2. is the function pointer containing the dl method list - nullptr if error occurs
    */
-  static std::pair<void*, CK_FUNCTION_LIST_PTR> openHSMDL(const std::string& iLibPath);
+  static std::pair<void*, CK_FUNCTION_LIST_PTR> openHSMDL(const std::string& iLibPath, LoadTimings* oTimings = nullptr);
 
   /**
    * @param iLib - the library being closed
    * @param iFunctionList - the function list on the library
+   * @param oTimings - if not null, receives the time of C_Finalize and dlclose
    * @return
    *  false in case of error during dl close, true otherwise
    *
    */
-  static bool closeHSMDL(void*& iLib, CK_FUNCTION_LIST_PTR iFunctionList);
+  static bool closeHSMDL(void*& iLib, CK_FUNCTION_LIST_PTR iFunctionList, LoadTimings* oTimings = nullptr);
 
   /**
    * @param iLibInterface - the function list of the dynamic lib
    * @param iSlotLabel - label of slot
+   * @param oTokenInfo - if not null, filled with the token info of the slot found
+   * @return
+   *  empty optional if error occurs or no slot has the label, the slot id otherwise
+   */
+  static std::optional<CK_SLOT_ID> findSlot(CK_FUNCTION_LIST_PTR iLibInterface, const std::string& iSlotLabel, CK_TOKEN_INFO* oTokenInfo = nullptr);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @return
+   *  empty optional if error occurs, the id and token info of every slot with a token present otherwise
+   */
+  static std::optional<std::vector<std::pair<CK_SLOT_ID, CK_TOKEN_INFO>>> listTokens(CK_FUNCTION_LIST_PTR iLibInterface);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSlotLabel - label of slot
+   * @param iAccess - read-only or read-write session
+   * @return
+   *  empty optional if error occurs, a session otherwise (yet to be logged in)
+   */
+  static std::optional<CK_SESSION_HANDLE> openSession(CK_FUNCTION_LIST_PTR iLibInterface, const std::string& iSlotLabel, SessionAccess iAccess = SessionAccess::ReadWrite);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSlotId - id of the slot, as returned by findSlot
+   * @param iAccess - read-only or read-write session
    * @return
    *  empty optional if error occurs, a session otherwise (yet to be logged in)
    */
-  static std::optional<CK_SESSION_HANDLE> openSession(CK_FUNCTION_LIST_PTR iLibInterface, const std::string& iSlotLabel);
+  static std::optional<CK_SESSION_HANDLE> openSession(CK_FUNCTION_LIST_PTR iLibInterface, CK_SLOT_ID iSlotId, SessionAccess iAccess);
 
   /**
    * @param iLibInterface - the function list of the dynamic lib
@@ -70,11 +143,160 @@ class HSMUtils {
   static std::optional<CK_OBJECT_HANDLE> retrieveKeyHandle(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::string& iKeyLabel);
 
 
-  static std::optional<CK_OBJECT_HANDLE> generateKey(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::string& iKeyLabel);
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - an HSM session (read-write for a token object)
+   * @param iKeyLabel - label of the AES key, also its id unless iKeyId is given
+   * @param iTokenObject - false to generate a session object: no NV storage write, gone with the session
+   * @param iModifiable - CKA_MODIFIABLE of the key, true for a key to be labeled afterwards
+   * @param iKeyId - CKA_ID of the key, empty for the label
+   * @return
+   *  empty optional if error occurs, the handle of the key otherwise
+   */
+  static std::optional<CK_OBJECT_HANDLE> generateKey(CK_FUNCTION_LIST_PTR iLibInterface,
+                                                     CK_SESSION_HANDLE iSession,
+                                                     const std::string& iKeyLabel,
+                                                     bool iTokenObject                         = true,
+                                                     bool iModifiable                          = false,
+                                                     const std::vector<unsigned char>& iKeyId = {});
+
+  /**
+   * Same as generateKey for an AES key allowed to sign and verify (CMAC) instead of encrypting and decrypting
+   * @return
+   *  empty optional if error occurs, the handle of the key otherwise
+   */
+  static std::optional<CK_OBJECT_HANDLE> generateMacKey(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::string& iKeyLabel, bool iTokenObject = true);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - an HSM session
+   * @param iTemplate - attributes the objects must match
+   * @param iBatchSize - number of handles fetched per C_FindObjects call
+   * @return
+   *  empty optional if there is a search error, the handles of all the matching objects otherwise
+   */
+  static std::optional<std::vector<CK_OBJECT_HANDLE>> findObjects(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::vector<CK_ATTRIBUTE>& iTemplate, std::size_t iBatchSize = 1024u);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - an HSM session
+   * @param iObject - the object
+   * @return
+   *  empty optional if error occurs, the CKA_LABEL and CKA_ID of the object otherwise
+   */
+  static std::optional<std::pair<std::string, std::vector<unsigned char>>> getLabelAndId(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iObject);
+
+  /**
+   * Reads the attributes with a single C_GetAttributeValue call when they fit in fixed size buffers,
+   * with a second call sized from the first one otherwise.
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - an HSM session
+   * @param iKey - a secret key
+   * @return
+   *  empty optional if error occurs, CKA_LABEL, CKA_ID, CKA_KEY_TYPE and CKA_VALUE_LEN of the key otherwise
+   */
+  static std::optional<KeyAttributes> getKeyAttributes(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iKey);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - an HSM session
+   * @param iWrappingKey - AES key the key is wrapped under (CKM_AES_KEY_WRAP_PAD)
+   * @param iKey - the key to export, must be CKA_EXTRACTABLE
+   * @return
+   *  empty optional if error occurs, the wrapped key otherwise
+   */
+  static std::optional<std::vector<unsigned char>> wrapKey(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iWrappingKey, CK_OBJECT_HANDLE iKey);
+
+  /**
+   * Imports an AES key wrapped by wrapKey as a token object usable for encrypt/decrypt.
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - a read-write HSM session
+   * @param iUnwrappingKey - AES key the key was wrapped under
+   * @param iWrappedKey - the output of wrapKey
+   * @param iKeyLabel - CKA_LABEL of the imported key
+   * @param iKeyId - CKA_ID of the imported key
+   * @return
+   *  empty optional if error occurs, the handle of the imported key otherwise
+   */
+  static std::optional<CK_OBJECT_HANDLE> unwrapKey(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iUnwrappingKey, const std::vector<unsigned char>& iWrappedKey, const std::string& iKeyLabel, const std::vector<unsigned char>& iKeyId);
+
+  /**
+   * Finds the AES token key labeled iKeyLabel, generating it if there is none.
+   * Concurrent calls for the same library, slot and label are coalesced into a single find/generate whose handle
+   * is shared with every caller. A generated key gets the label followed by a creation nonce (time then random
+   * bytes) as CKA_ID, and the label is looked up again: when several keys carry it, every application keeps the
+   * one with the smallest CKA_ID, so the generated copy is destroyed unless it is that one.
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - a read-write HSM session
+   * @param iKeyLabel - the key label
+   * @return
+   *  empty optional if the key could neither be found nor generated, its handle otherwise
+   */
+  static std::optional<CK_OBJECT_HANDLE> getOrCreateKey(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::string& iKeyLabel);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - an HSM session (read-write for token objects)
+   * @param iKeyLabel - label (and id) of both keys
+   * @param iTokenObject - false to generate session objects
+   * @return
+   *  empty optional if error occurs, the public and private key handles of a P-256 EC key pair otherwise
+   */
+  static std::optional<std::pair<CK_OBJECT_HANDLE, CK_OBJECT_HANDLE>> generateKeyPair(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::string& iKeyLabel, bool iTokenObject = true);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - an HSM session (read-write for a token object)
+   * @param iObject - a modifiable object
+   * @param iKeyLabel - new CKA_LABEL and CKA_ID of the object
+   * @return
+   *  false if an error occur, true otherwise
+   */
+  static bool setKeyLabel(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iObject, const std::string& iKeyLabel);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - an HSM session (read-write to create a token object)
+   * @param iObject - the object to copy
+   * @param iTokenObject - false to create a session object, destroyed with the session that created it
+   * @return
+   *  empty optional if error occurs, the handle of the copy otherwise
+   */
+  static std::optional<CK_OBJECT_HANDLE> copyObject(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iObject, bool iTokenObject);
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSession - an HSM session
+   * @param iObject - the object to destroy
+   * @return
+   *  false if an error occur, true otherwise
+   */
+  static bool destroyObject(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iObject);
 
   static std::optional<std::vector<unsigned char>> encrypt_aes(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iKeyHandle,  const std::vector<unsigned char>& iPlainText);
 
+  /**
+   * Same output as encrypt_aes (IV prepended, tag appended) with the payload passed in several C_EncryptUpdate calls
+   * @param iChunkSize - bytes of plaintext per C_EncryptUpdate call
+   * @return
+   *  empty optional if an error occur, the IV followed by the ciphertext and the tag otherwise
+   */
+  static std::optional<std::vector<unsigned char>> encrypt_aes_multipart(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iKeyHandle, const std::vector<unsigned char>& iPlainText, std::size_t iChunkSize);
+
   static std::optional<std::vector<unsigned char>> decrypt_aes(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iKeyHandle,  const std::vector<unsigned char>& iCipherText);
 
+  /**
+   * @param iKeyHandle - an AES key with CKA_SIGN
+   * @return
+   *  empty optional if an error occur, the 16 bytes AES-CMAC (CKM_AES_CMAC) of iData otherwise
+   */
+  static std::optional<std::vector<unsigned char>> sign_cmac(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, CK_OBJECT_HANDLE iKeyHandle, const std::vector<unsigned char>& iData);
+
+  /**
+   * @return
+   *  empty optional if an error occur, the SHA-256 (CKM_SHA256) of iData computed by the HSM otherwise
+   */
+  static std::optional<std::vector<unsigned char>> digest_sha256(CK_FUNCTION_LIST_PTR iLibInterface, CK_SESSION_HANDLE iSession, const std::vector<unsigned char>& iData);
+
 
 };
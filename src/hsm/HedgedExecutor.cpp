@@ -0,0 +1,188 @@
+#include "hsm/HedgedExecutor.h"
+#include "hsm/CircuitBreaker.h"
+#include "hsm/HSMUtils.h"
+#include <algorithm>
+#include <utility>
+
+// state shared between the caller and the attempts of one request
+struct HedgedExecutor::Race {
+  Operation operation;
+  std::string keyLabel;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::size_t pending = 0u;
+  bool done           = false;
+  bool wonByHedge     = false;
+  // status of the attempt on the primary once it failed, see SessionPool::execute
+  CK_RV primaryStatus = CKR_OK;
+  std::optional<std::vector<unsigned char>> value;
+};
+
+HedgedExecutor::HedgedExecutor(SessionPool& iPrimary, SessionPool& iSecondary) : HedgedExecutor(iPrimary, iSecondary, Config{}) {}
+
+HedgedExecutor::HedgedExecutor(SessionPool& iPrimary, SessionPool& iSecondary, Config iConfig)
+    : mPrimary(iPrimary), mSecondary(iSecondary), mConfig(iConfig), mLatencies(iConfig.latencyWindow), mBudget(iConfig.budgetBurst) {
+  startWorkers(mPrimaryLane, std::max<std::size_t>(mConfig.workers, 1u));
+  startWorkers(mHedgeLane, std::max<std::size_t>(mConfig.hedgeWorkers, 1u));
+}
+
+HedgedExecutor::~HedgedExecutor() {
+  {
+    std::lock_guard<std::mutex> aLock(mTaskMutex);
+    mStopped = true;
+  }
+  for (auto* aLane : { &mPrimaryLane, &mHedgeLane }) {
+    aLane->cv.notify_all();
+    for (auto& aWorker : aLane->workers) {
+      aWorker.join();
+    }
+  }
+}
+
+HSMResult HedgedExecutor::execute(const std::string& iKeyLabel, Operation iOperation) {
+  mRequests.fetch_add(1u, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> aLock(mBudgetMutex);
+    mBudget = std::min(mConfig.budgetBurst, mBudget + mConfig.budgetRatio);
+  }
+
+  auto aRace       = std::make_shared<Race>();
+  aRace->operation = std::move(iOperation);
+  aRace->keyLabel  = iKeyLabel;
+
+  launch(aRace, mPrimary, false);
+
+  auto aSettled = [&aRace] { return aRace->done or aRace->pending == 0u; };
+  bool aHedged  = false;
+  std::unique_lock<std::mutex> aLock(aRace->mutex);
+  if (not aRace->cv.wait_for(aLock, hedgeDelay(), aSettled)) {
+    if (takeBudget()) {
+      mHedgesIssued.fetch_add(1u, std::memory_order_relaxed);
+      aHedged = true;
+      aLock.unlock();
+      launch(aRace, mSecondary, true);
+      aLock.lock();
+    }
+    else {
+      mBudgetExceeded.fetch_add(1u, std::memory_order_relaxed);
+    }
+  }
+  aRace->cv.wait(aLock, aSettled);
+
+  // the primary slot failed without an answer from the secondary: the secondary holds the same key, try it
+  // instead of failing the request; not a hedge, the primary did no useful work
+  if (not aRace->done and not aHedged and CircuitBreaker::isSlotFailure(aRace->primaryStatus)) {
+    mFallbacks.fetch_add(1u, std::memory_order_relaxed);
+    aLock.unlock();
+    launch(aRace, mSecondary, true);
+    aLock.lock();
+    aRace->cv.wait(aLock, aSettled);
+  }
+
+  if (not aRace->done) {
+    return HSMResult{ HSMStatus::Failed, {} };
+  }
+  if (aRace->wonByHedge and aHedged) {
+    mHedgesWon.fetch_add(1u, std::memory_order_relaxed);
+  }
+  return HSMResult{ HSMStatus::Ok, std::move(aRace->value) };
+}
+
+HSMResult HedgedExecutor::decrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iCipherText) {
+  return execute(iKeyLabel, [iCipherText](const SessionLease& iLease, CK_OBJECT_HANDLE iKeyHandle) {
+    return HSMUtils::decrypt_aes(iLease.libInterface(), iLease.session(), iKeyHandle, iCipherText);
+  });
+}
+
+std::chrono::nanoseconds HedgedExecutor::hedgeDelay() const {
+  return std::max<std::chrono::nanoseconds>(mConfig.minDelay, mLatencies.percentile(0.95));
+}
+
+HedgedExecutor::Counters HedgedExecutor::counters() const {
+  Counters aCounters;
+  aCounters.requests       = mRequests.load(std::memory_order_relaxed);
+  aCounters.hedgesIssued   = mHedgesIssued.load(std::memory_order_relaxed);
+  aCounters.hedgesWon      = mHedgesWon.load(std::memory_order_relaxed);
+  aCounters.budgetExceeded = mBudgetExceeded.load(std::memory_order_relaxed);
+  aCounters.fallbacks      = mFallbacks.load(std::memory_order_relaxed);
+  return aCounters;
+}
+
+void HedgedExecutor::launch(const std::shared_ptr<Race>& iRace, SessionPool& iPool, bool iHedge) {
+  {
+    std::lock_guard<std::mutex> aLock(iRace->mutex);
+    ++iRace->pending;
+  }
+
+  auto aTask = [this, iRace, &iPool, iHedge] {
+    std::optional<std::vector<unsigned char>> aValue;
+    CK_RV aStatus = CKR_OK;
+    bool aAbandoned;
+    {
+      std::lock_guard<std::mutex> aLock(iRace->mutex);
+      aAbandoned = iRace->done;
+    }
+    // the other attempt already answered, do not spend HSM time on this one
+    if (not aAbandoned) {
+      auto aStart = Clock::now();
+      aValue      = iPool.execute(iRace->keyLabel, iRace->operation, SessionAccess::ReadOnly, &aStatus);
+      if (aValue) {
+        mLatencies.record(Clock::now() - aStart);
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> aLock(iRace->mutex);
+      --iRace->pending;
+      if (not iHedge and not aValue) {
+        iRace->primaryStatus = aStatus;
+      }
+      if (aValue and not iRace->done) {
+        iRace->done       = true;
+        iRace->wonByHedge = iHedge;
+        iRace->value      = std::move(aValue);
+      }
+    }
+    iRace->cv.notify_all();
+  };
+
+  auto& aLane = iHedge ? mHedgeLane : mPrimaryLane;
+  {
+    std::lock_guard<std::mutex> aLock(mTaskMutex);
+    aLane.tasks.emplace_back(std::move(aTask));
+  }
+  aLane.cv.notify_one();
+}
+
+bool HedgedExecutor::takeBudget() {
+  std::lock_guard<std::mutex> aLock(mBudgetMutex);
+  if (mBudget < 1.0) {
+    return false;
+  }
+  mBudget -= 1.0;
+  return true;
+}
+
+void HedgedExecutor::startWorkers(Lane& iLane, std::size_t iCount) {
+  iLane.workers.reserve(iCount);
+  for (std::size_t i = 0; i < iCount; ++i) {
+    iLane.workers.emplace_back([this, &iLane] { workerLoop(iLane); });
+  }
+}
+
+void HedgedExecutor::workerLoop(Lane& iLane) {
+  for (;;) {
+    std::function<void()> aTask;
+    {
+      std::unique_lock<std::mutex> aLock(mTaskMutex);
+      iLane.cv.wait(aLock, [this, &iLane] { return mStopped or not iLane.tasks.empty(); });
+      if (iLane.tasks.empty()) {
+        return;
+      }
+      aTask = std::move(iLane.tasks.front());
+      iLane.tasks.pop_front();
+    }
+    aTask();
+  }
+}
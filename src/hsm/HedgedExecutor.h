@@ -0,0 +1,118 @@
+#pragma once
+
+#include "hsm/HSMResult.h"
+#include "hsm/LatencyTracker.h"
+#include "hsm/SessionPool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs idempotent operations (decrypt, verify, MAC verify) on a primary slot and, when the primary has not
+ * answered within the current p95 latency, sends a duplicate to a secondary slot holding the same key.
+ * The first successful answer wins, the other attempt is abandoned: it completes on a background worker and
+ * its result is discarded. Hedges run on workers of their own, so that they are not queued behind the primaries
+ * they are meant to overtake. When the primary fails because of its slot (see CircuitBreaker::isSlotFailure)
+ * before any hedge was sent, the request falls back to the secondary right away.
+ *
+ * Only hedge operations without side effects on the token: both attempts may run to completion.
+ */
+class HedgedExecutor {
+ public:
+  using Clock = std::chrono::steady_clock;
+  // the key handle is the one of iKeyLabel on the slot the attempt runs on
+  using Operation = std::function<std::optional<std::vector<unsigned char>>(const SessionLease&, CK_OBJECT_HANDLE)>;
+
+  struct Config {
+    // extra load allowed, as a ratio of the requests executed (0.05 = at most 5% hedged requests)
+    double budgetRatio = 0.05;
+    // maximum number of unused hedges that can be accumulated
+    double budgetBurst = 10.0;
+    // lower bound on the hedging delay, also used until the latency window has samples
+    std::chrono::microseconds minDelay{ 1000 };
+    // number of samples the p95 is computed over
+    std::size_t latencyWindow = 1000u;
+    // background threads running the attempts on the primary
+    std::size_t workers = 8u;
+    // background threads reserved for the hedges and fallbacks on the secondary
+    std::size_t hedgeWorkers = 2u;
+  };
+
+  struct Counters {
+    std::uint64_t requests       = 0u;
+    std::uint64_t hedgesIssued   = 0u;
+    std::uint64_t hedgesWon      = 0u;
+    std::uint64_t budgetExceeded = 0u;
+    // requests sent to the secondary after a slot failure of the primary
+    std::uint64_t fallbacks = 0u;
+  };
+
+  /**
+   * @param iPrimary - pool of the slot tried first
+   * @param iSecondary - pool of the slot holding a copy of the same keys
+   */
+  HedgedExecutor(SessionPool& iPrimary, SessionPool& iSecondary);
+  HedgedExecutor(SessionPool& iPrimary, SessionPool& iSecondary, Config iConfig);
+  ~HedgedExecutor();
+
+  HedgedExecutor(const HedgedExecutor&) = delete;
+  HedgedExecutor& operator=(const HedgedExecutor&) = delete;
+
+  /**
+   * @param iKeyLabel - label of the key, resolved on each slot
+   * @param iOperation - idempotent operation
+   * @return the first successful result, HSMStatus::Failed if every attempt failed
+   */
+  HSMResult execute(const std::string& iKeyLabel, Operation iOperation);
+
+  HSMResult decrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iCipherText);
+
+  /**
+   * @return the delay after which a hedge is sent
+   */
+  std::chrono::nanoseconds hedgeDelay() const;
+
+  Counters counters() const;
+
+ private:
+  struct Race;
+
+  // workers and queue of the attempts on one slot
+  struct Lane {
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+  };
+
+  void launch(const std::shared_ptr<Race>& iRace, SessionPool& iPool, bool iHedge);
+  bool takeBudget();
+  void startWorkers(Lane& iLane, std::size_t iCount);
+  void workerLoop(Lane& iLane);
+
+  SessionPool& mPrimary;
+  SessionPool& mSecondary;
+  const Config mConfig;
+  LatencyTracker mLatencies;
+
+  std::mutex mBudgetMutex;
+  double mBudget;
+
+  std::atomic<std::uint64_t> mRequests{ 0u };
+  std::atomic<std::uint64_t> mHedgesIssued{ 0u };
+  std::atomic<std::uint64_t> mHedgesWon{ 0u };
+  std::atomic<std::uint64_t> mBudgetExceeded{ 0u };
+  std::atomic<std::uint64_t> mFallbacks{ 0u };
+
+  std::mutex mTaskMutex;
+  bool mStopped = false;
+  Lane mPrimaryLane;
+  Lane mHedgeLane;
+};
@@ -0,0 +1,116 @@
+#include "hsm/KeyInventory.h"
+#include "hsm/SessionPool.h"
+#include "hsm/Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace {
+
+bool entryLess(const KeyInventory::Entry& iLeft, const KeyInventory::Entry& iRight) {
+  return iLeft.label < iRight.label or (iLeft.label == iRight.label and iLeft.handle < iRight.handle);
+}
+
+}  // namespace
+
+std::unique_ptr<KeyInventory> KeyInventory::load(SessionPool& iPool, std::size_t iParallelism, std::size_t iFindBatch) {
+  static CK_OBJECT_CLASS KeyClass = CKO_SECRET_KEY;
+  std::vector<CK_ATTRIBUTE> aTemplate = { { CKA_CLASS, &KeyClass, sizeof(KeyClass) } };
+
+  std::unique_ptr<KeyInventory> aInventory(new KeyInventory());
+  auto aStart = std::chrono::steady_clock::now();
+  std::optional<std::vector<CK_OBJECT_HANDLE>> aHandles;
+  {
+    auto aLease = iPool.acquire();
+    if (aLease) {
+      aHandles = HSMUtils::findObjects(aLease->libInterface(), aLease->session(), aTemplate, iFindBatch);
+    }
+  }
+  if (not aHandles) {
+    TRC_ERROR(255, "Could not enumerate the secret keys of slot " + iPool.slotLabel());
+    return nullptr;
+  }
+  auto aFound = std::chrono::steady_clock::now();
+
+  // one slot per handle, filled by the workers without locking
+  std::vector<std::optional<KeyAttributes>> aAttributes(aHandles->size());
+  std::atomic<std::size_t> aNext{ 0u };
+  // chunks big enough to amortize the lease, small enough to balance the workers
+  constexpr const std::size_t K_CHUNK = 256u;
+  auto aWorker = [&]() {
+    auto aLease = iPool.acquire();
+    if (not aLease) {
+      return;
+    }
+    for (auto aBegin = aNext.fetch_add(K_CHUNK); aBegin < aHandles->size(); aBegin = aNext.fetch_add(K_CHUNK)) {
+      auto aEnd = std::min(aBegin + K_CHUNK, aHandles->size());
+      for (auto i = aBegin; i < aEnd; ++i) {
+        aAttributes[i] = HSMUtils::getKeyAttributes(aLease->libInterface(), aLease->session(), (*aHandles)[i]);
+      }
+    }
+  };
+  std::vector<std::thread> aThreads;
+  auto aThreadCount = std::min(std::max<std::size_t>(iParallelism, 1u), (aHandles->size() + K_CHUNK - 1u) / K_CHUNK);
+  for (std::size_t i = 0u; i < aThreadCount; ++i) {
+    aThreads.emplace_back(aWorker);
+  }
+  for (auto& aThread : aThreads) {
+    aThread.join();
+  }
+
+  auto& aEntries = aInventory->mEntries;
+  aEntries.reserve(aHandles->size());
+  for (std::size_t i = 0u; i < aHandles->size(); ++i) {
+    if (not aAttributes[i]) {
+      ++aInventory->mLoadStats.failed;
+      continue;
+    }
+    auto& aKey = aAttributes[i].value();
+    aEntries.push_back(Entry{ std::move(aKey.label), std::move(aKey.id), aKey.keyType, aKey.valueLen, (*aHandles)[i] });
+  }
+  std::sort(aEntries.begin(), aEntries.end(), entryLess);
+  aEntries.shrink_to_fit();
+
+  auto& aStats         = aInventory->mLoadStats;
+  aStats.found         = aHandles->size();
+  aStats.findTime      = std::chrono::duration_cast<std::chrono::milliseconds>(aFound - aStart);
+  aStats.attributeTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - aFound);
+  return aInventory;
+}
+
+const KeyInventory::Entry* KeyInventory::find(const std::string& iKeyLabel) const {
+  auto aIt = std::lower_bound(mEntries.begin(), mEntries.end(), iKeyLabel, [](const Entry& iEntry, const std::string& iLabel) {
+    return iEntry.label < iLabel;
+  });
+  return (aIt != mEntries.end() and aIt->label == iKeyLabel) ? &*aIt : nullptr;
+}
+
+std::vector<const KeyInventory::Entry*> KeyInventory::findAll(const std::string& iKeyLabel) const {
+  std::vector<const Entry*> aFound;
+  for (auto* aEntry = find(iKeyLabel); aEntry != nullptr and aEntry != mEntries.data() + mEntries.size() and aEntry->label == iKeyLabel; ++aEntry) {
+    aFound.push_back(aEntry);
+  }
+  return aFound;
+}
+
+std::vector<const KeyInventory::Entry*> KeyInventory::findById(const std::vector<unsigned char>& iKeyId) const {
+  std::vector<const Entry*> aFound;
+  for (const auto& aEntry : mEntries) {
+    if (aEntry.id == iKeyId) {
+      aFound.push_back(&aEntry);
+    }
+  }
+  return aFound;
+}
+
+void KeyInventory::seed(SessionPool& iPool) const {
+  std::vector<std::pair<std::string, CK_OBJECT_HANDLE>> aHandles;
+  aHandles.reserve(mEntries.size());
+  for (const auto& aEntry : mEntries) {
+    // entries are sorted by handle within a label, keep the first one as find() does
+    if (aHandles.empty() or aHandles.back().first != aEntry.label) {
+      aHandles.emplace_back(aEntry.label, aEntry.handle);
+    }
+  }
+  iPool.cacheKeyHandles(aHandles);
+}
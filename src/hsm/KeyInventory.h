@@ -0,0 +1,82 @@
+#pragma once
+
+#include "hsm/HSMUtils.h"
+#include "hsm/cryptoki.h"
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+class SessionPool;
+
+/**
+ * In-memory directory of the secret keys of a token, loaded in bulk at startup instead of resolving each label
+ * with its own C_FindObjectsInit / C_FindObjects / C_FindObjectsFinal cycle.
+ *
+ * load() enumerates every secret key in one search (C_FindObjects batches of iFindBatch handles), then reads
+ * CKA_LABEL, CKA_ID, CKA_KEY_TYPE and CKA_VALUE_LEN of each key with a single C_GetAttributeValue call, spread
+ * over the pool sessions. The entries are kept sorted by label for binary search lookups.
+ */
+class KeyInventory {
+ public:
+  struct Entry {
+    std::string label;
+    std::vector<unsigned char> id;
+    CK_KEY_TYPE keyType;
+    CK_ULONG valueLen;
+    CK_OBJECT_HANDLE handle;
+  };
+
+  struct LoadStats {
+    std::size_t found = 0u;
+    // keys whose attributes could not be read, left out of the index
+    std::size_t failed = 0u;
+    std::chrono::milliseconds findTime{ 0 };
+    std::chrono::milliseconds attributeTime{ 0 };
+  };
+
+  /**
+   * @param iPool - pool on the token to inventory
+   * @param iParallelism - number of threads (and sessions) reading the attributes
+   * @param iFindBatch - handles fetched per C_FindObjects call
+   * @return the inventory, nullptr if the keys could not be enumerated
+   */
+  static std::unique_ptr<KeyInventory> load(SessionPool& iPool, std::size_t iParallelism = 8u, std::size_t iFindBatch = 1024u);
+
+  /**
+   * @param iKeyLabel - the key label
+   * @return the entry with the label (the lowest handle if several), nullptr if none
+   */
+  const Entry* find(const std::string& iKeyLabel) const;
+
+  /**
+   * @return every entry with the label
+   */
+  std::vector<const Entry*> findAll(const std::string& iKeyLabel) const;
+
+  /**
+   * @param iKeyId - the CKA_ID
+   * @return the entries with the id, found with a linear scan
+   */
+  std::vector<const Entry*> findById(const std::vector<unsigned char>& iKeyId) const;
+
+  /**
+   * Fills the key handle cache of iPool with the handles of the index, so that findKey and execute do not
+   * search the token for the labels already known
+   * @param iPool - pool on the token the inventory was loaded from
+   */
+  void seed(SessionPool& iPool) const;
+
+  const std::vector<Entry>& entries() const { return mEntries; }
+  std::size_t size() const { return mEntries.size(); }
+  const LoadStats& loadStats() const { return mLoadStats; }
+
+ private:
+  KeyInventory() = default;
+
+  // sorted by label, then handle
+  std::vector<Entry> mEntries;
+  LoadStats mLoadStats;
+};
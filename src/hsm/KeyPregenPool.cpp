@@ -0,0 +1,232 @@
+#include "hsm/KeyPregenPool.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/SessionPool.h"
+#include "hsm/Trace.h"
+#include <algorithm>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// sessions are only borrowed when idle, back off that long when none is
+constexpr const std::chrono::milliseconds K_IDLE_BACKOFF{ 5 };
+
+// Linux: nice values are per thread, the lowest priority for the calling thread only
+void lowerThreadPriority() {
+  setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+}
+
+}  // namespace
+
+KeyPregenPool::KeyPregenPool(SessionPool& iPool, Config iConfig) : mPool(iPool), mConfig(std::move(iConfig)) {
+  mStats.swept = sweep();
+  mRefillStart = std::chrono::steady_clock::now();
+  for (std::size_t i = 0u; i < std::max<std::size_t>(mConfig.workers, 1u); ++i) {
+    mWorkers.emplace_back(&KeyPregenPool::refillLoop, this);
+  }
+}
+
+KeyPregenPool::~KeyPregenPool() {
+  stop();
+  std::vector<Entry> aLeft;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    aLeft.insert(aLeft.end(), mAes.begin(), mAes.end());
+    aLeft.insert(aLeft.end(), mEc.begin(), mEc.end());
+    mAes.clear();
+    mEc.clear();
+  }
+  const auto aGeneration = mPool.generation();
+  for (const auto& aEntry : aLeft) {
+    if (aEntry.generation == aGeneration) {
+      destroy(aEntry.key);
+    }
+  }
+}
+
+void KeyPregenPool::stop() {
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    mStopped = true;
+  }
+  mCv.notify_all();
+  for (auto& aWorker : mWorkers) {
+    if (aWorker.joinable()) {
+      aWorker.join();
+    }
+  }
+}
+
+std::optional<PregeneratedKey> KeyPregenPool::take(PregenKeyType iType) {
+  std::optional<PregeneratedKey> aKey;
+  // read before locking, the pool takes its own lock
+  const auto aGeneration = mPool.generation();
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    auto& aQueue = queue(iType);
+    // session keys do not survive a pool recovery
+    while (not mConfig.tokenObjects and not aQueue.empty() and aQueue.front().generation != aGeneration) {
+      aQueue.pop_front();
+    }
+    if (aQueue.empty()) {
+      ++mStats.misses;
+    } else {
+      aKey = aQueue.front().key;
+      aQueue.pop_front();
+      ++mStats.handedOut;
+    }
+    if (not mRefillStart) {
+      mRefillStart = std::chrono::steady_clock::now();
+    }
+  }
+  mCv.notify_one();
+  return aKey;
+}
+
+std::optional<PregeneratedKey> KeyPregenPool::take(PregenKeyType iType, const std::string& iKeyLabel) {
+  auto aKey = take(iType);
+  if (not aKey) {
+    return {};
+  }
+  auto aLease = mPool.acquire(mConfig.tokenObjects ? SessionAccess::ReadWrite : SessionAccess::ReadOnly);
+  if (not aLease) {
+    return {};
+  }
+  bool aLabeled = HSMUtils::setKeyLabel(aLease->libInterface(), aLease->session(), aKey->key, iKeyLabel);
+  if (aLabeled and aKey->publicKey != CK_INVALID_HANDLE) {
+    aLabeled = HSMUtils::setKeyLabel(aLease->libInterface(), aLease->session(), aKey->publicKey, iKeyLabel);
+  }
+  if (not aLabeled) {
+    HSMUtils::destroyObject(aLease->libInterface(), aLease->session(), aKey->key);
+    if (aKey->publicKey != CK_INVALID_HANDLE) {
+      HSMUtils::destroyObject(aLease->libInterface(), aLease->session(), aKey->publicKey);
+    }
+    return {};
+  }
+  return aKey;
+}
+
+KeyPregenPool::Stats KeyPregenPool::stats() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  auto aStats     = mStats;
+  aStats.aesDepth = mAes.size();
+  aStats.ecDepth  = mEc.size();
+  if (aStats.generated > 0u) {
+    aStats.meanGenerationUs = static_cast<double>(mGenerationNs) / 1000.0 / static_cast<double>(aStats.generated);
+  }
+  return aStats;
+}
+
+std::optional<PregenKeyType> KeyPregenPool::deficitLocked() const {
+  double aAesFill = mConfig.aesDepth == 0u ? 1.0 : static_cast<double>(mAes.size() + mAesInFlight) / static_cast<double>(mConfig.aesDepth);
+  double aEcFill  = mConfig.ecDepth == 0u ? 1.0 : static_cast<double>(mEc.size() + mEcInFlight) / static_cast<double>(mConfig.ecDepth);
+  if (aAesFill >= 1.0 and aEcFill >= 1.0) {
+    return {};
+  }
+  return aAesFill <= aEcFill ? PregenKeyType::Aes : PregenKeyType::EcKeyPair;
+}
+
+void KeyPregenPool::refillLoop() {
+  lowerThreadPriority();
+  const auto aAccess = mConfig.tokenObjects ? SessionAccess::ReadWrite : SessionAccess::ReadOnly;
+
+  std::unique_lock<std::mutex> aLock(mMutex);
+  while (not mStopped) {
+    auto aType = deficitLocked();
+    if (not aType) {
+      if (mRefillStart and mAesInFlight == 0u and mEcInFlight == 0u) {
+        mStats.lastRefill = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mRefillStart.value());
+        mRefillStart.reset();
+      }
+      mCv.wait(aLock, [this] { return mStopped or deficitLocked().has_value(); });
+      continue;
+    }
+    auto& aInFlight = (aType == PregenKeyType::Aes) ? mAesInFlight : mEcInFlight;
+    ++aInFlight;
+    aLock.unlock();
+
+    auto aLease = mPool.tryAcquire(aAccess);
+    if (not aLease) {
+      std::this_thread::sleep_for(K_IDLE_BACKOFF);
+      aLock.lock();
+      --aInFlight;
+      continue;
+    }
+
+    std::optional<PregeneratedKey> aKey;
+    auto aStart = std::chrono::steady_clock::now();
+    if (aType == PregenKeyType::Aes) {
+      // modifiable: labeled when handed out
+      auto aHandle = HSMUtils::generateKey(aLease->libInterface(), aLease->session(), mConfig.placeholderLabel, mConfig.tokenObjects, true);
+      if (aHandle) {
+        aKey = PregeneratedKey{ PregenKeyType::Aes, aHandle.value(), CK_INVALID_HANDLE };
+      }
+    } else {
+      auto aPair = HSMUtils::generateKeyPair(aLease->libInterface(), aLease->session(), mConfig.placeholderLabel, mConfig.tokenObjects);
+      if (aPair) {
+        aKey = PregeneratedKey{ PregenKeyType::EcKeyPair, aPair->second, aPair->first };
+      }
+    }
+    auto aElapsed    = std::chrono::steady_clock::now() - aStart;
+    auto aGeneration = aLease->generation();
+    aLease.reset();
+
+    aLock.lock();
+    --aInFlight;
+    if (not aKey) {
+      ++mStats.failures;
+      // do not spin on a module refusing the mechanism
+      aLock.unlock();
+      std::this_thread::sleep_for(K_IDLE_BACKOFF * 20);
+      aLock.lock();
+      continue;
+    }
+    ++mStats.generated;
+    mGenerationNs += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(aElapsed).count());
+    queue(aKey->type).push_back(Entry{ aKey.value(), aGeneration });
+  }
+}
+
+std::uint64_t KeyPregenPool::sweep() {
+  if (not mConfig.tokenObjects) {
+    return 0u;
+  }
+  auto aLease = mPool.acquire(SessionAccess::ReadWrite);
+  if (not aLease) {
+    return 0u;
+  }
+  static CK_BBOOL bTrue = true;
+  std::vector<CK_ATTRIBUTE> aTemplate = {
+      { CKA_LABEL, const_cast<char*>(mConfig.placeholderLabel.c_str()), mConfig.placeholderLabel.length() },
+      { CKA_TOKEN, &bTrue, sizeof(bTrue) },
+  };
+  auto aObjects = HSMUtils::findObjects(aLease->libInterface(), aLease->session(), aTemplate);
+  if (not aObjects) {
+    return 0u;
+  }
+  std::uint64_t aSwept = 0u;
+  for (auto aObject : aObjects.value()) {
+    if (HSMUtils::destroyObject(aLease->libInterface(), aLease->session(), aObject)) {
+      ++aSwept;
+    }
+  }
+  if (aSwept > 0u) {
+    std::ostringstream descr;
+    descr << "Destroyed " << aSwept << " leftover " << mConfig.placeholderLabel << " keys on slot " << mPool.slotLabel();
+    TRC_WARN(255, descr.str());
+  }
+  return aSwept;
+}
+
+void KeyPregenPool::destroy(const PregeneratedKey& iKey) {
+  auto aLease = mPool.acquire(mConfig.tokenObjects ? SessionAccess::ReadWrite : SessionAccess::ReadOnly);
+  if (not aLease) {
+    return;
+  }
+  HSMUtils::destroyObject(aLease->libInterface(), aLease->session(), iKey.key);
+  if (iKey.publicKey != CK_INVALID_HANDLE) {
+    HSMUtils::destroyObject(aLease->libInterface(), aLease->session(), iKey.publicKey);
+  }
+}
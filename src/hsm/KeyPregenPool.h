@@ -0,0 +1,132 @@
+#pragma once
+
+#include "hsm/cryptoki.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+class SessionPool;
+
+enum class PregenKeyType {
+  // AES-256 secret key, as HSMUtils::generateKey
+  Aes,
+  // P-256 EC key pair, as HSMUtils::generateKeyPair
+  EcKeyPair,
+};
+
+/**
+ * A key generated ahead of time by a KeyPregenPool
+ */
+struct PregeneratedKey {
+  PregenKeyType type;
+  // the AES key or the private key of the pair
+  CK_OBJECT_HANDLE key;
+  // public key of the pair, CK_INVALID_HANDLE for an AES key
+  CK_OBJECT_HANDLE publicKey;
+};
+
+/**
+ * Keeps a number of AES keys and EC key pairs generated ahead of time, so that provisioning a tenant takes
+ * them from memory instead of waiting for C_GenerateKey / C_GenerateKeyPair. The keys are generated under a
+ * placeholder label and labeled when handed out (C_SetAttributeValue), or kept as session keys.
+ *
+ * Refill workers run at the lowest scheduling priority and only use sessions that are idle at the time, so they
+ * do not compete with the request path for the pool's sessions.
+ */
+class KeyPregenPool {
+ public:
+  struct Config {
+    std::size_t aesDepth = 32u;
+    std::size_t ecDepth  = 8u;
+    std::size_t workers  = 1u;
+    // false to keep session keys: faster to generate, gone when the pool sessions are recovered
+    bool tokenObjects = true;
+    // label of the keys not handed out yet. Token objects still bearing it when the pool starts are left over from
+    // a process that stopped without cleaning up and are destroyed: it must not be shared with another process
+    std::string placeholderLabel = "PREGEN";
+  };
+
+  struct Stats {
+    std::size_t aesDepth = 0u;
+    std::size_t ecDepth  = 0u;
+    std::uint64_t handedOut = 0u;
+    // take() calls that found the pool empty
+    std::uint64_t misses    = 0u;
+    std::uint64_t generated = 0u;
+    std::uint64_t failures  = 0u;
+    // leftover placeholder keys destroyed on start
+    std::uint64_t swept = 0u;
+    // average duration of one key (pair) generation
+    double meanGenerationUs = 0.0;
+    // time from the pool going below its depth to being full again, for the last completed refill
+    std::chrono::microseconds lastRefill{ 0 };
+  };
+
+  /**
+   * Destroys the leftover placeholder keys of the token, then starts the refill workers
+   * @param iPool - pool the keys are generated on; must outlive the KeyPregenPool
+   * @param iConfig - the configuration
+   */
+  KeyPregenPool(SessionPool& iPool, Config iConfig);
+
+  /**
+   * Stops the workers and destroys the keys not handed out
+   */
+  ~KeyPregenPool();
+
+  KeyPregenPool(const KeyPregenPool&) = delete;
+  KeyPregenPool& operator=(const KeyPregenPool&) = delete;
+
+  /**
+   * @param iType - type of key
+   * @return a key still labeled with the placeholder label, without any PKCS#11 call; empty optional if none is ready
+   */
+  std::optional<PregeneratedKey> take(PregenKeyType iType);
+
+  /**
+   * Same as take, then sets CKA_LABEL / CKA_ID of the key (both keys of a pair) to iKeyLabel
+   * @return empty optional if none is ready or the label could not be set (the key is destroyed)
+   */
+  std::optional<PregeneratedKey> take(PregenKeyType iType, const std::string& iKeyLabel);
+
+  Stats stats() const;
+
+  void stop();
+
+ private:
+  struct Entry {
+    PregeneratedKey key;
+    // pool generation the key was made in, session keys of an older one are gone
+    std::uint64_t generation;
+  };
+
+  void refillLoop();
+  // destroys the token objects labeled with the placeholder label, returns how many
+  std::uint64_t sweep();
+  std::deque<Entry>& queue(PregenKeyType iType) { return iType == PregenKeyType::Aes ? mAes : mEc; }
+  // type with the largest relative deficit, empty if both are full
+  std::optional<PregenKeyType> deficitLocked() const;
+  void destroy(const PregeneratedKey& iKey);
+
+  SessionPool& mPool;
+  const Config mConfig;
+
+  mutable std::mutex mMutex;
+  std::condition_variable mCv;
+  std::deque<Entry> mAes;
+  std::deque<Entry> mEc;
+  // generations under way, counted in the deficit so that workers do not overshoot the depth
+  std::size_t mAesInFlight = 0u;
+  std::size_t mEcInFlight  = 0u;
+  Stats mStats;
+  std::uint64_t mGenerationNs = 0u;
+  std::optional<std::chrono::steady_clock::time_point> mRefillStart;
+  bool mStopped = false;
+  std::vector<std::thread> mWorkers;
+};
@@ -0,0 +1,140 @@
+#include "hsm/KeyReplicaSet.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/Trace.h"
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+namespace {
+
+// threads get consecutive indices on first use, a thread always uses the copy at its index modulo K
+std::atomic<std::size_t> gNextThreadIndex{ 0u };
+thread_local const std::size_t tThreadIndex = gNextThreadIndex.fetch_add(1u, std::memory_order_relaxed);
+
+}  // namespace
+
+std::unique_ptr<KeyReplicaSet> KeyReplicaSet::create(SessionPool& iPool, std::string iKeyLabel, std::size_t iReplicas) {
+  std::unique_ptr<KeyReplicaSet> aSet(new KeyReplicaSet(iPool, std::move(iKeyLabel), iReplicas));
+  if (not aSet->rebuild(0u)) {
+    return nullptr;
+  }
+  return aSet;
+}
+
+KeyReplicaSet::KeyReplicaSet(SessionPool& iPool, std::string iKeyLabel, std::size_t iReplicas)
+    : mPool(iPool), mKeyLabel(std::move(iKeyLabel)), mReplicas(iReplicas) {}
+
+KeyReplicaSet::~KeyReplicaSet() {
+  std::unique_lock<std::shared_mutex> aLock(mMutex);
+  destroyCopies();
+}
+
+std::optional<std::vector<unsigned char>> KeyReplicaSet::execute(const SessionPool::KeyOperation& iOperation, SessionAccess iAccess) {
+  for (std::size_t aAttempt = 0;;) {
+    CK_OBJECT_HANDLE aHandle;
+    std::uint64_t aBuild;
+    bool aStale;
+    {
+      std::shared_lock<std::shared_mutex> aLock(mMutex);
+      aStale  = mHandles.empty() or mGeneration != mPool.generation();
+      aBuild  = mBuilds;
+      aHandle = aStale ? CK_INVALID_HANDLE : mHandles[tThreadIndex % mHandles.size()];
+    }
+    if (aStale) {
+      // the pool was recovered since the copies were made, they went with the old sessions
+      if (not rebuild(aBuild)) {
+        return {};
+      }
+      continue;
+    }
+
+    auto aValue = mPool.execute([&iOperation, aHandle](const SessionLease& iLease) { return iOperation(iLease, aHandle); }, iAccess);
+    auto aStatus = HSMUtils::lastError();
+    if (aValue or aAttempt++ > 0 or (aStatus != CKR_KEY_HANDLE_INVALID and aStatus != CKR_OBJECT_HANDLE_INVALID)) {
+      return aValue;
+    }
+    // the session holding the copies was closed (e.g. quarantined)
+    if (not rebuild(aBuild)) {
+      return {};
+    }
+  }
+}
+
+std::optional<std::vector<unsigned char>> KeyReplicaSet::encrypt_aes(const std::vector<unsigned char>& iPlainText) {
+  return execute([&iPlainText](const SessionLease& iLease, CK_OBJECT_HANDLE iKeyHandle) {
+    return HSMUtils::encrypt_aes(iLease.libInterface(), iLease.session(), iKeyHandle, iPlainText);
+  });
+}
+
+std::optional<std::vector<unsigned char>> KeyReplicaSet::decrypt_aes(const std::vector<unsigned char>& iCipherText) {
+  return execute([&iCipherText](const SessionLease& iLease, CK_OBJECT_HANDLE iKeyHandle) {
+    return HSMUtils::decrypt_aes(iLease.libInterface(), iLease.session(), iKeyHandle, iCipherText);
+  });
+}
+
+std::vector<CK_OBJECT_HANDLE> KeyReplicaSet::handles() const {
+  std::shared_lock<std::shared_mutex> aLock(mMutex);
+  return mHandles;
+}
+
+std::uint64_t KeyReplicaSet::builds() const {
+  std::shared_lock<std::shared_mutex> aLock(mMutex);
+  return mBuilds;
+}
+
+bool KeyReplicaSet::rebuild(std::uint64_t iStaleBuild) {
+  std::unique_lock<std::shared_mutex> aLock(mMutex);
+  if (mBuilds != iStaleBuild and not mHandles.empty() and mGeneration == mPool.generation()) {
+    return true;
+  }
+
+  // nothing to destroy: the copies are only rebuilt once they are gone with their session
+  auto aGeneration = mPool.generation();
+  mHandles.clear();
+
+  auto aKey = mPool.findKey(mKeyLabel);
+  if (not aKey) {
+    return false;
+  }
+  if (mReplicas == 0u) {
+    mHandles.push_back(aKey.value());
+  } else {
+    auto aLease = mPool.acquire();
+    if (not aLease) {
+      return false;
+    }
+    for (std::size_t i = 0u; i < mReplicas; ++i) {
+      auto aCopy = HSMUtils::copyObject(aLease->libInterface(), aLease->session(), aKey.value(), false);
+      if (not aCopy) {
+        std::ostringstream descr;
+        descr << "Could only create " << i << " of " << mReplicas << " copies of key " << mKeyLabel;
+        TRC_ERROR(255, descr.str());
+        for (auto aHandle : mHandles) {
+          HSMUtils::destroyObject(aLease->libInterface(), aLease->session(), aHandle);
+        }
+        mHandles.clear();
+        return false;
+      }
+      mHandles.push_back(aCopy.value());
+    }
+    aGeneration = aLease->generation();
+  }
+  mGeneration = aGeneration;
+  ++mBuilds;
+  return true;
+}
+
+void KeyReplicaSet::destroyCopies() {
+  if (mReplicas == 0u or mHandles.empty() or mGeneration != mPool.generation()) {
+    return;
+  }
+  auto aLease = mPool.tryAcquire();
+  if (not aLease) {
+    // left to the session close
+    return;
+  }
+  for (auto aHandle : mHandles) {
+    HSMUtils::destroyObject(aLease->libInterface(), aLease->session(), aHandle);
+  }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "hsm/SessionPool.h"
+#include "hsm/cryptoki.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+/**
+ * K session-object copies of one key (C_CopyObject with CKA_TOKEN = false), for HSMs that serialize the
+ * operations on a single key object. Each thread sticks to one copy, threads being spread over the copies
+ * round-robin, so that concurrent operations on the key do not all queue on the same object.
+ *
+ * Session objects live as long as the session that created them: when the pool is recovered (or the session
+ * quarantined) the copies are gone, and they are created again on the first operation that notices it.
+ */
+class KeyReplicaSet {
+ public:
+  /**
+   * @param iPool - pool the copies are created on and used with; must outlive the set
+   * @param iKeyLabel - label of the (token) key to copy
+   * @param iReplicas - number of copies, 0 to use the key itself
+   * @return the set, nullptr if the key could not be found or copied
+   */
+  static std::unique_ptr<KeyReplicaSet> create(SessionPool& iPool, std::string iKeyLabel, std::size_t iReplicas);
+
+  /**
+   * Destroys the copies
+   */
+  ~KeyReplicaSet();
+
+  KeyReplicaSet(const KeyReplicaSet&) = delete;
+  KeyReplicaSet& operator=(const KeyReplicaSet&) = delete;
+
+  /**
+   * @param iOperation - operation executed with a leased session and the copy of the calling thread
+   * @param iAccess - access needed by the operation
+   * @return the output of the operation, retried once on fresh copies if the copy was gone
+   */
+  std::optional<std::vector<unsigned char>> execute(const SessionPool::KeyOperation& iOperation, SessionAccess iAccess = SessionAccess::ReadOnly);
+
+  std::optional<std::vector<unsigned char>> encrypt_aes(const std::vector<unsigned char>& iPlainText);
+
+  std::optional<std::vector<unsigned char>> decrypt_aes(const std::vector<unsigned char>& iCipherText);
+
+  /**
+   * @return the handles in use, the key itself when created with no copies
+   */
+  std::vector<CK_OBJECT_HANDLE> handles() const;
+
+  /**
+   * @return how many times the copies were (re)created
+   */
+  std::uint64_t builds() const;
+
+  const std::string& keyLabel() const { return mKeyLabel; }
+  std::size_t replicas() const { return mReplicas; }
+
+ private:
+  KeyReplicaSet(SessionPool& iPool, std::string iKeyLabel, std::size_t iReplicas);
+
+  // recreates the copies unless another thread already did since iStaleBuild
+  bool rebuild(std::uint64_t iStaleBuild);
+  void destroyCopies();
+
+  SessionPool& mPool;
+  const std::string mKeyLabel;
+  const std::size_t mReplicas;
+
+  mutable std::shared_mutex mMutex;
+  std::vector<CK_OBJECT_HANDLE> mHandles;
+  // pool generation the copies were created in
+  std::uint64_t mGeneration = 0u;
+  std::uint64_t mBuilds     = 0u;
+};
@@ -0,0 +1,233 @@
+#include "hsm/KeyReplicator.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+struct Progress {
+  std::atomic<std::size_t> imported{ 0u };
+  std::atomic<std::size_t> skipped{ 0u };
+  std::atomic<std::size_t> failed{ 0u };
+};
+
+// replaces the sessions of the lease's pool when the last call failed because they were lost
+bool recoverIfLost(SessionPool& iPool, std::optional<SessionLease>& ioLease, SessionAccess iAccess) {
+  if (not ioLease or not SessionPool::isSessionLost(HSMUtils::lastError())) {
+    return false;
+  }
+  auto aGeneration = ioLease->generation();
+  ioLease.reset();
+  if (not iPool.recover(aGeneration)) {
+    return false;
+  }
+  ioLease = iPool.acquire(iAccess);
+  return ioLease.has_value();
+}
+
+// true if iLabel names an object on the lease's token, empty optional on search error; unlike
+// HSMUtils::retrieveKeyHandle, an absent label is not reported as an error
+std::optional<bool> labelExists(const SessionLease& iLease, const std::string& iLabel) {
+  std::vector<CK_ATTRIBUTE> aTemplate = { { CKA_LABEL, const_cast<char*>(iLabel.c_str()), iLabel.length() } };
+  auto aObjects = HSMUtils::findObjects(iLease.libInterface(), iLease.session(), aTemplate, 1u);
+  if (not aObjects) {
+    return {};
+  }
+  return not aObjects->empty();
+}
+
+}  // namespace
+
+KeyReplicator::KeyReplicator(SessionPool& iSource, std::vector<SessionPool*> iTargets, Config iConfig)
+    : mSource(iSource), mTargets(std::move(iTargets)), mConfig(std::move(iConfig)) {}
+
+KeyReplicator::Report KeyReplicator::replicate(const std::vector<std::string>& iKeyLabels) {
+  std::vector<std::string> aKeys;
+  aKeys.reserve(iKeyLabels.size());
+  std::size_t aMissing = 0u;
+  for (const auto& aLabel : iKeyLabels) {
+    if (mSource.findKey(aLabel)) {
+      aKeys.push_back(aLabel);
+    } else {
+      std::ostringstream descr;
+      descr << "Key " << aLabel << " not found on source slot " << mSource.slotLabel();
+      TRC_ERROR(255, descr.str());
+      ++aMissing;
+    }
+  }
+  return run(aKeys, aMissing);
+}
+
+KeyReplicator::Report KeyReplicator::replicateAll() {
+  static CK_OBJECT_CLASS KeyClass = CKO_SECRET_KEY;
+  static CK_KEY_TYPE KeyType      = CKK_AES;
+  static CK_BBOOL bTrue           = true;
+  std::vector<CK_ATTRIBUTE> aTemplate = {
+      { CKA_CLASS, &KeyClass, sizeof(KeyClass) },
+      { CKA_KEY_TYPE, &KeyType, sizeof(KeyType) },
+      { CKA_EXTRACTABLE, &bTrue, sizeof(bTrue) },
+  };
+
+  // labels of the listed keys, their handles seeding the source pool's cache
+  std::vector<std::pair<std::string, CK_OBJECT_HANDLE>> aHandles;
+  bool aListed = false;
+  {
+    auto aLease = mSource.acquire(SessionAccess::ReadOnly);
+    auto aKeys  = aLease ? HSMUtils::findObjects(aLease->libInterface(), aLease->session(), aTemplate) : std::nullopt;
+    if (aKeys) {
+      aListed = true;
+      aHandles.reserve(aKeys->size());
+      for (auto aKey : aKeys.value()) {
+        auto aIdentity = HSMUtils::getLabelAndId(aLease->libInterface(), aLease->session(), aKey);
+        if (not aIdentity) {
+          aListed = false;
+          break;
+        }
+        aHandles.emplace_back(std::move(aIdentity->first), aKey);
+      }
+    }
+  }
+  if (not aListed) {
+    TRC_ERROR(255, "Could not list the keys of source slot " + mSource.slotLabel());
+    return Report{};
+  }
+  mSource.cacheKeyHandles(aHandles);
+
+  std::vector<std::string> aLabels;
+  aLabels.reserve(aHandles.size());
+  for (auto& aHandle : aHandles) {
+    if (aHandle.first != mConfig.transportKeyLabel and std::find(aLabels.begin(), aLabels.end(), aHandle.first) == aLabels.end()) {
+      aLabels.push_back(std::move(aHandle.first));
+    }
+  }
+  return run(aLabels, 0u);
+}
+
+KeyReplicator::Report KeyReplicator::run(const std::vector<std::string>& iKeyLabels, std::size_t iMissing) {
+  auto aStart = std::chrono::steady_clock::now();
+  Report aReport;
+  aReport.keys = iKeyLabels.size() + iMissing;
+
+  Progress aProgress;
+  aProgress.failed = iMissing * mTargets.size();
+
+  bool aTransportKeyFound = mSource.findKey(mConfig.transportKeyLabel).has_value();
+  for (auto* aTarget : mTargets) {
+    aTransportKeyFound = aTransportKeyFound and aTarget->findKey(mConfig.transportKeyLabel).has_value();
+  }
+  if (not aTransportKeyFound) {
+    std::ostringstream descr;
+    descr << "Transport key " << mConfig.transportKeyLabel << " is missing on the source or on a target slot";
+    TRC_ERROR(255, descr.str());
+    aReport.failed = aReport.keys * mTargets.size();
+    return aReport;
+  }
+
+  const std::size_t aChunkSize = std::max<std::size_t>(mConfig.chunkSize, 1u);
+  const std::size_t aChunks    = (iKeyLabels.size() + aChunkSize - 1u) / aChunkSize;
+  std::atomic<std::size_t> aNextChunk{ 0u };
+
+  auto aReplicateChunk = [&](std::size_t iBegin, std::size_t iEnd) {
+    auto aSource = mSource.acquire(SessionAccess::ReadOnly);
+    std::vector<std::optional<SessionLease>> aTargets;
+    aTargets.reserve(mTargets.size());
+    for (auto* aTarget : mTargets) {
+      aTargets.push_back(aTarget->acquire(SessionAccess::ReadWrite));
+    }
+
+    for (std::size_t i = iBegin; i < iEnd; ++i) {
+      std::optional<std::pair<std::string, std::vector<unsigned char>>> aIdentity;
+      std::optional<std::vector<unsigned char>> aWrapped;
+      for (int aAttempt = 0; aAttempt < 2 and aSource and not aWrapped; ++aAttempt) {
+        // resolved on every attempt: a recovery of the pool refreshes the cached handles
+        auto aTransportKey = mSource.findKey(mConfig.transportKeyLabel, aSource.value());
+        auto aKey          = mSource.findKey(iKeyLabels[i], aSource.value());
+        if (aKey) {
+          aIdentity = HSMUtils::getLabelAndId(aSource->libInterface(), aSource->session(), aKey.value());
+        }
+        if (aIdentity and aTransportKey) {
+          aWrapped = HSMUtils::wrapKey(aSource->libInterface(), aSource->session(), aTransportKey.value(), aKey.value());
+        }
+        if (aWrapped) {
+          break;
+        }
+        auto aStatus = HSMUtils::lastError();
+        if (aStatus == CKR_KEY_HANDLE_INVALID or aStatus == CKR_OBJECT_HANDLE_INVALID) {
+          mSource.forgetKey(iKeyLabels[i]);
+          mSource.forgetKey(mConfig.transportKeyLabel);
+          continue;
+        }
+        if (not recoverIfLost(mSource, aSource, SessionAccess::ReadOnly)) {
+          break;
+        }
+      }
+      if (not aWrapped) {
+        aProgress.failed += mTargets.size();
+        continue;
+      }
+
+      for (std::size_t t = 0u; t < mTargets.size(); ++t) {
+        auto& aTarget = aTargets[t];
+        bool aDone    = false;
+        for (int aAttempt = 0; aAttempt < 2 and aTarget and not aDone; ++aAttempt) {
+          if (mConfig.skipExisting) {
+            auto aExists = labelExists(aTarget.value(), aIdentity->first);
+            if (aExists and aExists.value()) {
+              ++aProgress.skipped;
+              aDone = true;
+              break;
+            }
+            if (not aExists) {
+              if (not recoverIfLost(*mTargets[t], aTarget, SessionAccess::ReadWrite)) {
+                break;
+              }
+              continue;
+            }
+          }
+          auto aTransportKey = mTargets[t]->findKey(mConfig.transportKeyLabel);
+          if (aTransportKey
+              and HSMUtils::unwrapKey(aTarget->libInterface(), aTarget->session(), aTransportKey.value(), aWrapped.value(), aIdentity->first, aIdentity->second)) {
+            ++aProgress.imported;
+            aDone = true;
+            break;
+          }
+          if (not recoverIfLost(*mTargets[t], aTarget, SessionAccess::ReadWrite)) {
+            break;
+          }
+        }
+        if (not aDone) {
+          ++aProgress.failed;
+        }
+      }
+    }
+  };
+
+  auto aWorker = [&]() {
+    for (;;) {
+      auto aChunk = aNextChunk.fetch_add(1u);
+      if (aChunk >= aChunks) {
+        return;
+      }
+      aReplicateChunk(aChunk * aChunkSize, std::min(iKeyLabels.size(), (aChunk + 1u) * aChunkSize));
+    }
+  };
+
+  std::vector<std::thread> aThreads;
+  auto aThreadCount = std::min(std::max<std::size_t>(mConfig.threads, 1u), aChunks);
+  for (std::size_t i = 0u; i < aThreadCount; ++i) {
+    aThreads.emplace_back(aWorker);
+  }
+  for (auto& aThread : aThreads) {
+    aThread.join();
+  }
+
+  aReport.imported = aProgress.imported;
+  aReport.skipped  = aProgress.skipped;
+  aReport.failed   = aProgress.failed;
+  aReport.elapsed  = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - aStart);
+  return aReport;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "hsm/SessionPool.h"
+#include "hsm/cryptoki.h"
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Copies AES keys from a source token to N target tokens with C_WrapKey / C_UnwrapKey under a transport key,
+ * keeping their CKA_LABEL and CKA_ID, so that the same key can be used on every partition.
+ *
+ * The transport key (an AES key with CKA_WRAP / CKA_UNWRAP) must already be present under the same label
+ * and value on the source and on every target. Only CKA_EXTRACTABLE keys can be replicated; the replicas are
+ * created extractable too.
+ *
+ * Keys are split in chunks handled by worker threads in parallel. A worker holds one source session and one
+ * read-write session per target for a whole chunk, so the threads are bounded by the sizes of the pools.
+ *
+ * Keys are identified by their label: source handles are resolved through the source pool's key cache, which a
+ * recovery of the pool refreshes, so a source that restarts midway is not left with stale handles.
+ */
+class KeyReplicator {
+ public:
+  struct Config {
+    std::string transportKeyLabel;
+    std::size_t threads = 8u;
+    // keys handled per set of leases
+    std::size_t chunkSize = 64u;
+    // leave the keys whose label already exists on a target untouched
+    bool skipExisting = true;
+  };
+
+  struct Report {
+    std::size_t keys = 0u;
+    // copies created on the targets
+    std::size_t imported = 0u;
+    // copies not made because the label already existed on the target
+    std::size_t skipped = 0u;
+    // copies that could not be made
+    std::size_t failed = 0u;
+    std::chrono::milliseconds elapsed{ 0 };
+  };
+
+  /**
+   * @param iSource - pool on the token the keys are exported from
+   * @param iTargets - pools on the tokens the keys are imported into, with read-write sessions
+   * @param iConfig - the configuration
+   */
+  KeyReplicator(SessionPool& iSource, std::vector<SessionPool*> iTargets, Config iConfig);
+
+  /**
+   * @param iKeyLabels - labels of the keys on the source token
+   * @return counts of the copies made, a label not found on the source counts as failed on every target
+   */
+  Report replicate(const std::vector<std::string>& iKeyLabels);
+
+  /**
+   * Replicates every extractable AES secret key of the source token but the transport key; keys sharing a label
+   * are replicated once
+   */
+  Report replicateAll();
+
+ private:
+  Report run(const std::vector<std::string>& iKeyLabels, std::size_t iMissing);
+
+  SessionPool& mSource;
+  std::vector<SessionPool*> mTargets;
+  const Config mConfig;
+};
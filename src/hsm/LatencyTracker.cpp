@@ -0,0 +1,32 @@
+#include "hsm/LatencyTracker.h"
+#include <algorithm>
+
+LatencyTracker::LatencyTracker(std::size_t iWindow) : mSamples(std::max<std::size_t>(iWindow, 1u)) {}
+
+void LatencyTracker::record(std::chrono::nanoseconds iLatency) {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  mSamples[mNext] = iLatency;
+  if (++mNext == mSamples.size()) {
+    mNext = 0u;
+    mFull = true;
+  }
+}
+
+std::chrono::nanoseconds LatencyTracker::percentile(double iPercentile) const {
+  std::vector<std::chrono::nanoseconds> aSamples;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    aSamples.assign(mSamples.begin(), mFull ? mSamples.end() : mSamples.begin() + mNext);
+  }
+  if (aSamples.empty()) {
+    return std::chrono::nanoseconds::zero();
+  }
+  auto aRank = static_cast<std::size_t>(std::clamp(iPercentile, 0.0, 1.0) * static_cast<double>(aSamples.size() - 1u));
+  std::nth_element(aSamples.begin(), aSamples.begin() + aRank, aSamples.end());
+  return aSamples[aRank];
+}
+
+std::size_t LatencyTracker::count() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mFull ? mSamples.size() : mNext;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * Sliding window over the most recent call latencies, used to derive percentiles on the fly
+ */
+class LatencyTracker {
+ public:
+  /**
+   * @param iWindow - number of most recent samples kept
+   */
+  explicit LatencyTracker(std::size_t iWindow = 1000u);
+
+  void record(std::chrono::nanoseconds iLatency);
+
+  /**
+   * @param iPercentile - in [0, 1], e.g. 0.95
+   * @return the percentile over the current window, zero if no sample was recorded yet
+   */
+  std::chrono::nanoseconds percentile(double iPercentile) const;
+
+  std::size_t count() const;
+
+ private:
+  mutable std::mutex mMutex;
+  std::vector<std::chrono::nanoseconds> mSamples;
+  std::size_t mNext = 0u;
+  bool mFull        = false;
+};
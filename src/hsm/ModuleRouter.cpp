@@ -0,0 +1,125 @@
+#include "hsm/ModuleRouter.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/Trace.h"
+#include <mutex>
+#include <sstream>
+
+void ModuleRouter::add(HSMModule& iModule) {
+  for (auto* aPool : iModule.pools()) {
+    auto aRoute    = std::make_unique<Route>();
+    aRoute->module = &iModule;
+    aRoute->pool   = aPool;
+    mRoutes.push_back(std::move(aRoute));
+  }
+  // keys may now be found on the new pools too
+  std::unique_lock<std::shared_mutex> aLock(mLocationMutex);
+  mLocations.clear();
+}
+
+HSMResult ModuleRouter::execute(const std::string& iKeyLabel, const SessionPool::KeyOperation& iOperation, SessionAccess iAccess) {
+  auto aLocation = locateRoutes(iKeyLabel);
+  auto* aRoute   = pick(aLocation);
+  if (not aRoute) {
+    std::ostringstream descr;
+    descr << "No module holds key " << iKeyLabel;
+    TRC_ERROR(255, descr.str());
+    return HSMResult{ HSMStatus::Failed, {} };
+  }
+
+  aRoute->outstanding.fetch_add(1u, std::memory_order_relaxed);
+  aRoute->routed.fetch_add(1u, std::memory_order_relaxed);
+  CK_RV aStatus = CKR_OK;
+  auto aValue   = aRoute->pool->execute(iKeyLabel, iOperation, iAccess, &aStatus);
+  aRoute->outstanding.fetch_sub(1u, std::memory_order_relaxed);
+  if (aValue) {
+    return HSMResult{ HSMStatus::Ok, std::move(aValue) };
+  }
+
+  aRoute->failures.fetch_add(1u, std::memory_order_relaxed);
+  if (aStatus == SessionPool::K_KEY_NOT_FOUND) {
+    // the key is gone from this pool, look it up everywhere on the next request
+    forget(iKeyLabel);
+  }
+  return HSMResult{ HSMStatus::Failed, {} };
+}
+
+HSMResult ModuleRouter::encrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iPlainText) {
+  return execute(iKeyLabel, [&iPlainText](const SessionLease& iLease, CK_OBJECT_HANDLE iKeyHandle) {
+    return HSMUtils::encrypt_aes(iLease.libInterface(), iLease.session(), iKeyHandle, iPlainText);
+  });
+}
+
+HSMResult ModuleRouter::decrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iCipherText) {
+  return execute(iKeyLabel, [&iCipherText](const SessionLease& iLease, CK_OBJECT_HANDLE iKeyHandle) {
+    return HSMUtils::decrypt_aes(iLease.libInterface(), iLease.session(), iKeyHandle, iCipherText);
+  });
+}
+
+std::vector<SessionPool*> ModuleRouter::locate(const std::string& iKeyLabel) {
+  std::vector<SessionPool*> aPools;
+  for (auto aIndex : locateRoutes(iKeyLabel)) {
+    aPools.push_back(mRoutes[aIndex]->pool);
+  }
+  return aPools;
+}
+
+void ModuleRouter::forget(const std::string& iKeyLabel) {
+  std::unique_lock<std::shared_mutex> aLock(mLocationMutex);
+  mLocations.erase(iKeyLabel);
+}
+
+std::vector<ModuleRouter::RouteStats> ModuleRouter::stats() const {
+  std::vector<RouteStats> aStats;
+  aStats.reserve(mRoutes.size());
+  for (const auto& aRoute : mRoutes) {
+    RouteStats aRouteStats;
+    aRouteStats.module       = aRoute->module->name();
+    aRouteStats.slotLabel    = aRoute->pool->slotLabel();
+    aRouteStats.routed       = aRoute->routed.load(std::memory_order_relaxed);
+    aRouteStats.failures     = aRoute->failures.load(std::memory_order_relaxed);
+    aRouteStats.outstanding  = aRoute->outstanding.load(std::memory_order_relaxed);
+    aRouteStats.idleSessions = aRoute->pool->available();
+    aStats.push_back(aRouteStats);
+  }
+  return aStats;
+}
+
+ModuleRouter::Route* ModuleRouter::pick(const std::vector<std::size_t>& iLocation) const {
+  Route* aBest              = nullptr;
+  std::size_t aBestIdle     = 0u;
+  std::size_t aBestInFlight = 0u;
+  for (auto aIndex : iLocation) {
+    auto* aRoute   = mRoutes[aIndex].get();
+    auto aIdle     = aRoute->pool->available();
+    auto aInFlight = aRoute->outstanding.load(std::memory_order_relaxed);
+    if (not aBest or aIdle > aBestIdle or (aIdle == aBestIdle and aInFlight < aBestInFlight)) {
+      aBest         = aRoute;
+      aBestIdle     = aIdle;
+      aBestInFlight = aInFlight;
+    }
+  }
+  return aBest;
+}
+
+std::vector<std::size_t> ModuleRouter::locateRoutes(const std::string& iKeyLabel) {
+  {
+    std::shared_lock<std::shared_mutex> aLock(mLocationMutex);
+    auto aIt = mLocations.find(iKeyLabel);
+    if (aIt != mLocations.end()) {
+      return aIt->second;
+    }
+  }
+
+  // the pools cache the handles they find, so this costs one lookup per pool and per key
+  std::vector<std::size_t> aLocation;
+  for (std::size_t i = 0u; i < mRoutes.size(); ++i) {
+    if (mRoutes[i]->pool->findKey(iKeyLabel)) {
+      aLocation.push_back(i);
+    }
+  }
+  if (not aLocation.empty()) {
+    std::unique_lock<std::shared_mutex> aLock(mLocationMutex);
+    mLocations[iKeyLabel] = aLocation;
+  }
+  return aLocation;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "hsm/HSMModule.h"
+#include "hsm/HSMResult.h"
+#include "hsm/SessionPool.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Dispatches key operations over the pools of several HSMModules.
+ * The first request on a key label looks the key up on every pool and remembers the pools holding it (its
+ * location); requests then go to the location pool with the most idle sessions, ties going to the pool with
+ * the fewest requests routed through the router and still running. A location is forgotten when the key
+ * cannot be found on the chosen pool anymore, and looked up again on the next request.
+ */
+class ModuleRouter {
+ public:
+  /**
+   * Requests routed to one pool
+   */
+  struct RouteStats {
+    std::string module;
+    std::string slotLabel;
+    std::uint64_t routed     = 0u;
+    std::uint64_t failures   = 0u;
+    std::size_t outstanding  = 0u;
+    std::size_t idleSessions = 0u;
+  };
+
+  ModuleRouter() = default;
+  ModuleRouter(const ModuleRouter&) = delete;
+  ModuleRouter& operator=(const ModuleRouter&) = delete;
+
+  /**
+   * Adds the pools currently opened on iModule. Not thread-safe with respect to execute().
+   * @param iModule - the module; must outlive the router
+   */
+  void add(HSMModule& iModule);
+
+  /**
+   * @param iKeyLabel - label of the key, routed to a pool whose token holds it
+   * @param iOperation - the operation
+   * @param iAccess - access needed by the operation
+   * @return HSMStatus::Failed if no pool holds the key or the operation failed
+   */
+  HSMResult execute(const std::string& iKeyLabel, const SessionPool::KeyOperation& iOperation, SessionAccess iAccess = SessionAccess::ReadOnly);
+
+  HSMResult encrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iPlainText);
+
+  HSMResult decrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iCipherText);
+
+  /**
+   * @param iKeyLabel - label of the key
+   * @return the pools whose token holds the key, looked up on first use
+   */
+  std::vector<SessionPool*> locate(const std::string& iKeyLabel);
+
+  /**
+   * Drops the cached location of iKeyLabel, e.g. after the key was replicated to another module
+   */
+  void forget(const std::string& iKeyLabel);
+
+  std::vector<RouteStats> stats() const;
+
+ private:
+  struct Route {
+    HSMModule* module;
+    SessionPool* pool;
+    std::atomic<std::size_t> outstanding{ 0u };
+    std::atomic<std::uint64_t> routed{ 0u };
+    std::atomic<std::uint64_t> failures{ 0u };
+  };
+
+  // route with the most spare capacity among the location of a key
+  Route* pick(const std::vector<std::size_t>& iLocation) const;
+  std::vector<std::size_t> locateRoutes(const std::string& iKeyLabel);
+
+  std::vector<std::unique_ptr<Route>> mRoutes;
+
+  mutable std::shared_mutex mLocationMutex;
+  // key label -> indices in mRoutes of the pools holding the key
+  std::unordered_map<std::string, std::vector<std::size_t>> mLocations;
+};
@@ -0,0 +1,132 @@
+#include "hsm/ObjectReaper.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/SessionPool.h"
+#include <algorithm>
+
+ObjectReaper::ObjectReaper(SessionPool& iPool) : ObjectReaper(iPool, Config{}) {}
+
+ObjectReaper::ObjectReaper(SessionPool& iPool, Config iConfig) : mPool(&iPool), mConfig(iConfig) {
+  mThread = std::thread(&ObjectReaper::reapLoop, this);
+  iPool.setReaper(this);
+}
+
+ObjectReaper::~ObjectReaper() {
+  detach();
+}
+
+void ObjectReaper::detach() {
+  SessionPool* aPool;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    aPool    = std::exchange(mPool, nullptr);
+    mStopped = true;
+  }
+  if (not aPool) {
+    return;
+  }
+  // waits for the enqueue calls in flight, none comes after
+  aPool->setReaper(nullptr);
+  mCv.notify_all();
+  mThread.join();
+  drain(*aPool);
+}
+
+void ObjectReaper::enqueue(std::vector<CK_OBJECT_HANDLE> iObjects, std::uint64_t iGeneration) {
+  bool aBatchFull;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    for (auto aObject : iObjects) {
+      mQueue.emplace_back(aObject, iGeneration);
+    }
+    mCounters.enqueued += iObjects.size();
+    aBatchFull = mQueue.size() >= mConfig.batchSize;
+  }
+  if (aBatchFull) {
+    mCv.notify_one();
+  }
+}
+
+void ObjectReaper::flush() {
+  SessionPool* aPool;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    aPool = mPool;
+  }
+  if (aPool) {
+    drain(*aPool);
+  }
+}
+
+void ObjectReaper::drain(SessionPool& iPool) {
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> aLock(mMutex);
+      if (mQueue.empty()) {
+        return;
+      }
+    }
+    if (not reap(iPool, mConfig.batchSize)) {
+      return;
+    }
+  }
+}
+
+ObjectReaper::Counters ObjectReaper::counters() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  auto aCounters    = mCounters;
+  aCounters.pending = mQueue.size();
+  return aCounters;
+}
+
+void ObjectReaper::reapLoop() {
+  std::unique_lock<std::mutex> aLock(mMutex);
+  while (not mStopped) {
+    mCv.wait_for(aLock, mConfig.period, [this] { return mStopped or mQueue.size() >= mConfig.batchSize; });
+    if (mStopped) {
+      return;
+    }
+    if (mQueue.empty()) {
+      continue;
+    }
+    // detach() joins this thread before the pool can go away
+    auto* aPool = mPool;
+    aLock.unlock();
+    reap(*aPool, mConfig.batchSize);
+    aLock.lock();
+  }
+}
+
+bool ObjectReaper::reap(SessionPool& iPool, std::size_t iMax) {
+  // never wait for a session behind the request traffic for long
+  auto aLease = iPool.acquireUntil(SessionPool::Clock::now() + mConfig.period);
+  if (not aLease) {
+    return false;
+  }
+
+  std::vector<std::pair<CK_OBJECT_HANDLE, std::uint64_t>> aBatch;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    auto aCount = std::min(iMax, mQueue.size());
+    aBatch.assign(mQueue.begin(), mQueue.begin() + aCount);
+    mQueue.erase(mQueue.begin(), mQueue.begin() + aCount);
+  }
+
+  std::uint64_t aDestroyed = 0u;
+  std::uint64_t aFailed    = 0u;
+  std::uint64_t aDropped   = 0u;
+  for (const auto& [aObject, aGeneration] : aBatch) {
+    if (aGeneration != aLease->generation()) {
+      ++aDropped;
+    } else if (HSMUtils::destroyObject(aLease->libInterface(), aLease->session(), aObject)) {
+      ++aDestroyed;
+    } else {
+      ++aFailed;
+    }
+  }
+
+  std::lock_guard<std::mutex> aLock(mMutex);
+  mCounters.destroyed += aDestroyed;
+  mCounters.failed += aFailed;
+  mCounters.dropped += aDropped;
+  return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "hsm/cryptoki.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class SessionPool;
+
+/**
+ * Destroys session objects in the background, in batches over a single leased session, so that releasing a
+ * lease holding ephemeral keys (see SessionLease::generateEphemeralKey) does not pay for the C_DestroyObject
+ * calls. Attaches itself to the pool on construction and detaches on destruction, after destroying what is
+ * still queued. A pool destroyed first detaches it itself (see detach), the reaper then does nothing anymore.
+ *
+ * Objects queued for an older pool generation are dropped: they went with the sessions that created them.
+ */
+class ObjectReaper {
+ public:
+  struct Config {
+    // objects destroyed per leased session
+    std::size_t batchSize = 256u;
+    // how long queued objects wait for a batch to fill
+    std::chrono::milliseconds period{ 200 };
+  };
+
+  struct Counters {
+    std::uint64_t enqueued  = 0u;
+    std::uint64_t destroyed = 0u;
+    std::uint64_t failed    = 0u;
+    // dropped because their sessions were closed in the meantime
+    std::uint64_t dropped   = 0u;
+    std::size_t pending     = 0u;
+  };
+
+  explicit ObjectReaper(SessionPool& iPool);
+  ObjectReaper(SessionPool& iPool, Config iConfig);
+  ~ObjectReaper();
+
+  ObjectReaper(const ObjectReaper&) = delete;
+  ObjectReaper& operator=(const ObjectReaper&) = delete;
+
+  /**
+   * @param iObjects - session objects of the pool to destroy
+   * @param iGeneration - pool generation of the session that created them
+   */
+  void enqueue(std::vector<CK_OBJECT_HANDLE> iObjects, std::uint64_t iGeneration);
+
+  /**
+   * Destroys everything queued so far, on the calling thread
+   */
+  void flush();
+
+  /**
+   * Stops queuing objects from the pool and the background thread, then destroys what is still queued; called by
+   * the destructor, and by the pool's destructor when the pool goes first
+   */
+  void detach();
+
+  Counters counters() const;
+
+ private:
+  void reapLoop();
+  void drain(SessionPool& iPool);
+  // destroys up to iMax queued objects, returns false if no session could be leased
+  bool reap(SessionPool& iPool, std::size_t iMax);
+
+  // nullptr once detached
+  SessionPool* mPool;
+  const Config mConfig;
+
+  mutable std::mutex mMutex;
+  std::condition_variable mCv;
+  std::deque<std::pair<CK_OBJECT_HANDLE, std::uint64_t>> mQueue;
+  Counters mCounters;
+  bool mStopped = false;
+  std::thread mThread;
+};
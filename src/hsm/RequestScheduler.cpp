@@ -0,0 +1,235 @@
+#include "hsm/RequestScheduler.h"
+#include "hsm/HSMUtils.h"
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+void complete(std::promise<HSMResult>& iPromise, HSMStatus iStatus, std::optional<std::vector<unsigned char>> iValue = {}) {
+  iPromise.set_value(HSMResult{ iStatus, std::move(iValue) });
+}
+
+}  // namespace
+
+RequestScheduler::RequestScheduler(SessionPool& iPool, std::size_t iWorkers, ConcurrencyLimiter* iLimiter)
+    : mPool(iPool), mLimiter(iLimiter) {
+  mWorkers.reserve(iWorkers);
+  for (std::size_t i = 0; i < iWorkers; ++i) {
+    mWorkers.emplace_back([this] { workerLoop(); });
+  }
+}
+
+RequestScheduler::~RequestScheduler() {
+  stop();
+}
+
+std::future<HSMResult> RequestScheduler::submit(PriorityClass iClass, Clock::time_point iDeadline, Operation iOperation) {
+  return enqueue(iClass, Request{ iDeadline, 0u, std::move(iOperation), nullptr, {}, {} });
+}
+
+std::future<HSMResult> RequestScheduler::submit(PriorityClass iClass, Clock::time_point iDeadline, std::string iKeyLabel, KeyOperation iOperation) {
+  return enqueue(iClass, Request{ iDeadline, 0u, {}, nullptr, std::move(iKeyLabel), std::move(iOperation) });
+}
+
+std::future<HSMResult> RequestScheduler::enqueue(PriorityClass iClass, Request iRequest) {
+  auto aClass   = static_cast<std::size_t>(iClass);
+  auto aPromise = std::make_shared<std::promise<HSMResult>>();
+  auto aFuture  = aPromise->get_future();
+  auto& aCounters = mCounters[aClass];
+  aCounters.submitted.fetch_add(1u, std::memory_order_relaxed);
+
+  if (iRequest.deadline <= Clock::now()) {
+    aCounters.dropped.fetch_add(1u, std::memory_order_relaxed);
+    complete(*aPromise, HSMStatus::DeadlineExceeded);
+    return aFuture;
+  }
+
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    if (mStopped) {
+      complete(*aPromise, HSMStatus::Cancelled);
+      return aFuture;
+    }
+    iRequest.sequence = mSequence++;
+    iRequest.promise  = aPromise;
+    mQueues[aClass].push(std::move(iRequest));
+    aCounters.maxQueueDepth = std::max(aCounters.maxQueueDepth, mQueues[aClass].size());
+  }
+  mQueueCv.notify_one();
+  return aFuture;
+}
+
+std::future<HSMResult> RequestScheduler::encrypt_aes(PriorityClass iClass, Clock::time_point iDeadline, std::string iKeyLabel, std::vector<unsigned char> iPlainText) {
+  return submit(iClass, iDeadline, std::move(iKeyLabel), [aPlainText = std::move(iPlainText)](const SessionLease& iLease, CK_OBJECT_HANDLE iKeyHandle) {
+    return HSMUtils::encrypt_aes(iLease.libInterface(), iLease.session(), iKeyHandle, aPlainText);
+  });
+}
+
+std::future<HSMResult> RequestScheduler::decrypt_aes(PriorityClass iClass, Clock::time_point iDeadline, std::string iKeyLabel, std::vector<unsigned char> iCipherText) {
+  return submit(iClass, iDeadline, std::move(iKeyLabel), [aCipherText = std::move(iCipherText)](const SessionLease& iLease, CK_OBJECT_HANDLE iKeyHandle) {
+    return HSMUtils::decrypt_aes(iLease.libInterface(), iLease.session(), iKeyHandle, aCipherText);
+  });
+}
+
+void RequestScheduler::stop() {
+  std::vector<std::thread> aWorkers;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    if (mStopped) {
+      return;
+    }
+    mStopped = true;
+    aWorkers.swap(mWorkers);
+  }
+  mQueueCv.notify_all();
+  for (auto& aWorker : aWorkers) {
+    aWorker.join();
+  }
+
+  std::lock_guard<std::mutex> aLock(mMutex);
+  for (auto& aQueue : mQueues) {
+    while (not aQueue.empty()) {
+      complete(*aQueue.top().promise, HSMStatus::Cancelled);
+      aQueue.pop();
+    }
+  }
+}
+
+std::array<RequestScheduler::ClassMetrics, K_PRIORITY_CLASS_COUNT> RequestScheduler::metrics() const {
+  std::array<ClassMetrics, K_PRIORITY_CLASS_COUNT> aMetrics;
+  std::lock_guard<std::mutex> aLock(mMutex);
+  for (std::size_t i = 0; i < K_PRIORITY_CLASS_COUNT; ++i) {
+    aMetrics[i].submitted     = mCounters[i].submitted.load(std::memory_order_relaxed);
+    aMetrics[i].completed     = mCounters[i].completed.load(std::memory_order_relaxed);
+    aMetrics[i].failed        = mCounters[i].failed.load(std::memory_order_relaxed);
+    aMetrics[i].dropped       = mCounters[i].dropped.load(std::memory_order_relaxed);
+    aMetrics[i].queueDepth    = mQueues[i].size();
+    aMetrics[i].maxQueueDepth = mCounters[i].maxQueueDepth;
+  }
+  return aMetrics;
+}
+
+void RequestScheduler::dropExpiredLocked(Clock::time_point iNow) {
+  // the top of each heap holds its earliest deadline, so expired requests surface first
+  for (std::size_t i = 0; i < K_PRIORITY_CLASS_COUNT; ++i) {
+    auto& aQueue = mQueues[i];
+    while (not aQueue.empty() and aQueue.top().deadline <= iNow) {
+      mCounters[i].dropped.fetch_add(1u, std::memory_order_relaxed);
+      complete(*aQueue.top().promise, HSMStatus::DeadlineExceeded);
+      aQueue.pop();
+    }
+  }
+}
+
+void RequestScheduler::workerLoop() {
+  for (;;) {
+    std::size_t aClass = K_PRIORITY_CLASS_COUNT;
+    Request aRequest;
+    {
+      std::unique_lock<std::mutex> aLock(mMutex);
+      for (;;) {
+        if (mStopped) {
+          return;
+        }
+        dropExpiredLocked(Clock::now());
+        for (std::size_t i = 0; i < K_PRIORITY_CLASS_COUNT; ++i) {
+          if (not mQueues[i].empty()) {
+            aClass = i;
+            break;
+          }
+        }
+        if (aClass != K_PRIORITY_CLASS_COUNT) {
+          break;
+        }
+        mQueueCv.wait(aLock);
+      }
+      // priority_queue::top is const, the request is moved out right before being popped
+      aRequest = std::move(const_cast<Request&>(mQueues[aClass].top()));
+      mQueues[aClass].pop();
+    }
+    execute(aClass, aRequest);
+  }
+}
+
+void RequestScheduler::execute(std::size_t iClass, Request& iRequest) {
+  auto& aCounters = mCounters[iClass];
+
+  std::optional<ConcurrencyLimiter::Permit> aPermit;
+  if (mLimiter) {
+    aPermit = mLimiter->acquireUntil(iRequest.deadline);
+    if (not aPermit) {
+      aCounters.dropped.fetch_add(1u, std::memory_order_relaxed);
+      complete(*iRequest.promise, HSMStatus::DeadlineExceeded);
+      return;
+    }
+  }
+
+  // waiting for a session counts against the deadline as well; a pool left broken by an earlier recovery is
+  // recovered again rather than failing every request until restart
+  CK_RV aAcquireStatus = CKR_OK;
+  auto aLease          = mPool.acquireForExecuteUntil(iRequest.deadline, SessionAccess::ReadOnly, &aAcquireStatus);
+  if (not aLease and aAcquireStatus == CKR_SESSION_CLOSED) {
+    // the pool was closed under us
+    complete(*iRequest.promise, HSMStatus::Cancelled);
+    return;
+  }
+  if (not aLease and aAcquireStatus == CKR_DEVICE_ERROR) {
+    aCounters.failed.fetch_add(1u, std::memory_order_relaxed);
+    complete(*iRequest.promise, HSMStatus::Unavailable);
+    return;
+  }
+  if (not aLease or Clock::now() >= iRequest.deadline) {
+    aCounters.dropped.fetch_add(1u, std::memory_order_relaxed);
+    complete(*iRequest.promise, HSMStatus::DeadlineExceeded);
+    return;
+  }
+
+  // the thread's last error may be left over from an earlier request: without a value and with CKR_OK the
+  // operation failed by itself, which is neither a stale key nor a lost session
+  CK_RV aStatus = CKR_OK;
+  auto aRun     = [&](const SessionLease& iLease) {
+    HSMUtils::clearLastError();
+    auto aResult = run(iRequest, iLease);
+    aStatus      = aResult ? CKR_OK : HSMUtils::lastError();
+    return aResult;
+  };
+  auto aValue = aRun(aLease.value());
+  if (not aValue and not iRequest.keyLabel.empty() and (aStatus == CKR_KEY_HANDLE_INVALID or aStatus == CKR_OBJECT_HANDLE_INVALID)) {
+    // the cached handle went stale, look the key up again
+    mPool.forgetKey(iRequest.keyLabel);
+    aValue = aRun(aLease.value());
+  } else if (not aValue and SessionPool::isSessionLost(aStatus)) {
+    // sessions lost (HSM restart, network blip): recover the pool and retry once within the deadline, the key
+    // handle resolved again on the new sessions
+    auto aGeneration = aLease->generation();
+    aLease.reset();
+    if (mPool.recover(aGeneration)) {
+      aLease = mPool.acquireForExecuteUntil(iRequest.deadline);
+      if (aLease and Clock::now() < iRequest.deadline) {
+        aValue = aRun(aLease.value());
+      }
+    }
+  }
+  if (aPermit) {
+    aPermit->record(aValue.has_value());
+  }
+  if (aValue) {
+    aCounters.completed.fetch_add(1u, std::memory_order_relaxed);
+    complete(*iRequest.promise, HSMStatus::Ok, std::move(aValue));
+  }
+  else {
+    aCounters.failed.fetch_add(1u, std::memory_order_relaxed);
+    complete(*iRequest.promise, HSMStatus::Failed);
+  }
+}
+
+std::optional<std::vector<unsigned char>> RequestScheduler::run(const Request& iRequest, const SessionLease& iLease) {
+  if (not iRequest.keyOperation) {
+    return iRequest.operation(iLease);
+  }
+  auto aKey = mPool.findKey(iRequest.keyLabel, iLease);
+  if (not aKey) {
+    return {};
+  }
+  return iRequest.keyOperation(iLease, aKey.value());
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "hsm/ConcurrencyLimiter.h"
+#include "hsm/HSMResult.h"
+#include "hsm/SessionPool.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * Priority classes served by the RequestScheduler, lower value is served first
+ */
+enum class PriorityClass : std::size_t {
+  Interactive = 0,
+  Normal,
+  Batch,
+};
+
+constexpr const std::size_t K_PRIORITY_CLASS_COUNT = 3u;
+
+/**
+ * Queues HSM requests in front of a SessionPool.
+ * Requests are served by strict priority class and, within a class, earliest deadline first.
+ * Requests whose deadline has passed are dropped before any PKCS#11 call is made and complete
+ * with HSMStatus::DeadlineExceeded. A request finding the pool broken by a recovery that gave up tries to
+ * recover it again and completes with HSMStatus::Unavailable if that fails too.
+ */
+class RequestScheduler {
+ public:
+  using Clock     = std::chrono::steady_clock;
+  using Operation    = SessionPool::Operation;
+  using KeyOperation = SessionPool::KeyOperation;
+
+  /**
+   * Snapshot of the counters of one priority class
+   */
+  struct ClassMetrics {
+    std::uint64_t submitted = 0u;
+    std::uint64_t completed = 0u;
+    std::uint64_t failed    = 0u;
+    std::uint64_t dropped   = 0u;
+    std::size_t queueDepth  = 0u;
+    std::size_t maxQueueDepth = 0u;
+  };
+
+  /**
+   * @param iPool - the pool providing the sessions, must outlive the scheduler
+   * @param iWorkers - number of threads draining the queues
+   * @param iLimiter - optional adaptive bound on the in-flight operations, must outlive the scheduler.
+   *  With a limiter iWorkers is the ceiling and the limiter decides how many of them actually reach the HSM.
+   */
+  RequestScheduler(SessionPool& iPool, std::size_t iWorkers, ConcurrencyLimiter* iLimiter = nullptr);
+  ~RequestScheduler();
+
+  RequestScheduler(const RequestScheduler&) = delete;
+  RequestScheduler& operator=(const RequestScheduler&) = delete;
+
+  /**
+   * @param iClass - priority class of the request
+   * @param iDeadline - point in time after which the result is useless to the caller
+   * @param iOperation - operation executed with a leased session. It is run again on the recovered sessions when
+   *  the first ones were lost, so it should not capture object handles (see the key label overload)
+   * @return future completed with the outcome of the operation
+   */
+  std::future<HSMResult> submit(PriorityClass iClass, Clock::time_point iDeadline, Operation iOperation);
+
+  /**
+   * Same as submit, the operation receives the handle of iKeyLabel resolved through the pool on every attempt,
+   * so that a retry after a recovery or a stale cached handle uses the current one
+   */
+  std::future<HSMResult> submit(PriorityClass iClass, Clock::time_point iDeadline, std::string iKeyLabel, KeyOperation iOperation);
+
+  std::future<HSMResult> encrypt_aes(PriorityClass iClass, Clock::time_point iDeadline, std::string iKeyLabel, std::vector<unsigned char> iPlainText);
+
+  std::future<HSMResult> decrypt_aes(PriorityClass iClass, Clock::time_point iDeadline, std::string iKeyLabel, std::vector<unsigned char> iCipherText);
+
+  /**
+   * Stops the workers; requests still queued complete with HSMStatus::Cancelled
+   */
+  void stop();
+
+  std::array<ClassMetrics, K_PRIORITY_CLASS_COUNT> metrics() const;
+
+ private:
+  struct Request {
+    Clock::time_point deadline;
+    std::uint64_t sequence;
+    Operation operation;
+    std::shared_ptr<std::promise<HSMResult>> promise;
+    // set instead of operation for the requests on a key
+    std::string keyLabel;
+    KeyOperation keyOperation;
+  };
+
+  // min-heap on deadline, FIFO among equal deadlines
+  struct LaterDeadline {
+    bool operator()(const Request& iLeft, const Request& iRight) const {
+      if (iLeft.deadline != iRight.deadline) {
+        return iLeft.deadline > iRight.deadline;
+      }
+      return iLeft.sequence > iRight.sequence;
+    }
+  };
+
+  struct ClassCounters {
+    std::atomic<std::uint64_t> submitted{ 0u };
+    std::atomic<std::uint64_t> completed{ 0u };
+    std::atomic<std::uint64_t> failed{ 0u };
+    std::atomic<std::uint64_t> dropped{ 0u };
+    std::size_t maxQueueDepth = 0u;  // guarded by mMutex
+  };
+
+  using Queue = std::priority_queue<Request, std::vector<Request>, LaterDeadline>;
+
+  void workerLoop();
+  void dropExpiredLocked(Clock::time_point iNow);
+  void execute(std::size_t iClass, Request& iRequest);
+  std::future<HSMResult> enqueue(PriorityClass iClass, Request iRequest);
+  std::optional<std::vector<unsigned char>> run(const Request& iRequest, const SessionLease& iLease);
+
+  SessionPool& mPool;
+  ConcurrencyLimiter* mLimiter;
+  mutable std::mutex mMutex;
+  std::condition_variable mQueueCv;
+  std::array<Queue, K_PRIORITY_CLASS_COUNT> mQueues;
+  std::array<ClassCounters, K_PRIORITY_CLASS_COUNT> mCounters;
+  std::uint64_t mSequence = 0u;
+  bool mStopped = false;
+  std::vector<std::thread> mWorkers;
+};
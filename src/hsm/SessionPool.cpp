@@ -0,0 +1,743 @@
+#include "hsm/SessionPool.h"
+#include "hsm/CallObserver.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/ObjectReaper.h"
+#include "hsm/Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// runs iTask(0..iCount-1) on up to iParallelism threads
+void parallelFor(std::size_t iCount, std::size_t iParallelism, const std::function<void(std::size_t)>& iTask) {
+  std::atomic<std::size_t> aNext{ 0u };
+  auto aWorker = [&aNext, iCount, &iTask] {
+    for (auto i = aNext.fetch_add(1u); i < iCount; i = aNext.fetch_add(1u)) {
+      iTask(i);
+    }
+  };
+  std::vector<std::thread> aThreads;
+  auto aThreadCount = std::min(iCount, std::max<std::size_t>(iParallelism, 1u));
+  for (std::size_t i = 1; i < aThreadCount; ++i) {
+    aThreads.emplace_back(aWorker);
+  }
+  aWorker();
+  for (auto& aThread : aThreads) {
+    aThread.join();
+  }
+}
+
+}  // namespace
+
+SessionLease::SessionLease(SessionPool* iPool, CK_SESSION_HANDLE iSession, SessionAccess iAccess, std::uint64_t iGeneration)
+    : mPool(iPool), mSession(iSession), mAccess(iAccess), mGeneration(iGeneration) {}
+
+SessionLease::SessionLease(SessionLease&& iOther) noexcept
+    : mPool(iOther.mPool), mSession(iOther.mSession), mAccess(iOther.mAccess), mGeneration(iOther.mGeneration),
+      mEphemeral(std::move(iOther.mEphemeral)) {
+  iOther.mPool = nullptr;
+}
+
+SessionLease& SessionLease::operator=(SessionLease&& iOther) noexcept {
+  if (this != &iOther) {
+    release();
+    mPool        = iOther.mPool;
+    mSession     = iOther.mSession;
+    mAccess      = iOther.mAccess;
+    mGeneration  = iOther.mGeneration;
+    mEphemeral   = std::move(iOther.mEphemeral);
+    iOther.mPool = nullptr;
+  }
+  return *this;
+}
+
+SessionLease::~SessionLease() {
+  release();
+}
+
+CK_FUNCTION_LIST_PTR SessionLease::libInterface() const {
+  return mPool ? mPool->libInterface() : nullptr;
+}
+
+void SessionLease::adopt(CK_OBJECT_HANDLE iObject) const {
+  mEphemeral.push_back(iObject);
+}
+
+std::optional<CK_OBJECT_HANDLE> SessionLease::generateEphemeralKey(const std::string& iKeyLabel) const {
+  auto aKey = HSMUtils::generateKey(libInterface(), mSession, iKeyLabel, false);
+  if (aKey) {
+    adopt(aKey.value());
+  }
+  return aKey;
+}
+
+void SessionLease::release() {
+  if (mPool) {
+    mPool->release(mSession, mAccess, mGeneration, std::move(mEphemeral));
+    mEphemeral.clear();
+    mPool = nullptr;
+  }
+}
+
+SessionPool::SessionPool(CK_FUNCTION_LIST_PTR iLibInterface, std::string iSlotLabel, std::string iSlotPwd)
+    : mLibInterface(iLibInterface), mSlotLabel(std::move(iSlotLabel)), mSlotPwd(std::move(iSlotPwd)) {}
+
+SessionPool::~SessionPool() {
+  // a reaper outliving the pool: stop its thread and destroy what it still holds while the sessions are there
+  ObjectReaper* aReaper;
+  {
+    std::lock_guard<std::mutex> aLock(mReaperMutex);
+    aReaper = mReaper;
+  }
+  if (aReaper) {
+    aReaper->detach();
+  }
+  close();
+}
+
+bool SessionPool::open(std::size_t iSize, std::size_t iReadWrite) {
+  CK_TOKEN_INFO aTokenInfo;
+  auto aSlotId = HSMUtils::findSlot(mLibInterface, mSlotLabel, &aTokenInfo);
+  if (not aSlotId) {
+    return false;
+  }
+
+  std::size_t aReadWrite = std::min(iSize, iReadWrite);
+  if (aTokenInfo.ulMaxRwSessionCount != CK_EFFECTIVELY_INFINITE
+      and aTokenInfo.ulMaxRwSessionCount != CK_UNAVAILABLE_INFORMATION) {
+    CK_ULONG aRwInUse = (aTokenInfo.ulRwSessionCount == CK_UNAVAILABLE_INFORMATION) ? 0u : aTokenInfo.ulRwSessionCount;
+    std::size_t aRwLeft = (aTokenInfo.ulMaxRwSessionCount > aRwInUse) ? aTokenInfo.ulMaxRwSessionCount - aRwInUse : 0u;
+    if (aRwLeft < aReadWrite) {
+      std::ostringstream descr;
+      descr << "Token " << mSlotLabel << " allows " << aRwLeft << " more read-write sessions, opening "
+            << (iSize - aRwLeft) << " read-only sessions instead";
+      TRC_WARN(255, descr.str());
+      aReadWrite = aRwLeft;
+    }
+  }
+
+  std::size_t aParallelism;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    aParallelism = mRecoveryPolicy.parallelism;
+  }
+  auto aSessions = openSessions(aSlotId.value(), iSize, aReadWrite, aParallelism);
+  if (not aSessions) {
+    std::ostringstream descr;
+    descr << "Could not open session pool of " << iSize << " sessions on slot " << mSlotLabel;
+    TRC_ERROR(255, descr.str());
+    return false;
+  }
+
+  std::lock_guard<std::mutex> aLock(mMutex);
+  mSlotId        = aSlotId.value();
+  installLocked(aSessions.value(), aReadWrite);
+  mTargetSize    = iSize;
+  mReadWriteSize = aReadWrite;
+  mOpen   = true;
+  mBroken = false;
+  ++mGeneration;
+  return true;
+}
+
+std::optional<std::vector<CK_SESSION_HANDLE>> SessionPool::openSessions(CK_SLOT_ID iSlotId,
+                                                                        std::size_t iSize,
+                                                                        std::size_t iReadWrite,
+                                                                        std::size_t iParallelism) {
+  std::vector<CK_SESSION_HANDLE> aSessions(iSize, CK_INVALID_HANDLE);
+  std::atomic<bool> aOk{ true };
+  parallelFor(iSize, iParallelism, [&](std::size_t i) {
+    auto aAccess  = (i < iReadWrite) ? SessionAccess::ReadWrite : SessionAccess::ReadOnly;
+    auto aSession = HSMUtils::openSession(mLibInterface, iSlotId, aAccess);
+    if (aSession) {
+      aSessions[i] = aSession.value();
+    }
+    else {
+      aOk = false;
+    }
+  });
+
+  // login state is shared by all the sessions of the application on a token, one login is enough; none when
+  // another session of the application is already logged in
+  CK_SESSION_INFO aInfo;
+  bool aLoggedIn = aOk and iSize > 0
+                   and observedCall(mLibInterface, "C_GetSessionInfo", aSessions.front(), mLibInterface->C_GetSessionInfo, aSessions.front(), &aInfo) == CKR_OK
+                   and (aInfo.state == CKS_RO_USER_FUNCTIONS or aInfo.state == CKS_RW_USER_FUNCTIONS);
+  if (aOk and iSize > 0 and not aLoggedIn and not HSMUtils::login(mLibInterface, aSessions.front(), mSlotPwd)
+      and HSMUtils::lastError() != CKR_USER_ALREADY_LOGGED_IN) {
+    aOk = false;
+  }
+
+  if (not aOk) {
+    // plain C_CloseSession: a C_Logout would log out every other session of the application on the token
+    for (auto aSession : aSessions) {
+      if (aSession != CK_INVALID_HANDLE) {
+        observedCall(mLibInterface, "C_CloseSession", aSession, mLibInterface->C_CloseSession, aSession);
+      }
+    }
+    return {};
+  }
+  return aSessions;
+}
+
+void SessionPool::close(bool iLogout) {
+  std::vector<CK_SESSION_HANDLE> aSessions;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    if (not mOpen) {
+      return;
+    }
+    mOpen = false;
+    aSessions.swap(mSessions);
+    mReadWriteSessions.clear();
+    mQuarantined.clear();
+    mIdleReadOnly.clear();
+    mIdleReadWrite.clear();
+    mReadWriteSize = 0u;
+  }
+  {
+    std::lock_guard<std::mutex> aLock(mKeyMutex);
+    mKeyHandles.clear();
+  }
+  mAvailableCv.notify_all();
+  if (iLogout and not aSessions.empty()) {
+    auto aStatus = observedCall(mLibInterface, "C_Logout", aSessions.front(), mLibInterface->C_Logout, aSessions.front());
+    if (aStatus != CKR_OK and aStatus != CKR_USER_NOT_LOGGED_IN) {
+      std::ostringstream descr;
+      descr << "Error while calling C_Logout: 0x" << std::hex << aStatus;
+      TRC_WARN(255, descr.str());
+    }
+  }
+  // plain C_CloseSession: HSMUtils::closeSession logs out each session, i.e. the whole application
+  for (auto aSession : aSessions) {
+    observedCall(mLibInterface, "C_CloseSession", aSession, mLibInterface->C_CloseSession, aSession);
+  }
+}
+
+std::optional<SessionLease> SessionPool::acquire(SessionAccess iAccess) {
+  std::unique_lock<std::mutex> aLock(mMutex);
+  mAvailableCv.wait(aLock, [this, iAccess] { return readyLocked(iAccess); });
+  if (not mOpen or mBroken) {
+    return {};
+  }
+  return takeIdleLocked(iAccess);
+}
+
+std::optional<SessionLease> SessionPool::acquireUntil(Clock::time_point iDeadline, SessionAccess iAccess) {
+  std::unique_lock<std::mutex> aLock(mMutex);
+  if (not mAvailableCv.wait_until(aLock, iDeadline, [this, iAccess] { return readyLocked(iAccess); })) {
+    return {};
+  }
+  if (not mOpen or mBroken) {
+    return {};
+  }
+  return takeIdleLocked(iAccess);
+}
+
+std::optional<SessionLease> SessionPool::tryAcquire(SessionAccess iAccess) {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  if (not mOpen or mBroken or not readyLocked(iAccess)) {
+    return {};
+  }
+  return takeIdleLocked(iAccess);
+}
+
+bool SessionPool::readyLocked(SessionAccess iAccess) const {
+  return not mOpen or mBroken or not mIdleReadWrite.empty() or (iAccess == SessionAccess::ReadOnly and not mIdleReadOnly.empty());
+}
+
+SessionLease SessionPool::takeIdleLocked(SessionAccess iAccess) {
+  // read-only callers drain the read-only sessions first to keep the read-write ones for writers
+  auto& aIdle = (iAccess == SessionAccess::ReadOnly and not mIdleReadOnly.empty()) ? mIdleReadOnly : mIdleReadWrite;
+  auto aSessionAccess = (&aIdle == &mIdleReadWrite) ? SessionAccess::ReadWrite : SessionAccess::ReadOnly;
+  auto aSession       = aIdle.back();
+  aIdle.pop_back();
+  return SessionLease(this, aSession, aSessionAccess, mGeneration);
+}
+
+std::optional<SessionLease> SessionPool::acquireForExecute(SessionAccess iAccess) {
+  auto aLease = acquire(iAccess);
+  if (aLease) {
+    return aLease;
+  }
+  // a previous recovery gave up, try again on behalf of this caller
+  std::uint64_t aGeneration;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    if (not mOpen or not mBroken) {
+      return {};
+    }
+    aGeneration = mGeneration;
+  }
+  if (not recover(aGeneration)) {
+    return {};
+  }
+  return acquire(iAccess);
+}
+
+std::optional<SessionLease> SessionPool::acquireForExecuteUntil(Clock::time_point iDeadline, SessionAccess iAccess, CK_RV* oStatus) {
+  auto aLease   = acquireUntil(iDeadline, iAccess);
+  CK_RV aStatus = K_NO_SESSION;
+  if (not aLease) {
+    std::optional<std::uint64_t> aBrokenGeneration;
+    {
+      std::lock_guard<std::mutex> aLock(mMutex);
+      if (not mOpen) {
+        aStatus = CKR_SESSION_CLOSED;
+      } else if (mBroken) {
+        aBrokenGeneration = mGeneration;
+      }
+    }
+    // a previous recovery gave up, try again on behalf of this caller
+    if (aBrokenGeneration) {
+      if (recover(aBrokenGeneration.value())) {
+        aLease = acquireUntil(iDeadline, iAccess);
+      } else {
+        aStatus = CKR_DEVICE_ERROR;
+      }
+    }
+  }
+  if (oStatus) {
+    *oStatus = aLease ? CKR_OK : aStatus;
+  }
+  return aLease;
+}
+
+std::optional<std::vector<unsigned char>> SessionPool::execute(const Operation& iOperation, SessionAccess iAccess, CK_RV* oStatus) {
+  CK_RV aStatus = K_NO_SESSION;
+  std::optional<std::vector<unsigned char>> aValue;
+  for (std::size_t aAttempt = 0;; ++aAttempt) {
+    auto aLease = acquireForExecute(iAccess);
+    if (not aLease) {
+      break;
+    }
+    // the thread's last error may be left over from an earlier call
+    HSMUtils::clearLastError();
+    aValue  = iOperation(aLease.value());
+    aStatus = aValue ? CKR_OK : HSMUtils::lastError();
+    if (aStatus == CKR_OK and not aValue) {
+      aStatus = CKR_FUNCTION_REJECTED;
+    }
+    if (aValue or aAttempt > 0 or not isSessionLost(aStatus)) {
+      break;
+    }
+    auto aGeneration = aLease->generation();
+    aLease.reset();
+    if (not recover(aGeneration)) {
+      break;
+    }
+  }
+  if (oStatus) {
+    *oStatus = aStatus;
+  }
+  return aValue;
+}
+
+std::optional<std::vector<unsigned char>> SessionPool::execute(const std::string& iKeyLabel,
+                                                               const KeyOperation& iOperation,
+                                                               SessionAccess iAccess,
+                                                               CK_RV* oStatus) {
+  CK_RV aStatus = K_NO_SESSION;
+  std::optional<std::vector<unsigned char>> aValue;
+  for (std::size_t aAttempt = 0;; ++aAttempt) {
+    auto aLease = acquireForExecute(iAccess);
+    if (not aLease) {
+      break;
+    }
+    HSMUtils::clearLastError();
+    auto aKeyHandle = findKey(iKeyLabel, aLease.value());
+    if (aKeyHandle) {
+      aValue  = iOperation(aLease.value(), aKeyHandle.value());
+      aStatus = aValue ? CKR_OK : HSMUtils::lastError();
+      if (aStatus == CKR_OK and not aValue) {
+        aStatus = CKR_FUNCTION_REJECTED;
+      }
+    }
+    else {
+      // not on the token, unless the lookup itself failed
+      aStatus = HSMUtils::lastError() != CKR_OK ? HSMUtils::lastError() : K_KEY_NOT_FOUND;
+    }
+    if (aValue or aAttempt > 0) {
+      break;
+    }
+    if (aKeyHandle and (aStatus == CKR_KEY_HANDLE_INVALID or aStatus == CKR_OBJECT_HANDLE_INVALID)) {
+      forgetKey(iKeyLabel);
+      continue;
+    }
+    if (not isSessionLost(aStatus)) {
+      break;
+    }
+    auto aGeneration = aLease->generation();
+    aLease.reset();
+    if (not recover(aGeneration)) {
+      break;
+    }
+  }
+  if (oStatus) {
+    *oStatus = aStatus;
+  }
+  return aValue;
+}
+
+bool SessionPool::recover(std::uint64_t iFailedGeneration) {
+  std::lock_guard<std::mutex> aRecoverLock(mRecoverMutex);
+
+  std::size_t aSize;
+  std::size_t aReadWrite;
+  std::vector<CK_SESSION_HANDLE> aOldSessions;
+  RecoveryPolicy aPolicy;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    if (not mOpen) {
+      return false;
+    }
+    if (mGeneration != iFailedGeneration) {
+      // somebody else already replaced the sessions the failure was seen on
+      return not mBroken;
+    }
+    // leases of the failed generation are dropped on release instead of going back to the idle lists
+    ++mGeneration;
+    ++mRecoveries;
+    aSize      = mTargetSize;
+    aReadWrite = mReadWriteSize;
+    aPolicy    = mRecoveryPolicy;
+    aOldSessions.swap(mSessions);
+    aOldSessions.insert(aOldSessions.end(), mQuarantined.begin(), mQuarantined.end());
+    mReadWriteSessions.clear();
+    mQuarantined.clear();
+    mIdleReadOnly.clear();
+    mIdleReadWrite.clear();
+  }
+
+  std::ostringstream descr;
+  descr << "Sessions on slot " << mSlotLabel << " lost, reopening " << aSize << " sessions";
+  TRC_WARN(255, descr.str());
+
+  // whatever is left of the old sessions; fails harmlessly if the token already dropped them. Only this pool's
+  // own: C_CloseAllSessions would also close the sessions other pools and callers of the application hold
+  for (auto aSession : aOldSessions) {
+    observedCall(mLibInterface, "C_CloseSession", aSession, mLibInterface->C_CloseSession, aSession);
+  }
+
+  std::optional<std::vector<CK_SESSION_HANDLE>> aSessions;
+  std::optional<CK_SLOT_ID> aSlotId;
+  auto aBackoff = aPolicy.initialBackoff;
+  for (std::size_t aAttempt = 0; aAttempt < aPolicy.attempts; ++aAttempt) {
+    if (aAttempt > 0) {
+      std::this_thread::sleep_for(aBackoff);
+      aBackoff = std::min(aBackoff * 2, aPolicy.maxBackoff);
+    }
+    // the slot id may change when the token comes back
+    aSlotId = HSMUtils::findSlot(mLibInterface, mSlotLabel);
+    if (aSlotId) {
+      aSessions = openSessions(aSlotId.value(), aSize, aReadWrite, aPolicy.parallelism);
+      if (aSessions) {
+        break;
+      }
+    }
+  }
+
+  if (not aSessions) {
+    std::ostringstream aErrorMsg;
+    aErrorMsg << "Could not recover sessions on slot " << mSlotLabel << " after " << aPolicy.attempts << " attempts";
+    TRC_ERROR(255, aErrorMsg.str());
+    {
+      std::lock_guard<std::mutex> aLock(mMutex);
+      mBroken = true;
+    }
+    mAvailableCv.notify_all();
+    return false;
+  }
+
+  // refresh the cached key handles, object handles are not guaranteed to survive a token restart
+  std::vector<std::string> aLabels;
+  {
+    std::lock_guard<std::mutex> aLock(mKeyMutex);
+    for (const auto& aEntry : mKeyHandles) {
+      aLabels.push_back(aEntry.first);
+    }
+    mKeyHandles.clear();
+  }
+  std::vector<std::optional<CK_OBJECT_HANDLE>> aHandles(aLabels.size());
+  const auto& aNewSessions = aSessions.value();
+  auto aThreads            = std::min(aPolicy.parallelism, aNewSessions.size());
+  parallelFor(aThreads, aThreads, [&](std::size_t t) {
+    // one session per thread: thread t resolves the labels t, t + aThreads, ...
+    for (std::size_t i = t; i < aLabels.size(); i += aThreads) {
+      aHandles[i] = HSMUtils::retrieveKeyHandle(mLibInterface, aNewSessions[t], aLabels[i]);
+    }
+  });
+  {
+    std::lock_guard<std::mutex> aLock(mKeyMutex);
+    for (std::size_t i = 0; i < aLabels.size(); ++i) {
+      if (aHandles[i]) {
+        mKeyHandles.emplace(aLabels[i], aHandles[i].value());
+      }
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    mSlotId   = aSlotId.value();
+    installLocked(aNewSessions, aReadWrite);
+    mBroken = false;
+  }
+  mAvailableCv.notify_all();
+  return true;
+}
+
+bool SessionPool::isSessionLost(CK_RV iStatus) {
+  switch (iStatus) {
+    case CKR_SESSION_HANDLE_INVALID:
+    case CKR_SESSION_CLOSED:
+    case CKR_DEVICE_REMOVED:
+    case CKR_TOKEN_NOT_PRESENT:
+    case CKR_TOKEN_NOT_RECOGNIZED:
+    case CKR_USER_NOT_LOGGED_IN:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void SessionPool::setRecoveryPolicy(const RecoveryPolicy& iPolicy) {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  mRecoveryPolicy = iPolicy;
+}
+
+std::uint64_t SessionPool::generation() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mGeneration;
+}
+
+std::uint64_t SessionPool::recoveries() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mRecoveries;
+}
+
+std::optional<CK_OBJECT_HANDLE> SessionPool::findKey(const std::string& iKeyLabel) {
+  {
+    std::lock_guard<std::mutex> aLock(mKeyMutex);
+    auto aIt = mKeyHandles.find(iKeyLabel);
+    if (aIt != mKeyHandles.end()) {
+      return { aIt->second };
+    }
+  }
+
+  auto aLease = acquire();
+  if (not aLease) {
+    return {};
+  }
+  return findKey(iKeyLabel, aLease.value());
+}
+
+void SessionPool::forgetKey(const std::string& iKeyLabel) {
+  std::lock_guard<std::mutex> aLock(mKeyMutex);
+  mKeyHandles.erase(iKeyLabel);
+}
+
+void SessionPool::cacheKeyHandles(const std::vector<std::pair<std::string, CK_OBJECT_HANDLE>>& iHandles) {
+  std::lock_guard<std::mutex> aLock(mKeyMutex);
+  mKeyHandles.reserve(mKeyHandles.size() + iHandles.size());
+  for (const auto& aHandle : iHandles) {
+    mKeyHandles.emplace(aHandle.first, aHandle.second);
+  }
+}
+
+std::optional<CK_OBJECT_HANDLE> SessionPool::getOrCreateKey(const std::string& iKeyLabel) {
+  std::promise<std::optional<CK_OBJECT_HANDLE>> aPromise;
+  std::shared_future<std::optional<CK_OBJECT_HANDLE>> aFlight;
+  bool aLeader = false;
+  {
+    std::lock_guard<std::mutex> aLock(mKeyMutex);
+    auto aIt = mKeyHandles.find(iKeyLabel);
+    if (aIt != mKeyHandles.end()) {
+      return { aIt->second };
+    }
+    auto aFlightIt = mKeyFlights.find(iKeyLabel);
+    if (aFlightIt != mKeyFlights.end()) {
+      aFlight = aFlightIt->second;
+    } else {
+      aFlight = aPromise.get_future().share();
+      mKeyFlights.emplace(iKeyLabel, aFlight);
+      aLeader = true;
+    }
+  }
+  if (not aLeader) {
+    return aFlight.get();
+  }
+
+  // the flight is settled and removed however the leader leaves, an exception gives the followers no key
+  struct FlightGuard {
+    SessionPool& pool;
+    const std::string& label;
+    std::promise<std::optional<CK_OBJECT_HANDLE>>& promise;
+    std::optional<CK_OBJECT_HANDLE> handle;
+    ~FlightGuard() {
+      {
+        std::lock_guard<std::mutex> aLock(pool.mKeyMutex);
+        if (handle) {
+          pool.mKeyHandles.emplace(label, handle.value());
+        }
+        pool.mKeyFlights.erase(label);
+      }
+      promise.set_value(handle);
+    }
+  } aGuard{ *this, iKeyLabel, aPromise, std::nullopt };
+
+  if (auto aLease = acquireForExecute(SessionAccess::ReadWrite)) {
+    aGuard.handle = HSMUtils::getOrCreateKey(mLibInterface, aLease->session(), iKeyLabel);
+  }
+  return aGuard.handle;
+}
+
+std::optional<CK_OBJECT_HANDLE> SessionPool::findKey(const std::string& iKeyLabel, const SessionLease& iLease) {
+  {
+    std::lock_guard<std::mutex> aLock(mKeyMutex);
+    auto aIt = mKeyHandles.find(iKeyLabel);
+    if (aIt != mKeyHandles.end()) {
+      return { aIt->second };
+    }
+  }
+
+  auto aHandle = HSMUtils::retrieveKeyHandle(mLibInterface, iLease.session(), iKeyLabel);
+  if (aHandle) {
+    std::lock_guard<std::mutex> aLock(mKeyMutex);
+    mKeyHandles.emplace(iKeyLabel, aHandle.value());
+  }
+  return aHandle;
+}
+
+std::size_t SessionPool::size() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mSessions.size();
+}
+
+std::size_t SessionPool::readWriteSize() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mReadWriteSize;
+}
+
+std::size_t SessionPool::available() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mIdleReadOnly.size() + mIdleReadWrite.size();
+}
+
+bool SessionPool::quarantine(CK_SESSION_HANDLE iSession) {
+  SessionAccess aAccess;
+  CK_SLOT_ID aSlotId;
+  std::uint64_t aGeneration;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    auto aIt = std::find(mSessions.begin(), mSessions.end(), iSession);
+    if (not mOpen or aIt == mSessions.end()) {
+      return false;
+    }
+    mSessions.erase(aIt);
+    aAccess = mReadWriteSessions.erase(iSession) ? SessionAccess::ReadWrite : SessionAccess::ReadOnly;
+    for (auto* aIdle : { &mIdleReadOnly, &mIdleReadWrite }) {
+      aIdle->erase(std::remove(aIdle->begin(), aIdle->end(), iSession), aIdle->end());
+    }
+    mQuarantined.insert(iSession);
+    ++mQuarantinedCount;
+    aSlotId     = mSlotId;
+    aGeneration = mGeneration;
+  }
+
+  std::ostringstream descr;
+  descr << "Session " << iSession << " on slot " << mSlotLabel << " quarantined, opening a replacement";
+  TRC_WARN(255, descr.str());
+
+  // the application is already logged in on the token, the new session inherits the login state
+  auto aReplacement = HSMUtils::openSession(mLibInterface, aSlotId, aAccess);
+  if (not aReplacement) {
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    if (mOpen and mGeneration == aGeneration) {
+      mSessions.push_back(aReplacement.value());
+      if (aAccess == SessionAccess::ReadWrite) {
+        mReadWriteSessions.insert(aReplacement.value());
+      }
+      (aAccess == SessionAccess::ReadWrite ? mIdleReadWrite : mIdleReadOnly).push_back(aReplacement.value());
+      aReplacement.reset();
+    }
+  }
+  if (aReplacement) {
+    // the pool was closed or recovered in the meantime
+    observedCall(mLibInterface, "C_CloseSession", aReplacement.value(), mLibInterface->C_CloseSession, aReplacement.value());
+    return true;
+  }
+  mAvailableCv.notify_all();
+  return true;
+}
+
+std::size_t SessionPool::quarantined() const {
+  std::lock_guard<std::mutex> aLock(mMutex);
+  return mQuarantinedCount;
+}
+
+void SessionPool::installLocked(const std::vector<CK_SESSION_HANDLE>& iSessions, std::size_t iReadWrite) {
+  mSessions = iSessions;
+  mReadWriteSessions.clear();
+  mReadWriteSessions.insert(iSessions.begin(), iSessions.begin() + iReadWrite);
+  mQuarantined.clear();
+  mIdleReadWrite.assign(iSessions.begin(), iSessions.begin() + iReadWrite);
+  mIdleReadOnly.assign(iSessions.begin() + iReadWrite, iSessions.end());
+}
+
+void SessionPool::destroyEphemeral(CK_SESSION_HANDLE iSession, std::uint64_t iGeneration, std::vector<CK_OBJECT_HANDLE> iObjects) {
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    // a closed session took its session objects along (a quarantined one is about to be closed)
+    if (not mOpen or iGeneration != mGeneration or mQuarantined.count(iSession) > 0u) {
+      return;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> aLock(mReaperMutex);
+    if (mReaper) {
+      mReaper->enqueue(std::move(iObjects), iGeneration);
+      return;
+    }
+  }
+  // direct calls, HSMUtils would reset the caller's lastError() from a lease destructor
+  for (auto aObject : iObjects) {
+    observedCall(mLibInterface, "C_DestroyObject", iSession, mLibInterface->C_DestroyObject, iSession, aObject);
+  }
+}
+
+void SessionPool::setReaper(ObjectReaper* iReaper) {
+  std::lock_guard<std::mutex> aLock(mReaperMutex);
+  mReaper = iReaper;
+}
+
+void SessionPool::release(CK_SESSION_HANDLE iSession, SessionAccess iAccess, std::uint64_t iGeneration, std::vector<CK_OBJECT_HANDLE> iObjects) {
+  if (not iObjects.empty()) {
+    destroyEphemeral(iSession, iGeneration, std::move(iObjects));
+  }
+
+  bool aQuarantined;
+  {
+    std::lock_guard<std::mutex> aLock(mMutex);
+    if (not mOpen or iGeneration != mGeneration) {
+      return;
+    }
+    aQuarantined = mQuarantined.erase(iSession) > 0u;
+    if (not aQuarantined) {
+      (iAccess == SessionAccess::ReadWrite ? mIdleReadWrite : mIdleReadOnly).push_back(iSession);
+    }
+  }
+  if (aQuarantined) {
+    // the stuck call finally returned and the session was already replaced, get rid of it
+    // (plain C_CloseSession, a C_Logout would log out every session of the application)
+    observedCall(mLibInterface, "C_CloseSession", iSession, mLibInterface->C_CloseSession, iSession);
+    return;
+  }
+  // waiters may be restricted to read-write sessions, wake them all to let the eligible one proceed
+  mAvailableCv.notify_all();
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "hsm/HSMUtils.h"
+#include "hsm/cryptoki.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+class ObjectReaper;
+class SessionPool;
+
+/**
+ * RAII handle over a session borrowed from a SessionPool.
+ * The session goes back to the pool when the lease is destroyed.
+ */
+class SessionLease {
+ public:
+  SessionLease(SessionPool* iPool, CK_SESSION_HANDLE iSession, SessionAccess iAccess, std::uint64_t iGeneration);
+  SessionLease(SessionLease&& iOther) noexcept;
+  SessionLease& operator=(SessionLease&& iOther) noexcept;
+  SessionLease(const SessionLease&) = delete;
+  SessionLease& operator=(const SessionLease&) = delete;
+  ~SessionLease();
+
+  CK_SESSION_HANDLE session() const { return mSession; }
+  SessionAccess access() const { return mAccess; }
+  // generation of the pool sessions the session belongs to, see SessionPool::recover
+  std::uint64_t generation() const { return mGeneration; }
+  CK_FUNCTION_LIST_PTR libInterface() const;
+  SessionPool* pool() const { return mPool; }
+
+  /**
+   * Destroys iObject when the lease ends
+   * @param iObject - a session object created on this lease's session
+   */
+  void adopt(CK_OBJECT_HANDLE iObject) const;
+
+  /**
+   * @param iKeyLabel - label (and id) of the key
+   * @return an AES session key (CKA_TOKEN = false) destroyed when the lease ends, empty optional on error
+   */
+  std::optional<CK_OBJECT_HANDLE> generateEphemeralKey(const std::string& iKeyLabel) const;
+
+ private:
+  void release();
+
+  SessionPool* mPool;
+  CK_SESSION_HANDLE mSession;
+  SessionAccess mAccess;
+  std::uint64_t mGeneration;
+  // session objects to destroy on release; operations only see a const lease
+  mutable std::vector<CK_OBJECT_HANDLE> mEphemeral;
+};
+
+/**
+ * Fixed set of logged in sessions on one slot, shared by worker threads.
+ * Sessions are handed out as SessionLease objects and returned to the pool on lease destruction.
+ *
+ * The pool can mix read-write and read-only sessions: callers that only decrypt, verify or find objects
+ * ask for SessionAccess::ReadOnly and are served from the read-only sessions first, so that the usually
+ * scarce read-write sessions stay available for the callers creating objects.
+ *
+ * When the HSM restarts or the link drops, every session fails with CKR_SESSION_HANDLE_INVALID,
+ * CKR_DEVICE_REMOVED and alike. execute() detects those return values and calls recover(), which replaces
+ * the whole generation of sessions at once (opened in parallel), logs in again, refreshes the cached key
+ * handles and lets the failed operation be retried once.
+ */
+class SessionPool {
+ public:
+  using Clock        = std::chrono::steady_clock;
+  using Operation    = std::function<std::optional<std::vector<unsigned char>>(const SessionLease&)>;
+  using KeyOperation = std::function<std::optional<std::vector<unsigned char>>(const SessionLease&, CK_OBJECT_HANDLE)>;
+
+  /**
+   * Backoff between attempts to reopen the sessions while the HSM is unreachable
+   */
+  struct RecoveryPolicy {
+    std::size_t attempts = 5u;
+    std::chrono::milliseconds initialBackoff{ 100 };
+    std::chrono::milliseconds maxBackoff{ 2000 };
+    // number of threads opening sessions and resolving keys during a recovery
+    std::size_t parallelism = 16u;
+  };
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSlotLabel - label of slot the sessions are opened on
+   * @param iSlotPwd - pwd for the slot
+   */
+  SessionPool(CK_FUNCTION_LIST_PTR iLibInterface, std::string iSlotLabel, std::string iSlotPwd);
+  ~SessionPool();
+
+  SessionPool(const SessionPool&) = delete;
+  SessionPool& operator=(const SessionPool&) = delete;
+
+  /**
+   * @param iSize - number of sessions to open
+   * @param iReadWrite - how many of them should be read-write. Capped by the read-write sessions the token
+   *  still allows (ulMaxRwSessionCount - ulRwSessionCount), the remaining sessions are opened read-only.
+   * @return
+   *  false if any session could not be opened or logged in (already opened sessions are closed), true otherwise
+   */
+  bool open(std::size_t iSize, std::size_t iReadWrite);
+
+  /**
+   * Opens iSize sessions, read-write as long as the token allows it
+   */
+  bool open(std::size_t iSize) { return open(iSize, iSize); }
+
+  /**
+   * Closes every session of the pool with C_CloseSession. Outstanding leases must have been released.
+   * @param iLogout - log out first (one C_Logout). The login state belongs to the application, this logs out every
+   *  other session it has on the token; the token logs out by itself once the last of them is closed.
+   */
+  void close(bool iLogout = false);
+
+  /**
+   * @param iAccess - access needed by the caller, a read-only caller may be handed a read-write session
+   * @return a lease, blocking until a session is available; empty optional if the pool is closed
+   */
+  std::optional<SessionLease> acquire(SessionAccess iAccess = SessionAccess::ReadOnly);
+
+  /**
+   * @param iDeadline - point in time after which the caller gives up waiting
+   * @param iAccess - access needed by the caller
+   * @return a lease, or empty optional if no session became available before iDeadline
+   */
+  std::optional<SessionLease> acquireUntil(Clock::time_point iDeadline, SessionAccess iAccess = SessionAccess::ReadOnly);
+
+  /**
+   * Same as acquireUntil, except that a pool left broken by a recovery that gave up is recovered again on behalf of
+   * the caller, as execute() does, instead of failing at once
+   * @param oStatus - CKR_OK with a lease, otherwise K_NO_SESSION if iDeadline passed first, CKR_DEVICE_ERROR if
+   *  the pool is broken and could not be recovered, CKR_SESSION_CLOSED if the pool is closed (nullptr if not wanted)
+   */
+  std::optional<SessionLease> acquireForExecuteUntil(Clock::time_point iDeadline, SessionAccess iAccess = SessionAccess::ReadOnly, CK_RV* oStatus = nullptr);
+
+  /**
+   * @param iAccess - access needed by the caller
+   * @return a lease if a session is immediately available, empty optional otherwise
+   */
+  std::optional<SessionLease> tryAcquire(SessionAccess iAccess = SessionAccess::ReadOnly);
+
+  /**
+   * @param iKeyLabel - the key label to be found
+   * @return
+   *  the handle of the key on this pool's token, looked up once and cached afterwards;
+   *  empty optional if the key cannot be found
+   */
+  std::optional<CK_OBJECT_HANDLE> findKey(const std::string& iKeyLabel);
+
+  /**
+   * Same as findKey, looking the key up on the session of iLease instead of acquiring one
+   */
+  std::optional<CK_OBJECT_HANDLE> findKey(const std::string& iKeyLabel, const SessionLease& iLease);
+
+  /**
+   * Drops the cached handle of iKeyLabel, e.g. after CKR_KEY_HANDLE_INVALID; the next findKey looks it up again
+   */
+  void forgetKey(const std::string& iKeyLabel);
+
+  /**
+   * @param iHandles - label and handle of keys of this pool's token, e.g. from a KeyInventory; labels already
+   *  cached keep their handle
+   */
+  void cacheKeyHandles(const std::vector<std::pair<std::string, CK_OBJECT_HANDLE>>& iHandles);
+
+  /**
+   * Same as findKey, generating the key on a read-write session if the token has none. Concurrent calls for the
+   * same label wait for a single lookup/generation without holding a session, see HSMUtils::getOrCreateKey.
+   * @param iKeyLabel - the key label
+   * @return the handle of the key, empty optional if it could neither be found nor generated
+   */
+  std::optional<CK_OBJECT_HANDLE> getOrCreateKey(const std::string& iKeyLabel);
+
+  /**
+   * @param iOperation - operation executed with a leased session
+   * @param iAccess - access needed by the operation
+   * @param oStatus - if not null, receives how the execution ended: CKR_OK on success, the PKCS#11 return value
+   *  of the failed attempt, K_NO_SESSION when the pool had no session to run it on (closed, or its recovery gave
+   *  up) and CKR_FUNCTION_REJECTED when the operation failed without a PKCS#11 error
+   * @return
+   *  the output of the operation; if it failed because the sessions were lost, the pool is recovered
+   *  and the operation retried once
+   */
+  std::optional<std::vector<unsigned char>> execute(const Operation& iOperation,
+                                                    SessionAccess iAccess = SessionAccess::ReadOnly,
+                                                    CK_RV* oStatus        = nullptr);
+
+  /**
+   * Same as execute, the operation receives the handle of iKeyLabel on this pool's token. A stale cached handle
+   * (CKR_KEY_HANDLE_INVALID / CKR_OBJECT_HANDLE_INVALID) is looked up again before the retry. A key the lookup
+   * did not find on the token is reported as K_KEY_NOT_FOUND.
+   */
+  std::optional<std::vector<unsigned char>> execute(const std::string& iKeyLabel,
+                                                    const KeyOperation& iOperation,
+                                                    SessionAccess iAccess = SessionAccess::ReadOnly,
+                                                    CK_RV* oStatus        = nullptr);
+
+  // status of an execute() that found no session to run on; a slot failure (see CircuitBreaker::isSlotFailure)
+  static constexpr CK_RV K_NO_SESSION = CKR_SESSION_COUNT;
+  // status of a keyed execute() whose key lookup succeeded without finding the key; not a slot failure
+  static constexpr CK_RV K_KEY_NOT_FOUND = CKR_KEY_NEEDED;
+
+  /**
+   * Replaces all the sessions of the pool. Concurrent callers that observed the failure on the same generation
+   * share a single recovery.
+   * @param iFailedGeneration - generation of the session on which the failure was observed
+   * @return true if the pool has usable sessions afterwards
+   */
+  bool recover(std::uint64_t iFailedGeneration);
+
+  /**
+   * @return true if iStatus means the session (or every session on the token) is gone
+   */
+  static bool isSessionLost(CK_RV iStatus);
+
+  /**
+   * Takes a session stuck in a call out of the pool and opens a replacement right away.
+   * The stuck session is closed once its lease is released.
+   * @param iSession - the session
+   * @return false if the session does not belong to the pool
+   */
+  bool quarantine(CK_SESSION_HANDLE iSession);
+
+  void setRecoveryPolicy(const RecoveryPolicy& iPolicy);
+
+  /**
+   * @param iReaper - destroys the session objects of the released leases in the background instead of on
+   *  release, nullptr to destroy them on release; called by ObjectReaper itself. Once it returns, the previous
+   *  reaper receives no more objects
+   */
+  void setReaper(ObjectReaper* iReaper);
+
+  std::uint64_t generation() const;
+  std::uint64_t recoveries() const;
+  std::size_t quarantined() const;
+
+  CK_FUNCTION_LIST_PTR libInterface() const { return mLibInterface; }
+  const std::string& slotLabel() const { return mSlotLabel; }
+
+  std::size_t size() const;
+  std::size_t readWriteSize() const;
+  std::size_t available() const;
+
+ private:
+  friend class SessionLease;
+  void release(CK_SESSION_HANDLE iSession, SessionAccess iAccess, std::uint64_t iGeneration, std::vector<CK_OBJECT_HANDLE> iObjects);
+  void destroyEphemeral(CK_SESSION_HANDLE iSession, std::uint64_t iGeneration, std::vector<CK_OBJECT_HANDLE> iObjects);
+  bool readyLocked(SessionAccess iAccess) const;
+  SessionLease takeIdleLocked(SessionAccess iAccess);
+  std::optional<SessionLease> acquireForExecute(SessionAccess iAccess);
+  // the first iReadWrite sessions are read-write
+  void installLocked(const std::vector<CK_SESSION_HANDLE>& iSessions, std::size_t iReadWrite);
+  // opens iSize sessions in parallel, the first iReadWrite of them read-write; all or nothing
+  std::optional<std::vector<CK_SESSION_HANDLE>> openSessions(CK_SLOT_ID iSlotId, std::size_t iSize, std::size_t iReadWrite, std::size_t iParallelism);
+
+  CK_FUNCTION_LIST_PTR mLibInterface;
+  std::string mSlotLabel;
+  std::string mSlotPwd;
+  CK_SLOT_ID mSlotId = 0u;
+
+  mutable std::mutex mMutex;
+  std::condition_variable mAvailableCv;
+  std::vector<CK_SESSION_HANDLE> mSessions;
+  std::unordered_set<CK_SESSION_HANDLE> mReadWriteSessions;
+  // sessions of the current generation taken out of the pool, still leased to a stuck caller
+  std::unordered_set<CK_SESSION_HANDLE> mQuarantined;
+  std::size_t mQuarantinedCount = 0u;
+  std::size_t mTargetSize    = 0u;
+  std::size_t mReadWriteSize = 0u;
+  std::vector<CK_SESSION_HANDLE> mIdleReadOnly;
+  std::vector<CK_SESSION_HANDLE> mIdleReadWrite;
+  bool mOpen = false;
+  // set while a recovery could not reopen the sessions, acquirers fail fast until the next recover()
+  bool mBroken = false;
+  std::uint64_t mGeneration = 0u;
+  std::uint64_t mRecoveries = 0u;
+  RecoveryPolicy mRecoveryPolicy;
+
+  std::mutex mRecoverMutex;
+  // held while objects are handed to the reaper, so that setReaper(nullptr) waits for them
+  std::mutex mReaperMutex;
+  ObjectReaper* mReaper = nullptr;
+
+  std::mutex mKeyMutex;
+  std::unordered_map<std::string, CK_OBJECT_HANDLE> mKeyHandles;
+  std::unordered_map<std::string, std::shared_future<std::optional<CK_OBJECT_HANDLE>>> mKeyFlights;
+};
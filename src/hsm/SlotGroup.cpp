@@ -0,0 +1,147 @@
+#include "hsm/SlotGroup.h"
+#include "hsm/HSMUtils.h"
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+SlotGroup::SlotGroup(const std::vector<SessionPool*>& iPools, BalancePolicy iPolicy, CircuitBreaker::Config iConfig) : mPolicy(iPolicy) {
+  mMembers.reserve(iPools.size());
+  for (auto* aPool : iPools) {
+    auto aMember     = std::make_unique<Member>();
+    aMember->pool    = aPool;
+    aMember->breaker = std::make_unique<CircuitBreaker>(aPool->slotLabel(), iConfig);
+    mMembers.push_back(std::move(aMember));
+  }
+}
+
+std::unique_ptr<SlotGroup> SlotGroup::open(CK_FUNCTION_LIST_PTR iLibInterface,
+                                           const std::vector<std::string>& iSlotLabels,
+                                           const std::string& iSlotPwd,
+                                           std::size_t iSessionsPerSlot,
+                                           BalancePolicy iPolicy) {
+  std::vector<std::unique_ptr<SessionPool>> aPools;
+  std::vector<SessionPool*> aPoolPointers;
+  for (const auto& aSlotLabel : iSlotLabels) {
+    auto aPool = std::make_unique<SessionPool>(iLibInterface, aSlotLabel, iSlotPwd);
+    if (not aPool->open(iSessionsPerSlot)) {
+      return nullptr;
+    }
+    aPoolPointers.push_back(aPool.get());
+    aPools.push_back(std::move(aPool));
+  }
+  auto aGroup         = std::make_unique<SlotGroup>(aPoolPointers, iPolicy);
+  aGroup->mOwnedPools = std::move(aPools);
+  return aGroup;
+}
+
+HSMResult SlotGroup::execute(const std::string& iKeyLabel, const SessionPool::KeyOperation& iOperation, SessionAccess iAccess) {
+  for (auto aIndex : candidates()) {
+    auto& aMember = *mMembers[aIndex];
+    if (auto aPermit = aMember.breaker->allow()) {
+      return run(aMember, aPermit, iKeyLabel, iOperation, iAccess);
+    }
+  }
+  return HSMResult{ HSMStatus::Unavailable, {} };
+}
+
+HSMResult SlotGroup::encrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iPlainText) {
+  return execute(iKeyLabel, [&iPlainText](const SessionLease& iLease, CK_OBJECT_HANDLE iKeyHandle) {
+    return HSMUtils::encrypt_aes(iLease.libInterface(), iLease.session(), iKeyHandle, iPlainText);
+  });
+}
+
+HSMResult SlotGroup::decrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iCipherText) {
+  return execute(iKeyLabel, [&iCipherText](const SessionLease& iLease, CK_OBJECT_HANDLE iKeyHandle) {
+    return HSMUtils::decrypt_aes(iLease.libInterface(), iLease.session(), iKeyHandle, iCipherText);
+  });
+}
+
+void SlotGroup::setListener(const CircuitBreaker::Listener& iListener) {
+  for (auto& aMember : mMembers) {
+    aMember->breaker->setListener(iListener);
+  }
+}
+
+std::vector<SlotGroup::SlotStats> SlotGroup::stats() const {
+  std::vector<SlotStats> aStats;
+  aStats.reserve(mMembers.size());
+  for (const auto& aMember : mMembers) {
+    SlotStats aSlot;
+    aSlot.slotLabel    = aMember->pool->slotLabel();
+    aSlot.requests     = aMember->requests.load(std::memory_order_relaxed);
+    aSlot.failures     = aMember->failures.load(std::memory_order_relaxed);
+    aSlot.rejected     = aMember->breaker->counters().rejected;
+    aSlot.outstanding  = aMember->outstanding.load(std::memory_order_relaxed);
+    aSlot.breakerState = aMember->breaker->state();
+    if (aSlot.requests > 0u) {
+      aSlot.meanLatencyUs = static_cast<double>(aMember->latencyNs.load(std::memory_order_relaxed)) / 1000.0 / static_cast<double>(aSlot.requests);
+    }
+    aStats.push_back(aSlot);
+  }
+  return aStats;
+}
+
+std::size_t SlotGroup::outstanding() const {
+  std::size_t aOutstanding = 0u;
+  for (const auto& aMember : mMembers) {
+    aOutstanding += aMember->outstanding.load(std::memory_order_relaxed);
+  }
+  return aOutstanding;
+}
+
+std::vector<std::size_t> SlotGroup::candidates() const {
+  std::vector<std::size_t> aOrder(mMembers.size());
+  std::iota(aOrder.begin(), aOrder.end(), 0u);
+  if (mPolicy == BalancePolicy::Ordered or aOrder.size() < 2u) {
+    return aOrder;
+  }
+
+  auto aLoad = [this](std::size_t i) { return mMembers[i]->outstanding.load(std::memory_order_relaxed); };
+
+  if (mPolicy == BalancePolicy::PowerOfTwoChoices) {
+    thread_local std::minstd_rand tGenerator{ std::random_device{}() };
+    std::uniform_int_distribution<std::size_t> aDist(0u, aOrder.size() - 1u);
+    auto aFirst  = aDist(tGenerator);
+    auto aSecond = aDist(tGenerator);
+    if (aSecond == aFirst) {
+      aSecond = (aFirst + 1u) % aOrder.size();
+    }
+    auto aBest  = aLoad(aSecond) < aLoad(aFirst) ? aSecond : aFirst;
+    auto aOther = aBest == aFirst ? aSecond : aFirst;
+    // the two picks come first, the remaining slots are only a fallback when both breakers refuse
+    std::swap(aOrder[0], aOrder[aBest]);
+    std::swap(aOrder[1], *std::find(aOrder.begin() + 1, aOrder.end(), aOther));
+    std::sort(aOrder.begin() + 2, aOrder.end(), [&aLoad](std::size_t l, std::size_t r) { return aLoad(l) < aLoad(r); });
+    return aOrder;
+  }
+
+  // stable: ties go to the slot given first
+  std::stable_sort(aOrder.begin(), aOrder.end(), [&aLoad](std::size_t l, std::size_t r) { return aLoad(l) < aLoad(r); });
+  return aOrder;
+}
+
+HSMResult SlotGroup::run(Member& iMember,
+                         const CircuitBreaker::Permit& iPermit,
+                         const std::string& iKeyLabel,
+                         const SessionPool::KeyOperation& iOperation,
+                         SessionAccess iAccess) {
+  iMember.outstanding.fetch_add(1u, std::memory_order_relaxed);
+  auto aStart   = CircuitBreaker::Clock::now();
+  CK_RV aStatus = CKR_OK;
+  auto aValue   = iMember.pool->execute(iKeyLabel, iOperation, iAccess, &aStatus);
+  auto aLatency = CircuitBreaker::Clock::now() - aStart;
+  iMember.outstanding.fetch_sub(1u, std::memory_order_relaxed);
+
+  // a request error (bad cipher text, missing key, ...) says nothing about the health of the slot, a pool without
+  // any session to hand out (SessionPool::K_NO_SESSION) does
+  bool aSlotHealthy = aValue.has_value() or not CircuitBreaker::isSlotFailure(aStatus);
+  iMember.breaker->onResult(iPermit, aSlotHealthy, aLatency);
+
+  iMember.requests.fetch_add(1u, std::memory_order_relaxed);
+  iMember.latencyNs.fetch_add(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(aLatency).count()), std::memory_order_relaxed);
+  if (not aValue) {
+    iMember.failures.fetch_add(1u, std::memory_order_relaxed);
+    return HSMResult{ HSMStatus::Failed, {} };
+  }
+  return HSMResult{ HSMStatus::Ok, std::move(aValue) };
+}
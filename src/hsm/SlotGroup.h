@@ -0,0 +1,121 @@
+#pragma once
+
+#include "hsm/CircuitBreaker.h"
+#include "hsm/HSMResult.h"
+#include "hsm/SessionPool.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * How a SlotGroup spreads the requests over its slots
+ */
+enum class BalancePolicy {
+  // first slot (in the order given) whose breaker allows the request: primary/standby
+  Ordered,
+  // slot with the fewest requests in flight
+  LeastOutstanding,
+  // the less loaded of two slots picked at random; close to LeastOutstanding without herding on one slot
+  PowerOfTwoChoices,
+};
+
+/**
+ * Set of session pools on slots holding the same (replicated) keys, each guarded by its own CircuitBreaker.
+ * Requests are spread over the slots according to the BalancePolicy, skipping the slots whose breaker is open,
+ * so traffic moves to the healthy slots and comes back once a probe succeeds. When every breaker refuses, the
+ * request fails fast with HSMStatus::Unavailable.
+ *
+ * Each pool keeps its own key handle cache, so a label resolves to the right handle on every slot.
+ */
+class SlotGroup {
+ public:
+  /**
+   * Per-slot statistics, to check how the load is spread
+   */
+  struct SlotStats {
+    std::string slotLabel;
+    std::uint64_t requests = 0u;
+    std::uint64_t failures = 0u;
+    std::uint64_t rejected = 0u;
+    std::size_t outstanding = 0u;
+    double meanLatencyUs = 0.0;
+    BreakerState breakerState = BreakerState::Closed;
+  };
+
+  /**
+   * @param iPools - pools of the slots, in order of preference; they must outlive the group
+   * @param iPolicy - how requests are spread over the slots
+   * @param iConfig - configuration shared by the breakers of all the slots
+   */
+  explicit SlotGroup(const std::vector<SessionPool*>& iPools,
+                     BalancePolicy iPolicy = BalancePolicy::Ordered,
+                     CircuitBreaker::Config iConfig = CircuitBreaker::Config{});
+
+  /**
+   * @param iLibInterface - the function list of the dynamic lib
+   * @param iSlotLabels - labels of the slots holding the same keys
+   * @param iSlotPwd - pwd of the slots
+   * @param iSessionsPerSlot - size of the pool opened on each slot
+   * @param iPolicy - how requests are spread over the slots
+   * @return a group owning its pools, nullptr if any pool could not be opened
+   */
+  static std::unique_ptr<SlotGroup> open(CK_FUNCTION_LIST_PTR iLibInterface,
+                                         const std::vector<std::string>& iSlotLabels,
+                                         const std::string& iSlotPwd,
+                                         std::size_t iSessionsPerSlot,
+                                         BalancePolicy iPolicy);
+
+  SlotGroup(const SlotGroup&) = delete;
+  SlotGroup& operator=(const SlotGroup&) = delete;
+
+  /**
+   * @param iKeyLabel - label of the key, resolved on the slot the request is routed to
+   * @param iOperation - the operation
+   * @param iAccess - access needed by the operation
+   */
+  HSMResult execute(const std::string& iKeyLabel, const SessionPool::KeyOperation& iOperation, SessionAccess iAccess = SessionAccess::ReadOnly);
+
+  HSMResult encrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iPlainText);
+
+  HSMResult decrypt_aes(const std::string& iKeyLabel, const std::vector<unsigned char>& iCipherText);
+
+  /**
+   * @param iListener - invoked on the state transitions of any of the breakers
+   */
+  void setListener(const CircuitBreaker::Listener& iListener);
+
+  std::vector<SlotStats> stats() const;
+
+  /**
+   * @return the number of requests in flight over all the slots
+   */
+  std::size_t outstanding() const;
+
+  std::size_t size() const { return mMembers.size(); }
+  SessionPool& pool(std::size_t iIndex) { return *mMembers[iIndex]->pool; }
+  const CircuitBreaker& breaker(std::size_t iIndex) const { return *mMembers[iIndex]->breaker; }
+
+ private:
+  struct Member {
+    SessionPool* pool;
+    std::unique_ptr<CircuitBreaker> breaker;
+    std::atomic<std::size_t> outstanding{ 0u };
+    std::atomic<std::uint64_t> requests{ 0u };
+    std::atomic<std::uint64_t> failures{ 0u };
+    std::atomic<std::uint64_t> latencyNs{ 0u };
+  };
+
+  // indices of the members in the order they should be tried for the next request
+  std::vector<std::size_t> candidates() const;
+  HSMResult run(Member& iMember,
+                const CircuitBreaker::Permit& iPermit,
+                const std::string& iKeyLabel,
+                const SessionPool::KeyOperation& iOperation,
+                SessionAccess iAccess);
+
+  const BalancePolicy mPolicy;
+  std::vector<std::unique_ptr<Member>> mMembers;
+  std::vector<std::unique_ptr<SessionPool>> mOwnedPools;
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+/**
+ * Minimal tracing helpers shared by the hsm sources (defined in HSMUtils.cpp)
+ */
+void TRC_ERROR(int error, const std::string& err);
+
+void TRC_WARN(int error, const std::string& err);
@@ -0,0 +1,528 @@
+#include "hsm/Workload.h"
+#include "hsm/HSMUtils.h"
+#include "hsm/SessionPool.h"
+#include "hsm/Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+const char* const K_OP_NAMES[K_WORKLOAD_OPS] = { "encrypt", "decrypt", "find", "generate", "sign", "digest" };
+
+// sizes drawn from a continuous decrypt payload distribution to make the ciphertexts of
+constexpr std::size_t K_DECRYPT_SIZES = 16u;
+
+std::string trim(const std::string& iText) {
+  auto aBegin = iText.find_first_not_of(" \t\r");
+  if (aBegin == std::string::npos) {
+    return "";
+  }
+  auto aEnd = iText.find_last_not_of(" \t\r");
+  return iText.substr(aBegin, aEnd - aBegin + 1u);
+}
+
+std::vector<std::string> split(const std::string& iText, char iSeparator) {
+  std::vector<std::string> aParts;
+  std::istringstream aStream(iText);
+  std::string aPart;
+  while (std::getline(aStream, aPart, iSeparator)) {
+    aParts.push_back(trim(aPart));
+  }
+  return aParts;
+}
+
+std::optional<double> parseNumber(const std::string& iText) {
+  if (iText.empty()) {
+    return {};
+  }
+  std::size_t aPos = 0u;
+  double aValue;
+  try {
+    aValue = std::stod(iText, &aPos);
+  } catch (const std::exception&) {
+    return {};
+  }
+  if (aPos < iText.size()) {
+    switch (std::toupper(static_cast<unsigned char>(iText[aPos]))) {
+      case 'K':
+        aValue *= 1024.0;
+        break;
+      case 'M':
+        aValue *= 1024.0 * 1024.0;
+        break;
+      case 'G':
+        aValue *= 1024.0 * 1024.0 * 1024.0;
+        break;
+      default:
+        return {};
+    }
+    if (aPos + 1u != iText.size()) {
+      return {};
+    }
+  }
+  if (aValue < 0.0 or not std::isfinite(aValue)) {
+    return {};
+  }
+  return aValue;
+}
+
+std::optional<WorkloadOp> parseOp(const std::string& iName) {
+  for (std::size_t i = 0u; i < K_WORKLOAD_OPS; ++i) {
+    if (iName == K_OP_NAMES[i]) {
+      return static_cast<WorkloadOp>(i);
+    }
+  }
+  return {};
+}
+
+double percentileUs(const std::vector<std::uint64_t>& iSortedNs, double iFraction) {
+  if (iSortedNs.empty()) {
+    return 0.0;
+  }
+  auto aRank = static_cast<std::size_t>(std::ceil(iFraction * static_cast<double>(iSortedNs.size())));
+  return static_cast<double>(iSortedNs[std::max<std::size_t>(aRank, 1u) - 1u]) / 1000.0;
+}
+
+// value of iGrid (sorted, not empty) closest to iValue
+std::size_t snap(const std::vector<std::size_t>& iGrid, std::size_t iValue) {
+  auto aAbove = std::lower_bound(iGrid.begin(), iGrid.end(), iValue);
+  if (aAbove == iGrid.end()) {
+    return iGrid.back();
+  }
+  if (aAbove == iGrid.begin() or *aAbove - iValue <= iValue - *std::prev(aAbove)) {
+    return *aAbove;
+  }
+  return *std::prev(aAbove);
+}
+
+}  // namespace
+
+const char* workloadOpName(WorkloadOp iOp) {
+  return K_OP_NAMES[static_cast<std::size_t>(iOp)];
+}
+
+bool workloadOpHasPayload(WorkloadOp iOp) {
+  return iOp != WorkloadOp::Find and iOp != WorkloadOp::Generate;
+}
+
+ValueDistribution::ValueDistribution(std::size_t iFixed)
+    : mFirst(static_cast<double>(iFixed)), mText(std::to_string(iFixed)) {}
+
+std::optional<ValueDistribution> ValueDistribution::parse(const std::string& iText) {
+  ValueDistribution aDistribution;
+  aDistribution.mText = trim(iText);
+  auto aParts         = split(aDistribution.mText, ':');
+  if (aParts.size() == 1u) {
+    auto aValue = parseNumber(aParts[0]);
+    if (not aValue) {
+      return {};
+    }
+    aDistribution.mFirst = aValue.value();
+    return aDistribution;
+  }
+  const auto& aKind = aParts[0];
+  if (aKind == "choice" and aParts.size() == 2u) {
+    aDistribution.mKind = Kind::Choice;
+    for (const auto& aItem : split(aParts[1], ',')) {
+      auto aAt     = aItem.find('@');
+      auto aValue  = parseNumber(aItem.substr(0, aAt));
+      auto aWeight = aAt == std::string::npos ? std::optional<double>(1.0) : parseNumber(aItem.substr(aAt + 1u));
+      if (not aValue or not aWeight) {
+        return {};
+      }
+      aDistribution.mValues.push_back(static_cast<std::size_t>(aValue.value()));
+      aDistribution.mWeights.push_back(aWeight.value());
+    }
+    if (aDistribution.mValues.empty() or std::accumulate(aDistribution.mWeights.begin(), aDistribution.mWeights.end(), 0.0) <= 0.0) {
+      return {};
+    }
+    return aDistribution;
+  }
+  std::vector<double> aNumbers;
+  for (std::size_t i = 1u; i < aParts.size(); ++i) {
+    auto aValue = parseNumber(aParts[i]);
+    if (not aValue) {
+      return {};
+    }
+    aNumbers.push_back(aValue.value());
+  }
+  if (aKind == "uniform" and aNumbers.size() == 2u and aNumbers[0] <= aNumbers[1]) {
+    aDistribution.mKind = Kind::Uniform;
+  } else if (aKind == "lognormal" and aNumbers.size() == 2u and aNumbers[0] > 0.0) {
+    aDistribution.mKind = Kind::LogNormal;
+  } else if (aKind == "exponential" and aNumbers.size() == 1u and aNumbers[0] > 0.0) {
+    aDistribution.mKind = Kind::Exponential;
+    aNumbers.push_back(0.0);
+  } else {
+    return {};
+  }
+  aDistribution.mFirst  = aNumbers[0];
+  aDistribution.mSecond = aNumbers[1];
+  return aDistribution;
+}
+
+std::size_t ValueDistribution::sample(std::mt19937_64& ioEngine) const {
+  switch (mKind) {
+    case Kind::Fixed:
+      return static_cast<std::size_t>(mFirst);
+    case Kind::Uniform:
+      return std::uniform_int_distribution<std::size_t>(static_cast<std::size_t>(mFirst), static_cast<std::size_t>(mSecond))(ioEngine);
+    case Kind::LogNormal:
+      return static_cast<std::size_t>(std::lognormal_distribution<double>(std::log(mFirst), mSecond)(ioEngine));
+    case Kind::Exponential:
+      return static_cast<std::size_t>(std::exponential_distribution<double>(1.0 / mFirst)(ioEngine));
+    case Kind::Choice:
+      return mValues[std::discrete_distribution<std::size_t>(mWeights.begin(), mWeights.end())(ioEngine)];
+  }
+  return 0u;
+}
+
+std::vector<std::size_t> ValueDistribution::grid(std::size_t iDraws, std::mt19937_64& ioEngine) const {
+  std::vector<std::size_t> aGrid;
+  if (mKind == Kind::Fixed) {
+    aGrid.push_back(static_cast<std::size_t>(mFirst));
+  } else if (mKind == Kind::Choice) {
+    aGrid = mValues;
+  } else {
+    for (std::size_t i = 0u; i < iDraws; ++i) {
+      aGrid.push_back(sample(ioEngine));
+    }
+  }
+  std::sort(aGrid.begin(), aGrid.end());
+  aGrid.erase(std::unique(aGrid.begin(), aGrid.end()), aGrid.end());
+  return aGrid;
+}
+
+std::optional<Scenario> Scenario::parse(std::istream& iInput, const std::string& iName) {
+  Scenario aScenario;
+  std::optional<ValueDistribution> aPayload;
+  std::array<std::optional<ValueDistribution>, K_WORKLOAD_OPS> aOpPayloads;
+  std::string aLine;
+  for (std::size_t aLineNumber = 1u; std::getline(iInput, aLine); ++aLineNumber) {
+    aLine = trim(aLine.substr(0, aLine.find('#')));
+    if (aLine.empty()) {
+      continue;
+    }
+    auto aError = [&](const std::string& iWhat) {
+      std::ostringstream descr;
+      descr << iName << ":" << aLineNumber << ": " << iWhat << ": " << aLine;
+      TRC_ERROR(255, descr.str());
+      return std::nullopt;
+    };
+    auto aEqual = aLine.find('=');
+    if (aEqual == std::string::npos) {
+      return aError("expected key = value");
+    }
+    const auto aKey   = trim(aLine.substr(0, aEqual));
+    const auto aValue = trim(aLine.substr(aEqual + 1u));
+    const auto aDot   = aKey.find('.');
+    const auto aBase  = aKey.substr(0, aDot);
+    std::optional<WorkloadOp> aOp;
+    if (aDot != std::string::npos) {
+      aOp = parseOp(aKey.substr(aDot + 1u));
+      if (not aOp or (aBase != "mix" and aBase != "payload")) {
+        return aError("unknown key");
+      }
+      if (aBase == "payload" and not workloadOpHasPayload(aOp.value())) {
+        return aError("operation without payload");
+      }
+    }
+
+    if (aBase == "mix" and aOp) {
+      auto aWeight = parseNumber(aValue);
+      if (not aWeight) {
+        return aError("invalid weight");
+      }
+      aScenario.mix[static_cast<std::size_t>(aOp.value())] = aWeight.value();
+    } else if (aBase == "payload" or aBase == "think_time_us") {
+      auto aDistribution = ValueDistribution::parse(aValue);
+      if (not aDistribution) {
+        return aError("invalid distribution");
+      }
+      if (aBase == "think_time_us") {
+        aScenario.thinkTimeUs = aDistribution.value();
+      } else if (aOp) {
+        aOpPayloads[static_cast<std::size_t>(aOp.value())] = aDistribution;
+      } else {
+        aPayload = aDistribution;
+      }
+    } else if (aKey == "key_prefix") {
+      aScenario.keyPrefix = aValue;
+    } else if (aKey == "generate_token") {
+      if (aValue != "true" and aValue != "false") {
+        return aError("expected true or false");
+      }
+      aScenario.generateToken = aValue == "true";
+    } else if (aKey == "keys" or aKey == "sessions" or aKey == "threads" or aKey == "seed" or aKey == "duration_s" or aKey == "warmup_s") {
+      auto aNumber = parseNumber(aValue);
+      if (not aNumber) {
+        return aError("invalid number");
+      }
+      if (aKey == "keys") {
+        aScenario.keys = static_cast<std::size_t>(aNumber.value());
+      } else if (aKey == "sessions") {
+        aScenario.sessions = static_cast<std::size_t>(aNumber.value());
+      } else if (aKey == "threads") {
+        aScenario.threads = static_cast<std::size_t>(aNumber.value());
+      } else if (aKey == "seed") {
+        aScenario.seed = static_cast<std::uint64_t>(aNumber.value());
+      } else if (aKey == "duration_s") {
+        aScenario.duration = std::chrono::duration<double>(aNumber.value());
+      } else {
+        aScenario.warmup = std::chrono::duration<double>(aNumber.value());
+      }
+    } else {
+      return aError("unknown key");
+    }
+  }
+
+  for (std::size_t i = 0u; i < K_WORKLOAD_OPS; ++i) {
+    if (aOpPayloads[i]) {
+      aScenario.payload[i] = aOpPayloads[i].value();
+    } else if (aPayload) {
+      aScenario.payload[i] = aPayload.value();
+    }
+  }
+  if (std::accumulate(aScenario.mix.begin(), aScenario.mix.end(), 0.0) <= 0.0) {
+    TRC_ERROR(255, iName + ": no operation, give at least one mix.<operation> weight");
+    return {};
+  }
+  if (aScenario.keys == 0u or aScenario.sessions == 0u or aScenario.threads == 0u) {
+    TRC_ERROR(255, iName + ": keys, sessions and threads cannot be 0");
+    return {};
+  }
+  return aScenario;
+}
+
+std::optional<Scenario> Scenario::load(const std::string& iPath) {
+  std::ifstream aFile(iPath);
+  if (not aFile) {
+    TRC_ERROR(255, "Could not open scenario " + iPath);
+    return {};
+  }
+  return parse(aFile, iPath);
+}
+
+void Scenario::print(std::ostream& oOut) const {
+  oOut << "threads: " << threads << ", sessions: " << sessions << ", keys: " << keys << " (" << keyPrefix << "*)"
+       << ", duration: " << duration.count() << " s, warm-up: " << warmup.count() << " s, think time: " << thinkTimeUs.text() << " us"
+       << std::endl;
+  const double aTotal = std::accumulate(mix.begin(), mix.end(), 0.0);
+  for (std::size_t i = 0u; i < K_WORKLOAD_OPS; ++i) {
+    if (mix[i] > 0.0) {
+      oOut << "  " << std::left << std::setw(9) << K_OP_NAMES[i] << std::right << std::fixed << std::setprecision(1) << std::setw(5)
+           << 100.0 * mix[i] / aTotal << "%";
+      if (workloadOpHasPayload(static_cast<WorkloadOp>(i))) {
+        oOut << "  payload " << payload[i].text();
+      }
+      oOut << std::endl;
+    }
+  }
+  oOut.unsetf(std::ios::floatfield);
+}
+
+void WorkloadReport::print(std::ostream& oOut) const {
+  const double aSeconds = elapsed.count() > 0.0 ? elapsed.count() : 1.0;
+  oOut << std::left << std::setw(10) << "operation" << std::right << std::setw(10) << "count" << std::setw(8) << "errors" << std::setw(11)
+       << "ops/s" << std::setw(10) << "MB/s" << std::setw(11) << "mean_us" << std::setw(11) << "p50_us" << std::setw(11) << "p99_us"
+       << std::setw(11) << "p99.9_us" << std::setw(11) << "max_us" << std::endl;
+  oOut << std::fixed << std::setprecision(2);
+  for (std::size_t i = 0u; i < K_WORKLOAD_OPS; ++i) {
+    const auto& aOp = operations[i];
+    if (aOp.count == 0u and aOp.errors == 0u) {
+      continue;
+    }
+    oOut << std::left << std::setw(10) << K_OP_NAMES[i] << std::right << std::setw(10) << aOp.count << std::setw(8) << aOp.errors
+         << std::setw(11) << static_cast<double>(aOp.count) / aSeconds << std::setw(10);
+    if (workloadOpHasPayload(static_cast<WorkloadOp>(i))) {
+      oOut << static_cast<double>(aOp.bytes) / aSeconds / 1e6;
+    } else {
+      oOut << "-";
+    }
+    oOut << std::setw(11) << aOp.meanUs << std::setw(11) << aOp.p50Us << std::setw(11) << aOp.p99Us << std::setw(11) << aOp.p999Us
+         << std::setw(11) << aOp.maxUs << std::endl;
+  }
+  oOut.unsetf(std::ios::floatfield);
+  oOut << std::setprecision(6);
+}
+
+WorkloadRunner::WorkloadRunner(CK_FUNCTION_LIST_PTR iLibInterface, std::string iSlotLabel, std::string iSlotPwd, Scenario iScenario)
+    : mLibInterface(iLibInterface), mSlotLabel(std::move(iSlotLabel)), mSlotPwd(std::move(iSlotPwd)), mScenario(std::move(iScenario)) {}
+
+std::optional<WorkloadReport> WorkloadRunner::run() {
+  using Clock = std::chrono::steady_clock;
+
+  SessionPool aPool(mLibInterface, mSlotLabel, mSlotPwd);
+  if (not aPool.open(mScenario.sessions)) {
+    return {};
+  }
+
+  const bool aSigning   = mScenario.mix[static_cast<std::size_t>(WorkloadOp::Sign)] > 0.0;
+  const bool aDecrypting = mScenario.mix[static_cast<std::size_t>(WorkloadOp::Decrypt)] > 0.0;
+  std::vector<CK_OBJECT_HANDLE> aKeys;
+  std::vector<CK_OBJECT_HANDLE> aMacKeys;
+  // ciphertexts to decrypt, per key and size of the decrypt payload grid, read-only once the threads run: a
+  // decryption never pays for an encryption nor makes one outside of the counted operations
+  std::vector<std::size_t> aDecryptSizes;
+  std::map<std::pair<std::size_t, std::size_t>, std::vector<unsigned char>> aCipherTexts;
+  {
+    auto aLease = aPool.acquire(SessionAccess::ReadWrite);
+    if (not aLease) {
+      aPool.close();
+      return {};
+    }
+    for (std::size_t k = 0u; k < mScenario.keys; ++k) {
+      auto aKey = HSMUtils::getOrCreateKey(mLibInterface, aLease->session(), mScenario.keyPrefix + std::to_string(k));
+      std::optional<CK_OBJECT_HANDLE> aMacKey;
+      if (aSigning) {
+        const auto aMacLabel = mScenario.keyPrefix + "MAC_" + std::to_string(k);
+        aMacKey              = HSMUtils::retrieveKeyHandle(mLibInterface, aLease->session(), aMacLabel);
+        if (not aMacKey) {
+          aMacKey = HSMUtils::generateMacKey(mLibInterface, aLease->session(), aMacLabel);
+        }
+      }
+      if (not aKey or (aSigning and not aMacKey)) {
+        TRC_ERROR(255, "Could not find nor generate the scenario keys");
+        aLease.reset();
+        aPool.close();
+        return {};
+      }
+      aKeys.push_back(aKey.value());
+      aMacKeys.push_back(aMacKey.value_or(CK_INVALID_HANDLE));
+    }
+    if (aDecrypting) {
+      std::mt19937_64 aEngine(mScenario.seed);
+      aDecryptSizes = mScenario.payload[static_cast<std::size_t>(WorkloadOp::Decrypt)].grid(K_DECRYPT_SIZES, aEngine);
+      for (std::size_t k = 0u; k < aKeys.size(); ++k) {
+        for (const auto aSize : aDecryptSizes) {
+          const std::vector<unsigned char> aPlainText(aSize, static_cast<unsigned char>(WorkloadOp::Decrypt));
+          auto aCipherText = HSMUtils::encrypt_aes(mLibInterface, aLease->session(), aKeys[k], aPlainText);
+          if (not aCipherText) {
+            TRC_ERROR(255, "Could not make the ciphertexts to decrypt");
+            aLease.reset();
+            aPool.close();
+            return {};
+          }
+          aCipherTexts.emplace(std::make_pair(k, aSize), std::move(aCipherText.value()));
+        }
+      }
+    }
+  }
+
+  struct ThreadStats {
+    std::array<std::vector<std::uint64_t>, K_WORKLOAD_OPS> latencies;
+    std::array<std::uint64_t, K_WORKLOAD_OPS> errors{};
+    std::array<std::uint64_t, K_WORKLOAD_OPS> bytes{};
+  };
+  std::vector<ThreadStats> aStats(mScenario.threads);
+  const auto aStart        = Clock::now();
+  const auto aMeasureFrom  = aStart + std::chrono::duration_cast<Clock::duration>(mScenario.warmup);
+  const auto aEnd          = aMeasureFrom + std::chrono::duration_cast<Clock::duration>(mScenario.duration);
+  std::vector<std::thread> aThreads;
+  for (std::size_t t = 0u; t < mScenario.threads; ++t) {
+    aThreads.emplace_back([&, t] {
+      auto& aThreadStats = aStats[t];
+      std::mt19937_64 aEngine(mScenario.seed + t);
+      std::discrete_distribution<std::size_t> aPickOp(mScenario.mix.begin(), mScenario.mix.end());
+      std::uniform_int_distribution<std::size_t> aPickKey(0u, aKeys.size() - 1u);
+      std::vector<unsigned char> aPayload;
+      while (Clock::now() < aEnd) {
+        const auto aOp      = aPickOp(aEngine);
+        const auto aOpType  = static_cast<WorkloadOp>(aOp);
+        // find and generate send no data, their size stays 0 and adds no bytes
+        std::size_t aSize   = workloadOpHasPayload(aOpType) ? mScenario.payload[aOp].sample(aEngine) : 0u;
+        const auto aKey     = aPickKey(aEngine);
+        const bool aToken   = aOpType == WorkloadOp::Generate and mScenario.generateToken;
+        if (aOpType == WorkloadOp::Decrypt) {
+          aSize = snap(aDecryptSizes, aSize);
+        } else {
+          aPayload.assign(aSize, static_cast<unsigned char>(aOp));
+        }
+
+        auto aStartOp = Clock::now();
+        auto aLease   = aPool.acquire(aToken ? SessionAccess::ReadWrite : SessionAccess::ReadOnly);
+        bool aOk      = false;
+        if (aLease) {
+          const auto aSession = aLease->session();
+          switch (aOpType) {
+            case WorkloadOp::Encrypt:
+              aOk = HSMUtils::encrypt_aes(mLibInterface, aSession, aKeys[aKey], aPayload).has_value();
+              break;
+            case WorkloadOp::Decrypt:
+              aOk = HSMUtils::decrypt_aes(mLibInterface, aSession, aKeys[aKey], aCipherTexts.at({ aKey, aSize })).has_value();
+              break;
+            case WorkloadOp::Find:
+              aOk = HSMUtils::retrieveKeyHandle(mLibInterface, aSession, mScenario.keyPrefix + std::to_string(aKey)).has_value();
+              break;
+            case WorkloadOp::Generate: {
+              auto aGenerated = HSMUtils::generateKey(mLibInterface, aSession, mScenario.keyPrefix + "GENERATED", aToken);
+              aOk             = aGenerated.has_value();
+              if (aOk) {
+                const auto aDone = Clock::now();
+                HSMUtils::destroyObject(mLibInterface, aSession, aGenerated.value());
+                // the destruction is cleanup, not part of the request
+                aStartOp += Clock::now() - aDone;
+              }
+              break;
+            }
+            case WorkloadOp::Sign:
+              aOk = HSMUtils::sign_cmac(mLibInterface, aSession, aMacKeys[aKey], aPayload).has_value();
+              break;
+            case WorkloadOp::Digest:
+              aOk = HSMUtils::digest_sha256(mLibInterface, aSession, aPayload).has_value();
+              break;
+          }
+          aLease.reset();
+        }
+        const auto aDone = Clock::now();
+        if (aDone >= aMeasureFrom and aDone < aEnd) {
+          if (aOk) {
+            aThreadStats.latencies[aOp].push_back(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(aDone - aStartOp).count()));
+            aThreadStats.bytes[aOp] += aSize;
+          } else {
+            ++aThreadStats.errors[aOp];
+          }
+        }
+        if (auto aThink = mScenario.thinkTimeUs.sample(aEngine); aThink > 0u) {
+          std::this_thread::sleep_for(std::chrono::microseconds(aThink));
+        }
+      }
+    });
+  }
+  for (auto& aThread : aThreads) {
+    aThread.join();
+  }
+  aPool.close();
+
+  WorkloadReport aReport;
+  aReport.elapsed = mScenario.duration;
+  for (std::size_t i = 0u; i < K_WORKLOAD_OPS; ++i) {
+    std::vector<std::uint64_t> aLatencies;
+    auto& aOp = aReport.operations[i];
+    for (const auto& aThreadStats : aStats) {
+      aLatencies.insert(aLatencies.end(), aThreadStats.latencies[i].begin(), aThreadStats.latencies[i].end());
+      aOp.errors += aThreadStats.errors[i];
+      aOp.bytes += aThreadStats.bytes[i];
+    }
+    if (aLatencies.empty()) {
+      continue;
+    }
+    std::sort(aLatencies.begin(), aLatencies.end());
+    aOp.count  = aLatencies.size();
+    aOp.meanUs = std::accumulate(aLatencies.begin(), aLatencies.end(), 0.0) / static_cast<double>(aLatencies.size()) / 1000.0;
+    aOp.p50Us  = percentileUs(aLatencies, 0.5);
+    aOp.p99Us  = percentileUs(aLatencies, 0.99);
+    aOp.p999Us = percentileUs(aLatencies, 0.999);
+    aOp.maxUs  = static_cast<double>(aLatencies.back()) / 1000.0;
+  }
+  return aReport;
+}
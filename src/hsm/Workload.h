@@ -0,0 +1,155 @@
+#pragma once
+
+#include "hsm/cryptoki.h"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Operations a workload scenario mixes, one HSMUtils call each
+ */
+enum class WorkloadOp : std::size_t {
+  Encrypt,   // encrypt_aes
+  Decrypt,   // decrypt_aes of a ciphertext made before the run, the payload size snapped to ValueDistribution::grid
+  Find,      // retrieveKeyHandle of one of the scenario keys
+  Generate,  // generateKey, the key is destroyed right after (not timed)
+  Sign,      // sign_cmac
+  Digest,    // digest_sha256
+};
+
+constexpr std::size_t K_WORKLOAD_OPS = 6u;
+
+const char* workloadOpName(WorkloadOp iOp);
+
+/**
+ * @return false for the operations sending no data to the token (find, generate): no payload size, no MB/s
+ */
+bool workloadOpHasPayload(WorkloadOp iOp);
+
+/**
+ * Distribution of payload sizes or think times, written as
+ *   <n>                           always n
+ *   uniform:<min>:<max>           uniform between min and max, both included
+ *   lognormal:<median>:<sigma>    log-normal, sigma of the underlying normal
+ *   exponential:<mean>            exponential
+ *   choice:<n>@<weight>,...       one of the values, in proportion to the weights
+ * Sizes accept a K, M or G (binary) suffix.
+ */
+class ValueDistribution {
+ public:
+  ValueDistribution() = default;
+  explicit ValueDistribution(std::size_t iFixed);
+
+  /**
+   * @return empty optional if iText is not one of the forms above
+   */
+  static std::optional<ValueDistribution> parse(const std::string& iText);
+
+  std::size_t sample(std::mt19937_64& ioEngine) const;
+
+  /**
+   * Values the samples are snapped to when each one needs something made in advance: every value of a fixed or
+   * choice distribution, iDraws draws of a continuous one
+   * @return the distinct values, sorted
+   */
+  std::vector<std::size_t> grid(std::size_t iDraws, std::mt19937_64& ioEngine) const;
+  const std::string& text() const { return mText; }
+
+ private:
+  enum class Kind { Fixed, Uniform, LogNormal, Exponential, Choice };
+
+  Kind mKind = Kind::Fixed;
+  double mFirst  = 0.0;
+  double mSecond = 0.0;
+  std::vector<std::size_t> mValues;
+  std::vector<double> mWeights;
+  std::string mText = "0";
+};
+
+/**
+ * Traffic shape replayed by the WorkloadRunner, read from a key = value file ('#' starts a comment):
+ *   mix.<op> = <weight>            relative share of encrypt, decrypt, find, generate, sign and digest (0 by default)
+ *   payload = <distribution>       payload size of every operation (32 by default)
+ *   payload.<op> = <distribution>  payload size of one operation, except find and generate which take none
+ *   keys = <n>                     AES keys <key_prefix>0 .. n-1, plus <key_prefix>MAC_0 .. n-1 for sign (1)
+ *   key_prefix = <label>           (WORKLOAD_KEY_)
+ *   generate_token = true|false    generate token keys instead of session keys (false)
+ *   sessions = <n>                 sessions of the pool (1)
+ *   threads = <n>                  client threads (1)
+ *   duration_s = <seconds>         measured time (10)
+ *   warmup_s = <seconds>           time run before measuring (0)
+ *   think_time_us = <distribution> pause of a thread between two operations (0)
+ *   seed = <n>                     random seed, for repeatable runs (1)
+ */
+struct Scenario {
+  std::array<double, K_WORKLOAD_OPS> mix{};
+  std::array<ValueDistribution, K_WORKLOAD_OPS> payload{ ValueDistribution(32u), ValueDistribution(32u), ValueDistribution(32u),
+                                                         ValueDistribution(32u), ValueDistribution(32u), ValueDistribution(32u) };
+  std::size_t keys      = 1u;
+  std::string keyPrefix = "WORKLOAD_KEY_";
+  bool generateToken    = false;
+  std::size_t sessions  = 1u;
+  std::size_t threads   = 1u;
+  std::chrono::duration<double> duration{ 10.0 };
+  std::chrono::duration<double> warmup{ 0.0 };
+  ValueDistribution thinkTimeUs;
+  std::uint64_t seed = 1u;
+
+  /**
+   * @param iName - name of the input in the error messages
+   * @return the scenario, empty optional on a syntax error or a scenario with no operation
+   */
+  static std::optional<Scenario> parse(std::istream& iInput, const std::string& iName);
+  static std::optional<Scenario> load(const std::string& iPath);
+
+  void print(std::ostream& oOut) const;
+};
+
+/**
+ * Results of one run, per operation type. Latencies include the wait for a session of the pool.
+ */
+struct WorkloadReport {
+  struct Operation {
+    std::uint64_t count  = 0u;
+    std::uint64_t errors = 0u;
+    std::uint64_t bytes  = 0u;
+    double meanUs        = 0.0;
+    double p50Us         = 0.0;
+    double p99Us         = 0.0;
+    double p999Us        = 0.0;
+    double maxUs         = 0.0;
+  };
+
+  std::array<Operation, K_WORKLOAD_OPS> operations;
+  std::chrono::duration<double> elapsed{ 0.0 };
+
+  void print(std::ostream& oOut) const;
+};
+
+/**
+ * Replays a Scenario on a token: scenario.threads threads share a SessionPool of scenario.sessions sessions and
+ * each draws the operation, payload size, key and think time of every request from the scenario distributions.
+ */
+class WorkloadRunner {
+ public:
+  WorkloadRunner(CK_FUNCTION_LIST_PTR iLibInterface, std::string iSlotLabel, std::string iSlotPwd, Scenario iScenario);
+
+  /**
+   * Opens the pool, finds or generates the scenario keys, then runs warm-up and measured time
+   * @return the report, empty optional if the pool or the keys could not be set up
+   */
+  std::optional<WorkloadReport> run();
+
+ private:
+  CK_FUNCTION_LIST_PTR mLibInterface;
+  std::string mSlotLabel;
+  std::string mSlotPwd;
+  Scenario mScenario;
+};
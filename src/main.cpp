@@ -1,4 +1,6 @@
+#include <hsm/AllocationTracker.h>
 #include <hsm/HSMUtils.h>
+#include <hsm/Workload.h>
 #include <iostream>
 #include <vector>
 #include <algorithm>
@@ -28,6 +30,22 @@ int main(int argc, char** argv) {
     std::cout << "custom Slot pwd: " << aSlotPwd << std::endl;
   }
 
+  // optional argument four - scenario file, replayed instead of the single encrypt/decrypt below
+  std::optional<Scenario> aScenario;
+  if (argc > 4) {
+    aScenario = Scenario::load(argv[4]);
+    if (not aScenario) {
+      return 6;
+    }
+    std::cout << "scenario: " << argv[4] << std::endl;
+  }
+
+  // allocations per PKCS#11 function, when run with LD_PRELOAD=libpkcs11_alloc_tracker.so
+  auto aAllocations = AllocationTracker::create();
+  if (aAllocations) {
+    CallObservers::add(aAllocations);
+  }
+
   // opening dl
   auto [lib, libFunc] = HSMUtils::openHSMDL(aLibPath);
   if (lib && libFunc) {
@@ -36,6 +54,22 @@ int main(int argc, char** argv) {
     std::cout << "Lib not loaded!" << std::endl;
   }
 
+  if (aScenario) {
+    aScenario->print(std::cout);
+    WorkloadRunner aRunner(libFunc, aSlotLabel, aSlotPwd, aScenario.value());
+    auto aReport = aRunner.run();
+    HSMUtils::closeHSMDL(lib, libFunc);
+    if (not aReport) {
+      std::cout << "Could not run the scenario." << std::endl;
+      return 7;
+    }
+    aReport->print(std::cout);
+    if (aAllocations) {
+      aAllocations->print(std::cout);
+    }
+    return 0;
+  }
+
   // opening session
   auto aSession = HSMUtils::openSession(libFunc, aSlotLabel);
   if (not aSession) {
@@ -53,19 +87,13 @@ int main(int argc, char** argv) {
   std::cout << "Login successful." << std::endl;
 
   static std::string aMasterKey = "MASTER_KEY"s;
-  // Retrieve Key and if does not exist generate
-  auto keyRetrieval = HSMUtils::retrieveKeyHandle(libFunc, aSession.value(), aMasterKey);
+  // Retrieve Key and if does not exist generate (a single find/generate even with concurrent callers)
+  auto keyRetrieval = HSMUtils::getOrCreateKey(libFunc, aSession.value(), aMasterKey);
   if (not keyRetrieval) {
-    std::cout << "Could not retrieve key Handle." <<std::endl;
-    keyRetrieval = HSMUtils::generateKey(libFunc, aSession.value(), aMasterKey);
-    if (not keyRetrieval) {
-      std::cout << "Could not generate missing key." <<std::endl;
-      return 3;
-    }
-    std::cout << "Generated Key with handle: " << aMasterKey << std::endl;
-  } else {
-    std::cout << "Retrieved existing key with label: " << aMasterKey << std::endl;
+    std::cout << "Could not retrieve nor generate key." <<std::endl;
+    return 3;
   }
+  std::cout << "Retrieved key with label: " << aMasterKey << std::endl;
 
   static std::vector<unsigned char> aPayload{
       0x12, 0x13, 0x21, 0x98, 0x87, 0xFA, 0xAE, 0xA3,
@@ -94,6 +122,10 @@ int main(int argc, char** argv) {
     std::cout << "Successful test" << std::endl;
   }
 
+  if (aAllocations) {
+    aAllocations->print(std::cout);
+  }
+
 
   return 0;
 }
@@ -0,0 +1,494 @@
+#include "mock/MockCrypto.h"
+#include <algorithm>
+#include <cstring>
+
+namespace mock {
+
+namespace {
+
+std::uint8_t xtime(std::uint8_t iByte) {
+  return static_cast<std::uint8_t>((iByte << 1) ^ ((iByte & 0x80u) ? 0x1Bu : 0x00u));
+}
+
+std::uint8_t gmul(std::uint8_t iLeft, std::uint8_t iRight) {
+  std::uint8_t aProduct = 0u;
+  for (; iRight != 0u; iRight >>= 1) {
+    if (iRight & 1u) {
+      aProduct ^= iLeft;
+    }
+    iLeft = xtime(iLeft);
+  }
+  return aProduct;
+}
+
+std::uint32_t rotr8(std::uint32_t iWord) {
+  return (iWord >> 8) | (iWord << 24);
+}
+
+struct AesTables {
+  std::uint8_t sbox[256];
+  std::uint8_t invSbox[256];
+  std::uint32_t te[4][256];
+
+  AesTables() {
+    // walks the multiplicative group with generator 3 and its inverse
+    std::uint8_t p = 1u;
+    std::uint8_t q = 1u;
+    do {
+      p = static_cast<std::uint8_t>(p ^ xtime(p));
+      q = static_cast<std::uint8_t>(q ^ (q << 1));
+      q = static_cast<std::uint8_t>(q ^ (q << 2));
+      q = static_cast<std::uint8_t>(q ^ (q << 4));
+      if (q & 0x80u) {
+        q ^= 0x09u;
+      }
+      auto aRotl = [](std::uint8_t iByte, int iShift) { return static_cast<std::uint8_t>((iByte << iShift) | (iByte >> (8 - iShift))); };
+      sbox[p] = static_cast<std::uint8_t>(q ^ aRotl(q, 1) ^ aRotl(q, 2) ^ aRotl(q, 3) ^ aRotl(q, 4) ^ 0x63u);
+    } while (p != 1u);
+    sbox[0] = 0x63u;
+    for (int i = 0; i < 256; ++i) {
+      invSbox[sbox[i]] = static_cast<std::uint8_t>(i);
+      std::uint8_t s = sbox[i];
+      te[0][i] = (static_cast<std::uint32_t>(xtime(s)) << 24) | (static_cast<std::uint32_t>(s) << 16) | (static_cast<std::uint32_t>(s) << 8) |
+                 static_cast<std::uint32_t>(xtime(s) ^ s);
+      te[1][i] = rotr8(te[0][i]);
+      te[2][i] = rotr8(te[1][i]);
+      te[3][i] = rotr8(te[2][i]);
+    }
+  }
+};
+
+const AesTables gTables;
+
+std::uint32_t loadBe32(const unsigned char* iBytes) {
+  return (static_cast<std::uint32_t>(iBytes[0]) << 24) | (static_cast<std::uint32_t>(iBytes[1]) << 16) |
+         (static_cast<std::uint32_t>(iBytes[2]) << 8) | static_cast<std::uint32_t>(iBytes[3]);
+}
+
+void storeBe32(std::uint32_t iWord, unsigned char* oBytes) {
+  oBytes[0] = static_cast<unsigned char>(iWord >> 24);
+  oBytes[1] = static_cast<unsigned char>(iWord >> 16);
+  oBytes[2] = static_cast<unsigned char>(iWord >> 8);
+  oBytes[3] = static_cast<unsigned char>(iWord);
+}
+
+std::uint64_t loadBe64(const unsigned char* iBytes) {
+  return (static_cast<std::uint64_t>(loadBe32(iBytes)) << 32) | loadBe32(iBytes + 4);
+}
+
+void storeBe64(std::uint64_t iWord, unsigned char* oBytes) {
+  storeBe32(static_cast<std::uint32_t>(iWord >> 32), oBytes);
+  storeBe32(static_cast<std::uint32_t>(iWord), oBytes + 4);
+}
+
+std::uint32_t subWord(std::uint32_t iWord) {
+  return (static_cast<std::uint32_t>(gTables.sbox[iWord >> 24]) << 24) | (static_cast<std::uint32_t>(gTables.sbox[(iWord >> 16) & 0xFFu]) << 16) |
+         (static_cast<std::uint32_t>(gTables.sbox[(iWord >> 8) & 0xFFu]) << 8) | gTables.sbox[iWord & 0xFFu];
+}
+
+// reduction of the 4 bits shifted out of the GHASH accumulator
+const std::uint64_t K_LAST4[16] = { 0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+                                    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0 };
+
+const unsigned char K_WRAP_PAD_IV[4] = { 0xA6, 0x59, 0x59, 0xA6 };
+
+const std::uint32_t K_SHA256[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be,
+  0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa,
+  0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85,
+  0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+  0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+std::uint32_t rotr(std::uint32_t iWord, unsigned iBits) {
+  return (iWord >> iBits) | (iWord << (32u - iBits));
+}
+
+void sha256Block(std::uint32_t* ioState, const unsigned char* iBlock) {
+  std::uint32_t w[64];
+  for (std::size_t i = 0u; i < 16u; ++i) {
+    w[i] = loadBe32(iBlock + 4u * i);
+  }
+  for (std::size_t i = 16u; i < 64u; ++i) {
+    const std::uint32_t s0 = rotr(w[i - 15u], 7u) ^ rotr(w[i - 15u], 18u) ^ (w[i - 15u] >> 3);
+    const std::uint32_t s1 = rotr(w[i - 2u], 17u) ^ rotr(w[i - 2u], 19u) ^ (w[i - 2u] >> 10);
+    w[i]                   = w[i - 16u] + s0 + w[i - 7u] + s1;
+  }
+  std::uint32_t a = ioState[0], b = ioState[1], c = ioState[2], d = ioState[3], e = ioState[4], f = ioState[5], g = ioState[6], h = ioState[7];
+  for (std::size_t i = 0u; i < 64u; ++i) {
+    const std::uint32_t t1 = h + (rotr(e, 6u) ^ rotr(e, 11u) ^ rotr(e, 25u)) + ((e & f) ^ (~e & g)) + K_SHA256[i] + w[i];
+    const std::uint32_t t2 = (rotr(a, 2u) ^ rotr(a, 13u) ^ rotr(a, 22u)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  ioState[0] += a;
+  ioState[1] += b;
+  ioState[2] += c;
+  ioState[3] += d;
+  ioState[4] += e;
+  ioState[5] += f;
+  ioState[6] += g;
+  ioState[7] += h;
+}
+
+// doubling in GF(2^128) for the CMAC subkeys
+void cmacDouble(const unsigned char* iIn, unsigned char* oOut) {
+  const unsigned char aCarry = iIn[0] >> 7;
+  for (std::size_t i = 0u; i < 15u; ++i) {
+    oOut[i] = static_cast<unsigned char>((iIn[i] << 1) | (iIn[i + 1u] >> 7));
+  }
+  oOut[15] = static_cast<unsigned char>((iIn[15] << 1) ^ (aCarry ? 0x87u : 0x00u));
+}
+
+}  // namespace
+
+Aes::Aes(const unsigned char* iKey, std::size_t iKeyLen) {
+  const auto aKeyWords = static_cast<int>(iKeyLen / 4u);
+  mRounds              = aKeyWords + 6;
+  const int aWords     = 4 * (mRounds + 1);
+  for (int i = 0; i < aKeyWords; ++i) {
+    mRoundKeys[i] = loadBe32(iKey + 4 * i);
+  }
+  std::uint8_t aRcon = 1u;
+  for (int i = aKeyWords; i < aWords; ++i) {
+    auto aTemp = mRoundKeys[i - 1];
+    if (i % aKeyWords == 0) {
+      aTemp = subWord((aTemp << 8) | (aTemp >> 24)) ^ (static_cast<std::uint32_t>(aRcon) << 24);
+      aRcon = xtime(aRcon);
+    } else if (aKeyWords > 6 and i % aKeyWords == 4) {
+      aTemp = subWord(aTemp);
+    }
+    mRoundKeys[i] = mRoundKeys[i - aKeyWords] ^ aTemp;
+  }
+}
+
+void Aes::encryptBlock(const unsigned char* iIn, unsigned char* oOut) const {
+  const auto& te = gTables.te;
+  const auto* rk = mRoundKeys.data();
+  std::uint32_t s0 = loadBe32(iIn) ^ rk[0];
+  std::uint32_t s1 = loadBe32(iIn + 4) ^ rk[1];
+  std::uint32_t s2 = loadBe32(iIn + 8) ^ rk[2];
+  std::uint32_t s3 = loadBe32(iIn + 12) ^ rk[3];
+  for (int r = 1; r < mRounds; ++r) {
+    rk += 4;
+    auto t0 = te[0][s0 >> 24] ^ te[1][(s1 >> 16) & 0xFFu] ^ te[2][(s2 >> 8) & 0xFFu] ^ te[3][s3 & 0xFFu] ^ rk[0];
+    auto t1 = te[0][s1 >> 24] ^ te[1][(s2 >> 16) & 0xFFu] ^ te[2][(s3 >> 8) & 0xFFu] ^ te[3][s0 & 0xFFu] ^ rk[1];
+    auto t2 = te[0][s2 >> 24] ^ te[1][(s3 >> 16) & 0xFFu] ^ te[2][(s0 >> 8) & 0xFFu] ^ te[3][s1 & 0xFFu] ^ rk[2];
+    auto t3 = te[0][s3 >> 24] ^ te[1][(s0 >> 16) & 0xFFu] ^ te[2][(s1 >> 8) & 0xFFu] ^ te[3][s2 & 0xFFu] ^ rk[3];
+    s0 = t0;
+    s1 = t1;
+    s2 = t2;
+    s3 = t3;
+  }
+  rk += 4;
+  const auto* sb  = gTables.sbox;
+  auto aLastRound = [sb](std::uint32_t a, std::uint32_t b, std::uint32_t c, std::uint32_t d) {
+    return (static_cast<std::uint32_t>(sb[a >> 24]) << 24) | (static_cast<std::uint32_t>(sb[(b >> 16) & 0xFFu]) << 16) |
+           (static_cast<std::uint32_t>(sb[(c >> 8) & 0xFFu]) << 8) | sb[d & 0xFFu];
+  };
+  storeBe32(aLastRound(s0, s1, s2, s3) ^ rk[0], oOut);
+  storeBe32(aLastRound(s1, s2, s3, s0) ^ rk[1], oOut + 4);
+  storeBe32(aLastRound(s2, s3, s0, s1) ^ rk[2], oOut + 8);
+  storeBe32(aLastRound(s3, s0, s1, s2) ^ rk[3], oOut + 12);
+}
+
+void Aes::decryptBlock(const unsigned char* iIn, unsigned char* oOut) const {
+  // state[row + 4 * column], as the input bytes
+  unsigned char aState[16];
+  auto aAddRoundKey = [this, &aState](int iRound) {
+    for (int c = 0; c < 4; ++c) {
+      auto aWord = mRoundKeys[4 * iRound + c];
+      for (int r = 0; r < 4; ++r) {
+        aState[r + 4 * c] ^= static_cast<unsigned char>(aWord >> (24 - 8 * r));
+      }
+    }
+  };
+  auto aInvShiftSub = [&aState]() {
+    unsigned char aOld[16];
+    std::memcpy(aOld, aState, sizeof(aOld));
+    for (int r = 0; r < 4; ++r) {
+      for (int c = 0; c < 4; ++c) {
+        aState[r + 4 * c] = gTables.invSbox[aOld[r + 4 * ((c - r + 4) % 4)]];
+      }
+    }
+  };
+  std::memcpy(aState, iIn, sizeof(aState));
+  aAddRoundKey(mRounds);
+  for (int aRound = mRounds - 1; aRound > 0; --aRound) {
+    aInvShiftSub();
+    aAddRoundKey(aRound);
+    for (int c = 0; c < 4; ++c) {
+      auto* a = aState + 4 * c;
+      std::uint8_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+      a[0] = gmul(a0, 14) ^ gmul(a1, 11) ^ gmul(a2, 13) ^ gmul(a3, 9);
+      a[1] = gmul(a0, 9) ^ gmul(a1, 14) ^ gmul(a2, 11) ^ gmul(a3, 13);
+      a[2] = gmul(a0, 13) ^ gmul(a1, 9) ^ gmul(a2, 14) ^ gmul(a3, 11);
+      a[3] = gmul(a0, 11) ^ gmul(a1, 13) ^ gmul(a2, 9) ^ gmul(a3, 14);
+    }
+  }
+  aInvShiftSub();
+  aAddRoundKey(0);
+  std::memcpy(oOut, aState, sizeof(aState));
+}
+
+Gcm::Gcm(const Aes& iAes, const unsigned char* iIv, std::size_t iIvLen, const unsigned char* iAad, std::size_t iAadLen)
+    : mAes(iAes), mAadLen(iAadLen) {
+  unsigned char aH[16] = {};
+  mAes.encryptBlock(aH, aH);
+  std::uint64_t vh = loadBe64(aH);
+  std::uint64_t vl = loadBe64(aH + 8);
+  mHL[0] = mHH[0] = 0u;
+  mHL[8] = vl;
+  mHH[8] = vh;
+  for (int i = 4; i > 0; i >>= 1) {
+    std::uint64_t aReduce = (vl & 1u) * 0xe1000000u;
+    vl     = (vh << 63) | (vl >> 1);
+    vh     = (vh >> 1) ^ (aReduce << 32);
+    mHL[i] = vl;
+    mHH[i] = vh;
+  }
+  for (int i = 2; i <= 8; i *= 2) {
+    for (int j = 1; j < i; ++j) {
+      mHH[i + j] = mHH[i] ^ mHH[j];
+      mHL[i + j] = mHL[i] ^ mHL[j];
+    }
+  }
+
+  if (iIvLen == 12u) {
+    std::memcpy(mJ0, iIv, 12u);
+    storeBe32(1u, mJ0 + 12);
+  } else {
+    ghashBytes(iIv, iIvLen);
+    unsigned char aLengths[16] = {};
+    storeBe64(static_cast<std::uint64_t>(iIvLen) * 8u, aLengths + 8);
+    ghash(aLengths);
+    std::memcpy(mJ0, mHash, sizeof(mJ0));
+    std::memset(mHash, 0, sizeof(mHash));
+  }
+  std::memcpy(mCounter, mJ0, sizeof(mCounter));
+  ghashBytes(iAad, iAadLen);
+}
+
+void Gcm::ghash(const unsigned char* iBlock) {
+  unsigned char x[16];
+  for (int i = 0; i < 16; ++i) {
+    x[i] = mHash[i] ^ iBlock[i];
+  }
+  unsigned lo = x[15] & 0xFu;
+  std::uint64_t zh = mHH[lo];
+  std::uint64_t zl = mHL[lo];
+  for (int i = 15; i >= 0; --i) {
+    lo          = x[i] & 0xFu;
+    unsigned hi = (x[i] >> 4) & 0xFu;
+    if (i != 15) {
+      auto aRem = zl & 0xFu;
+      zl        = (zh << 60) | (zl >> 4);
+      zh        = (zh >> 4) ^ (K_LAST4[aRem] << 48) ^ mHH[lo];
+      zl ^= mHL[lo];
+    }
+    auto aRem = zl & 0xFu;
+    zl        = (zh << 60) | (zl >> 4);
+    zh        = (zh >> 4) ^ (K_LAST4[aRem] << 48) ^ mHH[hi];
+    zl ^= mHL[hi];
+  }
+  storeBe64(zh, mHash);
+  storeBe64(zl, mHash + 8);
+}
+
+void Gcm::ghashBytes(const unsigned char* iData, std::size_t iLen) {
+  for (; iLen >= 16u; iData += 16, iLen -= 16u) {
+    ghash(iData);
+  }
+  if (iLen > 0u) {
+    unsigned char aBlock[16] = {};
+    std::memcpy(aBlock, iData, iLen);
+    ghash(aBlock);
+  }
+}
+
+void Gcm::ctr(const unsigned char* iIn, std::size_t iLen, unsigned char* oOut) {
+  for (std::size_t i = 0u; i < iLen; ++i) {
+    if (mKeyStreamUsed == 16u) {
+      storeBe32(loadBe32(mCounter + 12) + 1u, mCounter + 12);
+      mAes.encryptBlock(mCounter, mKeyStream);
+      mKeyStreamUsed = 0u;
+    }
+    oOut[i] = iIn[i] ^ mKeyStream[mKeyStreamUsed++];
+  }
+  mDataLen += iLen;
+}
+
+void Gcm::encrypt(const unsigned char* iIn, std::size_t iLen, unsigned char* oOut) {
+  ctr(iIn, iLen, oOut);
+  const unsigned char* aCipher = oOut;
+  // the ciphertext is hashed by whole blocks, keep the remainder for the next call
+  while (iLen > 0u) {
+    auto aTake = std::min(iLen, 16u - mPendingLen);
+    std::memcpy(mPending + mPendingLen, aCipher, aTake);
+    mPendingLen += aTake;
+    aCipher += aTake;
+    iLen -= aTake;
+    if (mPendingLen == 16u) {
+      ghash(mPending);
+      mPendingLen = 0u;
+    }
+  }
+}
+
+void Gcm::decrypt(const unsigned char* iIn, std::size_t iLen, unsigned char* oOut) {
+  const unsigned char* aCipher = iIn;
+  std::size_t aLeft            = iLen;
+  while (aLeft > 0u) {
+    auto aTake = std::min(aLeft, 16u - mPendingLen);
+    std::memcpy(mPending + mPendingLen, aCipher, aTake);
+    mPendingLen += aTake;
+    aCipher += aTake;
+    aLeft -= aTake;
+    if (mPendingLen == 16u) {
+      ghash(mPending);
+      mPendingLen = 0u;
+    }
+  }
+  ctr(iIn, iLen, oOut);
+}
+
+void Gcm::finish(unsigned char* oTag, std::size_t iTagLen) {
+  if (mPendingLen > 0u) {
+    std::memset(mPending + mPendingLen, 0, 16u - mPendingLen);
+    ghash(mPending);
+    mPendingLen = 0u;
+  }
+  unsigned char aLengths[16];
+  storeBe64(mAadLen * 8u, aLengths);
+  storeBe64(mDataLen * 8u, aLengths + 8);
+  ghash(aLengths);
+  unsigned char aTag[16];
+  mAes.encryptBlock(mJ0, aTag);
+  for (std::size_t i = 0u; i < std::min<std::size_t>(iTagLen, 16u); ++i) {
+    oTag[i] = aTag[i] ^ mHash[i];
+  }
+}
+
+std::vector<unsigned char> wrapKeyPad(const Aes& iAes, const std::vector<unsigned char>& iKey) {
+  const std::size_t aBlocks = (iKey.size() + 7u) / 8u;
+  std::vector<unsigned char> aOut(8u + aBlocks * 8u, 0u);
+  std::memcpy(aOut.data(), K_WRAP_PAD_IV, 4u);
+  storeBe32(static_cast<std::uint32_t>(iKey.size()), aOut.data() + 4);
+  std::copy(iKey.begin(), iKey.end(), aOut.begin() + 8);
+
+  unsigned char aBlock[16];
+  if (aBlocks == 1u) {
+    iAes.encryptBlock(aOut.data(), aOut.data());
+    return aOut;
+  }
+  // RFC 3394 wrapping, A is aOut[0..8), R[i] is aOut[8 * i..8 * i + 8)
+  for (std::uint64_t j = 0u; j < 6u; ++j) {
+    for (std::size_t i = 1u; i <= aBlocks; ++i) {
+      std::memcpy(aBlock, aOut.data(), 8u);
+      std::memcpy(aBlock + 8, aOut.data() + 8u * i, 8u);
+      iAes.encryptBlock(aBlock, aBlock);
+      storeBe64(loadBe64(aBlock) ^ (aBlocks * j + i), aOut.data());
+      std::memcpy(aOut.data() + 8u * i, aBlock + 8, 8u);
+    }
+  }
+  return aOut;
+}
+
+std::optional<std::vector<unsigned char>> unwrapKeyPad(const Aes& iAes, const std::vector<unsigned char>& iWrapped) {
+  if (iWrapped.size() < 16u or iWrapped.size() % 8u != 0u) {
+    return {};
+  }
+  std::vector<unsigned char> aOut(iWrapped);
+  const std::size_t aBlocks = aOut.size() / 8u - 1u;
+  unsigned char aBlock[16];
+  if (aBlocks == 1u) {
+    iAes.decryptBlock(aOut.data(), aOut.data());
+  } else {
+    for (std::uint64_t j = 6u; j-- > 0u;) {
+      for (std::size_t i = aBlocks; i >= 1u; --i) {
+        storeBe64(loadBe64(aOut.data()) ^ (aBlocks * j + i), aBlock);
+        std::memcpy(aBlock + 8, aOut.data() + 8u * i, 8u);
+        iAes.decryptBlock(aBlock, aBlock);
+        std::memcpy(aOut.data(), aBlock, 8u);
+        std::memcpy(aOut.data() + 8u * i, aBlock + 8, 8u);
+      }
+    }
+  }
+  if (std::memcmp(aOut.data(), K_WRAP_PAD_IV, 4u) != 0) {
+    return {};
+  }
+  const std::size_t aKeyLen = loadBe32(aOut.data() + 4);
+  if (aKeyLen > aBlocks * 8u or aKeyLen <= (aBlocks - 1u) * 8u) {
+    return {};
+  }
+  if (std::any_of(aOut.begin() + 8 + static_cast<std::ptrdiff_t>(aKeyLen), aOut.end(), [](unsigned char c) { return c != 0u; })) {
+    return {};
+  }
+  return std::vector<unsigned char>(aOut.begin() + 8, aOut.begin() + 8 + static_cast<std::ptrdiff_t>(aKeyLen));
+}
+
+std::array<unsigned char, 16> cmac(const Aes& iAes, const unsigned char* iData, std::size_t iLen) {
+  unsigned char aL[16] = {};
+  unsigned char aK1[16];
+  unsigned char aK2[16];
+  iAes.encryptBlock(aL, aL);
+  cmacDouble(aL, aK1);
+  cmacDouble(aK1, aK2);
+
+  // every block but the last one is chained as is, the last one is masked with K1 (complete) or K2 (padded)
+  std::array<unsigned char, 16> aMac{};
+  const std::size_t aBlocks = iLen == 0u ? 1u : (iLen + 15u) / 16u;
+  for (std::size_t b = 0u; b + 1u < aBlocks; ++b) {
+    for (std::size_t i = 0u; i < 16u; ++i) {
+      aMac[i] ^= iData[16u * b + i];
+    }
+    iAes.encryptBlock(aMac.data(), aMac.data());
+  }
+  const std::size_t aLastLen = iLen - 16u * (aBlocks - 1u);
+  unsigned char aLast[16]    = {};
+  std::memcpy(aLast, iData + 16u * (aBlocks - 1u), aLastLen);
+  const unsigned char* aMask = aK1;
+  if (aLastLen < 16u) {
+    aLast[aLastLen] = 0x80u;
+    aMask           = aK2;
+  }
+  for (std::size_t i = 0u; i < 16u; ++i) {
+    aMac[i] ^= aLast[i] ^ aMask[i];
+  }
+  iAes.encryptBlock(aMac.data(), aMac.data());
+  return aMac;
+}
+
+std::array<unsigned char, 32> sha256(const unsigned char* iData, std::size_t iLen) {
+  std::uint32_t aState[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+  std::size_t aDone = 0u;
+  for (; aDone + 64u <= iLen; aDone += 64u) {
+    sha256Block(aState, iData + aDone);
+  }
+  // padding: 0x80, zeros, then the length in bits on 8 bytes, over one or two blocks
+  unsigned char aTail[128] = {};
+  const std::size_t aRest  = iLen - aDone;
+  if (aRest > 0u) {
+    std::memcpy(aTail, iData + aDone, aRest);
+  }
+  aTail[aRest]                = 0x80u;
+  const std::size_t aTailSize = aRest < 56u ? 64u : 128u;
+  storeBe64(static_cast<std::uint64_t>(iLen) * 8u, aTail + aTailSize - 8u);
+  for (std::size_t b = 0u; b < aTailSize; b += 64u) {
+    sha256Block(aState, aTail + b);
+  }
+  std::array<unsigned char, 32> aDigest;
+  for (std::size_t i = 0u; i < 8u; ++i) {
+    storeBe32(aState[i], aDigest.data() + 4u * i);
+  }
+  return aDigest;
+}
+
+}  // namespace mock
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace mock {
+
+/**
+ * Software AES (FIPS 197) for the mock PKCS#11 module: table based encryption, byte oriented decryption (only
+ * used to unwrap keys). Not constant time, not meant to protect anything.
+ */
+class Aes {
+ public:
+  /**
+   * @param iKey - 16, 24 or 32 bytes
+   * @param iKeyLen - the key length
+   */
+  Aes(const unsigned char* iKey, std::size_t iKeyLen);
+
+  void encryptBlock(const unsigned char* iIn, unsigned char* oOut) const;
+  void decryptBlock(const unsigned char* iIn, unsigned char* oOut) const;
+
+ private:
+  std::array<std::uint32_t, 60> mRoundKeys{};
+  int mRounds;
+};
+
+/**
+ * Streaming AES-GCM (NIST SP 800-38D), any IV length, GHASH with 4-bit tables
+ */
+class Gcm {
+ public:
+  Gcm(const Aes& iAes, const unsigned char* iIv, std::size_t iIvLen, const unsigned char* iAad, std::size_t iAadLen);
+
+  /**
+   * Encrypts (or decrypts) iLen bytes, may be called several times
+   */
+  void encrypt(const unsigned char* iIn, std::size_t iLen, unsigned char* oOut);
+  void decrypt(const unsigned char* iIn, std::size_t iLen, unsigned char* oOut);
+
+  /**
+   * @param oTag - receives iTagLen bytes (at most 16) of the tag
+   */
+  void finish(unsigned char* oTag, std::size_t iTagLen);
+
+ private:
+  void ghash(const unsigned char* iBlock);
+  void ghashBytes(const unsigned char* iData, std::size_t iLen);
+  void ctr(const unsigned char* iIn, std::size_t iLen, unsigned char* oOut);
+
+  const Aes& mAes;
+  std::uint64_t mHL[16];
+  std::uint64_t mHH[16];
+  unsigned char mJ0[16];
+  unsigned char mCounter[16];
+  unsigned char mKeyStream[16];
+  std::size_t mKeyStreamUsed = 16u;
+  unsigned char mHash[16] = {};
+  // partial block of ciphertext not hashed yet
+  unsigned char mPending[16];
+  std::size_t mPendingLen = 0u;
+  std::uint64_t mAadLen;
+  std::uint64_t mDataLen = 0u;
+};
+
+/**
+ * AES key wrap with padding (RFC 5649), as CKM_AES_KEY_WRAP_PAD
+ */
+std::vector<unsigned char> wrapKeyPad(const Aes& iAes, const std::vector<unsigned char>& iKey);
+
+/**
+ * @return the key, empty optional if the integrity check fails
+ */
+std::optional<std::vector<unsigned char>> unwrapKeyPad(const Aes& iAes, const std::vector<unsigned char>& iWrapped);
+
+/**
+ * AES-CMAC (NIST SP 800-38B, RFC 4493), as CKM_AES_CMAC
+ */
+std::array<unsigned char, 16> cmac(const Aes& iAes, const unsigned char* iData, std::size_t iLen);
+
+/**
+ * SHA-256 (FIPS 180-4), as CKM_SHA256
+ */
+std::array<unsigned char, 32> sha256(const unsigned char* iData, std::size_t iLen);
+
+}  // namespace mock
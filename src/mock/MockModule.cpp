@@ -0,0 +1,1426 @@
+#include "hsm/cryptoki.h"
+#include "mock/MockCrypto.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Mock PKCS#11 module for benchmarking the wrappers without an HSM: the subset of the API HSMUtils uses, with
+// the objects kept in memory and AES done in software. Every call can be given a fixed cost (busy wait by
+// default) to stand in for the round trip to a real device. Configured from the environment at C_Initialize:
+//
+//   MOCK_PKCS11_TOKENS             label:pin of each slot, comma separated (default FKH:1234)
+//   MOCK_PKCS11_MAX_SESSIONS       sessions per token, 0 for no limit (default)
+//   MOCK_PKCS11_MAX_RW_SESSIONS    read-write sessions per token, 0 for no limit (default)
+//   MOCK_PKCS11_COST_US            cost of every call in microseconds, fractions allowed (default 0)
+//   MOCK_PKCS11_COST_US_<function> cost of one function, e.g. MOCK_PKCS11_COST_US_C_Encrypt=50
+//   MOCK_PKCS11_COST_MODE          spin (default) or sleep
+//
+// Token objects live as long as the library stays loaded, they survive C_Finalize / C_Initialize.
+
+namespace {
+
+enum class Fn : std::size_t {
+#define CK_PKCS11_FUNCTION_INFO(name) name,
+#include "hsm/pkcs11_v2_40/pkcs11f.h"
+#undef CK_PKCS11_FUNCTION_INFO
+  Count
+};
+
+const char* const K_FUNCTION_NAMES[] = {
+#define CK_PKCS11_FUNCTION_INFO(name) #name,
+#include "hsm/pkcs11_v2_40/pkcs11f.h"
+#undef CK_PKCS11_FUNCTION_INFO
+};
+
+constexpr const std::size_t K_FUNCTION_COUNT = static_cast<std::size_t>(Fn::Count);
+
+// per function cost in nanoseconds, set at C_Initialize
+std::array<std::atomic<std::int64_t>, K_FUNCTION_COUNT> gCosts{};
+std::atomic<bool> gSleep{ false };
+
+void pay(Fn iFunction) {
+  const auto aCost = std::chrono::nanoseconds(gCosts[static_cast<std::size_t>(iFunction)].load(std::memory_order_relaxed));
+  if (aCost.count() <= 0) {
+    return;
+  }
+  if (gSleep.load(std::memory_order_relaxed)) {
+    std::this_thread::sleep_for(aCost);
+    return;
+  }
+  // a device round trip keeps the caller's core busy in most drivers, and sleeps are too coarse below ~50us
+  const auto aEnd = std::chrono::steady_clock::now() + aCost;
+  while (std::chrono::steady_clock::now() < aEnd) {
+  }
+}
+
+using Attributes = std::map<CK_ATTRIBUTE_TYPE, std::vector<unsigned char>>;
+
+struct Object {
+  CK_SLOT_ID slot;
+  // session that created a session object, CK_INVALID_HANDLE for token objects
+  CK_SESSION_HANDLE session;
+  Attributes attributes;
+};
+
+struct CipherOperation {
+  // on the heap, the Gcm context keeps a reference
+  std::unique_ptr<mock::Aes> aes;
+  std::vector<unsigned char> iv;
+  std::vector<unsigned char> aad;
+  std::size_t tagLen;
+  // multi-part encryption, started by the first C_EncryptUpdate
+  std::unique_ptr<mock::Gcm> stream;
+};
+
+struct Session {
+  CK_SESSION_HANDLE handle;
+  CK_SLOT_ID slot;
+  CK_FLAGS flags;
+  // PKCS#11 sessions are not meant to be shared by threads, concurrent calls are serialized
+  std::mutex mutex;
+  std::optional<std::vector<CK_OBJECT_HANDLE>> found;
+  std::size_t foundNext = 0u;
+  std::optional<CipherOperation> encrypt;
+  std::optional<CipherOperation> decrypt;
+  // CKM_AES_CMAC key of an active C_SignInit
+  std::unique_ptr<mock::Aes> sign;
+  // CKM_SHA256 only, nothing to keep but the state
+  bool digest = false;
+};
+
+struct Token {
+  std::string label;
+  std::string pin;
+  bool loggedIn          = false;
+  CK_ULONG sessions      = 0u;
+  CK_ULONG rwSessions    = 0u;
+  CK_ULONG maxSessions   = 0u;
+  CK_ULONG maxRwSessions = 0u;
+};
+
+struct Module {
+  std::shared_mutex mutex;
+  bool initialized = false;
+  // slot id is the index
+  std::vector<Token> tokens;
+  std::unordered_map<CK_SESSION_HANDLE, std::shared_ptr<Session>> sessions;
+  // copy on write: C_SetAttributeValue swaps the object, readers keep the version they found
+  std::unordered_map<CK_OBJECT_HANDLE, std::shared_ptr<const Object>> objects;
+  CK_SESSION_HANDLE nextSession = 1u;
+  CK_OBJECT_HANDLE nextObject   = 1u;
+};
+
+Module gModule;
+
+std::string env(const std::string& iName, const std::string& iDefault) {
+  const char* aValue = std::getenv(iName.c_str());
+  return aValue ? std::string(aValue) : iDefault;
+}
+
+std::vector<Token> parseTokens(const std::string& iSpec) {
+  std::vector<Token> aTokens;
+  std::istringstream aStream(iSpec);
+  std::string aEntry;
+  while (std::getline(aStream, aEntry, ',')) {
+    if (aEntry.empty()) {
+      continue;
+    }
+    auto aColon = aEntry.find(':');
+    Token aToken;
+    aToken.label = aEntry.substr(0, aColon);
+    aToken.pin   = aColon == std::string::npos ? std::string() : aEntry.substr(aColon + 1);
+    aTokens.push_back(std::move(aToken));
+  }
+  return aTokens;
+}
+
+void loadCosts() {
+  const auto aDefault = env("MOCK_PKCS11_COST_US", "0");
+  for (std::size_t i = 0u; i < K_FUNCTION_COUNT; ++i) {
+    auto aUs = std::atof(env(std::string("MOCK_PKCS11_COST_US_") + K_FUNCTION_NAMES[i], aDefault).c_str());
+    gCosts[i].store(static_cast<std::int64_t>(aUs * 1000.0), std::memory_order_relaxed);
+  }
+  gSleep = env("MOCK_PKCS11_COST_MODE", "spin") == "sleep";
+}
+
+void randomBytes(unsigned char* oBytes, std::size_t iLen) {
+  thread_local std::mt19937_64 aEngine{ std::random_device{}() };
+  for (std::size_t i = 0u; i < iLen; ++i) {
+    oBytes[i] = static_cast<unsigned char>(aEngine());
+  }
+}
+
+void padded(unsigned char* oField, std::size_t iSize, const std::string& iValue) {
+  std::memset(oField, ' ', iSize);
+  std::memcpy(oField, iValue.data(), std::min(iSize, iValue.size()));
+}
+
+template <typename T>
+std::vector<unsigned char> scalar(T iValue) {
+  std::vector<unsigned char> aBytes(sizeof(T));
+  std::memcpy(aBytes.data(), &iValue, sizeof(T));
+  return aBytes;
+}
+
+bool flag(const Attributes& iAttributes, CK_ATTRIBUTE_TYPE iType, bool iDefault) {
+  auto aIt = iAttributes.find(iType);
+  return aIt == iAttributes.end() or aIt->second.empty() ? iDefault : aIt->second.front() != CK_FALSE;
+}
+
+std::optional<CK_ULONG> ulong(const Attributes& iAttributes, CK_ATTRIBUTE_TYPE iType) {
+  auto aIt = iAttributes.find(iType);
+  if (aIt == iAttributes.end() or aIt->second.size() != sizeof(CK_ULONG)) {
+    return {};
+  }
+  CK_ULONG aValue;
+  std::memcpy(&aValue, aIt->second.data(), sizeof(aValue));
+  return aValue;
+}
+
+void setDefault(Attributes& ioAttributes, CK_ATTRIBUTE_TYPE iType, std::vector<unsigned char> iValue) {
+  ioAttributes.emplace(iType, std::move(iValue));
+}
+
+CK_RV merge(Attributes& ioAttributes, CK_ATTRIBUTE_PTR iTemplate, CK_ULONG iCount) {
+  if (iTemplate == nullptr and iCount > 0u) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  for (CK_ULONG i = 0u; i < iCount; ++i) {
+    const auto& aAttribute = iTemplate[i];
+    if (aAttribute.pValue == nullptr and aAttribute.ulValueLen > 0u) {
+      return CKR_ATTRIBUTE_VALUE_INVALID;
+    }
+    const auto* aValue                = static_cast<const unsigned char*>(aAttribute.pValue);
+    ioAttributes[aAttribute.type] = std::vector<unsigned char>(aValue, aValue + aAttribute.ulValueLen);
+  }
+  return CKR_OK;
+}
+
+void secretKeyDefaults(Attributes& ioAttributes) {
+  setDefault(ioAttributes, CKA_CLASS, scalar<CK_OBJECT_CLASS>(CKO_SECRET_KEY));
+  setDefault(ioAttributes, CKA_TOKEN, scalar<CK_BBOOL>(CK_FALSE));
+  setDefault(ioAttributes, CKA_PRIVATE, scalar<CK_BBOOL>(CK_TRUE));
+  setDefault(ioAttributes, CKA_MODIFIABLE, scalar<CK_BBOOL>(CK_TRUE));
+  setDefault(ioAttributes, CKA_LABEL, {});
+  setDefault(ioAttributes, CKA_ID, {});
+  setDefault(ioAttributes, CKA_SENSITIVE, scalar<CK_BBOOL>(CK_FALSE));
+  // extractable unless said otherwise, so that replication can be benchmarked on generated keys
+  setDefault(ioAttributes, CKA_EXTRACTABLE, scalar<CK_BBOOL>(CK_TRUE));
+  for (auto aUsage : { CKA_ENCRYPT, CKA_DECRYPT, CKA_WRAP, CKA_UNWRAP, CKA_SIGN, CKA_VERIFY }) {
+    setDefault(ioAttributes, aUsage, scalar<CK_BBOOL>(CK_TRUE));
+  }
+}
+
+// attributes C_SetAttributeValue / C_CopyObject may not change
+bool readOnlyAttribute(CK_ATTRIBUTE_TYPE iType) {
+  return iType == CKA_CLASS or iType == CKA_KEY_TYPE or iType == CKA_VALUE or iType == CKA_VALUE_LEN;
+}
+
+CK_RV checkInitialized() {
+  return gModule.initialized ? CKR_OK : CKR_CRYPTOKI_NOT_INITIALIZED;
+}
+
+CK_RV findSession(CK_SESSION_HANDLE iHandle, std::shared_ptr<Session>& oSession) {
+  std::shared_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (not gModule.initialized) {
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  }
+  auto aIt = gModule.sessions.find(iHandle);
+  if (aIt == gModule.sessions.end()) {
+    return CKR_SESSION_HANDLE_INVALID;
+  }
+  oSession = aIt->second;
+  return CKR_OK;
+}
+
+// the object if it exists on the slot of the session and is visible in the login state; module lock held
+std::shared_ptr<const Object> visibleObjectLocked(const Session& iSession, CK_OBJECT_HANDLE iHandle) {
+  auto aIt = gModule.objects.find(iHandle);
+  if (aIt == gModule.objects.end() or aIt->second->slot != iSession.slot) {
+    return nullptr;
+  }
+  if (flag(aIt->second->attributes, CKA_PRIVATE, true) and not gModule.tokens[iSession.slot].loggedIn) {
+    return nullptr;
+  }
+  return aIt->second;
+}
+
+std::shared_ptr<const Object> visibleObject(const Session& iSession, CK_OBJECT_HANDLE iHandle) {
+  std::shared_lock<std::shared_mutex> aLock(gModule.mutex);
+  return visibleObjectLocked(iSession, iHandle);
+}
+
+CK_RV storeObject(const Session& iSession, Attributes iAttributes, CK_OBJECT_HANDLE& oHandle) {
+  const bool aToken = flag(iAttributes, CKA_TOKEN, false);
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (aToken and not(iSession.flags & CKF_RW_SESSION)) {
+    return CKR_SESSION_READ_ONLY;
+  }
+  if (flag(iAttributes, CKA_PRIVATE, true) and not gModule.tokens[iSession.slot].loggedIn) {
+    return CKR_USER_NOT_LOGGED_IN;
+  }
+  auto aObject = std::make_shared<Object>(Object{ iSession.slot, aToken ? CK_INVALID_HANDLE : iSession.handle, std::move(iAttributes) });
+  oHandle      = gModule.nextObject++;
+  gModule.objects.emplace(oHandle, std::move(aObject));
+  return CKR_OK;
+}
+
+bool matches(const Attributes& iAttributes, const Attributes& iTemplate) {
+  for (const auto& aCriterion : iTemplate) {
+    auto aIt = iAttributes.find(aCriterion.first);
+    if (aIt == iAttributes.end() or aIt->second != aCriterion.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// removes the session and its session objects, logs out when it was the last session of the token; lock held
+void closeSessionLocked(std::unordered_map<CK_SESSION_HANDLE, std::shared_ptr<Session>>::iterator iSession) {
+  const auto aHandle = iSession->first;
+  auto& aToken       = gModule.tokens[iSession->second->slot];
+  --aToken.sessions;
+  if (iSession->second->flags & CKF_RW_SESSION) {
+    --aToken.rwSessions;
+  }
+  if (aToken.sessions == 0u) {
+    aToken.loggedIn = false;
+  }
+  gModule.sessions.erase(iSession);
+  for (auto aIt = gModule.objects.begin(); aIt != gModule.objects.end();) {
+    aIt = aIt->second->session == aHandle ? gModule.objects.erase(aIt) : std::next(aIt);
+  }
+}
+
+std::optional<std::vector<unsigned char>> keyValue(const Object& iKey) {
+  auto aClass   = ulong(iKey.attributes, CKA_CLASS);
+  auto aKeyType = ulong(iKey.attributes, CKA_KEY_TYPE);
+  auto aValue   = iKey.attributes.find(CKA_VALUE);
+  if (aClass != CKO_SECRET_KEY or aKeyType != CKK_AES or aValue == iKey.attributes.end()) {
+    return {};
+  }
+  return aValue->second;
+}
+
+// mock::Aes only takes AES-128, 192 and 256 keys, a value of any other length may come from C_CreateObject or C_UnwrapKey
+bool aesKeyLength(std::size_t iLength) {
+  return iLength == 16u or iLength == 24u or iLength == 32u;
+}
+
+CK_RV cipherInit(Fn iFunction, CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey) {
+  pay(iFunction);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pMechanism == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  const bool aEncrypt = iFunction == Fn::C_EncryptInit;
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  auto& aOperation = aEncrypt ? aSession->encrypt : aSession->decrypt;
+  if (aOperation) {
+    return CKR_OPERATION_ACTIVE;
+  }
+  if (pMechanism->mechanism != CKM_AES_GCM) {
+    return CKR_MECHANISM_INVALID;
+  }
+  if (pMechanism->pParameter == nullptr or pMechanism->ulParameterLen != sizeof(CK_AES_GCM_PARAMS)) {
+    return CKR_MECHANISM_PARAM_INVALID;
+  }
+  const auto& aParams = *static_cast<const CK_AES_GCM_PARAMS*>(pMechanism->pParameter);
+  if (aParams.pIv == nullptr or aParams.ulIvLen == 0u or (aParams.pAAD == nullptr and aParams.ulAADLen > 0u)
+      or aParams.ulTagBits == 0u or aParams.ulTagBits > 128u or aParams.ulTagBits % 8u != 0u) {
+    return CKR_MECHANISM_PARAM_INVALID;
+  }
+
+  auto aKey = visibleObject(*aSession, hKey);
+  if (not aKey) {
+    return CKR_KEY_HANDLE_INVALID;
+  }
+  auto aValue = keyValue(*aKey);
+  if (not aValue) {
+    return CKR_KEY_TYPE_INCONSISTENT;
+  }
+  if (not aesKeyLength(aValue->size())) {
+    return CKR_KEY_SIZE_RANGE;
+  }
+  if (not flag(aKey->attributes, aEncrypt ? CKA_ENCRYPT : CKA_DECRYPT, true)) {
+    return CKR_KEY_FUNCTION_NOT_PERMITTED;
+  }
+  CipherOperation aCipher;
+  aCipher.aes = std::make_unique<mock::Aes>(aValue->data(), aValue->size());
+  aCipher.iv.assign(aParams.pIv, aParams.pIv + aParams.ulIvLen);
+  if (aParams.ulAADLen > 0u) {
+    aCipher.aad.assign(aParams.pAAD, aParams.pAAD + aParams.ulAADLen);
+  }
+  aCipher.tagLen = aParams.ulTagBits / 8u;
+  aOperation     = std::move(aCipher);
+  return CKR_OK;
+}
+
+// C_Encrypt / C_Decrypt: a size query (null output) or a too small buffer keep the operation active
+CK_RV cipher(Fn iFunction, CK_SESSION_HANDLE hSession, CK_BYTE_PTR pIn, CK_ULONG ulInLen, CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen) {
+  pay(iFunction);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  const bool aEncrypt = iFunction == Fn::C_Encrypt;
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  auto& aOperation = aEncrypt ? aSession->encrypt : aSession->decrypt;
+  if (not aOperation) {
+    return CKR_OPERATION_NOT_INITIALIZED;
+  }
+  if (pulOutLen == nullptr or (pIn == nullptr and ulInLen > 0u)) {
+    aOperation.reset();
+    return CKR_ARGUMENTS_BAD;
+  }
+  if (aOperation->stream) {
+    // C_Encrypt cannot terminate a multi-part operation
+    return CKR_OPERATION_ACTIVE;
+  }
+  const auto aTagLen = aOperation->tagLen;
+  if (not aEncrypt and ulInLen < aTagLen) {
+    aOperation.reset();
+    return CKR_ENCRYPTED_DATA_LEN_RANGE;
+  }
+  const CK_ULONG aRequired = aEncrypt ? ulInLen + aTagLen : ulInLen - aTagLen;
+  if (pOut == nullptr) {
+    *pulOutLen = aRequired;
+    return CKR_OK;
+  }
+  if (*pulOutLen < aRequired) {
+    *pulOutLen = aRequired;
+    return CKR_BUFFER_TOO_SMALL;
+  }
+
+  mock::Gcm aGcm(*aOperation->aes, aOperation->iv.data(), aOperation->iv.size(), aOperation->aad.data(), aOperation->aad.size());
+  CK_RV aStatus = CKR_OK;
+  if (aEncrypt) {
+    aGcm.encrypt(pIn, ulInLen, pOut);
+    aGcm.finish(pOut + ulInLen, aTagLen);
+  } else {
+    aGcm.decrypt(pIn, aRequired, pOut);
+    unsigned char aTag[16];
+    aGcm.finish(aTag, aTagLen);
+    if (std::memcmp(aTag, pIn + aRequired, aTagLen) != 0) {
+      std::memset(pOut, 0, aRequired);
+      aStatus = CKR_ENCRYPTED_DATA_INVALID;
+    }
+  }
+  *pulOutLen = aRequired;
+  aOperation.reset();
+  return aStatus;
+}
+
+// C_EncryptUpdate (iFinal false) / C_EncryptFinal: GCM outputs each part right away, the final part is the tag
+CK_RV encryptPart(Fn iFunction, CK_SESSION_HANDLE hSession, CK_BYTE_PTR pIn, CK_ULONG ulInLen, CK_BYTE_PTR pOut, CK_ULONG_PTR pulOutLen) {
+  pay(iFunction);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  const bool aFinal = iFunction == Fn::C_EncryptFinal;
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  auto& aOperation = aSession->encrypt;
+  if (not aOperation) {
+    return CKR_OPERATION_NOT_INITIALIZED;
+  }
+  if (pulOutLen == nullptr or (pIn == nullptr and ulInLen > 0u)) {
+    aOperation.reset();
+    return CKR_ARGUMENTS_BAD;
+  }
+  const CK_ULONG aRequired = aFinal ? aOperation->tagLen : ulInLen;
+  if (pOut == nullptr) {
+    *pulOutLen = aRequired;
+    return CKR_OK;
+  }
+  if (*pulOutLen < aRequired) {
+    *pulOutLen = aRequired;
+    return CKR_BUFFER_TOO_SMALL;
+  }
+
+  if (not aOperation->stream) {
+    aOperation->stream = std::make_unique<mock::Gcm>(*aOperation->aes, aOperation->iv.data(), aOperation->iv.size(), aOperation->aad.data(),
+                                                     aOperation->aad.size());
+  }
+  *pulOutLen = aRequired;
+  if (aFinal) {
+    aOperation->stream->finish(pOut, aRequired);
+    aOperation.reset();
+  } else {
+    aOperation->stream->encrypt(pIn, ulInLen, pOut);
+  }
+  return CKR_OK;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// PKCS#11 entry points
+
+template <typename... Args>
+CK_RV notSupported(Args...) {
+  return CKR_FUNCTION_NOT_SUPPORTED;
+}
+
+CK_RV initialize(CK_VOID_PTR) {
+  pay(Fn::C_Initialize);
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (gModule.initialized) {
+    return CKR_CRYPTOKI_ALREADY_INITIALIZED;
+  }
+  loadCosts();
+  gModule.tokens = parseTokens(env("MOCK_PKCS11_TOKENS", "FKH:1234"));
+  const CK_ULONG aMaxSessions   = std::strtoul(env("MOCK_PKCS11_MAX_SESSIONS", "0").c_str(), nullptr, 10);
+  const CK_ULONG aMaxRwSessions = std::strtoul(env("MOCK_PKCS11_MAX_RW_SESSIONS", "0").c_str(), nullptr, 10);
+  for (auto& aToken : gModule.tokens) {
+    aToken.maxSessions   = aMaxSessions;
+    aToken.maxRwSessions = aMaxRwSessions;
+  }
+  gModule.initialized = true;
+  return CKR_OK;
+}
+
+CK_RV finalize(CK_VOID_PTR pReserved) {
+  pay(Fn::C_Finalize);
+  if (pReserved != nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (not gModule.initialized) {
+    return CKR_CRYPTOKI_NOT_INITIALIZED;
+  }
+  while (not gModule.sessions.empty()) {
+    closeSessionLocked(gModule.sessions.begin());
+  }
+  gModule.initialized = false;
+  return CKR_OK;
+}
+
+CK_RV getInfo(CK_INFO_PTR pInfo) {
+  pay(Fn::C_GetInfo);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pInfo == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  pInfo->cryptokiVersion = { 2, 40 };
+  padded(pInfo->manufacturerID, sizeof(pInfo->manufacturerID), "pkcs11_leak_reproducer");
+  pInfo->flags = 0u;
+  padded(pInfo->libraryDescription, sizeof(pInfo->libraryDescription), "Mock PKCS#11 module");
+  pInfo->libraryVersion = { 1, 0 };
+  return CKR_OK;
+}
+
+CK_RV getSlotList(CK_BBOOL, CK_SLOT_ID_PTR pSlotList, CK_ULONG_PTR pulCount) {
+  pay(Fn::C_GetSlotList);
+  std::shared_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pulCount == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  const CK_ULONG aCount = gModule.tokens.size();
+  if (pSlotList == nullptr) {
+    *pulCount = aCount;
+    return CKR_OK;
+  }
+  if (*pulCount < aCount) {
+    *pulCount = aCount;
+    return CKR_BUFFER_TOO_SMALL;
+  }
+  for (CK_ULONG i = 0u; i < aCount; ++i) {
+    pSlotList[i] = i;
+  }
+  *pulCount = aCount;
+  return CKR_OK;
+}
+
+CK_RV getSlotInfo(CK_SLOT_ID slotID, CK_SLOT_INFO_PTR pInfo) {
+  pay(Fn::C_GetSlotInfo);
+  std::shared_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (slotID >= gModule.tokens.size()) {
+    return CKR_SLOT_ID_INVALID;
+  }
+  if (pInfo == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  padded(pInfo->slotDescription, sizeof(pInfo->slotDescription), "Mock slot " + std::to_string(slotID));
+  padded(pInfo->manufacturerID, sizeof(pInfo->manufacturerID), "pkcs11_leak_reproducer");
+  pInfo->flags           = CKF_TOKEN_PRESENT;
+  pInfo->hardwareVersion = { 1, 0 };
+  pInfo->firmwareVersion = { 1, 0 };
+  return CKR_OK;
+}
+
+CK_RV getTokenInfo(CK_SLOT_ID slotID, CK_TOKEN_INFO_PTR pInfo) {
+  pay(Fn::C_GetTokenInfo);
+  std::shared_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (slotID >= gModule.tokens.size()) {
+    return CKR_SLOT_ID_INVALID;
+  }
+  if (pInfo == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  const auto& aToken = gModule.tokens[slotID];
+  padded(pInfo->label, sizeof(pInfo->label), aToken.label);
+  padded(pInfo->manufacturerID, sizeof(pInfo->manufacturerID), "pkcs11_leak_reproducer");
+  padded(pInfo->model, sizeof(pInfo->model), "mock");
+  padded(pInfo->serialNumber, sizeof(pInfo->serialNumber), std::to_string(slotID));
+  pInfo->flags                = CKF_RNG | CKF_LOGIN_REQUIRED | CKF_USER_PIN_INITIALIZED | CKF_TOKEN_INITIALIZED;
+  pInfo->ulMaxSessionCount    = aToken.maxSessions;
+  pInfo->ulSessionCount       = aToken.sessions;
+  pInfo->ulMaxRwSessionCount  = aToken.maxRwSessions;
+  pInfo->ulRwSessionCount     = aToken.rwSessions;
+  pInfo->ulMaxPinLen          = 255u;
+  pInfo->ulMinPinLen          = 1u;
+  pInfo->ulTotalPublicMemory  = CK_UNAVAILABLE_INFORMATION;
+  pInfo->ulFreePublicMemory   = CK_UNAVAILABLE_INFORMATION;
+  pInfo->ulTotalPrivateMemory = CK_UNAVAILABLE_INFORMATION;
+  pInfo->ulFreePrivateMemory  = CK_UNAVAILABLE_INFORMATION;
+  pInfo->hardwareVersion      = { 1, 0 };
+  pInfo->firmwareVersion      = { 1, 0 };
+  padded(pInfo->utcTime, sizeof(pInfo->utcTime), "");
+  return CKR_OK;
+}
+
+const CK_MECHANISM_TYPE K_MECHANISMS[] = { CKM_AES_KEY_GEN, CKM_AES_GCM, CKM_AES_KEY_WRAP_PAD, CKM_AES_CMAC, CKM_SHA256, CKM_EC_KEY_PAIR_GEN };
+
+CK_RV getMechanismList(CK_SLOT_ID slotID, CK_MECHANISM_TYPE_PTR pMechanismList, CK_ULONG_PTR pulCount) {
+  pay(Fn::C_GetMechanismList);
+  std::shared_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (slotID >= gModule.tokens.size()) {
+    return CKR_SLOT_ID_INVALID;
+  }
+  if (pulCount == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  const CK_ULONG aCount = sizeof(K_MECHANISMS) / sizeof(K_MECHANISMS[0]);
+  if (pMechanismList != nullptr and *pulCount < aCount) {
+    *pulCount = aCount;
+    return CKR_BUFFER_TOO_SMALL;
+  }
+  if (pMechanismList != nullptr) {
+    std::copy(std::begin(K_MECHANISMS), std::end(K_MECHANISMS), pMechanismList);
+  }
+  *pulCount = aCount;
+  return CKR_OK;
+}
+
+CK_RV getMechanismInfo(CK_SLOT_ID slotID, CK_MECHANISM_TYPE type, CK_MECHANISM_INFO_PTR pInfo) {
+  pay(Fn::C_GetMechanismInfo);
+  std::shared_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (slotID >= gModule.tokens.size()) {
+    return CKR_SLOT_ID_INVALID;
+  }
+  if (pInfo == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  switch (type) {
+    case CKM_AES_KEY_GEN:
+      *pInfo = { 16u, 32u, CKF_GENERATE };
+      return CKR_OK;
+    case CKM_AES_GCM:
+      *pInfo = { 16u, 32u, CKF_ENCRYPT | CKF_DECRYPT };
+      return CKR_OK;
+    case CKM_AES_KEY_WRAP_PAD:
+      *pInfo = { 16u, 32u, CKF_WRAP | CKF_UNWRAP };
+      return CKR_OK;
+    case CKM_AES_CMAC:
+      *pInfo = { 16u, 32u, CKF_SIGN };
+      return CKR_OK;
+    case CKM_SHA256:
+      *pInfo = { 0u, 0u, CKF_DIGEST };
+      return CKR_OK;
+    case CKM_EC_KEY_PAIR_GEN:
+      *pInfo = { 256u, 256u, CKF_GENERATE_KEY_PAIR };
+      return CKR_OK;
+    default:
+      return CKR_MECHANISM_INVALID;
+  }
+}
+
+CK_RV openSession(CK_SLOT_ID slotID, CK_FLAGS flags, CK_VOID_PTR, CK_NOTIFY, CK_SESSION_HANDLE_PTR phSession) {
+  pay(Fn::C_OpenSession);
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (slotID >= gModule.tokens.size()) {
+    return CKR_SLOT_ID_INVALID;
+  }
+  if (not(flags & CKF_SERIAL_SESSION)) {
+    return CKR_SESSION_PARALLEL_NOT_SUPPORTED;
+  }
+  if (phSession == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  auto& aToken    = gModule.tokens[slotID];
+  const bool aRw  = flags & CKF_RW_SESSION;
+  if (aToken.maxSessions != 0u and aToken.sessions >= aToken.maxSessions) {
+    return CKR_SESSION_COUNT;
+  }
+  if (aRw and aToken.maxRwSessions != 0u and aToken.rwSessions >= aToken.maxRwSessions) {
+    return CKR_SESSION_COUNT;
+  }
+  auto aSession    = std::make_shared<Session>();
+  aSession->handle = gModule.nextSession++;
+  aSession->slot   = slotID;
+  aSession->flags  = flags;
+  ++aToken.sessions;
+  if (aRw) {
+    ++aToken.rwSessions;
+  }
+  *phSession = aSession->handle;
+  gModule.sessions.emplace(aSession->handle, std::move(aSession));
+  return CKR_OK;
+}
+
+CK_RV closeSession(CK_SESSION_HANDLE hSession) {
+  pay(Fn::C_CloseSession);
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  auto aIt = gModule.sessions.find(hSession);
+  if (aIt == gModule.sessions.end()) {
+    return CKR_SESSION_HANDLE_INVALID;
+  }
+  closeSessionLocked(aIt);
+  return CKR_OK;
+}
+
+CK_RV closeAllSessions(CK_SLOT_ID slotID) {
+  pay(Fn::C_CloseAllSessions);
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (slotID >= gModule.tokens.size()) {
+    return CKR_SLOT_ID_INVALID;
+  }
+  for (auto aIt = gModule.sessions.begin(); aIt != gModule.sessions.end();) {
+    auto aNext = std::next(aIt);
+    if (aIt->second->slot == slotID) {
+      closeSessionLocked(aIt);
+    }
+    aIt = aNext;
+  }
+  return CKR_OK;
+}
+
+CK_RV getSessionInfo(CK_SESSION_HANDLE hSession, CK_SESSION_INFO_PTR pInfo) {
+  pay(Fn::C_GetSessionInfo);
+  std::shared_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  auto aIt = gModule.sessions.find(hSession);
+  if (aIt == gModule.sessions.end()) {
+    return CKR_SESSION_HANDLE_INVALID;
+  }
+  if (pInfo == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  const auto& aSession = *aIt->second;
+  const bool aRw       = aSession.flags & CKF_RW_SESSION;
+  const bool aUser     = gModule.tokens[aSession.slot].loggedIn;
+  pInfo->slotID        = aSession.slot;
+  pInfo->state         = aRw ? (aUser ? CKS_RW_USER_FUNCTIONS : CKS_RW_PUBLIC_SESSION) : (aUser ? CKS_RO_USER_FUNCTIONS : CKS_RO_PUBLIC_SESSION);
+  pInfo->flags         = aSession.flags;
+  pInfo->ulDeviceError = 0u;
+  return CKR_OK;
+}
+
+CK_RV login(CK_SESSION_HANDLE hSession, CK_USER_TYPE userType, CK_UTF8CHAR_PTR pPin, CK_ULONG ulPinLen) {
+  pay(Fn::C_Login);
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  auto aIt = gModule.sessions.find(hSession);
+  if (aIt == gModule.sessions.end()) {
+    return CKR_SESSION_HANDLE_INVALID;
+  }
+  if (userType != CKU_USER) {
+    return CKR_USER_TYPE_INVALID;
+  }
+  auto& aToken = gModule.tokens[aIt->second->slot];
+  if (aToken.loggedIn) {
+    return CKR_USER_ALREADY_LOGGED_IN;
+  }
+  if (pPin == nullptr or std::string(reinterpret_cast<const char*>(pPin), ulPinLen) != aToken.pin) {
+    return CKR_PIN_INCORRECT;
+  }
+  aToken.loggedIn = true;
+  return CKR_OK;
+}
+
+CK_RV logout(CK_SESSION_HANDLE hSession) {
+  pay(Fn::C_Logout);
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  if (auto aStatus = checkInitialized(); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  auto aIt = gModule.sessions.find(hSession);
+  if (aIt == gModule.sessions.end()) {
+    return CKR_SESSION_HANDLE_INVALID;
+  }
+  auto& aToken = gModule.tokens[aIt->second->slot];
+  if (not aToken.loggedIn) {
+    return CKR_USER_NOT_LOGGED_IN;
+  }
+  aToken.loggedIn = false;
+  return CKR_OK;
+}
+
+CK_RV copyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phNewObject) {
+  pay(Fn::C_CopyObject);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (phNewObject == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  auto aSource = visibleObject(*aSession, hObject);
+  if (not aSource) {
+    return CKR_OBJECT_HANDLE_INVALID;
+  }
+  Attributes aChanges;
+  if (auto aStatus = merge(aChanges, pTemplate, ulCount); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  auto aAttributes = aSource->attributes;
+  for (auto& aChange : aChanges) {
+    if (readOnlyAttribute(aChange.first)) {
+      return CKR_ATTRIBUTE_READ_ONLY;
+    }
+    aAttributes[aChange.first] = std::move(aChange.second);
+  }
+  return storeObject(*aSession, std::move(aAttributes), *phNewObject);
+}
+
+CK_RV destroyObject(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject) {
+  pay(Fn::C_DestroyObject);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  auto aObject = visibleObjectLocked(*aSession, hObject);
+  if (not aObject) {
+    return CKR_OBJECT_HANDLE_INVALID;
+  }
+  if (aObject->session == CK_INVALID_HANDLE and not(aSession->flags & CKF_RW_SESSION)) {
+    return CKR_SESSION_READ_ONLY;
+  }
+  gModule.objects.erase(hObject);
+  return CKR_OK;
+}
+
+CK_RV getAttributeValue(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount) {
+  pay(Fn::C_GetAttributeValue);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pTemplate == nullptr and ulCount > 0u) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  auto aObject = visibleObject(*aSession, hObject);
+  if (not aObject) {
+    return CKR_OBJECT_HANDLE_INVALID;
+  }
+  const bool aSecret = flag(aObject->attributes, CKA_SENSITIVE, false) or not flag(aObject->attributes, CKA_EXTRACTABLE, true);
+  // every attribute is processed, the status is that of the last failure
+  CK_RV aStatus = CKR_OK;
+  for (CK_ULONG i = 0u; i < ulCount; ++i) {
+    auto& aAttribute = pTemplate[i];
+    auto aIt         = aObject->attributes.find(aAttribute.type);
+    if (aAttribute.type == CKA_VALUE and aSecret and aIt != aObject->attributes.end()) {
+      aAttribute.ulValueLen = CK_UNAVAILABLE_INFORMATION;
+      aStatus               = CKR_ATTRIBUTE_SENSITIVE;
+    } else if (aIt == aObject->attributes.end()) {
+      aAttribute.ulValueLen = CK_UNAVAILABLE_INFORMATION;
+      aStatus               = CKR_ATTRIBUTE_TYPE_INVALID;
+    } else if (aAttribute.pValue == nullptr) {
+      aAttribute.ulValueLen = aIt->second.size();
+    } else if (aAttribute.ulValueLen >= aIt->second.size()) {
+      std::copy(aIt->second.begin(), aIt->second.end(), static_cast<unsigned char*>(aAttribute.pValue));
+      aAttribute.ulValueLen = aIt->second.size();
+    } else {
+      aAttribute.ulValueLen = CK_UNAVAILABLE_INFORMATION;
+      aStatus               = CKR_BUFFER_TOO_SMALL;
+    }
+  }
+  return aStatus;
+}
+
+CK_RV setAttributeValue(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hObject, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount) {
+  pay(Fn::C_SetAttributeValue);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  Attributes aChanges;
+  if (auto aStatus = merge(aChanges, pTemplate, ulCount); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+  auto aObject = visibleObjectLocked(*aSession, hObject);
+  if (not aObject) {
+    return CKR_OBJECT_HANDLE_INVALID;
+  }
+  if (aObject->session == CK_INVALID_HANDLE and not(aSession->flags & CKF_RW_SESSION)) {
+    return CKR_SESSION_READ_ONLY;
+  }
+  if (not flag(aObject->attributes, CKA_MODIFIABLE, true)) {
+    return CKR_ATTRIBUTE_READ_ONLY;
+  }
+  auto aUpdated = std::make_shared<Object>(*aObject);
+  for (auto& aChange : aChanges) {
+    if (readOnlyAttribute(aChange.first) or aChange.first == CKA_TOKEN) {
+      return CKR_ATTRIBUTE_READ_ONLY;
+    }
+    aUpdated->attributes[aChange.first] = std::move(aChange.second);
+  }
+  gModule.objects[hObject] = std::move(aUpdated);
+  return CKR_OK;
+}
+
+CK_RV findObjectsInit(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount) {
+  pay(Fn::C_FindObjectsInit);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  Attributes aCriteria;
+  if (auto aStatus = merge(aCriteria, pTemplate, ulCount); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  if (aSession->found) {
+    return CKR_OPERATION_ACTIVE;
+  }
+  std::vector<CK_OBJECT_HANDLE> aFound;
+  {
+    std::shared_lock<std::shared_mutex> aLock(gModule.mutex);
+    const bool aLoggedIn = gModule.tokens[aSession->slot].loggedIn;
+    for (const auto& aEntry : gModule.objects) {
+      const auto& aObject = *aEntry.second;
+      if (aObject.slot == aSession->slot and (aLoggedIn or not flag(aObject.attributes, CKA_PRIVATE, true)) and matches(aObject.attributes, aCriteria)) {
+        aFound.push_back(aEntry.first);
+      }
+    }
+  }
+  // creation order, as a token would
+  std::sort(aFound.begin(), aFound.end());
+  aSession->found     = std::move(aFound);
+  aSession->foundNext = 0u;
+  return CKR_OK;
+}
+
+CK_RV findObjects(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE_PTR phObject, CK_ULONG ulMaxObjectCount, CK_ULONG_PTR pulObjectCount) {
+  pay(Fn::C_FindObjects);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (phObject == nullptr or pulObjectCount == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  if (not aSession->found) {
+    return CKR_OPERATION_NOT_INITIALIZED;
+  }
+  const auto& aFound = aSession->found.value();
+  const auto aCount  = std::min<std::size_t>(ulMaxObjectCount, aFound.size() - aSession->foundNext);
+  std::copy_n(aFound.begin() + static_cast<std::ptrdiff_t>(aSession->foundNext), aCount, phObject);
+  aSession->foundNext += aCount;
+  *pulObjectCount = aCount;
+  return CKR_OK;
+}
+
+CK_RV findObjectsFinal(CK_SESSION_HANDLE hSession) {
+  pay(Fn::C_FindObjectsFinal);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  if (not aSession->found) {
+    return CKR_OPERATION_NOT_INITIALIZED;
+  }
+  aSession->found.reset();
+  return CKR_OK;
+}
+
+CK_RV encryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey) {
+  return cipherInit(Fn::C_EncryptInit, hSession, pMechanism, hKey);
+}
+
+CK_RV encrypt(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pEncryptedData, CK_ULONG_PTR pulEncryptedDataLen) {
+  return cipher(Fn::C_Encrypt, hSession, pData, ulDataLen, pEncryptedData, pulEncryptedDataLen);
+}
+
+CK_RV encryptUpdate(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pPart, CK_ULONG ulPartLen, CK_BYTE_PTR pEncryptedPart, CK_ULONG_PTR pulEncryptedPartLen) {
+  return encryptPart(Fn::C_EncryptUpdate, hSession, pPart, ulPartLen, pEncryptedPart, pulEncryptedPartLen);
+}
+
+CK_RV encryptFinal(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pLastEncryptedPart, CK_ULONG_PTR pulLastEncryptedPartLen) {
+  return encryptPart(Fn::C_EncryptFinal, hSession, nullptr, 0u, pLastEncryptedPart, pulLastEncryptedPartLen);
+}
+
+CK_RV decryptInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey) {
+  return cipherInit(Fn::C_DecryptInit, hSession, pMechanism, hKey);
+}
+
+CK_RV decrypt(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pEncryptedData, CK_ULONG ulEncryptedDataLen, CK_BYTE_PTR pData, CK_ULONG_PTR pulDataLen) {
+  return cipher(Fn::C_Decrypt, hSession, pEncryptedData, ulEncryptedDataLen, pData, pulDataLen);
+}
+
+CK_RV digestInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism) {
+  pay(Fn::C_DigestInit);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pMechanism == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  if (aSession->digest) {
+    return CKR_OPERATION_ACTIVE;
+  }
+  if (pMechanism->mechanism != CKM_SHA256) {
+    return CKR_MECHANISM_INVALID;
+  }
+  aSession->digest = true;
+  return CKR_OK;
+}
+
+// a size query (null output) or a too small buffer keep the operation active
+CK_RV digest(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pDigest, CK_ULONG_PTR pulDigestLen) {
+  pay(Fn::C_Digest);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  if (not aSession->digest) {
+    return CKR_OPERATION_NOT_INITIALIZED;
+  }
+  if (pulDigestLen == nullptr or (pData == nullptr and ulDataLen > 0u)) {
+    aSession->digest = false;
+    return CKR_ARGUMENTS_BAD;
+  }
+  const CK_ULONG aRequired = 32u;
+  if (pDigest == nullptr) {
+    *pulDigestLen = aRequired;
+    return CKR_OK;
+  }
+  if (*pulDigestLen < aRequired) {
+    *pulDigestLen = aRequired;
+    return CKR_BUFFER_TOO_SMALL;
+  }
+  auto aDigest = mock::sha256(pData, ulDataLen);
+  std::memcpy(pDigest, aDigest.data(), aDigest.size());
+  *pulDigestLen    = aRequired;
+  aSession->digest = false;
+  return CKR_OK;
+}
+
+CK_RV signInit(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hKey) {
+  pay(Fn::C_SignInit);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pMechanism == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  if (aSession->sign) {
+    return CKR_OPERATION_ACTIVE;
+  }
+  if (pMechanism->mechanism != CKM_AES_CMAC) {
+    return CKR_MECHANISM_INVALID;
+  }
+  auto aKey = visibleObject(*aSession, hKey);
+  if (not aKey) {
+    return CKR_KEY_HANDLE_INVALID;
+  }
+  auto aValue = keyValue(*aKey);
+  if (not aValue) {
+    return CKR_KEY_TYPE_INCONSISTENT;
+  }
+  if (not aesKeyLength(aValue->size())) {
+    return CKR_KEY_SIZE_RANGE;
+  }
+  if (not flag(aKey->attributes, CKA_SIGN, true)) {
+    return CKR_KEY_FUNCTION_NOT_PERMITTED;
+  }
+  aSession->sign = std::make_unique<mock::Aes>(aValue->data(), aValue->size());
+  return CKR_OK;
+}
+
+// a size query (null output) or a too small buffer keep the operation active
+CK_RV sign(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pData, CK_ULONG ulDataLen, CK_BYTE_PTR pSignature, CK_ULONG_PTR pulSignatureLen) {
+  pay(Fn::C_Sign);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  std::lock_guard<std::mutex> aSessionLock(aSession->mutex);
+  if (not aSession->sign) {
+    return CKR_OPERATION_NOT_INITIALIZED;
+  }
+  if (pulSignatureLen == nullptr or (pData == nullptr and ulDataLen > 0u)) {
+    aSession->sign.reset();
+    return CKR_ARGUMENTS_BAD;
+  }
+  const CK_ULONG aRequired = 16u;
+  if (pSignature == nullptr) {
+    *pulSignatureLen = aRequired;
+    return CKR_OK;
+  }
+  if (*pulSignatureLen < aRequired) {
+    *pulSignatureLen = aRequired;
+    return CKR_BUFFER_TOO_SMALL;
+  }
+  auto aMac = mock::cmac(*aSession->sign, pData, ulDataLen);
+  std::memcpy(pSignature, aMac.data(), aMac.size());
+  *pulSignatureLen = aRequired;
+  aSession->sign.reset();
+  return CKR_OK;
+}
+
+CK_RV generateKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_OBJECT_HANDLE_PTR phKey) {
+  pay(Fn::C_GenerateKey);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pMechanism == nullptr or phKey == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  if (pMechanism->mechanism != CKM_AES_KEY_GEN) {
+    return CKR_MECHANISM_INVALID;
+  }
+  Attributes aAttributes;
+  if (auto aStatus = merge(aAttributes, pTemplate, ulCount); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  auto aLength = ulong(aAttributes, CKA_VALUE_LEN);
+  if (not aLength) {
+    return CKR_TEMPLATE_INCOMPLETE;
+  }
+  if (not aesKeyLength(aLength.value())) {
+    return CKR_ATTRIBUTE_VALUE_INVALID;
+  }
+  if (ulong(aAttributes, CKA_CLASS).value_or(CKO_SECRET_KEY) != CKO_SECRET_KEY or ulong(aAttributes, CKA_KEY_TYPE).value_or(CKK_AES) != CKK_AES) {
+    return CKR_TEMPLATE_INCONSISTENT;
+  }
+  setDefault(aAttributes, CKA_KEY_TYPE, scalar<CK_KEY_TYPE>(CKK_AES));
+  secretKeyDefaults(aAttributes);
+  std::vector<unsigned char> aValue(aLength.value());
+  randomBytes(aValue.data(), aValue.size());
+  aAttributes[CKA_VALUE] = std::move(aValue);
+  aAttributes[CKA_LOCAL] = scalar<CK_BBOOL>(CK_TRUE);
+  return storeObject(*aSession, std::move(aAttributes), *phKey);
+}
+
+CK_RV generateKeyPair(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_ATTRIBUTE_PTR pPublicKeyTemplate, CK_ULONG ulPublicKeyAttributeCount,
+                      CK_ATTRIBUTE_PTR pPrivateKeyTemplate, CK_ULONG ulPrivateKeyAttributeCount, CK_OBJECT_HANDLE_PTR phPublicKey,
+                      CK_OBJECT_HANDLE_PTR phPrivateKey) {
+  pay(Fn::C_GenerateKeyPair);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pMechanism == nullptr or phPublicKey == nullptr or phPrivateKey == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  if (pMechanism->mechanism != CKM_EC_KEY_PAIR_GEN) {
+    return CKR_MECHANISM_INVALID;
+  }
+  Attributes aPublic;
+  Attributes aPrivate;
+  if (auto aStatus = merge(aPublic, pPublicKeyTemplate, ulPublicKeyAttributeCount); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (auto aStatus = merge(aPrivate, pPrivateKeyTemplate, ulPrivateKeyAttributeCount); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  auto aParams = aPublic.find(CKA_EC_PARAMS);
+  if (aParams == aPublic.end()) {
+    return CKR_TEMPLATE_INCOMPLETE;
+  }
+  aPrivate[CKA_EC_PARAMS] = aParams->second;
+
+  // no EC arithmetic: random bytes of the right shape stand for the point and the scalar
+  std::vector<unsigned char> aPoint(65u);
+  randomBytes(aPoint.data(), aPoint.size());
+  aPoint[0] = 0x04u;
+  std::vector<unsigned char> aScalar(32u);
+  randomBytes(aScalar.data(), aScalar.size());
+
+  setDefault(aPublic, CKA_CLASS, scalar<CK_OBJECT_CLASS>(CKO_PUBLIC_KEY));
+  setDefault(aPublic, CKA_KEY_TYPE, scalar<CK_KEY_TYPE>(CKK_EC));
+  setDefault(aPublic, CKA_TOKEN, scalar<CK_BBOOL>(CK_FALSE));
+  setDefault(aPublic, CKA_PRIVATE, scalar<CK_BBOOL>(CK_FALSE));
+  setDefault(aPublic, CKA_MODIFIABLE, scalar<CK_BBOOL>(CK_TRUE));
+  setDefault(aPublic, CKA_LABEL, {});
+  setDefault(aPublic, CKA_ID, {});
+  aPublic[CKA_EC_POINT] = std::move(aPoint);
+  aPublic[CKA_LOCAL]    = scalar<CK_BBOOL>(CK_TRUE);
+
+  setDefault(aPrivate, CKA_CLASS, scalar<CK_OBJECT_CLASS>(CKO_PRIVATE_KEY));
+  setDefault(aPrivate, CKA_KEY_TYPE, scalar<CK_KEY_TYPE>(CKK_EC));
+  setDefault(aPrivate, CKA_TOKEN, scalar<CK_BBOOL>(CK_FALSE));
+  setDefault(aPrivate, CKA_PRIVATE, scalar<CK_BBOOL>(CK_TRUE));
+  setDefault(aPrivate, CKA_MODIFIABLE, scalar<CK_BBOOL>(CK_TRUE));
+  setDefault(aPrivate, CKA_SENSITIVE, scalar<CK_BBOOL>(CK_TRUE));
+  setDefault(aPrivate, CKA_EXTRACTABLE, scalar<CK_BBOOL>(CK_FALSE));
+  setDefault(aPrivate, CKA_LABEL, {});
+  setDefault(aPrivate, CKA_ID, {});
+  aPrivate[CKA_VALUE] = std::move(aScalar);
+  aPrivate[CKA_LOCAL] = scalar<CK_BBOOL>(CK_TRUE);
+
+  if (auto aStatus = storeObject(*aSession, std::move(aPublic), *phPublicKey); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (auto aStatus = storeObject(*aSession, std::move(aPrivate), *phPrivateKey); aStatus != CKR_OK) {
+    std::unique_lock<std::shared_mutex> aLock(gModule.mutex);
+    gModule.objects.erase(*phPublicKey);
+    return aStatus;
+  }
+  return CKR_OK;
+}
+
+// the AES key usable for iUsage, or the status to return
+CK_RV wrappingKey(const Session& iSession, CK_OBJECT_HANDLE iHandle, CK_ATTRIBUTE_TYPE iUsage, std::optional<mock::Aes>& oAes) {
+  auto aKey = visibleObject(iSession, iHandle);
+  if (not aKey) {
+    return iUsage == CKA_WRAP ? CKR_WRAPPING_KEY_HANDLE_INVALID : CKR_UNWRAPPING_KEY_HANDLE_INVALID;
+  }
+  auto aValue = keyValue(*aKey);
+  if (not aValue) {
+    return iUsage == CKA_WRAP ? CKR_WRAPPING_KEY_TYPE_INCONSISTENT : CKR_UNWRAPPING_KEY_TYPE_INCONSISTENT;
+  }
+  if (not aesKeyLength(aValue->size())) {
+    return iUsage == CKA_WRAP ? CKR_WRAPPING_KEY_SIZE_RANGE : CKR_UNWRAPPING_KEY_SIZE_RANGE;
+  }
+  if (not flag(aKey->attributes, iUsage, true)) {
+    return CKR_KEY_FUNCTION_NOT_PERMITTED;
+  }
+  oAes.emplace(aValue->data(), aValue->size());
+  return CKR_OK;
+}
+
+CK_RV wrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hWrappingKey, CK_OBJECT_HANDLE hKey, CK_BYTE_PTR pWrappedKey,
+              CK_ULONG_PTR pulWrappedKeyLen) {
+  pay(Fn::C_WrapKey);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pMechanism == nullptr or pulWrappedKeyLen == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  if (pMechanism->mechanism != CKM_AES_KEY_WRAP_PAD) {
+    return CKR_MECHANISM_INVALID;
+  }
+  std::optional<mock::Aes> aAes;
+  if (auto aStatus = wrappingKey(*aSession, hWrappingKey, CKA_WRAP, aAes); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  auto aKey = visibleObject(*aSession, hKey);
+  if (not aKey) {
+    return CKR_KEY_HANDLE_INVALID;
+  }
+  auto aValue = aKey->attributes.find(CKA_VALUE);
+  if (ulong(aKey->attributes, CKA_CLASS) != CKO_SECRET_KEY or aValue == aKey->attributes.end()) {
+    return CKR_KEY_NOT_WRAPPABLE;
+  }
+  if (not flag(aKey->attributes, CKA_EXTRACTABLE, true)) {
+    return CKR_KEY_UNEXTRACTABLE;
+  }
+  const CK_ULONG aRequired = 8u + (aValue->second.size() + 7u) / 8u * 8u;
+  if (pWrappedKey == nullptr) {
+    *pulWrappedKeyLen = aRequired;
+    return CKR_OK;
+  }
+  if (*pulWrappedKeyLen < aRequired) {
+    *pulWrappedKeyLen = aRequired;
+    return CKR_BUFFER_TOO_SMALL;
+  }
+  auto aWrapped = mock::wrapKeyPad(aAes.value(), aValue->second);
+  std::copy(aWrapped.begin(), aWrapped.end(), pWrappedKey);
+  *pulWrappedKeyLen = aWrapped.size();
+  return CKR_OK;
+}
+
+CK_RV unwrapKey(CK_SESSION_HANDLE hSession, CK_MECHANISM_PTR pMechanism, CK_OBJECT_HANDLE hUnwrappingKey, CK_BYTE_PTR pWrappedKey, CK_ULONG ulWrappedKeyLen,
+                CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulAttributeCount, CK_OBJECT_HANDLE_PTR phKey) {
+  pay(Fn::C_UnwrapKey);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pMechanism == nullptr or phKey == nullptr or (pWrappedKey == nullptr and ulWrappedKeyLen > 0u)) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  if (pMechanism->mechanism != CKM_AES_KEY_WRAP_PAD) {
+    return CKR_MECHANISM_INVALID;
+  }
+  std::optional<mock::Aes> aAes;
+  if (auto aStatus = wrappingKey(*aSession, hUnwrappingKey, CKA_UNWRAP, aAes); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  Attributes aAttributes;
+  if (auto aStatus = merge(aAttributes, pTemplate, ulAttributeCount); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (aAttributes.count(CKA_KEY_TYPE) == 0u) {
+    return CKR_TEMPLATE_INCOMPLETE;
+  }
+  auto aValue = mock::unwrapKeyPad(aAes.value(), std::vector<unsigned char>(pWrappedKey, pWrappedKey + ulWrappedKeyLen));
+  if (not aValue) {
+    return CKR_WRAPPED_KEY_INVALID;
+  }
+  if (ulong(aAttributes, CKA_KEY_TYPE) == CKK_AES and not aesKeyLength(aValue->size())) {
+    return CKR_KEY_SIZE_RANGE;
+  }
+  secretKeyDefaults(aAttributes);
+  aAttributes[CKA_VALUE_LEN] = scalar<CK_ULONG>(aValue->size());
+  aAttributes[CKA_VALUE]     = std::move(aValue.value());
+  aAttributes[CKA_LOCAL]     = scalar<CK_BBOOL>(CK_FALSE);
+  return storeObject(*aSession, std::move(aAttributes), *phKey);
+}
+
+CK_RV seedRandom(CK_SESSION_HANDLE hSession, CK_BYTE_PTR, CK_ULONG) {
+  pay(Fn::C_SeedRandom);
+  std::shared_ptr<Session> aSession;
+  return findSession(hSession, aSession);
+}
+
+CK_RV generateRandom(CK_SESSION_HANDLE hSession, CK_BYTE_PTR pRandomData, CK_ULONG ulRandomLen) {
+  pay(Fn::C_GenerateRandom);
+  std::shared_ptr<Session> aSession;
+  if (auto aStatus = findSession(hSession, aSession); aStatus != CKR_OK) {
+    return aStatus;
+  }
+  if (pRandomData == nullptr and ulRandomLen > 0u) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  randomBytes(pRandomData, ulRandomLen);
+  return CKR_OK;
+}
+
+CK_RV getFunctionStatus(CK_SESSION_HANDLE) {
+  return CKR_FUNCTION_NOT_PARALLEL;
+}
+
+CK_RV cancelFunction(CK_SESSION_HANDLE) {
+  return CKR_FUNCTION_NOT_PARALLEL;
+}
+
+CK_FUNCTION_LIST makeFunctionList();
+
+CK_FUNCTION_LIST gFunctionList = makeFunctionList();
+
+CK_RV getFunctionList(CK_FUNCTION_LIST_PTR_PTR ppFunctionList) {
+  if (ppFunctionList == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  *ppFunctionList = &gFunctionList;
+  return CKR_OK;
+}
+
+CK_FUNCTION_LIST makeFunctionList() {
+  CK_FUNCTION_LIST aList{};
+  aList.version = { 2, 40 };
+  // everything not implemented below answers CKR_FUNCTION_NOT_SUPPORTED
+#define CK_PKCS11_FUNCTION_INFO(name) aList.name = notSupported;
+#include "hsm/pkcs11_v2_40/pkcs11f.h"
+#undef CK_PKCS11_FUNCTION_INFO
+  aList.C_Initialize        = initialize;
+  aList.C_Finalize          = finalize;
+  aList.C_GetInfo           = getInfo;
+  aList.C_GetFunctionList   = getFunctionList;
+  aList.C_GetSlotList       = getSlotList;
+  aList.C_GetSlotInfo       = getSlotInfo;
+  aList.C_GetTokenInfo      = getTokenInfo;
+  aList.C_GetMechanismList  = getMechanismList;
+  aList.C_GetMechanismInfo  = getMechanismInfo;
+  aList.C_OpenSession       = openSession;
+  aList.C_CloseSession      = closeSession;
+  aList.C_CloseAllSessions  = closeAllSessions;
+  aList.C_GetSessionInfo    = getSessionInfo;
+  aList.C_Login             = login;
+  aList.C_Logout            = logout;
+  aList.C_CopyObject        = copyObject;
+  aList.C_DestroyObject     = destroyObject;
+  aList.C_GetAttributeValue = getAttributeValue;
+  aList.C_SetAttributeValue = setAttributeValue;
+  aList.C_FindObjectsInit   = findObjectsInit;
+  aList.C_FindObjects       = findObjects;
+  aList.C_FindObjectsFinal  = findObjectsFinal;
+  aList.C_EncryptInit       = encryptInit;
+  aList.C_Encrypt           = encrypt;
+  aList.C_EncryptUpdate     = encryptUpdate;
+  aList.C_EncryptFinal      = encryptFinal;
+  aList.C_DecryptInit       = decryptInit;
+  aList.C_Decrypt           = decrypt;
+  aList.C_DigestInit        = digestInit;
+  aList.C_Digest            = digest;
+  aList.C_SignInit          = signInit;
+  aList.C_Sign              = sign;
+  aList.C_GenerateKey       = generateKey;
+  aList.C_GenerateKeyPair   = generateKeyPair;
+  aList.C_WrapKey           = wrapKey;
+  aList.C_UnwrapKey         = unwrapKey;
+  aList.C_SeedRandom        = seedRandom;
+  aList.C_GenerateRandom    = generateRandom;
+  aList.C_GetFunctionStatus = getFunctionStatus;
+  aList.C_CancelFunction    = cancelFunction;
+  return aList;
+}
+
+}  // namespace
+
+// the only exported symbol, what HSMUtils::openHSMDL looks up
+extern "C" CK_RV C_GetFunctionList(CK_FUNCTION_LIST_PTR_PTR ppFunctionList) {
+  return getFunctionList(ppFunctionList);
+}
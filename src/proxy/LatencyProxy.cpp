@@ -0,0 +1,268 @@
+#include "hsm/cryptoki.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// PKCS#11 module forwarding every call to another module and delaying it first, to reproduce the round trips
+// of a network HSM (0.5-5 ms, long tails, occasional stalls) against a local SoftHSM or the mock module.
+// Configured from the environment when the function list is first requested:
+//
+//   PKCS11_PROXY_MODULE               path of the module to forward to (required)
+//   PKCS11_PROXY_LATENCY              latency of every call, in microseconds:
+//                                       <us> or fixed:<us>
+//                                       uniform:<min us>:<max us>
+//                                       normal:<mean us>:<stddev us>
+//                                       lognormal:<median us>:<sigma>
+//                                       exponential:<mean us>
+//   PKCS11_PROXY_JITTER_US            uniform random delay added on top, between 0 and this value
+//   PKCS11_PROXY_STALL_RATE           probability of a call to stall (e.g. 0.001)
+//   PKCS11_PROXY_STALL_MS             duration of a stall
+//   PKCS11_PROXY_<setting>_<function> the same settings for one function, e.g. PKCS11_PROXY_LATENCY_C_Encrypt
+//   PKCS11_PROXY_DELAY_MODE           sleep (default, as a blocked socket read) or spin
+//   PKCS11_PROXY_SEED                 seed of the per thread generators, for repeatable runs
+//
+// The whole delay is applied before forwarding the call. C_GetFunctionList is not delayed.
+
+namespace {
+
+enum class Fn : std::size_t {
+#define CK_PKCS11_FUNCTION_INFO(name) name,
+#include "hsm/pkcs11_v2_40/pkcs11f.h"
+#undef CK_PKCS11_FUNCTION_INFO
+  Count
+};
+
+const char* const K_FUNCTION_NAMES[] = {
+#define CK_PKCS11_FUNCTION_INFO(name) #name,
+#include "hsm/pkcs11_v2_40/pkcs11f.h"
+#undef CK_PKCS11_FUNCTION_INFO
+};
+
+constexpr const std::size_t K_FUNCTION_COUNT = static_cast<std::size_t>(Fn::Count);
+
+enum class Shape {
+  Fixed,
+  Uniform,
+  Normal,
+  LogNormal,
+  Exponential,
+};
+
+struct Distribution {
+  Shape shape = Shape::Fixed;
+  double first  = 0.0;
+  double second = 0.0;
+};
+
+struct Injection {
+  Distribution latency;
+  double jitterUs  = 0.0;
+  double stallRate = 0.0;
+  double stallMs   = 0.0;
+};
+
+struct Proxy {
+  void* library = nullptr;
+  CK_FUNCTION_LIST_PTR target = nullptr;
+  CK_FUNCTION_LIST functionList{};
+  std::array<Injection, K_FUNCTION_COUNT> injections;
+  bool spin = false;
+  std::uint64_t seed = 0u;
+
+  ~Proxy() {
+    if (library) {
+      dlclose(library);
+    }
+  }
+};
+
+// loaded once, read only afterwards
+Proxy gProxy;
+std::once_flag gLoadOnce;
+bool gLoaded = false;
+
+const char* env(const std::string& iName) {
+  return std::getenv(iName.c_str());
+}
+
+// the function specific variable if set, the general one otherwise
+const char* setting(const std::string& iName, std::size_t iFunction) {
+  auto aValue = env(iName + "_" + K_FUNCTION_NAMES[iFunction]);
+  return aValue ? aValue : env(iName);
+}
+
+Distribution parseDistribution(const std::string& iSpec) {
+  Distribution aDistribution;
+  std::istringstream aStream(iSpec);
+  std::string aKind;
+  std::getline(aStream, aKind, ':');
+  std::string aFirst;
+  std::string aSecond;
+  std::getline(aStream, aFirst, ':');
+  std::getline(aStream, aSecond, ':');
+  if (aFirst.empty()) {
+    // a plain number
+    aDistribution.first = std::atof(aKind.c_str());
+    return aDistribution;
+  }
+  aDistribution.first  = std::atof(aFirst.c_str());
+  aDistribution.second = std::atof(aSecond.c_str());
+  if (aKind == "uniform") {
+    aDistribution.shape = Shape::Uniform;
+  } else if (aKind == "normal") {
+    aDistribution.shape = Shape::Normal;
+  } else if (aKind == "lognormal") {
+    aDistribution.shape = Shape::LogNormal;
+  } else if (aKind == "exponential") {
+    aDistribution.shape = Shape::Exponential;
+  } else if (aKind != "fixed") {
+    std::cerr << "pkcs11 proxy: unknown latency distribution " << iSpec << ", using fixed" << std::endl;
+  }
+  return aDistribution;
+}
+
+bool load() {
+  const char* aPath = env("PKCS11_PROXY_MODULE");
+  if (aPath == nullptr) {
+    std::cerr << "pkcs11 proxy: PKCS11_PROXY_MODULE is not set" << std::endl;
+    return false;
+  }
+  gProxy.library = dlopen(aPath, RTLD_NOW | RTLD_LOCAL);
+  if (gProxy.library == nullptr) {
+    std::cerr << "pkcs11 proxy: could not open " << aPath << ": " << dlerror() << std::endl;
+    return false;
+  }
+  auto aGetFunctionList = reinterpret_cast<CK_C_GetFunctionList>(dlsym(gProxy.library, "C_GetFunctionList"));
+  if (aGetFunctionList == nullptr or aGetFunctionList(&gProxy.target) != CKR_OK or gProxy.target == nullptr) {
+    std::cerr << "pkcs11 proxy: no function list in " << aPath << std::endl;
+    return false;
+  }
+
+  for (std::size_t i = 0u; i < K_FUNCTION_COUNT; ++i) {
+    auto& aInjection = gProxy.injections[i];
+    if (auto aValue = setting("PKCS11_PROXY_LATENCY", i)) {
+      aInjection.latency = parseDistribution(aValue);
+    }
+    if (auto aValue = setting("PKCS11_PROXY_JITTER_US", i)) {
+      aInjection.jitterUs = std::atof(aValue);
+    }
+    if (auto aValue = setting("PKCS11_PROXY_STALL_RATE", i)) {
+      aInjection.stallRate = std::atof(aValue);
+    }
+    if (auto aValue = setting("PKCS11_PROXY_STALL_MS", i)) {
+      aInjection.stallMs = std::atof(aValue);
+    }
+  }
+  auto aMode  = env("PKCS11_PROXY_DELAY_MODE");
+  gProxy.spin = aMode != nullptr and std::string(aMode) == "spin";
+  auto aSeed  = env("PKCS11_PROXY_SEED");
+  gProxy.seed = aSeed ? std::strtoull(aSeed, nullptr, 10) : std::random_device{}();
+  return true;
+}
+
+std::mt19937_64& engine() {
+  static std::atomic<std::uint64_t> sThreads{ 0u };
+  // distinct streams per thread, repeatable for a given seed and thread creation order
+  thread_local std::mt19937_64 aEngine{ gProxy.seed + sThreads.fetch_add(1u) };
+  return aEngine;
+}
+
+double sampleUs(const Distribution& iDistribution) {
+  auto& aEngine = engine();
+  switch (iDistribution.shape) {
+    case Shape::Fixed:
+      return iDistribution.first;
+    case Shape::Uniform:
+      return std::uniform_real_distribution<double>(iDistribution.first, std::max(iDistribution.first, iDistribution.second))(aEngine);
+    case Shape::Normal:
+      return std::normal_distribution<double>(iDistribution.first, iDistribution.second)(aEngine);
+    case Shape::LogNormal:
+      // parameterized by the median, log(median) is the mean of the underlying normal
+      return std::lognormal_distribution<double>(std::log(std::max(iDistribution.first, 1e-3)), iDistribution.second)(aEngine);
+    case Shape::Exponential:
+      return iDistribution.first > 0.0 ? std::exponential_distribution<double>(1.0 / iDistribution.first)(aEngine) : 0.0;
+  }
+  return 0.0;
+}
+
+void delay(Fn iFunction) {
+  const auto& aInjection = gProxy.injections[static_cast<std::size_t>(iFunction)];
+  double aUs             = sampleUs(aInjection.latency);
+  if (aInjection.jitterUs > 0.0) {
+    aUs += std::uniform_real_distribution<double>(0.0, aInjection.jitterUs)(engine());
+  }
+  if (aInjection.stallRate > 0.0 and std::uniform_real_distribution<double>(0.0, 1.0)(engine()) < aInjection.stallRate) {
+    aUs += aInjection.stallMs * 1000.0;
+  }
+  if (aUs <= 0.0) {
+    return;
+  }
+  const auto aDelay = std::chrono::nanoseconds(static_cast<std::int64_t>(aUs * 1000.0));
+  if (not gProxy.spin) {
+    std::this_thread::sleep_for(aDelay);
+    return;
+  }
+  const auto aEnd = std::chrono::steady_clock::now() + aDelay;
+  while (std::chrono::steady_clock::now() < aEnd) {
+  }
+}
+
+template <typename T>
+struct Forwarder;
+
+// one forwarding function per entry of the function list, with the signature of the entry
+template <typename... Args>
+struct Forwarder<CK_RV (*)(Args...)> {
+  template <Fn F, CK_RV (*CK_FUNCTION_LIST::*Member)(Args...)>
+  static CK_RV forward(Args... iArgs) {
+    auto aTarget = gProxy.target->*Member;
+    if (aTarget == nullptr) {
+      return CKR_FUNCTION_NOT_SUPPORTED;
+    }
+    delay(F);
+    return aTarget(iArgs...);
+  }
+};
+
+CK_RV getFunctionList(CK_FUNCTION_LIST_PTR_PTR ppFunctionList) {
+  if (ppFunctionList == nullptr) {
+    return CKR_ARGUMENTS_BAD;
+  }
+  std::call_once(gLoadOnce, [] {
+    gLoaded = load();
+    if (not gLoaded) {
+      return;
+    }
+    auto& aList   = gProxy.functionList;
+    aList.version = gProxy.target->version;
+#define CK_PKCS11_FUNCTION_INFO(name) \
+    aList.name = &Forwarder<decltype(CK_FUNCTION_LIST::name)>::forward<Fn::name, &CK_FUNCTION_LIST::name>;
+#include "hsm/pkcs11_v2_40/pkcs11f.h"
+#undef CK_PKCS11_FUNCTION_INFO
+    aList.C_GetFunctionList = getFunctionList;
+  });
+  if (not gLoaded) {
+    *ppFunctionList = nullptr;
+    return CKR_GENERAL_ERROR;
+  }
+  *ppFunctionList = &gProxy.functionList;
+  return CKR_OK;
+}
+
+}  // namespace
+
+// the only exported symbol, what HSMUtils::openHSMDL looks up
+extern "C" CK_RV C_GetFunctionList(CK_FUNCTION_LIST_PTR_PTR ppFunctionList) {
+  return getFunctionList(ppFunctionList);
+}